@@ -1,30 +1,36 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 extern int yylex();
+extern int yylex_destroy();
 extern int rsparse();
+extern FILE *yyin;
 
 #define PUSHBACK_LEN 4
 
 static char pushback[PUSHBACK_LEN];
 static int verbose;
+static long n_tokens;
 
-void print(const char* format, ...) {
-  va_list args;
-  va_start(args, format);
-  if (verbose) {
-    vprintf(format, args);
-  }
-  va_end(args);
-}
+// Checking `verbose` at the call site keeps a quiet run from formatting
+// (or even evaluating the arguments of) every debug line.
+#define print(...)             \
+  do {                         \
+    if (verbose) {             \
+      printf(__VA_ARGS__);     \
+    }                          \
+  } while (0)
 
 // If there is a non-null char at the head of the pushback queue,
 // dequeue it and shift the rest of the queue forwards. Otherwise,
 // return the token from calling yylex.
 int rslex() {
   if (pushback[0] == '\0') {
+    n_tokens++;
     return yylex();
   } else {
     char c = pushback[0];
@@ -48,15 +54,60 @@ void push_back(char c) {
 
 extern int rsdebug;
 
+// Nodes and atom names are bump-allocated out of a list of chunks, and are
+// all released together once a parse is done with them.
+#define ARENA_CHUNK_LEN (64 * 1024)
+#define ARENA_ALIGN(sz) \
+  (((sz) + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1))
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t len;
+  size_t used;
+  max_align_t data[];
+};
+
+static struct arena_chunk *arena;
+
+static void *arena_alloc(size_t sz) {
+  sz = ARENA_ALIGN(sz);
+  if (!arena || arena->len - arena->used < sz) {
+    size_t len = sz > ARENA_CHUNK_LEN ? sz : ARENA_CHUNK_LEN;
+    struct arena_chunk *chunk = malloc(sizeof(struct arena_chunk) + len);
+    if (!chunk) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+    chunk->next = arena;
+    chunk->len = len;
+    chunk->used = 0;
+    arena = chunk;
+  }
+  void *p = (char *)arena->data + arena->used;
+  arena->used += sz;
+  return p;
+}
+
+static void arena_free_all() {
+  while (arena) {
+    struct arena_chunk *next = arena->next;
+    free(arena);
+    arena = next;
+  }
+}
+
+// `cap` is how many elements there is room for. Arena memory is only ever
+// released in bulk, so a node outgrowing its room is copied into one with
+// twice as much to keep repeated `ext_node` calls from using quadratic space.
 struct node {
-  struct node *next;
-  struct node *prev;
-  int own_string;
   char const *name;
   int n_elems;
+  int cap;
   struct node *elems[];
 };
 
+// The most recently created or extended node, which is the root once a
+// parse is complete.
 struct node *nodes = NULL;
 int n_nodes;
 
@@ -64,20 +115,15 @@ struct node *mk_node(char const *name, int n, ...) {
   va_list ap;
   int i = 0;
   unsigned sz = sizeof(struct node) + (n * sizeof(struct node *));
-  struct node *nn, *nd = (struct node *)malloc(sz);
+  struct node *nn, *nd = (struct node *)arena_alloc(sz);
 
   print("# New %d-ary node: %s = %p\n", n, name, nd);
 
-  nd->own_string = 0;
-  nd->prev = NULL;
-  nd->next = nodes;
-  if (nodes) {
-    nodes->prev = nd;
-  }
   nodes = nd;
 
   nd->name = name;
   nd->n_elems = n;
+  nd->cap = n;
 
   va_start(ap, n);
   while (i < n) {
@@ -92,9 +138,10 @@ struct node *mk_node(char const *name, int n, ...) {
 }
 
 struct node *mk_atom(char *name) {
-  struct node *nd = mk_node((char const *)strdup(name), 0);
-  nd->own_string = 1;
-  return nd;
+  size_t len = strlen(name) + 1;
+  char *copy = arena_alloc(len);
+  memcpy(copy, name, len);
+  return mk_node(copy, 0);
 }
 
 struct node *mk_none() {
@@ -104,22 +151,19 @@ struct node *mk_none() {
 struct node *ext_node(struct node *nd, int n, ...) {
   va_list ap;
   int i = 0, c = nd->n_elems + n;
-  unsigned sz = sizeof(struct node) + (c * sizeof(struct node *));
   struct node *nn;
 
   print("# Extending %d-ary node by %d nodes: %s = %p",
         nd->n_elems, c, nd->name, nd);
 
-  if (nd->next) {
-    nd->next->prev = nd->prev;
-  }
-  if (nd->prev) {
-    nd->prev->next = nd->next;
+  if (c > nd->cap) {
+    int cap = c > 2 * nd->cap ? c : 2 * nd->cap;
+    struct node *grown =
+      arena_alloc(sizeof(struct node) + (cap * sizeof(struct node *)));
+    memcpy(grown, nd, sizeof(struct node) + (nd->n_elems * sizeof(struct node *)));
+    grown->cap = cap;
+    nd = grown;
   }
-  nd = realloc(nd, sz);
-  nd->prev = NULL;
-  nd->next = nodes;
-  nodes->prev = nd;
   nodes = nd;
 
   print(" ==> %p\n", nd);
@@ -163,28 +207,90 @@ void print_node(struct node *n, int depth) {
   }
 }
 
+static void reset_parser() {
+  memset(pushback, '\0', PUSHBACK_LEN);
+  nodes = NULL;
+  arena_free_all();
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_file(char const *path, long *n_failed) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return 1;
+  }
+  yyin = f;
+  if (rsparse() != 0) {
+    fprintf(stderr, "%s: parse failed\n", path);
+    ++*n_failed;
+  }
+  // Start the next file from a clean lexer, whatever state this one
+  // was left in.
+  yylex_destroy();
+  fclose(f);
+  reset_parser();
+  return 0;
+}
+
+// Parses every file named on the command line, or on stdin (one per line)
+// when there are none, and reports how fast that went.
+static int bench(int argc, char **argv) {
+  long n_files = 0, n_failed = 0;
+  double start = now();
+  if (argc > 0) {
+    for (int i = 0; i < argc; ++i) {
+      if (bench_file(argv[i], &n_failed) != 0) {
+        return 1;
+      }
+      n_files++;
+    }
+  } else {
+    char line[4096];
+    while (fgets(line, sizeof(line), stdin)) {
+      line[strcspn(line, "\n")] = '\0';
+      if (line[0] == '\0') {
+        continue;
+      }
+      if (bench_file(line, &n_failed) != 0) {
+        return 1;
+      }
+      n_files++;
+    }
+  }
+  double elapsed = now() - start;
+  if (elapsed <= 0) {
+    elapsed = 1e-9;
+  }
+
+  printf("files: %ld (%ld failed)\n", n_files, n_failed);
+  printf("tokens: %ld, nodes: %d, time: %.3fs\n", n_tokens, n_nodes, elapsed);
+  printf("tokens/s: %.0f, nodes/s: %.0f\n", n_tokens / elapsed, n_nodes / elapsed);
+  return n_failed != 0;
+}
+
 int main(int argc, char **argv) {
+  if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+    return bench(argc - 2, argv + 2);
+  }
   if (argc == 2 && strcmp(argv[1], "-v") == 0) {
     verbose = 1;
   } else {
     verbose = 0;
   }
   int ret = 0;
-  struct node *tmp;
   memset(pushback, '\0', PUSHBACK_LEN);
   ret = rsparse();
   print("--- PARSE COMPLETE: ret:%d, n_nodes:%d ---\n", ret, n_nodes);
   if (nodes) {
     print_node(nodes, 0);
   }
-  while (nodes) {
-    tmp = nodes;
-    nodes = tmp->next;
-    if (tmp->own_string) {
-      free((void*)tmp->name);
-    }
-    free(tmp);
-  }
+  reset_parser();
   return ret;
 }
 
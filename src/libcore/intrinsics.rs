@@ -1118,6 +1118,25 @@ extern "rust-intrinsic" {
     /// May assume inputs are finite.
     pub fn frem_fast<T>(a: T, b: T) -> T;
 
+    /// Float addition which may be fused with a `fmul_contract` feeding it into
+    /// a single fused multiply-add, without rounding in between. Otherwise
+    /// exactly like `a + b`, NaNs and infinities included.
+    #[cfg(not(stage0))]
+    pub fn fadd_contract<T>(a: T, b: T) -> T;
+
+    /// Float subtraction which may be fused with a `fmul_contract` feeding it
+    /// into a single fused multiply-add, without rounding in between. Otherwise
+    /// exactly like `a - b`, NaNs and infinities included.
+    #[cfg(not(stage0))]
+    pub fn fsub_contract<T>(a: T, b: T) -> T;
+
+    /// Float multiplication which may be fused with the `fadd_contract` or
+    /// `fsub_contract` it feeds into a single fused multiply-add, without
+    /// rounding in between. Otherwise exactly like `a * b`, NaNs and infinities
+    /// included.
+    #[cfg(not(stage0))]
+    pub fn fmul_contract<T>(a: T, b: T) -> T;
+
 
     /// Returns the number of bits set in an integer type `T`
     pub fn ctpop<T>(x: T) -> T;
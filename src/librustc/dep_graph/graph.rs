@@ -937,6 +937,7 @@ pub enum WorkProductFileKind {
     Object,
     Bytecode,
     BytecodeCompressed,
+    SplitDwarf,
 }
 
 #[derive(Clone)]
@@ -48,6 +48,30 @@ pub enum Sanitizer {
     Thread,
 }
 
+/// How much `-Z sanitizer-coverage` instruments, the same as the levels of
+/// clang's `-fsanitize-coverage`.
+#[derive(Clone, Copy, Debug, PartialEq, Hash)]
+pub enum SanitizerCoverageLevel {
+    Function,
+    BasicBlock,
+    Edge,
+}
+
+/// What `-Z sanitizer-coverage` asks for: a level, and what to do at each
+/// point instrumented at that level, as with clang's `-fsanitize-coverage`.
+#[derive(Clone, Copy, Debug, PartialEq, Hash)]
+pub struct SanitizerCoverage {
+    pub level: SanitizerCoverageLevel,
+    pub trace_pc_guard: bool,
+    pub inline_8bit_counters: bool,
+    pub pc_table: bool,
+    pub trace_cmp: bool,
+    pub trace_div: bool,
+    pub trace_gep: bool,
+    pub indirect_calls: bool,
+    pub stack_depth: bool,
+}
+
 #[derive(Clone, Copy, Debug, PartialEq, Hash)]
 pub enum OptLevel {
     No,         // -O0
@@ -797,12 +821,18 @@ macro_rules! options {
             Some("a space-separated list of passes, or `all`");
         pub const parse_opt_uint: Option<&str> =
             Some("a number");
+        pub const parse_opt_float: Option<&str> =
+            Some("a number");
         pub const parse_panic_strategy: Option<&str> =
             Some("either `unwind` or `abort`");
         pub const parse_relro_level: Option<&str> =
             Some("one of: `full`, `partial`, or `off`");
         pub const parse_sanitizer: Option<&str> =
             Some("one of: `address`, `leak`, `memory` or `thread`");
+        pub const parse_sanitizer_coverage: Option<&str> =
+            Some("a comma-separated list of at most one of `func`, `bb` or `edge`, and any of \
+                  `trace-pc-guard`, `inline-8bit-counters`, `pc-table`, `trace-cmp`, \
+                  `trace-div`, `trace-gep`, `indirect-calls` or `stack-depth`");
         pub const parse_linker_flavor: Option<&str> =
             Some(::rustc_target::spec::LinkerFlavor::one_of());
         pub const parse_optimization_fuel: Option<&str> =
@@ -821,7 +851,8 @@ macro_rules! options {
 
     #[allow(dead_code)]
     mod $mod_set {
-        use super::{$struct_name, Passes, Sanitizer, LtoCli, LinkerPluginLto};
+        use super::{$struct_name, Passes, Sanitizer, SanitizerCoverage, SanitizerCoverageLevel,
+                    LtoCli, LinkerPluginLto};
         use rustc_target::spec::{LinkerFlavor, MergeFunctions, PanicStrategy, RelroLevel};
         use std::path::PathBuf;
         use std::str::FromStr;
@@ -930,6 +961,16 @@ macro_rules! options {
             }
         }
 
+        fn parse_opt_float(slot: &mut Option<f32>, v: Option<&str>) -> bool {
+            match v {
+                Some(s) => {
+                    *slot = s.parse().ok().filter(|f: &f32| f.is_finite() && *f >= 0.0);
+                    slot.is_some()
+                }
+                None => { *slot = None; false }
+            }
+        }
+
         fn parse_passes(slot: &mut Passes, v: Option<&str>) -> bool {
             match v {
                 Some("all") => {
@@ -981,6 +1022,50 @@ macro_rules! options {
             true
         }
 
+        fn parse_sanitizer_coverage(slot: &mut Option<SanitizerCoverage>,
+                                    v: Option<&str>) -> bool {
+            let v = match v {
+                Some(v) => v,
+                None => return false,
+            };
+            let mut level = None;
+            let mut coverage = SanitizerCoverage {
+                level: SanitizerCoverageLevel::Edge,
+                trace_pc_guard: false,
+                inline_8bit_counters: false,
+                pc_table: false,
+                trace_cmp: false,
+                trace_div: false,
+                trace_gep: false,
+                indirect_calls: false,
+                stack_depth: false,
+            };
+            for option in v.split(',') {
+                let new_level = match option {
+                    "func" => SanitizerCoverageLevel::Function,
+                    "bb" => SanitizerCoverageLevel::BasicBlock,
+                    "edge" => SanitizerCoverageLevel::Edge,
+                    "trace-pc-guard" => { coverage.trace_pc_guard = true; continue }
+                    "inline-8bit-counters" => { coverage.inline_8bit_counters = true; continue }
+                    "pc-table" => { coverage.pc_table = true; continue }
+                    "trace-cmp" => { coverage.trace_cmp = true; continue }
+                    "trace-div" => { coverage.trace_div = true; continue }
+                    "trace-gep" => { coverage.trace_gep = true; continue }
+                    "indirect-calls" => { coverage.indirect_calls = true; continue }
+                    "stack-depth" => { coverage.stack_depth = true; continue }
+                    _ => return false,
+                };
+                if level.replace(new_level).is_some() {
+                    return false
+                }
+            }
+            // Like clang, anything asked for without a level is done for
+            // every edge.
+            coverage.level = level.unwrap_or(SanitizerCoverageLevel::Edge);
+            *slot = Some(coverage);
+            true
+        }
+
         fn parse_linker_flavor(slote: &mut Option<LinkerFlavor>, v: Option<&str>) -> bool {
             match v.and_then(LinkerFlavor::from_str) {
                 Some(lf) => *slote = Some(lf),
@@ -1317,6 +1402,14 @@ options! {DebuggingOptions, DebuggingSetter, basic_debugging_options,
         "pass `-install_name @rpath/...` to the macOS linker"),
     sanitizer: Option<Sanitizer> = (None, parse_sanitizer, [TRACKED],
                                     "Use a sanitizer"),
+    sanitizer_recover: bool = (false, parse_bool, [TRACKED],
+        "keep going after the address or memory sanitizer reports an error, if the runtime \
+         is also told not to halt on errors"),
+    sanitizer_coverage: Option<SanitizerCoverage> = (None, parse_sanitizer_coverage, [TRACKED],
+        "instrument code for coverage guided fuzzing, like clang's `-fsanitize-coverage`"),
+    sanitizer_skip: Vec<String> = (Vec::new(), parse_string_push, [TRACKED],
+        "don't instrument the functions with the given path (or in the module with the given \
+         path) for the sanitizer in use, e.g. `mycrate::hot::loop_body`"),
     fuel: Option<(String, u64)> = (None, parse_optimization_fuel, [TRACKED],
         "set the optimization fuel quota for a crate"),
     print_fuel: Option<String> = (None, parse_opt_string, [TRACKED],
@@ -1333,6 +1426,9 @@ options! {DebuggingOptions, DebuggingSetter, basic_debugging_options,
         "Generate PGO profile data, to a given file, or to the default location if it's empty."),
     pgo_use: String = (String::new(), parse_string, [TRACKED],
         "Use PGO profile data from the given profile file."),
+    pgo_sample_use: String = (String::new(), parse_string, [TRACKED],
+        "Use sampled PGO profile data (e.g. from perf, converted with AutoFDO) from the \
+         given profile file."),
     disable_instrumentation_preinliner: bool = (false, parse_bool, [TRACKED],
         "Disable the instrumentation pre-inliner, useful for profiling / PGO."),
     relro_level: Option<RelroLevel> = (None, parse_relro_level, [TRACKED],
@@ -1349,6 +1445,65 @@ options! {DebuggingOptions, DebuggingSetter, basic_debugging_options,
         "generate a graphical HTML report of time spent in codegen and LLVM"),
     thinlto: Option<bool> = (None, parse_opt_bool, [TRACKED],
         "enable ThinLTO when possible"),
+    thinlto_import_instr_limit: Option<usize> = (None, parse_opt_uint, [TRACKED],
+        "the largest function (in instructions) ThinLTO will import across modules"),
+    thinlto_import_max_per_module: Option<usize> = (None, parse_opt_uint, [TRACKED],
+        "the most functions ThinLTO will import into any one module"),
+    thinlto_import_hot_multiplier: Option<f32> = (None, parse_opt_float, [TRACKED],
+        "how many times `-Z thinlto-import-instr-limit` functions called from hot call sites \
+         may be (only makes a difference with profile data)"),
+    thinlto_import_cold_multiplier: Option<f32> = (None, parse_opt_float, [TRACKED],
+        "how many times `-Z thinlto-import-instr-limit` functions called from cold call sites \
+         may be (only makes a difference with profile data)"),
+    lto_link_only_needed: bool = (false, parse_bool, [TRACKED],
+        "with fat LTO, only link in what's reachable from exported symbols"),
+    single_codegen_asm_obj: bool = (false, parse_bool, [TRACKED],
+        "when emitting both assembly and object files, run codegen only once and assemble \
+         the object file from the assembly (unless some functions have target features \
+         of their own)"),
+    split_codegen_parts: Option<usize> = (None, parse_opt_uint, [TRACKED],
+        "split each codegen unit into this many partitions after optimizing it, codegen \
+         them in parallel and partially link them back into one object file (ELF targets \
+         with a `cc` or `ld` linker only)"),
+    new_llvm_pass_manager: bool = (false, parse_bool, [TRACKED],
+        "use LLVM's new pass manager to optimize modules, unless `-C passes` \
+         or a sanitizer is used"),
+    llvm_pass_timings: bool = (false, parse_bool, [UNTRACKED],
+        "with -Z new-llvm-pass-manager, write the time each LLVM pass took on each \
+         codegen unit to a `.pass-timings.tsv` file next to it"),
+    remark_dir: Option<String> = (None, parse_opt_string, [UNTRACKED],
+        "write the optimization remarks of the passes selected with `-C remark` (or of \
+         all passes if there are none) to YAML files in this directory"),
+    remark_hotness_threshold: Option<usize> = (None, parse_opt_uint, [UNTRACKED],
+        "with -Z remark-dir, only write remarks whose profile count is at least this"),
+    split_dwarf: bool = (false, parse_bool, [TRACKED],
+        "write most of the DWARF of each object file to a `.dwo` file next to it, which \
+         the linker doesn't have to copy (ELF targets only)"),
+    compress_debug_sections: Option<String> = (None, parse_opt_string, [TRACKED],
+        "compress the debug sections of object files: `none`, `zlib` or `zlib-gnu`"),
+    share_debuginfo_types: bool = (false, parse_bool, [TRACKED],
+        "deduplicate the debuginfo of types with the same unique id across codegen units, \
+         with DWARF type units on ELF targets and when LTO merges or imports modules"),
+    whole_program_devirt: bool = (false, parse_bool, [TRACKED],
+        "tie trait object vtables to the calls made through them, so that fat LTO or \
+         -C linker-plugin-lto can make calls to traits with a single implementation direct; \
+         every crate linked into the program has to be built with this, and dylibs and \
+         cdylibs can't be"),
+    hot_cold_split: bool = (false, parse_bool, [TRACKED],
+        "outline the cold parts of functions into functions of their own (LLVM 8 and later)"),
+    symbol_ordering_file: Option<PathBuf> = (None, parse_opt_pathbuf, [TRACKED],
+        "put each function in its own section and write a file ordering their symbols by \
+         profiled hotness and calls, for the linker's `--symbol-ordering-file`"),
+    target_clones: Vec<String> = (Vec::new(), parse_string_push, [TRACKED],
+        "clone the function with the given symbol for each `|`-separated set of extra target \
+         features, picking the first the host supports when the program is loaded, e.g. \
+         `kernel=avx512f,avx512bw|avx2,fma` (x86 ELF targets only)"),
+    thin_archives: bool = (false, parse_bool, [UNTRACKED],
+        "write rlibs as GNU thin archives referring to copies of their members kept in a \
+         `.members` directory next to them, so they can't be moved on their own"),
+    reuse_llvm_contexts: bool = (false, parse_bool, [UNTRACKED],
+        "reuse the LLVM context of a finished codegen unit or ThinLTO module for the next one \
+         instead of creating a new one each time (named LLVM types may get different names)"),
     inline_in_all_cgus: Option<bool> = (None, parse_opt_bool, [TRACKED],
         "control whether #[inline] functions are in all cgus"),
     tls_model: Option<String> = (None, parse_opt_string, [TRACKED],
@@ -1403,6 +1558,9 @@ options! {DebuggingOptions, DebuggingSetter, basic_debugging_options,
         "output a json file with profiler results"),
     emit_stack_sizes: bool = (false, parse_bool, [UNTRACKED],
         "emits a section containing stack size metadata"),
+    stack_sizes_report: Option<PathBuf> = (None, parse_opt_pathbuf, [TRACKED],
+        "write the stack frame size of every function, largest first, to a tab-separated \
+         file (ELF targets only; implies `-Z emit-stack-sizes`)"),
     plt: Option<bool> = (None, parse_opt_bool, [TRACKED],
           "whether to use the PLT when calling into shared libraries;
           only has effect for PIC code on systems with ELF binaries
@@ -1410,6 +1568,13 @@ options! {DebuggingOptions, DebuggingSetter, basic_debugging_options,
     merge_functions: Option<MergeFunctions> = (None, parse_merge_functions, [TRACKED],
         "control the operation of the MergeFunctions LLVM pass, taking
          the same values as the target option of the same name"),
+    merge_functions_for_size: bool = (false, parse_bool, [TRACKED],
+        "also run the MergeFunctions LLVM pass at opt-level=s and z, rather than only at \
+         opt-level=2 and 3"),
+    machine_outliner: Option<bool> = (None, parse_opt_bool, [TRACKED],
+        "fold repeated instruction sequences into calls to shared functions with LLVM's \
+         MachineOutliner, which LLVM only runs for AArch64 (LLVM 7 and later; default: the \
+         target's `machine-outliner` option)"),
 }
 
 pub fn default_lib_output() -> CrateType {
@@ -1942,6 +2107,14 @@ pub fn build_session_options_and_crate_config(
         );
     }
 
+    if !debugging_opts.pgo_sample_use.is_empty() &&
+       (debugging_opts.pgo_gen.is_some() || !debugging_opts.pgo_use.is_empty()) {
+        early_error(
+            error_format,
+            "option `-Z pgo-sample-use` is exclusive with `-Z pgo-gen` and `-Z pgo-use`",
+        );
+    }
+
     let mut output_types = BTreeMap::new();
     if !debugging_opts.parse_only {
         for list in matches.opt_strs("emit") {
@@ -2237,6 +2410,13 @@ pub fn build_session_options_and_crate_config(
         );
     }
 
+    if !debugging_opts.pgo_sample_use.is_empty() && debuginfo == DebugInfo::None {
+        early_warn(
+            error_format,
+            "-Z pgo-sample-use requires \"-C debuginfo=n\" to match samples to code",
+        );
+    }
+
     if matches.opt_present("extern-private") && !debugging_opts.unstable_options {
         early_error(
             ErrorOutputType::default(),
@@ -2445,7 +2625,7 @@ mod dep_tracking {
     use std::path::PathBuf;
     use std::collections::hash_map::DefaultHasher;
     use super::{CrateType, DebugInfo, ErrorOutputType, OptLevel, OutputTypes,
-                Passes, Sanitizer, LtoCli, LinkerPluginLto};
+                Passes, Sanitizer, SanitizerCoverage, LtoCli, LinkerPluginLto};
     use syntax::feature_gate::UnstableFeatures;
     use rustc_target::spec::{MergeFunctions, PanicStrategy, RelroLevel, TargetTriple};
     use syntax::edition::Edition;
@@ -2510,10 +2690,18 @@ mod dep_tracking {
     impl_dep_tracking_hash_via_hash!(cstore::NativeLibraryKind);
     impl_dep_tracking_hash_via_hash!(Sanitizer);
     impl_dep_tracking_hash_via_hash!(Option<Sanitizer>);
+    impl_dep_tracking_hash_via_hash!(Option<SanitizerCoverage>);
     impl_dep_tracking_hash_via_hash!(TargetTriple);
     impl_dep_tracking_hash_via_hash!(Edition);
     impl_dep_tracking_hash_via_hash!(LinkerPluginLto);
 
+    // Floats aren't `Hash`, but their bits are.
+    impl DepTrackingHash for Option<f32> {
+        fn hash(&self, hasher: &mut DefaultHasher, _: ErrorOutputType) {
+            Hash::hash(&self.map(f32::to_bits), hasher);
+        }
+    }
+
     impl_dep_tracking_hash_for_sortable_vec_of!(String);
     impl_dep_tracking_hash_for_sortable_vec_of!(PathBuf);
     impl_dep_tracking_hash_for_sortable_vec_of!(CrateType);
@@ -2582,7 +2770,7 @@ mod tests {
     use std::collections::{BTreeMap, BTreeSet};
     use std::iter::FromIterator;
     use std::path::PathBuf;
-    use super::{Externs, OutputType, OutputTypes};
+    use super::{Externs, OutputType, OutputTypes, SanitizerCoverage, SanitizerCoverageLevel};
     use rustc_target::spec::{MergeFunctions, PanicStrategy, RelroLevel};
     use syntax::symbol::Symbol;
     use syntax::edition::{Edition, DEFAULT_EDITION};
@@ -3082,6 +3270,10 @@ mod tests {
         opts.debugging_opts.pgo_use = String::from("abc");
         assert_ne!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
 
+        opts = reference.clone();
+        opts.debugging_opts.pgo_sample_use = String::from("abc");
+        assert_ne!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
+
         opts = reference.clone();
         opts.cg.metadata = vec![String::from("A"), String::from("B")];
         assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
@@ -3129,6 +3321,12 @@ mod tests {
         assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
         opts.debugging_opts.time_llvm_passes = true;
         assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
+        opts.debugging_opts.llvm_pass_timings = true;
+        assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
+        opts.debugging_opts.remark_dir = Some(String::from("remarks"));
+        assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
+        opts.debugging_opts.remark_hotness_threshold = Some(100);
+        assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
         opts.debugging_opts.input_stats = true;
         assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
         opts.debugging_opts.codegen_stats = true;
@@ -3185,6 +3383,10 @@ mod tests {
         assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
         opts.debugging_opts.dump_mir_graphviz = true;
         assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
+        opts.debugging_opts.thin_archives = true;
+        assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
+        opts.debugging_opts.reuse_llvm_contexts = true;
+        assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
 
         // Make sure changing a [TRACKED] option changes the hash
         opts = reference.clone();
@@ -3242,6 +3444,100 @@ mod tests {
         opts = reference.clone();
         opts.debugging_opts.merge_functions = Some(MergeFunctions::Disabled);
         assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.thinlto_import_instr_limit = Some(10);
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.thinlto_import_max_per_module = Some(10);
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.thinlto_import_hot_multiplier = Some(2.0);
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.thinlto_import_cold_multiplier = Some(0.5);
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.lto_link_only_needed = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.single_codegen_asm_obj = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.new_llvm_pass_manager = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.share_debuginfo_types = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.split_dwarf = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.split_codegen_parts = Some(4);
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.compress_debug_sections = Some(String::from("zlib"));
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.whole_program_devirt = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.hot_cold_split = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.symbol_ordering_file = Some(PathBuf::from("foo.order"));
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.target_clones = vec![String::from("kernel=avx2")];
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.merge_functions_for_size = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.machine_outliner = Some(true);
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.sanitizer_recover = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.sanitizer_coverage = Some(SanitizerCoverage {
+            level: SanitizerCoverageLevel::Edge,
+            trace_pc_guard: true,
+            inline_8bit_counters: false,
+            pc_table: false,
+            trace_cmp: false,
+            trace_div: false,
+            trace_gep: false,
+            indirect_calls: false,
+            stack_depth: false,
+        });
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.sanitizer_skip = vec![String::from("foo::bar")];
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.stack_sizes_report = Some(PathBuf::from("stack-sizes.tsv"));
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
     }
 
     #[test]
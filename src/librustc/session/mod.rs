@@ -203,6 +203,16 @@ impl From<&'static lint::Lint> for DiagnosticMessageId {
 }
 
 impl Session {
+    /// Whether the object files of the target are ELF, as opposed to Mach-O, COFF or wasm.
+    pub fn target_uses_elf(&self) -> bool {
+        let target = &self.target.target;
+        !(target.options.is_like_osx ||
+          target.options.is_like_windows ||
+          target.options.is_like_msvc ||
+          target.arch.starts_with("wasm") ||
+          target.arch == "asmjs")
+    }
+
     pub fn local_crate_disambiguator(&self) -> CrateDisambiguator {
         *self.crate_disambiguator.get()
     }
@@ -1259,6 +1269,43 @@ fn validate_commandline_args_with_session_available(sess: &Session) {
         sess.err("Linker plugin based LTO is not supported together with \
                   `-C prefer-dynamic` when targeting MSVC");
     }
+
+    // Bitcode embedded in objects gets compiled again on its own later, where
+    // nothing could devirtualize calls with the type tests this leaves in it.
+    if sess.opts.debugging_opts.whole_program_devirt &&
+       (sess.opts.debugging_opts.embed_bitcode || sess.target.target.options.embed_bitcode) {
+        sess.err("`-Z whole-program-devirt` is not supported together with embedded bitcode");
+    }
+
+    // `.dwo` files are an ELF thing, other object formats keep their DWARF elsewhere.
+    if sess.opts.debugging_opts.split_dwarf && !sess.target_uses_elf() {
+        sess.err(&format!("`-Z split-dwarf` is only supported for ELF targets, not `{}`",
+                          sess.opts.target_triple));
+    }
+
+    // The partitions are put back together with a relocatable link, which only
+    // `cc` and `ld` are asked to do.
+    if sess.opts.debugging_opts.split_codegen_parts.is_some() && !sess.target_uses_elf() {
+        sess.err(&format!("`-Z split-codegen-parts` is only supported for ELF targets, not `{}`",
+                          sess.opts.target_triple));
+    }
+
+    // Likewise `.stack_sizes` sections, which the report is read out of.
+    if sess.opts.debugging_opts.stack_sizes_report.is_some() && !sess.target_uses_elf() {
+        sess.warn(&format!("`-Z stack-sizes-report` is only supported for ELF targets, \
+                            so no report is written for `{}`",
+                           sess.opts.target_triple));
+    }
+
+    // LLVM only runs the MachineOutliner for targets which support outlining
+    // by default, and it silently ignores the option everywhere else.
+    let machine_outliner = sess.opts.debugging_opts.machine_outliner
+        .unwrap_or(sess.target.target.options.machine_outliner);
+    if machine_outliner && sess.target.target.arch != "aarch64" {
+        sess.warn(&format!("the machine outliner is only supported for AArch64 targets, \
+                            so it has no effect for `{}`",
+                           sess.opts.target_triple));
+    }
 }
 
 /// Hash value constructed out of all the `-C metadata` arguments passed to the
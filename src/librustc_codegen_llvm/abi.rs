@@ -1,5 +1,6 @@
-use crate::llvm::{self, AttributePlace};
+use crate::llvm::{self, AttributePlace, BasicBlock};
 use crate::builder::Builder;
+use crate::common::Funclet;
 use crate::context::CodegenCx;
 use crate::type_::Type;
 use crate::type_of::{LayoutLlvmExt, PointerKind};
@@ -39,59 +40,28 @@ impl ArgAttributeExt for ArgAttribute {
 }
 
 pub trait ArgAttributesExt {
-    fn apply_llfn(&self, idx: AttributePlace, llfn: &Value);
-    fn apply_callsite(&self, idx: AttributePlace, callsite: &Value);
+    fn push_attrs(&self, idx: AttributePlace, attrs: &mut Vec<llvm::AttributeDesc>);
 }
 
 impl ArgAttributesExt for ArgAttributes {
-    fn apply_llfn(&self, idx: AttributePlace, llfn: &Value) {
+    fn push_attrs(&self, idx: AttributePlace, attrs: &mut Vec<llvm::AttributeDesc>) {
         let mut regular = self.regular;
-        unsafe {
-            let deref = self.pointee_size.bytes();
-            if deref != 0 {
-                if regular.contains(ArgAttribute::NonNull) {
-                    llvm::LLVMRustAddDereferenceableAttr(llfn,
-                                                         idx.as_uint(),
-                                                         deref);
-                } else {
-                    llvm::LLVMRustAddDereferenceableOrNullAttr(llfn,
-                                                               idx.as_uint(),
-                                                               deref);
-                }
-                regular -= ArgAttribute::NonNull;
-            }
-            if let Some(align) = self.pointee_align {
-                llvm::LLVMRustAddAlignmentAttr(llfn,
-                                               idx.as_uint(),
-                                               align.bytes() as u32);
-            }
-            regular.for_each_kind(|attr| attr.apply_llfn(idx, llfn));
+        let deref = self.pointee_size.bytes();
+        if deref != 0 {
+            let kind = if regular.contains(ArgAttribute::NonNull) {
+                llvm::AttributeKind::Dereferenceable
+            } else {
+                llvm::AttributeKind::DereferenceableOrNull
+            };
+            attrs.push(llvm::AttributeDesc::with_value(idx, kind, deref));
+            regular -= ArgAttribute::NonNull;
         }
-    }
-
-    fn apply_callsite(&self, idx: AttributePlace, callsite: &Value) {
-        let mut regular = self.regular;
-        unsafe {
-            let deref = self.pointee_size.bytes();
-            if deref != 0 {
-                if regular.contains(ArgAttribute::NonNull) {
-                    llvm::LLVMRustAddDereferenceableCallSiteAttr(callsite,
-                                                                 idx.as_uint(),
-                                                                 deref);
-                } else {
-                    llvm::LLVMRustAddDereferenceableOrNullCallSiteAttr(callsite,
-                                                                       idx.as_uint(),
-                                                                       deref);
-                }
-                regular -= ArgAttribute::NonNull;
-            }
-            if let Some(align) = self.pointee_align {
-                llvm::LLVMRustAddAlignmentCallSiteAttr(callsite,
-                                                       idx.as_uint(),
-                                                       align.bytes() as u32);
-            }
-            regular.for_each_kind(|attr| attr.apply_callsite(idx, callsite));
+        if let Some(align) = self.pointee_align {
+            attrs.push(llvm::AttributeDesc::with_value(idx,
+                                                       llvm::AttributeKind::Alignment,
+                                                       align.bytes()));
         }
+        regular.for_each_kind(|attr| attrs.push(llvm::AttributeDesc::new(idx, attr)));
     }
 }
 
@@ -313,8 +283,10 @@ pub trait FnTypeExt<'tcx> {
     fn llvm_type(&self, cx: &CodegenCx<'ll, 'tcx>) -> &'ll Type;
     fn ptr_to_llvm_type(&self, cx: &CodegenCx<'ll, 'tcx>) -> &'ll Type;
     fn llvm_cconv(&self) -> llvm::CallConv;
-    fn apply_attrs_llfn(&self, llfn: &'ll Value);
+    fn llvm_attrs(&self) -> Vec<llvm::AttributeDesc>;
+    fn apply_attrs_llfn(&self, cx: &CodegenCx<'ll, 'tcx>, llfn: &'ll Value);
     fn apply_attrs_callsite(&self, bx: &mut Builder<'a, 'll, 'tcx>, callsite: &'ll Value);
+    fn apply_ret_range_metadata(&self, bx: &mut Builder<'a, 'll, 'tcx>, callsite: &'ll Value);
 }
 
 impl<'tcx> FnTypeExt<'tcx> for FnType<'tcx, Ty<'tcx>> {
@@ -715,18 +687,18 @@ impl<'tcx> FnTypeExt<'tcx> for FnType<'tcx, Ty<'tcx>> {
         }
     }
 
-    fn apply_attrs_llfn(&self, llfn: &'ll Value) {
+    fn llvm_attrs(&self) -> Vec<llvm::AttributeDesc> {
+        let mut llattrs = vec![];
+        if let PassMode::Direct(ref attrs) = self.ret.mode {
+            attrs.push_attrs(llvm::AttributePlace::ReturnValue, &mut llattrs);
+        }
         let mut i = 0;
         let mut apply = |attrs: &ArgAttributes| {
-            attrs.apply_llfn(llvm::AttributePlace::Argument(i), llfn);
+            attrs.push_attrs(llvm::AttributePlace::Argument(i), &mut llattrs);
             i += 1;
         };
-        match self.ret.mode {
-            PassMode::Direct(ref attrs) => {
-                attrs.apply_llfn(llvm::AttributePlace::ReturnValue, llfn);
-            }
-            PassMode::Indirect(ref attrs, _) => apply(attrs),
-            _ => {}
+        if let PassMode::Indirect(ref attrs, _) = self.ret.mode {
+            apply(attrs);
         }
         for arg in &self.args {
             if arg.pad.is_some() {
@@ -747,21 +719,24 @@ impl<'tcx> FnTypeExt<'tcx> for FnType<'tcx, Ty<'tcx>> {
                 PassMode::Cast(_) => apply(&ArgAttributes::new()),
             }
         }
+        llattrs
+    }
+
+    fn apply_attrs_llfn(&self, cx: &CodegenCx<'ll, 'tcx>, llfn: &'ll Value) {
+        cx.attr_lists.add_function_attributes(llfn, &self.llvm_attrs());
     }
 
     fn apply_attrs_callsite(&self, bx: &mut Builder<'a, 'll, 'tcx>, callsite: &'ll Value) {
-        let mut i = 0;
-        let mut apply = |attrs: &ArgAttributes| {
-            attrs.apply_callsite(llvm::AttributePlace::Argument(i), callsite);
-            i += 1;
-        };
-        match self.ret.mode {
-            PassMode::Direct(ref attrs) => {
-                attrs.apply_callsite(llvm::AttributePlace::ReturnValue, callsite);
-            }
-            PassMode::Indirect(ref attrs, _) => apply(attrs),
-            _ => {}
+        self.apply_ret_range_metadata(bx, callsite);
+        bx.cx.attr_lists.add_callsite_attributes(callsite, &self.llvm_attrs());
+
+        let cconv = self.llvm_cconv();
+        if cconv != llvm::CCallConv {
+            llvm::SetInstructionCallConv(callsite, cconv);
         }
+    }
+
+    fn apply_ret_range_metadata(&self, bx: &mut Builder<'a, 'll, 'tcx>, callsite: &'ll Value) {
         if let layout::Abi::Scalar(ref scalar) = self.ret.layout.abi {
             // If the value is a boolean, the range is 0..2 and that ultimately
             // become 0..0 when the type becomes i1, which would be rejected
@@ -775,30 +750,6 @@ impl<'tcx> FnTypeExt<'tcx> for FnType<'tcx, Ty<'tcx>> {
                 }
             }
         }
-        for arg in &self.args {
-            if arg.pad.is_some() {
-                apply(&ArgAttributes::new());
-            }
-            match arg.mode {
-                PassMode::Ignore => {}
-                PassMode::Direct(ref attrs) |
-                PassMode::Indirect(ref attrs, None) => apply(attrs),
-                PassMode::Indirect(ref attrs, Some(ref extra_attrs)) => {
-                    apply(attrs);
-                    apply(extra_attrs);
-                }
-                PassMode::Pair(ref a, ref b) => {
-                    apply(a);
-                    apply(b);
-                }
-                PassMode::Cast(_) => apply(&ArgAttributes::new()),
-            }
-        }
-
-        let cconv = self.llvm_cconv();
-        if cconv != llvm::CCallConv {
-            llvm::SetInstructionCallConv(callsite, cconv);
-        }
     }
 }
 
@@ -826,4 +777,32 @@ impl AbiBuilderMethods<'tcx> for Builder<'a, 'll, 'tcx> {
     ) {
         ty.apply_attrs_callsite(self, callsite)
     }
+
+    fn call_with_attrs(
+        &mut self,
+        ty: &FnType<'tcx, Ty<'tcx>>,
+        llfn: &'ll Value,
+        args: &[&'ll Value],
+        funclet: Option<&Funclet<'ll>>,
+    ) -> &'ll Value {
+        let llret = self.call_with_attributes(llfn, args, funclet, &ty.llvm_attrs(),
+                                              ty.llvm_cconv());
+        ty.apply_ret_range_metadata(self, llret);
+        llret
+    }
+
+    fn invoke_with_attrs(
+        &mut self,
+        ty: &FnType<'tcx, Ty<'tcx>>,
+        llfn: &'ll Value,
+        args: &[&'ll Value],
+        then: &'ll BasicBlock,
+        catch: &'ll BasicBlock,
+        funclet: Option<&Funclet<'ll>>,
+    ) -> &'ll Value {
+        let llret = self.invoke_with_attributes(llfn, args, then, catch, funclet,
+                                                &ty.llvm_attrs(), ty.llvm_cconv());
+        ty.apply_ret_range_metadata(self, llret);
+        llret
+    }
 }
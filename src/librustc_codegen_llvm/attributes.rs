@@ -121,7 +121,9 @@ pub fn llvm_target_features(sess: &Session) -> impl Iterator<Item = &str> {
 
     let cmdline = sess.opts.cg.target_feature.split(',')
         .filter(|f| !RUSTC_SPECIFIC_FEATURES.iter().any(|s| f.contains(s)));
+    // Host features come before the command line's so that those still win.
     sess.target.target.options.features.split(',')
+        .chain(llvm_util::native_target_features(sess).split(','))
         .chain(cmdline)
         .filter(|l| !l.is_empty())
 }
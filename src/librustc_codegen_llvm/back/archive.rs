@@ -1,6 +1,7 @@
 //! A helper class for dealing with static archives
 
-use std::ffi::{CString, CStr};
+use std::ffi::{CString, OsString};
+use std::fs::{self, File};
 use std::io;
 use std::mem;
 use std::path::{Path, PathBuf};
@@ -12,6 +13,7 @@ use crate::llvm::archive_ro::{ArchiveRO, Child};
 use crate::llvm::{self, ArchiveKind};
 use crate::metadata::METADATA_FILENAME;
 use rustc_codegen_ssa::back::archive::find_library;
+use rustc_fs_util::link_or_copy;
 use rustc::session::Session;
 
 pub struct ArchiveConfig<'a> {
@@ -19,8 +21,17 @@ pub struct ArchiveConfig<'a> {
     pub dst: PathBuf,
     pub src: Option<PathBuf>,
     pub lib_search_paths: Vec<PathBuf>,
+    /// Whether the archive is an rlib that's the final output, the only kind
+    /// which may be written as a thin archive.
+    pub rlib: bool,
+    /// Write a GNU thin archive if possible, see `ArchiveBuilder::thin_members`.
+    pub thin: bool,
 }
 
+/// The file marking a `<dst>.members` directory as having been created for a
+/// thin archive, so that only directories rustc made itself are ever removed.
+const THIN_MEMBERS_MARKER: &str = ".rustc-thin-archive";
+
 /// Helper for adding many files to an archive.
 #[must_use = "must call build() to finish building the archive"]
 pub struct ArchiveBuilder<'a> {
@@ -188,7 +199,73 @@ impl<'a> ArchiveBuilder<'a> {
         kind.parse().map_err(|_| kind)
     }
 
+    /// The directory the members of a thin archive at `dst` are kept in.
+    fn members_dir(dst: &Path) -> PathBuf {
+        let mut dir = OsString::from(dst);
+        dir.push(".members");
+        PathBuf::from(dir)
+    }
+
+    /// Whether the archive can be written as a thin one. Thin archives only
+    /// refer to their members by path, so this is only the case for new GNU
+    /// archives made up of nothing but files.
+    fn can_be_thin(&self, kind: ArchiveKind) -> bool {
+        let gnu = match kind {
+            ArchiveKind::K_GNU => true,
+            _ => false,
+        };
+        self.config.rlib &&
+            self.config.thin &&
+            gnu &&
+            self.config.src.is_none() &&
+            self.additions.iter().all(|a| match a {
+                Addition::File { .. } => true,
+                Addition::Archive { .. } => false,
+            })
+    }
+
+    /// Moves the files to be added to a thin archive into the directory next
+    /// to it that the archive will refer to them in. The files passed to
+    /// `add_file` usually live in a temporary directory that's gone by the
+    /// time the archive is used, so they're hard linked (or copied) into a
+    /// fresh `<dst>.members` directory instead, under the names they'd have
+    /// in a regular archive.
+    fn thin_members(&mut self) -> io::Result<()> {
+        let dir = ArchiveBuilder::members_dir(&self.config.dst);
+        self.remove_thin_members()?;
+        fs::create_dir_all(&dir)?;
+        File::create(dir.join(THIN_MEMBERS_MARKER))?;
+        for addition in &mut self.additions {
+            if let Addition::File { path, name_in_archive } = addition {
+                let member = dir.join(&*name_in_archive);
+                link_or_copy(&*path, &member)?;
+                *path = member;
+            }
+        }
+        Ok(())
+    }
+
+    /// Removes the members of a previous thin rlib at `dst`, if there was one.
+    fn remove_thin_members(&self) -> io::Result<()> {
+        if !self.config.rlib {
+            return Ok(())
+        }
+        let dir = ArchiveBuilder::members_dir(&self.config.dst);
+        if dir.join(THIN_MEMBERS_MARKER).exists() {
+            fs::remove_dir_all(&dir)?;
+        }
+        Ok(())
+    }
+
     fn build_with_llvm(&mut self, kind: ArchiveKind) -> io::Result<()> {
+        let thin = self.can_be_thin(kind);
+        if thin {
+            self.thin_members()?;
+        } else {
+            // Don't leave the members of a previous thin archive lying around.
+            self.remove_thin_members()?;
+        }
+
         let removals = mem::replace(&mut self.removals, Vec::new());
         let mut additions = mem::replace(&mut self.additions, Vec::new());
         let mut strings = Vec::new();
@@ -262,14 +339,12 @@ impl<'a> ArchiveBuilder<'a> {
                                                members.len() as libc::size_t,
                                                members.as_ptr() as *const &_,
                                                should_update_symbols,
-                                               kind);
+                                               kind,
+                                               ::num_cpus::get() as libc::c_uint,
+                                               thin);
             let ret = if r.into_result().is_err() {
-                let err = llvm::LLVMRustGetLastError();
-                let msg = if err.is_null() {
-                    "failed to write archive".into()
-                } else {
-                    String::from_utf8_lossy(CStr::from_ptr(err).to_bytes())
-                };
+                let msg = llvm::last_error()
+                    .unwrap_or_else(|| "failed to write archive".to_string());
                 Err(io::Error::new(io::ErrorKind::Other, msg))
             } else {
                 Ok(())
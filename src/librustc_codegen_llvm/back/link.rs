@@ -49,6 +49,7 @@ pub(crate) fn link_binary(sess: &Session,
                           outputs: &OutputFilenames,
                           crate_name: &str) -> Vec<PathBuf> {
     let mut out_filenames = Vec::new();
+    let mut split_dwarf_packaged = true;
     for &crate_type in sess.crate_types.borrow().iter() {
         // Ignore executable crates if we have -Z no-codegen, as they will error.
         let output_metadata = sess.opts.output_types.contains_key(&OutputType::Metadata);
@@ -66,7 +67,8 @@ pub(crate) fn link_binary(sess: &Session,
                                            codegen_results,
                                            crate_type,
                                            outputs,
-                                           crate_name);
+                                           crate_name,
+                                           &mut split_dwarf_packaged);
         out_filenames.extend(out_files);
     }
 
@@ -80,6 +82,16 @@ pub(crate) fn link_binary(sess: &Session,
         for obj in codegen_results.modules.iter().filter_map(|m| m.bytecode_compressed.as_ref()) {
             remove(sess, obj);
         }
+        // Once they've been packaged into `.dwp` files the `.dwo` files aren't
+        // needed anymore, unless archives have objects referring to them.
+        let output_archive = sess.crate_types.borrow()
+            .iter()
+            .any(|&x| x == config::CrateType::Rlib || x == config::CrateType::Staticlib);
+        if split_dwarf_packaged && !output_archive {
+            for dwo in split_dwarf_objects(codegen_results) {
+                remove(sess, dwo);
+            }
+        }
         if let Some(ref obj) = codegen_results.metadata_module.object {
             remove(sess, obj);
         }
@@ -146,7 +158,8 @@ fn link_binary_output(sess: &Session,
                       codegen_results: &CodegenResults,
                       crate_type: config::CrateType,
                       outputs: &OutputFilenames,
-                      crate_name: &str) -> Vec<PathBuf> {
+                      crate_name: &str,
+                      split_dwarf_packaged: &mut bool) -> Vec<PathBuf> {
     for obj in codegen_results.modules.iter().filter_map(|m| m.object.as_ref()) {
         check_file_is_writeable(obj, sess);
     }
@@ -189,6 +202,9 @@ fn link_binary_output(sess: &Session,
             }
             _ => {
                 link_natively(sess, crate_type, &out_filename, codegen_results, tmpdir.path());
+                if !package_split_dwarf(sess, codegen_results, &out_filename) {
+                    *split_dwarf_packaged = false;
+                }
             }
         }
         out_filenames.push(out_filename);
@@ -201,6 +217,49 @@ fn link_binary_output(sess: &Session,
     out_filenames
 }
 
+/// The `.dwo` files of the crate's own objects, with `-Z split-dwarf`.
+fn split_dwarf_objects(codegen_results: &CodegenResults) -> Vec<&PathBuf> {
+    codegen_results.modules.iter()
+        .chain(codegen_results.allocator_module.iter())
+        .filter_map(|m| m.dwarf_object.as_ref())
+        .collect()
+}
+
+/// Packages the `.dwo` files of the crate's objects into a `.dwp` file next to
+/// `out_filename`, which is where debuggers look for it. Returns whether there
+/// was nothing to package or it was packaged; if `dwp` can't be run the
+/// `.dwo` files are left for the debugger to find instead.
+fn package_split_dwarf(sess: &Session,
+                       codegen_results: &CodegenResults,
+                       out_filename: &Path) -> bool {
+    let dwos = split_dwarf_objects(codegen_results);
+    if dwos.is_empty() {
+        return true
+    }
+
+    let mut dwp = out_filename.as_os_str().to_owned();
+    dwp.push(".dwp");
+    let mut cmd = Command::new("dwp");
+    cmd.arg("-o").arg(&dwp).args(&dwos);
+    info!("{:?}", &cmd);
+    match cmd.output() {
+        Ok(ref prog) if prog.status.success() => true,
+        Ok(prog) => {
+            sess.struct_warn(&format!("packaging split DWARF with `dwp` failed: {}",
+                                      prog.status))
+                .note(&format!("{:?}", &cmd))
+                .note(&String::from_utf8_lossy(&prog.stderr))
+                .emit();
+            false
+        }
+        Err(e) => {
+            sess.warn(&format!("could not run `dwp`, the `.dwo` files are kept instead: {}",
+                               e));
+            false
+        }
+    }
+}
+
 fn archive_search_paths(sess: &Session) -> Vec<PathBuf> {
     sess.target_filesearch(PathKind::Native).search_path_dirs()
 }
@@ -213,6 +272,8 @@ fn archive_config<'a>(sess: &'a Session,
         dst: output.to_path_buf(),
         src: input.map(|p| p.to_path_buf()),
         lib_search_paths: archive_search_paths(sess),
+        rlib: false,
+        thin: false,
     }
 }
 
@@ -253,7 +314,17 @@ fn link_rlib<'a>(sess: &'a Session,
                  out_filename: &Path,
                  tmpdir: &TempDir) -> ArchiveBuilder<'a> {
     info!("preparing rlib to {:?}", out_filename);
-    let mut ab = ArchiveBuilder::new(archive_config(sess, out_filename, None));
+    let mut config = archive_config(sess, out_filename, None);
+    // Only rlibs that are the final output can refer to their members, the
+    // base of a staticlib is a temporary that everything is copied out of.
+    match flavor {
+        RlibFlavor::Normal => {
+            config.rlib = true;
+            config.thin = sess.opts.debugging_opts.thin_archives;
+        }
+        RlibFlavor::StaticlibBase => {}
+    }
+    let mut ab = ArchiveBuilder::new(config);
 
     for obj in codegen_results.modules.iter().filter_map(|m| m.object.as_ref()) {
         ab.add_file(obj);
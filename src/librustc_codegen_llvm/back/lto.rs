@@ -1,6 +1,6 @@
 use crate::back::bytecode::{DecodedBytecode, RLIB_BYTECODE_EXTENSION};
-use crate::back::write::{self, DiagnosticHandlers, with_llvm_pmb, save_temp_bitcode,
-    to_llvm_opt_settings};
+use crate::back::write::{self, DiagnosticHandlers, RemarkStreamer, with_llvm_pmb,
+    save_temp_bitcode, to_llvm_opt_settings};
 use crate::llvm::archive_ro::ArchiveRO;
 use crate::llvm::{self, True, False};
 use crate::time_graph::Timeline;
@@ -16,12 +16,17 @@ use rustc::hir::def_id::LOCAL_CRATE;
 use rustc::middle::exported_symbols::SymbolExportLevel;
 use rustc::session::config::{self, Lto};
 use rustc::util::common::time_ext;
-use rustc_data_structures::fx::FxHashMap;
+use rustc_data_structures::fx::{FxHashMap, FxHashSet};
 use rustc_codegen_ssa::{ModuleCodegen, ModuleKind};
+use libc::c_int;
 
+use std::cmp;
 use std::ffi::{CStr, CString};
+use std::fs;
+use std::path::Path;
 use std::ptr;
 use std::slice;
+use std::str;
 use std::sync::Arc;
 
 pub fn crate_type_allows_lto(crate_type: config::CrateType) -> bool {
@@ -105,12 +110,11 @@ fn prepare_lto(cgcx: &CodegenContext<LlvmCodegenBackend>,
                     .filter_map(symbol_filter));
 
             let archive = ArchiveRO::open(&path).expect("wanted an rlib");
-            let bytecodes = archive.iter().filter_map(|child| {
-                child.ok().and_then(|c| c.name().map(|name| (name, c)))
+            let bytecodes = archive.members().filter_map(|member| {
+                member.ok().and_then(|(name, data)| name.map(|name| (name, data)))
             }).filter(|&(name, _)| name.ends_with(RLIB_BYTECODE_EXTENSION));
-            for (name, data) in bytecodes {
+            for (name, bc_encoded) in bytecodes {
                 info!("adding bytecode {}", name);
-                let bc_encoded = data.data();
 
                 let (bc, id) = time_ext(cgcx.time_passes, None, &format!("decode {}", name), || {
                     match DecodedBytecode::new(bc_encoded) {
@@ -180,9 +184,19 @@ pub(crate) fn run_thin(cgcx: &CodegenContext<LlvmCodegenBackend>,
 }
 
 pub(crate) fn prepare_thin(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
     module: ModuleCodegen<ModuleLlvm>
 ) -> (String, ThinBuffer) {
     let name = module.name.clone();
+    // Devirtualizing with the type tests needs a regular LTO module, which
+    // ours doesn't have, and the backend would only resolve them as failing.
+    if cgcx.opts.debugging_opts.whole_program_devirt {
+        unsafe { llvm::LLVMRustStripTypeTests(module.module_llvm.llmod()) };
+    }
+    // The pipeline run when preparing for ThinLTO doesn't merge constants, so
+    // fold the duplicates here rather than summarizing and shipping them.
+    let merged = unsafe { llvm::LLVMRustMergeConstants(module.module_llvm.llmod()) };
+    debug!("merged {} constants in {}", merged, name);
     let buffer = ThinBuffer::new(module.module_llvm.llmod());
     (name, buffer)
 }
@@ -266,6 +280,7 @@ fn fat_lto(cgcx: &CodegenContext<LlvmCodegenBackend>,
         // which we'd like to handle and print, so set up our diagnostic handlers
         // (which get unregistered when they go out of scope below).
         let _handler = DiagnosticHandlers::new(cgcx, diag_handler, llcx);
+        let _remarks = RemarkStreamer::new(cgcx, diag_handler, llcx, &module.name, "lto")?;
 
         // For all other modules we codegened we'll need to link them into our own
         // bitcode. All modules were codegened in their own LLVM context, however,
@@ -289,11 +304,23 @@ fn fat_lto(cgcx: &CodegenContext<LlvmCodegenBackend>,
             (buffer, CString::new(wp.cgu_name.clone()).unwrap())
         }));
 
+        let layout = unsafe { CStr::from_ptr(llvm::LLVMGetDataLayout(llmod)) };
+        check_lto_inputs(diag_handler,
+                         layout.to_str().ok(),
+                         serialized_modules.iter().map(|(m, name)| (&name[..], m.data())))?;
+
         // For all serialized bitcode files we parse them and link them in as we did
         // above, this is all mostly handled in C++. Like above, though, we don't
         // know much about the memory management here so we err on the side of being
         // save and persist everything with the original module.
-        let mut linker = Linker::new(llmod);
+        //
+        // If asked to, only what's reachable from what's already linked (or
+        // from our whitelist) is linked in, instead of every module in full.
+        let mut linker = if cgcx.opts.debugging_opts.lto_link_only_needed {
+            Linker::new_only_needed(llmod, symbol_white_list)
+        } else {
+            Linker::new(llmod)
+        };
         for (bc_decoded, name) in serialized_modules {
             info!("linking {:?}", name);
             time_ext(cgcx.time_passes, None, &format!("ll link {:?}", name), || {
@@ -306,9 +333,21 @@ fn fat_lto(cgcx: &CodegenContext<LlvmCodegenBackend>,
             timeline.record(&format!("link {:?}", name));
             serialized_bitcode.push(bc_decoded);
         }
+        time_ext(cgcx.time_passes, None, "ll link finish", || {
+            linker.finish().map_err(|()| {
+                write::llvm_err(&diag_handler, "failed to link needed bc")
+            })
+        })?;
         drop(linker);
         save_temp_bitcode(&cgcx, &module, "lto.input");
 
+        // Now that every module is in one, the constants each of them had a
+        // copy of can be folded together.
+        let merged = time_ext(cgcx.time_passes, None, "ll merge constants", || unsafe {
+            llvm::LLVMRustMergeConstants(llmod)
+        });
+        info!("merged {} constants", merged);
+
         // Internalize everything that *isn't* in our whitelist to help strip out
         // more modules and such
         unsafe {
@@ -341,6 +380,27 @@ impl Linker<'a> {
         unsafe { Linker(llvm::LLVMRustLinkerNew(llmod)) }
     }
 
+    fn new_only_needed(llmod: &'a llvm::Module,
+                       symbol_white_list: &[*const libc::c_char]) -> Self {
+        unsafe {
+            Linker(llvm::LLVMRustLinkerNewOnlyNeeded(
+                llmod,
+                symbol_white_list.as_ptr() as *const *const libc::c_char,
+                symbol_white_list.len() as libc::size_t,
+            ))
+        }
+    }
+
+    fn finish(&mut self) -> Result<(), ()> {
+        unsafe {
+            if llvm::LLVMRustLinkerFinish(self.0) {
+                Ok(())
+            } else {
+                Err(())
+            }
+        }
+    }
+
     fn add(&mut self, bytecode: &[u8]) -> Result<(), ()> {
         unsafe {
             if llvm::LLVMRustLinkerAdd(self.0,
@@ -360,6 +420,48 @@ impl Drop for Linker<'a> {
     }
 }
 
+/// Checks the bitcode of every module about to be linked (or imported from)
+/// for LTO, so that bitcode LLVM can't use is rejected by name before any of
+/// the expensive work starts, rather than failing somewhere in the middle of
+/// it. Bitcode from a newer LLVM than ours can't be read, and bitcode for a
+/// different data layout than `expected_layout` (or, without one, than the
+/// first of `inputs`) can be linked but not correctly. Only the start of each
+/// module is read, so this is cheap even for large ones.
+fn check_lto_inputs<'a>(diag_handler: &Handler,
+                        expected_layout: Option<&str>,
+                        inputs: impl Iterator<Item = (&'a CStr, &'a [u8])>)
+    -> Result<(), FatalError>
+{
+    let mut expected_layout = expected_layout.map(|s| s.to_string());
+    for (name, data) in inputs {
+        let mut result = llvm::LLVMRustResult::Success;
+        let layout = llvm::build_string(|s| unsafe {
+            result = llvm::LLVMRustCheckBitcodeForLTO(data.as_ptr() as *const libc::c_char,
+                                                      data.len(),
+                                                      name.as_ptr(),
+                                                      s);
+        }).unwrap_or_default();
+        if result.into_result().is_err() {
+            let err = llvm::last_error().unwrap_or_else(|| "unknown error".to_string());
+            return Err(diag_handler.fatal(&format!("failed to load bc of {:?}: {}", name, err)));
+        }
+        // Bitcode without a data layout takes on whichever it's linked into.
+        if layout.is_empty() {
+            continue
+        }
+        match expected_layout {
+            Some(ref expected) if *expected != layout => {
+                return Err(diag_handler.fatal(&format!(
+                    "bc of {:?} has data layout `{}`, which doesn't match the `{}` of the \
+                     modules it's being linked with", name, layout, expected)));
+            }
+            Some(_) => {}
+            None => expected_layout = Some(layout),
+        }
+    }
+    Ok(())
+}
+
 /// Prepare "thin" LTO to get run on these modules.
 ///
 /// The general structure of ThinLTO is quite different from the structure of
@@ -461,15 +563,44 @@ fn thin_lto(cgcx: &CodegenContext<LlvmCodegenBackend>,
         // Sanity check
         assert_eq!(thin_modules.len(), module_names.len());
 
+        check_lto_inputs(diag_handler, None, thin_modules.iter().zip(&module_names).map(
+            |(m, name)| (&name[..], slice::from_raw_parts(m.data, m.len))
+        ))?;
+
         // Delegate to the C++ bindings to create some data here. Once this is a
         // tried-and-true interface we may wish to try to upstream some of this
         // to LLVM itself, right now we reimplement a lot of what they do
         // upstream...
+        //
+        // Unless asked otherwise, LLVM gets to decide how much is imported
+        // across modules. If we are building with a profile then the summaries
+        // know which call sites are hot, and that's taken into account when
+        // trimming import lists as well.
+        //
+        // Anything not given on the command line is passed on as negative.
+        let opts = &cgcx.opts.debugging_opts;
+        let import_budget = if opts.thinlto_import_instr_limit.is_some() ||
+                               opts.thinlto_import_hot_multiplier.is_some() ||
+                               opts.thinlto_import_cold_multiplier.is_some() ||
+                               opts.thinlto_import_max_per_module.is_some() {
+            let to_c_int = |n: Option<usize>| {
+                n.map_or(-1, |n| cmp::min(n, c_int::max_value() as usize) as c_int)
+            };
+            Some(llvm::ThinLTOImportBudget {
+                instr_limit: to_c_int(opts.thinlto_import_instr_limit),
+                hot_multiplier: opts.thinlto_import_hot_multiplier.unwrap_or(-1.0),
+                cold_multiplier: opts.thinlto_import_cold_multiplier.unwrap_or(-1.0),
+                max_imports_per_module: to_c_int(opts.thinlto_import_max_per_module),
+            })
+        } else {
+            None
+        };
         let data = llvm::LLVMRustCreateThinLTOData(
             thin_modules.as_ptr(),
             thin_modules.len() as u32,
             symbol_white_list.as_ptr(),
             symbol_white_list.len() as u32,
+            import_budget.as_ref(),
         ).ok_or_else(|| {
             write::llvm_err(&diag_handler, "failed to prepare thin LTO context")
         })?;
@@ -477,8 +608,9 @@ fn thin_lto(cgcx: &CodegenContext<LlvmCodegenBackend>,
         info!("thin LTO data created");
         timeline.record("data");
 
-        let import_map = if cgcx.incr_comp_session_dir.is_some() {
-            ThinLTOImports::from_thin_lto_data(data)
+        let import_map = if let Some(ref incr_comp_session_dir) = cgcx.incr_comp_session_dir {
+            let path = incr_comp_session_dir.join(THIN_LTO_IMPORTS_INCR_FILE_NAME);
+            ThinLTOImports::from_thin_lto_data(data, &path, &diag_handler)
         } else {
             // If we don't compile incrementally, we don't need to load the
             // import data from LLVM.
@@ -488,6 +620,29 @@ fn thin_lto(cgcx: &CodegenContext<LlvmCodegenBackend>,
         info!("thin LTO import map loaded");
         timeline.record("import-map-loaded");
 
+        // Which definitions get dropped as dead depends on the whole program,
+        // so a module whose own didn't change could still be missing
+        // something that's now needed.
+        let dead_definitions_changed = match cgcx.incr_comp_session_dir {
+            Some(ref incr_comp_session_dir) => {
+                let path = incr_comp_session_dir.join(THIN_LTO_DEAD_DEFINITIONS_INCR_FILE_NAME);
+                dead_definitions_changed(data, &path, &diag_handler)
+            }
+            None => None,
+        };
+        let dead_definitions_unchanged = |module_name: &str| {
+            match dead_definitions_changed {
+                Some(ref changed) => !changed.contains(module_name),
+                None => false,
+            }
+        };
+
+        // Ask the summary index how costly each module is, which is what we'll
+        // use to hand out the biggest modules first.
+        let module_costs = module_names.iter()
+            .map(|name| llvm::LLVMRustThinLTOModuleCost(data, name.as_ptr()))
+            .collect();
+
         let data = ThinData(data);
 
         // Throw our data in an `Arc` as we'll be sharing it across threads. We
@@ -499,6 +654,7 @@ fn thin_lto(cgcx: &CodegenContext<LlvmCodegenBackend>,
             thin_buffers,
             serialized_modules: serialized,
             module_names,
+            module_costs,
         });
 
         let mut copy_jobs = vec![];
@@ -508,10 +664,13 @@ fn thin_lto(cgcx: &CodegenContext<LlvmCodegenBackend>,
         for (module_index, module_name) in shared.module_names.iter().enumerate() {
             let module_name = module_name_to_str(module_name);
 
-            // If the module hasn't changed and none of the modules it imports
-            // from has changed, we can re-use the post-ThinLTO version of the
-            // module.
-            if green_modules.contains_key(module_name) {
+            // If the module hasn't changed, still imports from the same
+            // modules it did last time, has the same definitions dropped as
+            // dead, and none of the modules it imports from has changed
+            // either, we can re-use the post-ThinLTO version of the module.
+            if green_modules.contains_key(module_name) &&
+               import_map.imports_unchanged(module_name) &&
+               dead_definitions_unchanged(module_name) {
                 let imports_all_green = import_map.modules_imported_by(module_name)
                     .iter()
                     .all(|imported_module| green_modules.contains_key(imported_module));
@@ -548,6 +707,23 @@ pub(crate) fn run_pass_manager(cgcx: &CodegenContext<LlvmCodegenBackend>,
     //      tools/lto/LTOCodeGenerator.cpp
     debug!("running the pass manager");
     unsafe {
+        if write::use_new_llvm_pass_manager(cgcx, config) {
+            let opt_stage = if thin { llvm::OptStage::ThinLTO } else { llvm::OptStage::FatLTO };
+            // As with the legacy pass manager below, LTO always optimizes at
+            // least at `-O1`.
+            let opt_level = match config.opt_level {
+                None | Some(config::OptLevel::No) => config::OptLevel::Less,
+                Some(level) => level,
+            };
+            let diag_handler = cgcx.create_diag_handler();
+            time_ext(cgcx.time_passes, None, "LTO passes", || {
+                write::optimize_with_new_llvm_pass_manager(cgcx, module, config, opt_level,
+                                                           opt_stage, &diag_handler)
+            }).unwrap_or_else(|e| e.raise());
+            debug!("lto done");
+            return;
+        }
+
         let pm = llvm::LLVMCreatePassManager();
         llvm::LLVMRustAddAnalysisPasses(module.module_llvm.tm, pm, module.module_llvm.llmod());
 
@@ -699,17 +875,24 @@ pub unsafe fn optimize_thin_module(
     })?;
 
     // Right now the implementation we've got only works over serialized
-    // modules, so we create a fresh new LLVM context and parse the module
-    // into that context. One day, however, we may do this for upstream
-    // crates but for locally codegened modules we may be able to reuse
-    // that LLVM Context and Module.
-    let llcx = llvm::LLVMRustContextCreate(cgcx.fewer_names);
-    let llmod_raw = parse_module(
+    // modules, so we create a fresh new LLVM context (or take one from the
+    // pool) and parse the module into that context. One day, however, we may
+    // do this for upstream crates but for locally codegened modules we may be
+    // able to reuse that LLVM Context and Module.
+    let llcx = llvm::LLVMRustContextAcquire(cgcx.fewer_names);
+    // The module's parsed lazily so that whatever the global analysis found
+    // to be dead never has to be.
+    let name = &thin_module.shared.module_names[thin_module.idx];
+    let data = thin_module.data();
+    let llmod_raw = llvm::LLVMRustParseThinLTOModule(
+        thin_module.shared.data.0,
         llcx,
-        &thin_module.shared.module_names[thin_module.idx],
-        thin_module.data(),
-        &diag_handler,
-    )? as *const _;
+        data.as_ptr(),
+        data.len(),
+        name.as_ptr(),
+    ).ok_or_else(|| {
+        write::llvm_err(&diag_handler, "failed to parse bitcode for thin LTO module")
+    })? as *const _;
     let module = ModuleCodegen {
         module_llvm: ModuleLlvm {
             llmod_raw,
@@ -721,6 +904,8 @@ pub unsafe fn optimize_thin_module(
     };
     {
         let llmod = module.module_llvm.llmod();
+        let _remarks = RemarkStreamer::new(cgcx, &diag_handler, &*module.module_llvm.llcx,
+                                           &module.name, "thin-lto")?;
         save_temp_bitcode(&cgcx, &module, "thin-lto-input");
 
         // Before we do much else find the "main" `DICompileUnit` that we'll be
@@ -749,32 +934,45 @@ pub unsafe fn optimize_thin_module(
         // each of these would be supported by upstream LLVM but that's perhaps
         // a patch for another day!
         //
+        // They're all run with one call, and only if we're saving temps do we
+        // need to hear back after each one (rename, resolve, internalize and
+        // import) to save off the intermediate bitcode.
+        //
         // You can find some more comments about these functions in the LLVM
         // bindings we've got (currently `PassWrapper.cpp`)
-        if !llvm::LLVMRustPrepareThinLTORename(thin_module.shared.data.0, llmod) {
-            let msg = "failed to prepare thin LTO module";
-            return Err(write::llvm_err(&diag_handler, msg))
-        }
-        save_temp_bitcode(cgcx, &module, "thin-lto-after-rename");
-        timeline.record("rename");
-        if !llvm::LLVMRustPrepareThinLTOResolveWeak(thin_module.shared.data.0, llmod) {
-            let msg = "failed to prepare thin LTO module";
-            return Err(write::llvm_err(&diag_handler, msg))
-        }
-        save_temp_bitcode(cgcx, &module, "thin-lto-after-resolve");
-        timeline.record("resolve");
-        if !llvm::LLVMRustPrepareThinLTOInternalize(thin_module.shared.data.0, llmod) {
-            let msg = "failed to prepare thin LTO module";
-            return Err(write::llvm_err(&diag_handler, msg))
+        unsafe extern "C" fn step_callback(payload: *mut libc::c_void,
+                                           step: *const libc::c_char) {
+            let (cgcx, module, timeline) = &mut *(payload as *mut (
+                &CodegenContext<LlvmCodegenBackend>,
+                &ModuleCodegen<ModuleLlvm>,
+                &mut Timeline,
+            ));
+            let step = CStr::from_ptr(step).to_str().unwrap();
+            save_temp_bitcode(cgcx, module, &format!("thin-lto-after-{}", step));
+            timeline.record(step);
         }
-        save_temp_bitcode(cgcx, &module, "thin-lto-after-internalize");
-        timeline.record("internalize");
-        if !llvm::LLVMRustPrepareThinLTOImport(thin_module.shared.data.0, llmod) {
+        let prepared = if cgcx.save_temps {
+            let mut payload = (cgcx, &module, &mut *timeline);
+            llvm::LLVMRustPrepareThinLTOModule(
+                thin_module.shared.data.0,
+                llmod,
+                Some(step_callback),
+                &mut payload as *mut _ as *mut libc::c_void,
+            )
+        } else {
+            let prepared = llvm::LLVMRustPrepareThinLTOModule(
+                thin_module.shared.data.0,
+                llmod,
+                None,
+                ptr::null_mut(),
+            );
+            timeline.record("prepare");
+            prepared
+        };
+        if !prepared {
             let msg = "failed to prepare thin LTO module";
             return Err(write::llvm_err(&diag_handler, msg))
         }
-        save_temp_bitcode(cgcx, &module, "thin-lto-after-import");
-        timeline.record("import");
 
         // Ok now this is a bit unfortunate. This is also something you won't
         // find upstream in LLVM's ThinLTO passes! This is a hack for now to
@@ -823,10 +1021,53 @@ pub unsafe fn optimize_thin_module(
     Ok(module)
 }
 
+/// The name of the file in the incremental session directory holding the
+/// import map of the last session, as serialized by
+/// `LLVMRustThinLTOSerializeImports`.
+const THIN_LTO_IMPORTS_INCR_FILE_NAME: &str = "thin-lto-imports.bin";
+
+/// The name of the file in the incremental session directory holding which
+/// definitions were dead in each module in the last session, as serialized by
+/// `LLVMRustThinLTOSerializeDeadDefinitions`.
+const THIN_LTO_DEAD_DEFINITIONS_INCR_FILE_NAME: &str = "thin-lto-dead-definitions.txt";
+
+/// Returns the modules whose dead definitions aren't the same as they were
+/// when they were last saved to `path`, or `None` if there's nothing to
+/// compare against, and then saves the current ones there for the next
+/// session.
+unsafe fn dead_definitions_changed(data: *const llvm::ThinLTOData,
+                                   path: &Path,
+                                   diag_handler: &Handler)
+                                   -> Option<FxHashSet<String>> {
+    let current = llvm::build_string(|s| {
+        llvm::LLVMRustThinLTOSerializeDeadDefinitions(&*data, s)
+    }).unwrap_or_else(|_| bug!("LLVM serialized non-utf8 ThinLTO module names"));
+
+    let changed = fs::read_to_string(path).ok().map(|prev| {
+        let prev = prev.lines().collect::<FxHashSet<_>>();
+        current.lines()
+            .filter(|line| !prev.contains(line))
+            .filter_map(|line| line.splitn(2, ' ').nth(1))
+            .map(|name| name.to_owned())
+            .collect()
+    });
+
+    // Like the import map, replace the file rather than write to it.
+    let _ = fs::remove_file(path);
+    if let Err(e) = fs::write(path, &current) {
+        diag_handler.warn(&format!("failed to save ThinLTO dead definitions to {}: {}",
+                                   path.display(), e));
+    }
+    changed
+}
+
 #[derive(Debug, Default)]
 pub struct ThinLTOImports {
     // key = llvm name of importing module, value = list of modules it imports from
     imports: FxHashMap<String, Vec<String>>,
+    // The modules which don't import from the same modules they did in the
+    // previous session, or `None` if there's nothing to compare against.
+    changed: Option<FxHashSet<String>>,
 }
 
 impl ThinLTOImports {
@@ -834,32 +1075,89 @@ impl ThinLTOImports {
         self.imports.get(llvm_module_name).map(|v| &v[..]).unwrap_or(&[])
     }
 
-    /// Loads the ThinLTO import map from ThinLTOData.
-    unsafe fn from_thin_lto_data(data: *const llvm::ThinLTOData) -> ThinLTOImports {
-        unsafe extern "C" fn imported_module_callback(payload: *mut libc::c_void,
-                                                      importing_module_name: *const libc::c_char,
-                                                      imported_module_name: *const libc::c_char) {
-            let map = &mut* (payload as *mut ThinLTOImports);
-            let importing_module_name = CStr::from_ptr(importing_module_name);
-            let importing_module_name = module_name_to_str(&importing_module_name);
-            let imported_module_name = CStr::from_ptr(imported_module_name);
-            let imported_module_name = module_name_to_str(&imported_module_name);
-
-            if !map.imports.contains_key(importing_module_name) {
-                map.imports.insert(importing_module_name.to_owned(), vec![]);
+    fn imports_unchanged(&self, llvm_module_name: &str) -> bool {
+        match self.changed {
+            Some(ref changed) => !changed.contains(llvm_module_name),
+            None => false,
+        }
+    }
+
+    /// Loads the ThinLTO import map from ThinLTOData, along with which
+    /// modules' imports changed since the map last saved to `path`, and then
+    /// saves the new one there for the next session.
+    unsafe fn from_thin_lto_data(data: *const llvm::ThinLTOData,
+                                 path: &Path,
+                                 diag_handler: &Handler)
+                                 -> ThinLTOImports {
+        let data = &*data;
+        let serialized = llvm::build_byte_buffer(|s| {
+            llvm::LLVMRustThinLTOSerializeImports(data, s)
+        });
+        let imports = parse_thin_lto_imports(&serialized).unwrap_or_else(|| {
+            bug!("LLVM serialized a malformed ThinLTO import map")
+        });
+
+        let changed = fs::read(path).ok().and_then(|prev| {
+            let mut valid = false;
+            let changed = llvm::build_byte_buffer(|s| {
+                valid = llvm::LLVMRustThinLTODiffImports(data, prev.as_ptr(), prev.len(), s);
+            });
+            if !valid {
+                return None
             }
+            Some(changed.split(|&b| b == 0)
+                .filter(|name| !name.is_empty())
+                .map(|name| String::from_utf8_lossy(name).into_owned())
+                .collect())
+        });
+
+        // The file may well be a hard link to the one in the session this one
+        // was copied from, so replace it rather than write to it.
+        let _ = fs::remove_file(path);
+        if let Err(e) = fs::write(path, &serialized) {
+            diag_handler.warn(&format!("failed to save ThinLTO import map to {}: {}",
+                                       path.display(), e));
+        }
 
-            map.imports
-               .get_mut(importing_module_name)
-               .unwrap()
-               .push(imported_module_name.to_owned());
+        ThinLTOImports { imports, changed }
+    }
+}
+
+/// Parses an import map serialized by `LLVMRustThinLTOSerializeImports`.
+fn parse_thin_lto_imports(mut buf: &[u8]) -> Option<FxHashMap<String, Vec<String>>> {
+    fn read_u32(buf: &mut &[u8]) -> Option<usize> {
+        if buf.len() < 4 {
+            return None
+        }
+        let v = u32::from_le_bytes([buf[0], buf[1], buf[2], buf[3]]);
+        *buf = &buf[4..];
+        Some(v as usize)
+    }
+
+    let num_modules = read_u32(&mut buf)?;
+    let mut ids = Vec::with_capacity(num_modules);
+    for _ in 0..num_modules {
+        let len = read_u32(&mut buf)?;
+        if buf.len() < len {
+            return None
+        }
+        ids.push(str::from_utf8(&buf[..len]).ok()?.to_owned());
+        buf = &buf[len..];
+    }
+
+    let mut imports = FxHashMap::default();
+    for id in &ids {
+        let num_imports = read_u32(&mut buf)?;
+        if num_imports == 0 {
+            continue
+        }
+        let mut imported = Vec::with_capacity(num_imports);
+        for _ in 0..num_imports {
+            imported.push(ids.get(read_u32(&mut buf)?)?.clone());
         }
-        let mut map = ThinLTOImports::default();
-        llvm::LLVMRustGetThinLTOModuleImports(data,
-                                              imported_module_callback,
-                                              &mut map as *mut _ as *mut libc::c_void);
-        map
+        imports.insert(id.clone(), imported);
     }
+    Some(imports)
 }
 
 fn module_name_to_str(c_str: &CStr) -> &str {
@@ -11,7 +11,8 @@ use crate::type_::Type;
 use crate::context::{is_pie_binary, get_reloc_model};
 use crate::common;
 use crate::LlvmCodegenBackend;
-use rustc_codegen_ssa::back::write::{CodegenContext, ModuleConfig, run_assembler};
+use rustc_codegen_ssa::back::write::{CodegenContext, ModuleConfig, run_assembler,
+                                      run_partial_link};
 use rustc_codegen_ssa::traits::*;
 use rustc::hir::def_id::LOCAL_CRATE;
 use rustc::session::config::{self, OutputType, Passes, Lto};
@@ -26,7 +27,7 @@ use errors::{Handler, FatalError};
 use std::ffi::{CString, CStr};
 use std::fs;
 use std::io::{self, Write};
-use std::path::Path;
+use std::path::{Path, PathBuf};
 use std::str;
 use std::sync::Arc;
 use std::slice;
@@ -49,6 +50,12 @@ pub const CODE_GEN_MODEL_ARGS: &[(&str, llvm::CodeModel)] = &[
     ("large", llvm::CodeModel::Large),
 ];
 
+pub const DEBUG_COMPRESSION_ARGS: &[(&str, llvm::DebugCompression)] = &[
+    ("none", llvm::DebugCompression::None),
+    ("zlib", llvm::DebugCompression::Zlib),
+    ("zlib-gnu", llvm::DebugCompression::ZlibGnu),
+];
+
 pub const TLS_MODEL_ARGS : [(&str, llvm::ThreadLocalMode); 4] = [
     ("global-dynamic", llvm::ThreadLocalMode::GeneralDynamic),
     ("local-dynamic", llvm::ThreadLocalMode::LocalDynamic),
@@ -69,10 +76,64 @@ pub fn write_output_file(
         pm: &llvm::PassManager<'ll>,
         m: &'ll llvm::Module,
         output: &Path,
+        dwo_output: Option<&Path>,
         file_type: llvm::FileType) -> Result<(), FatalError> {
     unsafe {
         let output_c = path_to_c_string(output);
-        let result = llvm::LLVMRustWriteOutputFile(target, pm, m, output_c.as_ptr(), file_type);
+        let dwo_output_c = dwo_output.map(path_to_c_string);
+        let dwo_output_ptr = dwo_output_c.as_ref().map_or(std::ptr::null(), |s| s.as_ptr());
+        let result = llvm::LLVMRustWriteOutputFile(target, pm, m, output_c.as_ptr(),
+                                                   dwo_output_ptr, file_type);
+        if result.into_result().is_err() {
+            let msg = format!("could not write output to {}", output.display());
+            Err(llvm_err(handler, &msg))
+        } else {
+            Ok(())
+        }
+    }
+}
+
+/// Codegens `m` into one object file per path in `outputs`, each of them with
+/// a partition of the module, in parallel.
+fn write_object_files_split(
+        handler: &errors::Handler,
+        target: &'ll llvm::TargetMachine,
+        m: &'ll llvm::Module,
+        outputs: &[PathBuf]) -> Result<(), FatalError> {
+    unsafe {
+        let outputs_c = outputs.iter().map(|p| path_to_c_string(p)).collect::<Vec<_>>();
+        let outputs_ptrs = outputs_c.iter().map(|s| s.as_ptr()).collect::<Vec<_>>();
+        let result = llvm::LLVMRustWriteOutputFilesSplit(target, m, outputs_ptrs.as_ptr(),
+                                                         outputs_ptrs.len(),
+                                                         llvm::FileType::ObjectFile);
+        if result.into_result().is_err() {
+            let msg = format!("could not write output to {}", outputs[0].display());
+            Err(llvm_err(handler, &msg))
+        } else {
+            Ok(())
+        }
+    }
+}
+
+/// Same as `write_output_file` for an object file, for a module which only
+/// has a placeholder for its embedded `bitcode`, which is copied into the
+/// object once it's been made.
+fn write_object_file_with_bitcode(
+        handler: &errors::Handler,
+        target: &'ll llvm::TargetMachine,
+        pm: &llvm::PassManager<'ll>,
+        m: &'ll llvm::Module,
+        output: &Path,
+        dwo_output: Option<&Path>,
+        bitcode: &[u8]) -> Result<(), FatalError> {
+    unsafe {
+        let output_c = path_to_c_string(output);
+        let dwo_output_c = dwo_output.map(path_to_c_string);
+        let dwo_output_ptr = dwo_output_c.as_ref().map_or(std::ptr::null(), |s| s.as_ptr());
+        let result = llvm::LLVMRustWriteObjectFileWithBitcode(target, pm, m, output_c.as_ptr(),
+                                                              dwo_output_ptr,
+                                                              bitcode.as_ptr() as *const c_char,
+                                                              bitcode.len());
         if result.into_result().is_err() {
             let msg = format!("could not write output to {}", output.display());
             Err(llvm_err(handler, &msg))
@@ -82,6 +143,33 @@ pub fn write_output_file(
     }
 }
 
+pub fn write_asm_and_object_files(
+        handler: &errors::Handler,
+        target: &'ll llvm::TargetMachine,
+        pm: &llvm::PassManager<'ll>,
+        m: &'ll llvm::Module,
+        asm_output: &Path,
+        obj_output: &Path,
+        dwo_output: Option<&Path>) -> Result<(), FatalError> {
+    unsafe {
+        let asm_output_c = path_to_c_string(asm_output);
+        let obj_output_c = path_to_c_string(obj_output);
+        let dwo_output_c = dwo_output.map(path_to_c_string);
+        let dwo_output_ptr = dwo_output_c.as_ref().map_or(std::ptr::null(), |s| s.as_ptr());
+        let result = llvm::LLVMRustWriteAsmAndObjectFiles(target, pm, m,
+                                                          asm_output_c.as_ptr(),
+                                                          obj_output_c.as_ptr(),
+                                                          dwo_output_ptr);
+        if result.into_result().is_err() {
+            let msg = format!("could not write output to {} and {}",
+                              asm_output.display(), obj_output.display());
+            Err(llvm_err(handler, &msg))
+        } else {
+            Ok(())
+        }
+    }
+}
+
 pub fn create_target_machine(
     tcx: TyCtxt<'_, '_, '_>,
     find_features: bool,
@@ -113,6 +201,18 @@ pub fn to_llvm_opt_settings(cfg: config::OptLevel) -> (llvm::CodeGenOptLevel, ll
     }
 }
 
+fn to_pass_builder_opt_level(cfg: config::OptLevel) -> llvm::PassBuilderOptLevel {
+    use self::config::OptLevel::*;
+    match cfg {
+        No => llvm::PassBuilderOptLevel::O0,
+        Less => llvm::PassBuilderOptLevel::O1,
+        Default => llvm::PassBuilderOptLevel::O2,
+        Aggressive => llvm::PassBuilderOptLevel::O3,
+        Size => llvm::PassBuilderOptLevel::Os,
+        SizeMin => llvm::PassBuilderOptLevel::Oz,
+    }
+}
+
 // If find_features is true this won't access `sess.crate_types` by assuming
 // that `is_pie_binary` is false. When we discover LLVM target features
 // `sess.crate_types` is uninitialized so we cannot access it.
@@ -124,7 +224,10 @@ pub fn target_machine_factory(sess: &Session, optlvl: config::OptLevel, find_fea
     let (opt_level, _) = to_llvm_opt_settings(optlvl);
     let use_softfp = sess.opts.cg.soft_float;
 
-    let ffunction_sections = sess.target.target.options.function_sections;
+    // The symbol ordering file can only reorder functions which are in
+    // sections of their own.
+    let ffunction_sections = sess.target.target.options.function_sections ||
+        sess.opts.debugging_opts.symbol_ordering_file.is_some();
     let fdata_sections = ffunction_sections;
 
     let code_model_arg = sess.opts.cg.code_model.as_ref().or(
@@ -146,6 +249,20 @@ pub fn target_machine_factory(sess: &Session, optlvl: config::OptLevel, find_fea
         None => llvm::CodeModel::None,
     };
 
+    let compress_debug_sections = match sess.opts.debugging_opts.compress_debug_sections {
+        Some(ref s) => {
+            match DEBUG_COMPRESSION_ARGS.iter().find(|arg| arg.0 == s) {
+                Some(x) => x.1,
+                _ => {
+                    sess.err(&format!("{:?} is not a valid debug section compression", s));
+                    sess.abort_if_errors();
+                    bug!();
+                }
+            }
+        }
+        None => llvm::DebugCompression::None,
+    };
+
     let features = attributes::llvm_target_features(sess).collect::<Vec<_>>();
     let mut singlethread = sess.target.target.options.singlethread;
 
@@ -165,27 +282,38 @@ pub fn target_machine_factory(sess: &Session, optlvl: config::OptLevel, find_fea
     let features = CString::new(features).unwrap();
     let is_pie_binary = !find_features && is_pie_binary(sess);
     let trap_unreachable = sess.target.target.options.trap_unreachable;
-    let emit_stack_size_section = sess.opts.debugging_opts.emit_stack_sizes;
+    let emit_stack_size_section = sess.opts.debugging_opts.emit_stack_sizes ||
+        sess.opts.debugging_opts.stack_sizes_report.is_some();
+    let machine_outliner = sess.opts.debugging_opts.machine_outliner
+        .unwrap_or(sess.target.target.options.machine_outliner);
 
     let asm_comments = sess.asm_comments();
 
+    // Everything that goes into a target machine is resolved once here, so
+    // each thread wanting one only has to create it.
+    let factory = unsafe {
+        llvm::LLVMRustCreateTargetMachineFactory(
+            triple.as_ptr(), cpu.as_ptr(), features.as_ptr(),
+            code_model,
+            reloc_model,
+            opt_level,
+            use_softfp,
+            is_pie_binary,
+            ffunction_sections,
+            fdata_sections,
+            trap_unreachable,
+            singlethread,
+            asm_comments,
+            emit_stack_size_section,
+            compress_debug_sections,
+            machine_outliner,
+        )
+    }.map(TargetMachineFactory);
+
     Arc::new(move || {
-        let tm = unsafe {
-            llvm::LLVMRustCreateTargetMachine(
-                triple.as_ptr(), cpu.as_ptr(), features.as_ptr(),
-                code_model,
-                reloc_model,
-                opt_level,
-                use_softfp,
-                is_pie_binary,
-                ffunction_sections,
-                fdata_sections,
-                trap_unreachable,
-                singlethread,
-                asm_comments,
-                emit_stack_size_section,
-            )
-        };
+        let tm = factory.as_ref().and_then(|factory| unsafe {
+            llvm::LLVMRustTargetMachineFactoryCreate(&*factory.0)
+        });
 
         tm.ok_or_else(|| {
             format!("Could not create LLVM TargetMachine for triple: {}",
@@ -194,6 +322,21 @@ pub fn target_machine_factory(sess: &Session, optlvl: config::OptLevel, find_fea
     })
 }
 
+/// An owned `LLVMRustTargetMachineFactory`, which can create target machines
+/// on any thread.
+pub struct TargetMachineFactory(&'static mut llvm::TargetMachineFactory);
+
+unsafe impl Send for TargetMachineFactory {}
+unsafe impl Sync for TargetMachineFactory {}
+
+impl Drop for TargetMachineFactory {
+    fn drop(&mut self) {
+        unsafe {
+            llvm::LLVMRustFreeTargetMachineFactory(&mut *(self.0 as *mut _));
+        }
+    }
+}
+
 pub(crate) fn save_temp_bitcode(
     cgcx: &CodegenContext<LlvmCodegenBackend>,
     module: &ModuleCodegen<ModuleLlvm>,
@@ -241,6 +384,64 @@ impl<'a> Drop for DiagnosticHandlers<'a> {
     }
 }
 
+/// Streams the optimization remarks produced in an LLVM context to a YAML file
+/// in `-Z remark-dir` for as long as it's alive. Has to be created after, and
+/// dropped before, the `DiagnosticHandlers` of the same context.
+pub struct RemarkStreamer<'a> {
+    llcx: &'a llvm::Context,
+    streamer: &'a llvm::RustRemarkStreamer,
+}
+
+impl<'a> RemarkStreamer<'a> {
+    /// Starts streaming the remarks of `llcx` to `<module>.<stage>.opt.yaml`,
+    /// unless `-Z remark-dir` wasn't passed.
+    pub fn new(cgcx: &CodegenContext<LlvmCodegenBackend>,
+               handler: &Handler,
+               llcx: &'a llvm::Context,
+               module_name: &str,
+               stage: &str) -> Result<Option<Self>, FatalError> {
+        let dir = match cgcx.opts.debugging_opts.remark_dir {
+            Some(ref dir) => Path::new(dir),
+            None => return Ok(None),
+        };
+        if let Err(e) = fs::create_dir_all(dir) {
+            return Err(handler.fatal(&format!("failed to create remark directory {}: {}",
+                                              dir.display(), e)));
+        }
+
+        // No passes means all of them.
+        let passes = match cgcx.remark {
+            Passes::Some(ref passes) => {
+                passes.iter().map(|p| CString::new(&p[..]).unwrap()).collect()
+            }
+            Passes::All => Vec::new(),
+        };
+        let passes_ptrs = passes.iter().map(|p| p.as_ptr()).collect::<Vec<_>>();
+        let path = dir.join(format!("{}.{}.opt.yaml", module_name, stage));
+        let path_c = path_to_c_string(&path);
+        let threshold = cgcx.opts.debugging_opts.remark_hotness_threshold.unwrap_or(0);
+        let streamer = unsafe {
+            llvm::LLVMRustContextStartRemarkStreaming(llcx,
+                                                      path_c.as_ptr(),
+                                                      passes_ptrs.as_ptr(),
+                                                      passes_ptrs.len(),
+                                                      threshold as u64)
+        };
+        let streamer = streamer.ok_or_else(|| {
+            llvm_err(handler, &format!("failed to write remarks to {}", path.display()))
+        })?;
+        Ok(Some(RemarkStreamer { llcx, streamer }))
+    }
+}
+
+impl<'a> Drop for RemarkStreamer<'a> {
+    fn drop(&mut self) {
+        unsafe {
+            llvm::LLVMRustContextStopRemarkStreaming(self.llcx, self.streamer);
+        }
+    }
+}
+
 unsafe extern "C" fn report_inline_asm<'a, 'b>(cgcx: &'a CodegenContext<LlvmCodegenBackend>,
                                                msg: &'b str,
                                                cookie: c_uint) {
@@ -301,6 +502,208 @@ unsafe extern "C" fn diagnostic_handler(info: &DiagnosticInfo, user: *mut c_void
     }
 }
 
+/// Whether `config` can be optimized with `optimize_with_new_llvm_pass_manager`
+/// rather than the legacy pass managers. Passes are only ever added by name to
+/// legacy pass managers, as are the sanitizer and coverage instrumentation
+/// passes, so anything asking for those still goes through the legacy ones.
+///
+/// `LLVMRustOptimizeWithNewPassManager` also builds its pipeline with the
+/// `PassBuilder`'s default tuning options, which vectorize nothing, never merge
+/// functions and derive the inline threshold from the optimization level, so
+/// any other choice of those has to go through the legacy ones too.
+pub(crate) fn use_new_llvm_pass_manager(cgcx: &CodegenContext<LlvmCodegenBackend>,
+                                        config: &ModuleConfig) -> bool {
+    cgcx.opts.debugging_opts.new_llvm_pass_manager &&
+        config.passes.is_empty() &&
+        cgcx.plugin_passes.is_empty() &&
+        sanitizer_options(config).is_none() &&
+        !config.vectorize_loop &&
+        !config.vectorize_slp &&
+        !config.merge_functions &&
+        config.inline_threshold.is_none()
+}
+
+/// The instrumentation `config` asks for, if any. LeakSanitizer only needs its
+/// runtime linked in, so on its own it doesn't need any passes.
+fn sanitizer_options(config: &ModuleConfig) -> Option<llvm::SanitizerOptions> {
+    let sanitizer = match config.sanitizer {
+        Some(config::Sanitizer::Address) => llvm::Sanitizer::Address,
+        Some(config::Sanitizer::Memory) => llvm::Sanitizer::Memory,
+        Some(config::Sanitizer::Thread) => llvm::Sanitizer::Thread,
+        Some(config::Sanitizer::Leak) | None => llvm::Sanitizer::None,
+    };
+    if sanitizer == llvm::Sanitizer::None && config.sanitizer_coverage.is_none() {
+        return None;
+    }
+
+    let mut opts = llvm::SanitizerOptions {
+        sanitizer,
+        recover: config.sanitizer_recover,
+        coverage_level: 0,
+        trace_pc_guard: false,
+        inline_8bit_counters: false,
+        pc_table: false,
+        trace_cmp: false,
+        trace_div: false,
+        trace_gep: false,
+        indirect_calls: false,
+        stack_depth: false,
+    };
+    if let Some(coverage) = config.sanitizer_coverage {
+        opts.coverage_level = match coverage.level {
+            config::SanitizerCoverageLevel::Function => 1,
+            config::SanitizerCoverageLevel::BasicBlock => 2,
+            config::SanitizerCoverageLevel::Edge => 3,
+        };
+        opts.trace_pc_guard = coverage.trace_pc_guard;
+        opts.inline_8bit_counters = coverage.inline_8bit_counters;
+        opts.pc_table = coverage.pc_table;
+        opts.trace_cmp = coverage.trace_cmp;
+        opts.trace_div = coverage.trace_div;
+        opts.trace_gep = coverage.trace_gep;
+        opts.indirect_calls = coverage.indirect_calls;
+        opts.stack_depth = coverage.stack_depth;
+    }
+    Some(opts)
+}
+
+pub(crate) unsafe fn optimize_with_new_llvm_pass_manager(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    module: &ModuleCodegen<ModuleLlvm>,
+    config: &ModuleConfig,
+    opt_level: config::OptLevel,
+    opt_stage: llvm::OptStage,
+    diag_handler: &Handler,
+) -> Result<(), FatalError> {
+    use std::ptr;
+
+    let pgo_gen_path = config.pgo_gen.as_ref().map(|s| {
+        let s = if s.is_empty() { "default_%m.profraw" } else { s };
+        CString::new(s.as_bytes()).unwrap()
+    });
+
+    let pgo_use_path = if config.pgo_use.is_empty() {
+        None
+    } else {
+        Some(CString::new(config.pgo_use.as_bytes()).unwrap())
+    };
+
+    let pgo_sample_use_path = if config.pgo_sample_use.is_empty() {
+        None
+    } else {
+        Some(CString::new(config.pgo_sample_use.as_bytes()).unwrap())
+    };
+
+    let timings = if cgcx.opts.debugging_opts.llvm_pass_timings {
+        Some(PassTimings(llvm::LLVMRustCreatePassTimings()))
+    } else {
+        None
+    };
+
+    let result = llvm::LLVMRustOptimizeWithNewPassManager(
+        module.module_llvm.llmod(),
+        &*module.module_llvm.tm,
+        to_pass_builder_opt_level(opt_level),
+        opt_stage,
+        config.no_prepopulate_passes,
+        config.verify_llvm_ir,
+        config.bitcode_needed(),
+        config.no_builtins,
+        pgo_gen_path.as_ref().map_or(ptr::null(), |s| s.as_ptr()),
+        pgo_use_path.as_ref().map_or(ptr::null(), |s| s.as_ptr()),
+        pgo_sample_use_path.as_ref().map_or(ptr::null(), |s| s.as_ptr()),
+        timings.as_ref().map(|t| &*t.0),
+    );
+
+    if let Some(timings) = timings {
+        let ext = match opt_stage {
+            llvm::OptStage::ThinLTO | llvm::OptStage::FatLTO => "lto.pass-timings.tsv",
+            _ => "pass-timings.tsv",
+        };
+        let path = cgcx.output_filenames.temp_path_ext(ext, Some(&module.name[..]));
+        if let Err(e) = timings.write(&module.name, &path) {
+            diag_handler.err(&format!("failed to write LLVM pass timings to {}: {}",
+                                      path.display(), e));
+        }
+    }
+
+    result.into_result().map_err(|()| llvm_err(diag_handler, "failed to run LLVM passes"))
+}
+
+/// Per-pass timings collected by `LLVMRustOptimizeWithNewPassManager` for a
+/// single module.
+struct PassTimings(&'static mut llvm::PassTimings);
+
+impl PassTimings {
+    /// Writes the timings out as tab-separated values, one line per pass
+    /// (in the order they finished), tagged with the module's name so that
+    /// the files of all of a crate's codegen units can simply be concatenated.
+    fn write(&self, module_name: &str, path: &Path) -> io::Result<()> {
+        let mut out = io::BufWriter::new(fs::File::create(path)?);
+        writeln!(out, "module\tpass\twall_ns\tinstr_delta\tmalloc_delta")?;
+        unsafe {
+            for i in 0..llvm::LLVMRustPassTimingsCount(&*self.0) {
+                let mut info = llvm::PassTimingInfo {
+                    pass: std::ptr::null(),
+                    pass_len: 0,
+                    wall_nanos: 0,
+                    instr_count_delta: 0,
+                    malloc_delta: 0,
+                };
+                llvm::LLVMRustPassTimingsGet(&*self.0, i, &mut info);
+                let pass = slice::from_raw_parts(info.pass as *const u8, info.pass_len);
+                writeln!(out, "{}\t{}\t{}\t{}\t{}",
+                         module_name,
+                         String::from_utf8_lossy(pass),
+                         info.wall_nanos,
+                         info.instr_count_delta,
+                         info.malloc_delta)?;
+            }
+        }
+        out.flush()
+    }
+}
+
+impl Drop for PassTimings {
+    fn drop(&mut self) {
+        unsafe {
+            llvm::LLVMRustFreePassTimings(&mut *(self.0 as *mut _));
+        }
+    }
+}
+
+/// Multiversions the functions named by `-Z target-clones` which are defined
+/// in `llmod`, before any of them can be inlined anywhere.
+unsafe fn add_target_clones(cgcx: &CodegenContext<LlvmCodegenBackend>,
+                            diag_handler: &Handler,
+                            llmod: &llvm::Module)
+    -> Result<(), FatalError>
+{
+    for spec in &cgcx.opts.debugging_opts.target_clones {
+        let mut parts = spec.splitn(2, '=');
+        let (name, clones) = match (parts.next(), parts.next()) {
+            (Some(name), Some(clones)) if !name.is_empty() => (name, clones),
+            _ => {
+                return Err(diag_handler.fatal(&format!(
+                    "`-Z target-clones` expects `symbol=features|...`, found `{}`", spec)));
+            }
+        };
+        let name = SmallCStr::new(name);
+        let clones: Vec<CString> = clones.split('|')
+            .map(|features| CString::new(features).unwrap())
+            .collect();
+        let clones: Vec<*const c_char> = clones.iter().map(|s| s.as_ptr()).collect();
+        let result = llvm::LLVMRustAddTargetClones(llmod,
+                                                   name.as_ptr(),
+                                                   clones.as_ptr(),
+                                                   clones.len());
+        result.into_result().map_err(|()| {
+            llvm_err(diag_handler, &format!("failed to clone `{}`", spec))
+        })?;
+    }
+    Ok(())
+}
+
 // Unsafe due to LLVM calls.
 pub(crate) unsafe fn optimize(cgcx: &CodegenContext<LlvmCodegenBackend>,
                    diag_handler: &Handler,
@@ -313,6 +716,7 @@ pub(crate) unsafe fn optimize(cgcx: &CodegenContext<LlvmCodegenBackend>,
     let llcx = &*module.module_llvm.llcx;
     let tm = &*module.module_llvm.tm;
     let _handlers = DiagnosticHandlers::new(cgcx, diag_handler, llcx);
+    let _remarks = RemarkStreamer::new(cgcx, diag_handler, llcx, &module.name, "opt")?;
 
     let module_name = module.name.clone();
     let module_name = Some(&module_name[..]);
@@ -323,7 +727,27 @@ pub(crate) unsafe fn optimize(cgcx: &CodegenContext<LlvmCodegenBackend>,
         llvm::LLVMWriteBitcodeToFile(llmod, out.as_ptr());
     }
 
-    if config.opt_level.is_some() {
+    add_target_clones(cgcx, diag_handler, llmod)?;
+
+    if let Some(opt_level) = config.opt_level {
+        if use_new_llvm_pass_manager(cgcx, config) {
+            let opt_stage = match cgcx.lto {
+                Lto::Fat => llvm::OptStage::PreLinkFatLTO,
+                Lto::Thin | Lto::ThinLocal => llvm::OptStage::PreLinkThinLTO,
+                _ if cgcx.opts.cg.linker_plugin_lto.enabled() => llvm::OptStage::PreLinkThinLTO,
+                _ => llvm::OptStage::PreLinkNoLTO,
+            };
+            let result = time_ext(config.time_passes,
+                                  None,
+                                  &format!("llvm passes [{}]", module_name.unwrap()),
+                                  || {
+                optimize_with_new_llvm_pass_manager(cgcx, module, config, opt_level, opt_stage,
+                                                    diag_handler)
+            });
+            timeline.record("npm");
+            return result;
+        }
+
         // Create the two optimizing pass managers. These mirror what clang
         // does, and are by populated by LLVM's default PassManagerBuilder.
         // Each manager has a different set of passes, but they also share
@@ -398,6 +822,12 @@ pub(crate) unsafe fn optimize(cgcx: &CodegenContext<LlvmCodegenBackend>,
                 }
             }
 
+            // Instrument last, so that the sanitizers only see the code which
+            // is left after optimization.
+            if let Some(opts) = sanitizer_options(config) {
+                llvm::LLVMRustAddSanitizerPasses(mpm, &opts);
+            }
+
             if using_thin_buffers && !have_name_anon_globals_pass {
                 // As described above, this will probably cause an error in LLVM
                 if config.no_prepopulate_passes {
@@ -436,6 +866,28 @@ pub(crate) unsafe fn optimize(cgcx: &CodegenContext<LlvmCodegenBackend>,
     Ok(())
 }
 
+/// The `<size>\t<function>` lines of the report for the object file `obj`,
+/// read out of its `.stack_sizes` sections.
+pub(crate) fn stack_sizes(obj: &Path) -> Result<String, String> {
+    let data = fs::read(obj).map_err(|e| e.to_string())?;
+    let mut result = llvm::LLVMRustResult::Success;
+    let sizes = llvm::build_string(|s| unsafe {
+        result = llvm::LLVMRustGetStackSizes(data.as_ptr() as *const c_char, data.len(), s);
+    }).map_err(|e| e.to_string())?;
+    if result.into_result().is_err() {
+        return Err(llvm::last_error().unwrap_or_else(|| "unknown error".to_string()));
+    }
+
+    let mut out = String::new();
+    for line in sizes.lines() {
+        let mut parts = line.splitn(2, ' ');
+        if let (Some(size), Some(symbol)) = (parts.next(), parts.next()) {
+            out.push_str(&format!("{}\t{:#}\n", size, rustc_demangle::demangle(symbol)));
+        }
+    }
+    Ok(out)
+}
+
 pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
                   diag_handler: &Handler,
                   module: ModuleCodegen<ModuleLlvm>,
@@ -444,6 +896,12 @@ pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
     -> Result<CompiledModule, FatalError>
 {
     timeline.record("codegen");
+
+    // Split DWARF comes out of LLVM's object writer, so there's none for objects
+    // that are bitcode or that come out of an external assembler.
+    let emit_dwo = config.emit_obj && !config.obj_is_bitcode && !config.no_integrated_as &&
+        cgcx.opts.debugging_opts.split_dwarf &&
+        cgcx.opts.debuginfo != config::DebugInfo::None;
     {
         let llmod = module.module_llvm.llmod();
         let llcx = &*module.module_llvm.llcx;
@@ -451,6 +909,7 @@ pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
         let module_name = module.name.clone();
         let module_name = Some(&module_name[..]);
         let handlers = DiagnosticHandlers::new(cgcx, diag_handler, llcx);
+        let remarks = RemarkStreamer::new(cgcx, diag_handler, llcx, &module.name, "codegen")?;
 
         if cgcx.msvc_imps_needed {
             create_msvc_imps(cgcx, llcx, llmod);
@@ -493,6 +952,25 @@ pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
         let obj_out = cgcx.output_filenames.temp_path(OutputType::Object, module_name);
 
 
+        // When the object file is the only thing the module is codegened into,
+        // the bitcode it embeds is copied into it once it's been made, rather
+        // than going into the module as a constant first. Assembly and IR
+        // output need it in the module to show it, though.
+        let patch_embedded_bitcode = config.embed_bitcode && write_obj &&
+            !config.emit_asm && !config.emit_ir;
+        let mut embedded_bitcode = None;
+
+        // Type tests only help an LTO that can devirtualize calls with them:
+        // fat LTO against an rlib's bitcode, or the linker's when the object
+        // file is bitcode. Every other use of the module goes without, as
+        // LowerTypeTests would otherwise resolve their unknown type ids as
+        // failing (or the backends would choke on them).
+        let whole_program_devirt = cgcx.opts.debugging_opts.whole_program_devirt;
+        if whole_program_devirt &&
+           !(config.emit_bc || config.emit_bc_compressed || config.obj_is_bitcode) {
+            llvm::LLVMRustStripTypeTests(llmod);
+        }
+
         if write_bc || config.emit_bc_compressed || config.embed_bitcode {
             let thin = ThinBuffer::new(llmod);
             let data = thin.data();
@@ -505,8 +983,11 @@ pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
                 timeline.record("write-bc");
             }
 
-            if config.embed_bitcode {
-                embed_bitcode(cgcx, llcx, llmod, Some(data));
+            if patch_embedded_bitcode {
+                embed_bitcode(cgcx, llcx, llmod, EmbeddedBitcode::Placeholder(data.len()));
+                timeline.record("embed-bc");
+            } else if config.embed_bitcode {
+                embed_bitcode(cgcx, llcx, llmod, EmbeddedBitcode::Data(data));
                 timeline.record("embed-bc");
             }
 
@@ -518,8 +999,18 @@ pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
                 }
                 timeline.record("compress-bc");
             }
+
+            if patch_embedded_bitcode {
+                embedded_bitcode = Some(thin);
+            }
         } else if config.embed_bitcode_marker {
-            embed_bitcode(cgcx, llcx, llmod, None);
+            embed_bitcode(cgcx, llcx, llmod, EmbeddedBitcode::Marker);
+        }
+
+        // The bitcode above keeps its type tests for whichever LTO ends up
+        // using it, but machine code can't have any.
+        if whole_program_devirt && (write_obj || asm_to_obj || config.emit_asm) {
+            llvm::LLVMRustStripTypeTests(llmod);
         }
 
         time_ext(config.time_passes, None, &format!("codegen passes [{}]", module_name.unwrap()),
@@ -566,7 +1057,28 @@ pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
                 timeline.record("ir");
             }
 
-            if config.emit_asm || asm_to_obj {
+            let dwo_out = if emit_dwo {
+                Some(obj_out.with_extension("dwo"))
+            } else {
+                None
+            };
+            let dwo_out = dwo_out.as_ref().map(|p| &**p);
+
+            // Codegen the module once for both outputs, instead of cloning it and
+            // going through the backend twice. Functions with target features of
+            // their own can't be assembled like that, though.
+            let asm_and_obj = config.emit_asm && write_obj &&
+                cgcx.opts.debugging_opts.single_codegen_asm_obj &&
+                !llvm::LLVMRustModuleHasFunctionSubtargets(tm, llmod);
+
+            if asm_and_obj {
+                let path = cgcx.output_filenames.temp_path(OutputType::Assembly, module_name);
+                with_codegen(tm, llmod, config.no_builtins, |cpm| {
+                    write_asm_and_object_files(diag_handler, tm, cpm, llmod, &path, &obj_out,
+                                               dwo_out)
+                })?;
+                timeline.record("asm+obj");
+            } else if config.emit_asm || asm_to_obj {
                 let path = cgcx.output_filenames.temp_path(OutputType::Assembly, module_name);
 
                 // We can't use the same module for asm and binary output, because that triggers
@@ -578,16 +1090,45 @@ pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
                     llmod
                 };
                 with_codegen(tm, llmod, config.no_builtins, |cpm| {
-                    write_output_file(diag_handler, tm, cpm, llmod, &path,
+                    write_output_file(diag_handler, tm, cpm, llmod, &path, None,
                                       llvm::FileType::AssemblyFile)
                 })?;
                 timeline.record("asm");
             }
 
-            if write_obj {
+            // The partitions are linked back into the one object file the module
+            // is expected to have. Split DWARF and bitcode copied in afterwards
+            // are only written for a whole module, so those always go without.
+            let split_obj = write_obj && !asm_and_obj && config.split_codegen_parts > 1 &&
+                dwo_out.is_none() && embedded_bitcode.is_none();
+
+            if split_obj {
+                let parts = (0..config.split_codegen_parts).map(|i| {
+                    obj_out.with_extension(format!("part{}.o", i))
+                }).collect::<Vec<_>>();
+                write_object_files_split(diag_handler, tm, llmod, &parts)?;
+                timeline.record("obj-parts");
+
+                run_partial_link(cgcx, diag_handler, &parts, &obj_out);
+                timeline.record("obj");
+
+                if !cgcx.save_temps {
+                    for part in &parts {
+                        drop(fs::remove_file(part));
+                    }
+                }
+            } else if write_obj && !asm_and_obj {
                 with_codegen(tm, llmod, config.no_builtins, |cpm| {
-                    write_output_file(diag_handler, tm, cpm, llmod, &obj_out,
-                                      llvm::FileType::ObjectFile)
+                    match embedded_bitcode {
+                        Some(ref bitcode) => {
+                            write_object_file_with_bitcode(diag_handler, tm, cpm, llmod,
+                                                           &obj_out, dwo_out, bitcode.data())
+                        }
+                        None => {
+                            write_output_file(diag_handler, tm, cpm, llmod, &obj_out, dwo_out,
+                                              llvm::FileType::ObjectFile)
+                        }
+                    }
                 })?;
                 timeline.record("obj");
             } else if asm_to_obj {
@@ -603,6 +1144,43 @@ pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
             Ok(())
         })?;
 
+        // Merged into the final ordering file with those of all the other modules
+        // once they've all been codegened.
+        if (write_obj || asm_to_obj) &&
+           cgcx.opts.debugging_opts.symbol_ordering_file.is_some() {
+            let ordering = llvm::build_string(|s| llvm::LLVMRustModuleGetSymbolOrdering(llmod, s));
+            let out = cgcx.output_filenames.temp_path_ext("order", module_name);
+            match ordering {
+                Ok(ordering) => {
+                    if let Err(e) = fs::write(&out, ordering) {
+                        diag_handler.err(&format!("failed to write symbol ordering: {}", e));
+                    }
+                }
+                Err(e) => {
+                    diag_handler.err(&format!("failed to write symbol ordering: {}", e));
+                }
+            }
+            timeline.record("symbol-ordering");
+        }
+
+        // Also merged with those of all the other modules, into the report
+        // asked for with `-Z stack-sizes-report`.
+        if (write_obj || asm_to_obj) && config.stack_sizes_report {
+            let out = cgcx.output_filenames.temp_path_ext("stack-sizes", module_name);
+            match stack_sizes(&obj_out) {
+                Ok(sizes) => {
+                    if let Err(e) = fs::write(&out, sizes) {
+                        diag_handler.err(&format!("failed to write stack sizes: {}", e));
+                    }
+                }
+                Err(e) => {
+                    diag_handler.warn(&format!("couldn't read the stack sizes of {}: {}",
+                                               obj_out.display(), e));
+                }
+            }
+            timeline.record("stack-sizes");
+        }
+
         if copy_bc_to_obj {
             debug!("copying bitcode {:?} to obj {:?}", bc_out, obj_out);
             if let Err(e) = link_or_copy(&bc_out, &obj_out) {
@@ -617,14 +1195,27 @@ pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
             }
         }
 
+        drop(remarks);
         drop(handlers);
     }
     Ok(module.into_compiled_module(config.emit_obj,
                                    config.emit_bc,
                                    config.emit_bc_compressed,
+                                   emit_dwo,
                                    &cgcx.output_filenames))
 }
 
+/// What `embed_bitcode` puts in the section bitcode is embedded in.
+enum EmbeddedBitcode<'a> {
+    /// Nothing, the empty section only marks where bitcode would go.
+    Marker,
+    /// The module's bitcode itself.
+    Data(&'a [u8]),
+    /// Zeros to be overwritten with this much bitcode once the object file's
+    /// been made, see `write_object_file_with_bitcode`.
+    Placeholder(usize),
+}
+
 /// Embed the bitcode of an LLVM module in the LLVM module itself.
 ///
 /// This is done primarily for iOS where it appears to be standard to compile C
@@ -646,8 +1237,15 @@ pub(crate) unsafe fn codegen(cgcx: &CodegenContext<LlvmCodegenBackend>,
 unsafe fn embed_bitcode(cgcx: &CodegenContext<LlvmCodegenBackend>,
                         llcx: &llvm::Context,
                         llmod: &llvm::Module,
-                        bitcode: Option<&[u8]>) {
-    let llconst = common::bytes_in_context(llcx, bitcode.unwrap_or(&[]));
+                        bitcode: EmbeddedBitcode<'_>) {
+    let llconst = match bitcode {
+        EmbeddedBitcode::Marker => common::bytes_in_context(llcx, &[]),
+        EmbeddedBitcode::Data(data) => common::bytes_in_context(llcx, data),
+        EmbeddedBitcode::Placeholder(len) => {
+            let ty = llvm::LLVMRustArrayType(llvm::LLVMInt8TypeInContext(llcx), len as u64);
+            llvm::LLVMConstNull(ty)
+        }
+    };
     let llglobal = llvm::LLVMAddGlobal(
         llmod,
         common::val_ty(llconst),
@@ -709,6 +1307,12 @@ pub unsafe fn with_llvm_pmb(llmod: &llvm::Module,
         Some(CString::new(config.pgo_use.as_bytes()).unwrap())
     };
 
+    let pgo_sample_use_path = if config.pgo_sample_use.is_empty() {
+        None
+    } else {
+        Some(CString::new(config.pgo_sample_use.as_bytes()).unwrap())
+    };
+
     llvm::LLVMRustConfigurePassManagerBuilder(
         builder,
         opt_level,
@@ -718,6 +1322,7 @@ pub unsafe fn with_llvm_pmb(llmod: &llvm::Module,
         prepare_for_thin_lto,
         pgo_gen_path.as_ref().map_or(ptr::null(), |s| s.as_ptr()),
         pgo_use_path.as_ref().map_or(ptr::null(), |s| s.as_ptr()),
+        pgo_sample_use_path.as_ref().map_or(ptr::null(), |s| s.as_ptr()),
     );
 
     llvm::LLVMPassManagerBuilderSetSizeLevel(builder, opt_size as u32);
@@ -6,7 +6,7 @@ use crate::type_::Type;
 use crate::type_of::LayoutLlvmExt;
 use crate::value::Value;
 use rustc_codegen_ssa::common::{IntPredicate, TypeKind, RealPredicate};
-use rustc_codegen_ssa::MemFlags;
+use rustc_codegen_ssa::{FastMathFlags, MemFlags};
 use libc::{c_uint, c_char};
 use rustc::ty::{self, Ty, TyCtxt};
 use rustc::ty::layout::{self, Align, Size, TyLayout};
@@ -223,8 +223,7 @@ impl BuilderMethods<'a, 'tcx> for Builder<'a, 'll, 'tcx> {
                args);
 
         let args = self.check_call("invoke", llfn, args);
-        let bundle = funclet.map(|funclet| funclet.bundle());
-        let bundle = bundle.as_ref().map(|b| &*b.raw);
+        let bundle = funclet.map(|funclet| self.cx.operand_bundles.funclet(funclet.cleanuppad()));
 
         unsafe {
             llvm::LLVMRustBuildInvoke(self.llbuilder,
@@ -390,6 +389,12 @@ impl BuilderMethods<'a, 'tcx> for Builder<'a, 'll, 'tcx> {
         }
     }
 
+    fn set_fast_math_flags(&mut self, instr: &'ll Value, flags: FastMathFlags) {
+        unsafe {
+            llvm::LLVMRustSetFastMathFlags(instr, llvm::FastMathFlags::from_generic(flags));
+        }
+    }
+
     fn shl(&mut self, lhs: &'ll Value, rhs: &'ll Value) -> &'ll Value {
         self.count_insn("shl");
         unsafe {
@@ -933,24 +938,15 @@ impl BuilderMethods<'a, 'tcx> for Builder<'a, 'll, 'tcx> {
 
         debug!("Asm Output Type: {:?}", output);
         let fty = self.type_func(&argtys[..], output);
-        unsafe {
-            // Ask LLVM to verify that the constraints are well-formed.
-            let constraints_ok = llvm::LLVMRustInlineAsmVerify(fty, cons.as_ptr());
-            debug!("Constraint verification result: {:?}", constraints_ok);
-            if constraints_ok {
-                let v = llvm::LLVMRustInlineAsm(
-                    fty,
-                    asm.as_ptr(),
-                    cons.as_ptr(),
-                    volatile,
-                    alignstack,
-                    AsmDialect::from_generic(dia),
-                );
-                Some(self.call(v, inputs, None))
-            } else {
-                // LLVM has detected an issue with our constraints, bail out
-                None
-            }
+        // LLVM verifies that the constraints are well-formed the first time
+        // each distinct asm is seen here.
+        let v = self.cx.inline_asms.get(fty, asm, cons, volatile, alignstack,
+                                        AsmDialect::from_generic(dia));
+        debug!("Constraint verification result: {:?}", v.is_some());
+        match v {
+            Some(v) => Some(self.call(v, inputs, None)),
+            // LLVM has detected an issue with our constraints, bail out
+            None => None,
         }
     }
 
@@ -1077,9 +1073,6 @@ impl BuilderMethods<'a, 'tcx> for Builder<'a, 'll, 'tcx> {
     fn vector_reduce_fadd_fast(&mut self, acc: &'ll Value, src: &'ll Value) -> &'ll Value {
         self.count_insn("vector.reduce.fadd_fast");
         unsafe {
-            // FIXME: add a non-fast math version once
-            // https://bugs.llvm.org/show_bug.cgi?id=36732
-            // is fixed.
             let instr = llvm::LLVMRustBuildVectorReduceFAdd(self.llbuilder, acc, src);
             llvm::LLVMRustSetHasUnsafeAlgebra(instr);
             instr
@@ -1088,14 +1081,27 @@ impl BuilderMethods<'a, 'tcx> for Builder<'a, 'll, 'tcx> {
     fn vector_reduce_fmul_fast(&mut self, acc: &'ll Value, src: &'ll Value) -> &'ll Value {
         self.count_insn("vector.reduce.fmul_fast");
         unsafe {
-            // FIXME: add a non-fast math version once
-            // https://bugs.llvm.org/show_bug.cgi?id=36732
-            // is fixed.
             let instr = llvm::LLVMRustBuildVectorReduceFMul(self.llbuilder, acc, src);
             llvm::LLVMRustSetHasUnsafeAlgebra(instr);
             instr
         }
     }
+    fn vector_reduce_fadd(&mut self, acc: &'ll Value, src: &'ll Value) -> &'ll Value {
+        self.count_insn("vector.reduce.fadd");
+        unsafe { llvm::LLVMRustBuildVectorReduceFAddOrdered(self.llbuilder, acc, src) }
+    }
+    fn vector_reduce_fmul(&mut self, acc: &'ll Value, src: &'ll Value) -> &'ll Value {
+        self.count_insn("vector.reduce.fmul");
+        unsafe { llvm::LLVMRustBuildVectorReduceFMulOrdered(self.llbuilder, acc, src) }
+    }
+    fn vector_reduce_fadd_unordered(&mut self, src: &'ll Value) -> &'ll Value {
+        self.count_insn("vector.reduce.fadd_unordered");
+        unsafe { llvm::LLVMRustBuildVectorReduceFAddUnordered(self.llbuilder, src) }
+    }
+    fn vector_reduce_fmul_unordered(&mut self, src: &'ll Value) -> &'ll Value {
+        self.count_insn("vector.reduce.fmul_unordered");
+        unsafe { llvm::LLVMRustBuildVectorReduceFMulUnordered(self.llbuilder, src) }
+    }
     fn vector_reduce_add(&mut self, src: &'ll Value) -> &'ll Value {
         self.count_insn("vector.reduce.add");
         unsafe { llvm::LLVMRustBuildVectorReduceAdd(self.llbuilder, src) }
@@ -1428,8 +1434,7 @@ impl BuilderMethods<'a, 'tcx> for Builder<'a, 'll, 'tcx> {
                args);
 
         let args = self.check_call("call", llfn, args);
-        let bundle = funclet.map(|funclet| funclet.bundle());
-        let bundle = bundle.as_ref().map(|b| &*b.raw);
+        let bundle = funclet.map(|funclet| self.cx.operand_bundles.funclet(funclet.cleanuppad()));
 
         unsafe {
             llvm::LLVMRustBuildCall(
@@ -1477,6 +1482,73 @@ impl StaticBuilderMethods<'tcx> for Builder<'a, 'll, 'tcx> {
 }
 
 impl Builder<'a, 'll, 'tcx> {
+    /// A `call` which also adds `attrs` to the call and sets its calling
+    /// convention, in a single call into LLVM.
+    crate fn call_with_attributes(
+        &mut self,
+        llfn: &'ll Value,
+        args: &[&'ll Value],
+        funclet: Option<&Funclet<'ll>>,
+        attrs: &[llvm::AttributeDesc],
+        cconv: llvm::CallConv,
+    ) -> &'ll Value {
+        self.count_insn("call");
+
+        debug!("Call {:?} with args ({:?})",
+               llfn,
+               args);
+
+        let args = self.check_call("call", llfn, args);
+        unsafe {
+            llvm::LLVMRustBuildCallWithAttributes(self.llbuilder,
+                                                  llfn,
+                                                  args.as_ptr(),
+                                                  args.len() as c_uint,
+                                                  self.cx.operand_bundles.raw(),
+                                                  funclet.map(|funclet| funclet.cleanuppad()),
+                                                  self.cx.attr_lists.raw(),
+                                                  attrs.as_ptr(),
+                                                  attrs.len(),
+                                                  cconv as c_uint,
+                                                  noname())
+        }
+    }
+
+    /// Like `call_with_attributes`, but for an `invoke`.
+    crate fn invoke_with_attributes(
+        &mut self,
+        llfn: &'ll Value,
+        args: &[&'ll Value],
+        then: &'ll BasicBlock,
+        catch: &'ll BasicBlock,
+        funclet: Option<&Funclet<'ll>>,
+        attrs: &[llvm::AttributeDesc],
+        cconv: llvm::CallConv,
+    ) -> &'ll Value {
+        self.count_insn("invoke");
+
+        debug!("Invoke {:?} with args ({:?})",
+               llfn,
+               args);
+
+        let args = self.check_call("invoke", llfn, args);
+        unsafe {
+            llvm::LLVMRustBuildInvokeWithAttributes(self.llbuilder,
+                                                    llfn,
+                                                    args.as_ptr(),
+                                                    args.len() as c_uint,
+                                                    then,
+                                                    catch,
+                                                    self.cx.operand_bundles.raw(),
+                                                    funclet.map(|funclet| funclet.cleanuppad()),
+                                                    self.cx.attr_lists.raw(),
+                                                    attrs.as_ptr(),
+                                                    attrs.len(),
+                                                    cconv as c_uint,
+                                                    noname())
+        }
+    }
+
     fn call_lifetime_intrinsic(&mut self, intrinsic: &str, ptr: &'ll Value, size: Size) {
         if self.cx.sess().opts.optimize == config::OptLevel::No {
             return;
@@ -2,7 +2,7 @@
 
 //! Code that is useful in various codegen modules.
 
-use crate::llvm::{self, True, False, Bool, BasicBlock, OperandBundleDef};
+use crate::llvm::{self, True, False, Bool, BasicBlock};
 use crate::abi;
 use crate::consts;
 use crate::type_::Type;
@@ -61,27 +61,20 @@ pub use crate::context::CodegenCx;
 /// exceptions (`cleanuppad` + `cleanupret` instructions) this contains data.
 /// When inside of a landing pad, each function call in LLVM IR needs to be
 /// annotated with which landing pad it's a part of. This is accomplished via
-/// the `OperandBundleDef` value created for MSVC landing pads.
+/// the `OperandBundleDef` kept for each MSVC landing pad in
+/// `CodegenCx::operand_bundles`.
 pub struct Funclet<'ll> {
     cleanuppad: &'ll Value,
-    operand: OperandBundleDef<'ll>,
 }
 
 impl Funclet<'ll> {
     pub fn new(cleanuppad: &'ll Value) -> Self {
-        Funclet {
-            cleanuppad,
-            operand: OperandBundleDef::new("funclet", &[cleanuppad]),
-        }
+        Funclet { cleanuppad }
     }
 
     pub fn cleanuppad(&self) -> &'ll Value {
         self.cleanuppad
     }
-
-    pub fn bundle(&self) -> &OperandBundleDef<'ll> {
-        &self.operand
-    }
 }
 
 impl BackendTypes for CodegenCx<'ll, 'tcx> {
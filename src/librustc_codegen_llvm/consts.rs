@@ -7,7 +7,7 @@ use crate::base;
 use crate::type_::Type;
 use crate::type_of::LayoutLlvmExt;
 use crate::value::Value;
-use libc::c_uint;
+use libc::{c_char, c_uint};
 use rustc::hir::def_id::DefId;
 use rustc::mir::interpret::{ConstValue, Allocation, read_target_uint,
     Pointer, ErrorHandled, GlobalId};
@@ -342,6 +342,15 @@ impl StaticMethods for CodegenCx<'ll, 'tcx> {
         gv
     }
 
+    fn add_type_metadata(&self, global: &'ll Value, type_id: &str) {
+        unsafe {
+            llvm::LLVMRustGlobalAddTypeMetadata(global,
+                                                0,
+                                                type_id.as_ptr() as *const c_char,
+                                                type_id.len());
+        }
+    }
+
     fn codegen_static(
         &self,
         def_id: DefId,
@@ -19,7 +19,7 @@ use rustc::session::config::{self, DebugInfo};
 use rustc::session::Session;
 use rustc::ty::layout::{LayoutError, LayoutOf, Size, TyLayout, VariantIdx};
 use rustc::ty::{self, Ty, TyCtxt};
-use rustc::util::nodemap::FxHashMap;
+use rustc::util::nodemap::{FxHashMap, FxHashSet};
 use rustc_target::spec::{HasTargetSpec, Target};
 use rustc_codegen_ssa::callee::resolve_and_get_fn;
 use rustc_codegen_ssa::base::wants_msvc_seh;
@@ -91,6 +91,13 @@ pub struct CodegenCx<'ll, 'tcx: 'll> {
 
     intrinsics: RefCell<FxHashMap<&'static str, &'ll Value>>,
 
+    /// Attribute lists of the functions and calls built so far
+    pub attr_lists: llvm::AttributeListCache<'ll>,
+    /// Operand bundles of the calls within MSVC landing pads
+    pub operand_bundles: llvm::OperandBundlePool<'ll>,
+    /// Inline assembly values, and whether their constraints verified
+    pub inline_asms: llvm::InlineAsmCache<'ll>,
+
     /// A counter that is used for generating local symbol names
     local_gen_sym_counter: Cell<usize>,
 }
@@ -143,6 +150,14 @@ pub fn is_pie_binary(sess: &Session) -> bool {
     !is_any_library(sess) && get_reloc_model(sess) == llvm::RelocMode::PIC
 }
 
+thread_local! {
+    // The `(llvm_target, data_layout)` pairs already checked against LLVM's own
+    // data layout in `create_module`. Getting that takes creating a whole
+    // target machine, which only needs to be done once rather than for every
+    // module.
+    static CHECKED_DATA_LAYOUTS: RefCell<FxHashSet<(String, String)>> = Default::default();
+}
+
 pub unsafe fn create_module(
     tcx: TyCtxt<'_, '_, '_>,
     llcx: &'ll llvm::Context,
@@ -153,7 +168,12 @@ pub unsafe fn create_module(
     let llmod = llvm::LLVMModuleCreateWithNameInContext(mod_name.as_ptr(), llcx);
 
     // Ensure the data-layout values hardcoded remain the defaults.
-    if sess.target.target.options.is_builtin {
+    let data_layout_key = (sess.target.target.llvm_target.clone(),
+                           sess.target.target.data_layout.clone());
+    let data_layout_checked = CHECKED_DATA_LAYOUTS.with(|checked| {
+        checked.borrow().contains(&data_layout_key)
+    });
+    if sess.target.target.options.is_builtin && !data_layout_checked {
         let tm = crate::back::write::create_target_machine(tcx, false);
         llvm::LLVMRustSetDataLayoutFromTargetMachine(llmod, tm);
         llvm::LLVMRustDisposeTargetMachine(tm);
@@ -187,6 +207,8 @@ pub unsafe fn create_module(
                  sess.target.target.data_layout,
                  data_layout);
         }
+
+        CHECKED_DATA_LAYOUTS.with(|checked| checked.borrow_mut().insert(data_layout_key));
     }
 
     let data_layout = SmallCStr::new(&sess.target.target.data_layout);
@@ -206,6 +228,14 @@ pub unsafe fn create_module(
         llvm::LLVMRustAddModuleFlag(llmod, avoid_plt, 1);
     }
 
+    // Have the bitcode written for the linker's LTO split the vtables and
+    // type tests off into a regular LTO module, which is what the linker runs
+    // whole program devirtualization on. LLVM 8 doesn't do that by default.
+    if sess.opts.debugging_opts.whole_program_devirt && sess.opts.cg.linker_plugin_lto.enabled() {
+        let split = "EnableSplitLTOUnit\0".as_ptr() as *const _;
+        llvm::LLVMRustAddModuleFlag(llmod, split, 1);
+    }
+
     llmod
 }
 
@@ -302,6 +332,9 @@ impl<'ll, 'tcx> CodegenCx<'ll, 'tcx> {
             eh_unwind_resume: Cell::new(None),
             rust_try_fn: Cell::new(None),
             intrinsics: Default::default(),
+            attr_lists: llvm::AttributeListCache::new(llcx),
+            operand_bundles: llvm::OperandBundlePool::new(),
+            inline_asms: llvm::InlineAsmCache::new(),
             local_gen_sym_counter: Cell::new(0),
         }
     }
@@ -806,6 +839,7 @@ impl CodegenCx<'b, 'tcx> {
         ifn!("llvm.x86.seh.recoverfp", fn(i8p, i8p) -> i8p);
 
         ifn!("llvm.assume", fn(i1) -> void);
+        ifn!("llvm.type.test", fn(i8p, self.type_metadata()) -> i1);
         ifn!("llvm.prefetch", fn(i8p, t_i32, t_i32, t_i32) -> void);
 
         // variadic intrinsics
@@ -845,7 +845,16 @@ pub fn compile_unit_metadata(tcx: TyCtxt<'_, '_, '_>,
     let work_dir = SmallCStr::new(&tcx.sess.working_dir.0.to_string_lossy());
     let producer = CString::new(producer).unwrap();
     let flags = "\0";
-    let split_name = "\0";
+    // With `-Z split-dwarf` this is where the skeleton unit tells debuggers
+    // (and `dwp`) to look for the rest of its DWARF.
+    let split_name = if tcx.sess.opts.debugging_opts.split_dwarf {
+        tcx.output_filenames(LOCAL_CRATE)
+            .temp_path(config::OutputType::Object, Some(codegen_unit_name))
+            .with_extension("dwo")
+    } else {
+        PathBuf::new()
+    };
+    let split_name = path_to_c_string(&split_name);
     let kind = DebugEmissionKind::from_generic(tcx.sess.opts.debuginfo);
 
     unsafe {
@@ -860,7 +869,7 @@ pub fn compile_unit_metadata(tcx: TyCtxt<'_, '_, '_>,
             tcx.sess.opts.optimize != config::OptLevel::No,
             flags.as_ptr() as *const _,
             0,
-            split_name.as_ptr() as *const _,
+            split_name.as_ptr(),
             kind);
 
         if tcx.sess.opts.debugging_opts.profile {
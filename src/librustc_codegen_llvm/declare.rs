@@ -52,6 +52,7 @@ fn declare_raw_fn(
 
     if let Some(ref sanitizer) = cx.tcx.sess.opts.debugging_opts.sanitizer {
         match *sanitizer {
+            _ if skips_sanitizer(cx, name) => {}
             Sanitizer::Address => {
                 llvm::Attribute::SanitizeAddress.apply_llfn(Function, llfn);
             },
@@ -70,6 +71,25 @@ fn declare_raw_fn(
     llfn
 }
 
+/// Whether `-Z sanitizer-skip` opts the function with symbol `name` out of
+/// sanitizer instrumentation. Entries are either symbol names or paths, where
+/// a path also covers everything nested inside of it.
+fn skips_sanitizer(cx: &CodegenCx<'ll, '_>, name: &str) -> bool {
+    let skip = &cx.tcx.sess.opts.debugging_opts.sanitizer_skip;
+    if skip.is_empty() {
+        return false;
+    }
+    if skip.iter().any(|entry| entry == name) {
+        return true;
+    }
+
+    let path = format!("{:#}", rustc_demangle::demangle(name));
+    skip.iter().any(|entry| {
+        path.starts_with(&entry[..]) &&
+            (path.len() == entry.len() || path[entry.len()..].starts_with("::"))
+    })
+}
+
 impl DeclareMethods<'tcx> for CodegenCx<'ll, 'tcx> {
 
     fn declare_global(
@@ -107,7 +127,7 @@ impl DeclareMethods<'tcx> for CodegenCx<'ll, 'tcx> {
             llvm::Attribute::NoReturn.apply_llfn(Function, llfn);
         }
 
-        fty.apply_attrs_llfn(llfn);
+        fty.apply_attrs_llfn(self, llfn);
 
         llfn
     }
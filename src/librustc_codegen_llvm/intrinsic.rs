@@ -10,7 +10,7 @@ use crate::type_of::LayoutLlvmExt;
 use crate::builder::Builder;
 use crate::value::Value;
 use crate::va_arg::emit_va_arg;
-use rustc_codegen_ssa::MemFlags;
+use rustc_codegen_ssa::{FastMathFlags, MemFlags};
 use rustc_codegen_ssa::mir::place::PlaceRef;
 use rustc_codegen_ssa::mir::operand::{OperandRef, OperandValue};
 use rustc_codegen_ssa::glue;
@@ -27,6 +27,8 @@ use rustc_codegen_ssa::traits::*;
 use rustc::session::Session;
 use syntax_pos::Span;
 
+use libc::{c_char, c_uint};
+
 use std::cmp::Ordering;
 use std::{iter, i128, u128};
 
@@ -538,6 +540,25 @@ impl IntrinsicCallMethods<'tcx> for Builder<'a, 'll, 'tcx> {
                 }
 
             },
+            "fadd_contract" | "fsub_contract" | "fmul_contract" => {
+                let sty = &arg_tys[0].sty;
+                if float_type_width(sty).is_none() {
+                    span_invalid_monomorphization_error(
+                        tcx.sess, span,
+                        &format!("invalid monomorphization of `{}` intrinsic: \
+                                  expected basic float type, found `{}`", name, sty));
+                    return;
+                }
+                let (lhs, rhs) = (args[0].immediate(), args[1].immediate());
+                let instr = match name {
+                    "fadd_contract" => self.fadd(lhs, rhs),
+                    "fsub_contract" => self.fsub(lhs, rhs),
+                    "fmul_contract" => self.fmul(lhs, rhs),
+                    _ => bug!(),
+                };
+                self.set_fast_math_flags(instr, FastMathFlags::CONTRACT);
+                instr
+            },
 
             "discriminant_value" => {
                 args[0].deref(self.cx()).codegen_get_discr(self, ret_ty)
@@ -722,6 +743,17 @@ impl IntrinsicCallMethods<'tcx> for Builder<'a, 'll, 'tcx> {
         let expect = self.get_intrinsic(&"llvm.expect.i1");
         self.call(expect, &[cond, self.const_bool(expected)], None)
     }
+
+    fn type_test(&mut self, pointer: &'ll Value, type_id: &str) -> &'ll Value {
+        let type_test = self.get_intrinsic("llvm.type.test");
+        let pointer = self.pointercast(pointer, self.type_i8p());
+        let type_id = unsafe {
+            llvm::LLVMMDStringInContext(self.cx.llcx,
+                                        type_id.as_ptr() as *const c_char,
+                                        type_id.len() as c_uint)
+        };
+        self.call(type_test, &[pointer, type_id], None)
+    }
 }
 
 fn copy_intrinsic(
@@ -1596,7 +1628,8 @@ fn generic_simd_intrinsic(
     }
 
     macro_rules! arith_red {
-        ($name:tt : $integer_reduce:ident, $float_reduce:ident, $ordered:expr) => {
+        ($name:tt : $integer_reduce:ident, $float_reduce:ident,
+         $float_reduce_unordered:ident, $ordered:expr) => {
             if name == $name {
                 require!(ret_ty == in_elem,
                          "expected return type `{}` (element of input `{}`), found `{}`",
@@ -1617,32 +1650,17 @@ fn generic_simd_intrinsic(
                         }
                     },
                     ty::Float(f) => {
-                        // ordered arithmetic reductions take an accumulator
-                        let acc = if $ordered {
+                        // ordered arithmetic reductions take an accumulator,
+                        // any one of which, constant or not, is folded over
+                        // the elements one at a time
+                        if $ordered {
                             let acc = args[1].immediate();
-                            // FIXME: https://bugs.llvm.org/show_bug.cgi?id=36734
-                            // * if the accumulator of the fadd isn't 0, incorrect
-                            //   code is generated
-                            // * if the accumulator of the fmul isn't 1, incorrect
-                            //   code is generated
-                            match bx.const_get_real(acc) {
-                                None => return_error!("accumulator of {} is not a constant", $name),
-                                Some((v, loses_info)) => {
-                                    if $name.contains("mul") && v != 1.0_f64 {
-                                        return_error!("accumulator of {} is not 1.0", $name);
-                                    } else if $name.contains("add") && v != 0.0_f64 {
-                                        return_error!("accumulator of {} is not 0.0", $name);
-                                    } else if loses_info {
-                                        return_error!("accumulator of {} loses information", $name);
-                                    }
-                                }
-                            }
-                            acc
+                            Ok(bx.$float_reduce(acc, args[0].immediate()))
                         } else {
-                            // unordered arithmetic reductions do not:
+                            // unordered arithmetic reductions do not, and can
+                            // be done as a tree instead of one element at a time
                             match f.bit_width() {
-                                32 => bx.const_undef(bx.type_f32()),
-                                64 => bx.const_undef(bx.type_f64()),
+                                32 | 64 => Ok(bx.$float_reduce_unordered(args[0].immediate())),
                                 v => {
                                     return_error!(r#"
 unsupported {} from `{}` with element `{}` of size `{}` to `{}`"#,
@@ -1650,8 +1668,7 @@ unsupported {} from `{}` with element `{}` of size `{}` to `{}`"#,
                                     )
                                 }
                             }
-                        };
-                        Ok(bx.$float_reduce(acc, args[0].immediate()))
+                        }
                     }
                     _ => {
                         return_error!(
@@ -1664,10 +1681,14 @@ unsupported {} from `{}` with element `{}` of size `{}` to `{}`"#,
         }
     }
 
-    arith_red!("simd_reduce_add_ordered": vector_reduce_add, vector_reduce_fadd_fast, true);
-    arith_red!("simd_reduce_mul_ordered": vector_reduce_mul, vector_reduce_fmul_fast, true);
-    arith_red!("simd_reduce_add_unordered": vector_reduce_add, vector_reduce_fadd_fast, false);
-    arith_red!("simd_reduce_mul_unordered": vector_reduce_mul, vector_reduce_fmul_fast, false);
+    arith_red!("simd_reduce_add_ordered": vector_reduce_add, vector_reduce_fadd,
+               vector_reduce_fadd_unordered, true);
+    arith_red!("simd_reduce_mul_ordered": vector_reduce_mul, vector_reduce_fmul,
+               vector_reduce_fmul_unordered, true);
+    arith_red!("simd_reduce_add_unordered": vector_reduce_add, vector_reduce_fadd,
+               vector_reduce_fadd_unordered, false);
+    arith_red!("simd_reduce_mul_unordered": vector_reduce_mul, vector_reduce_fmul,
+               vector_reduce_fmul_unordered, false);
 
     macro_rules! minmax_red {
         ($name:tt: $int_red:ident, $float_red:ident) => {
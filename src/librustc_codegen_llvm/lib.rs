@@ -30,6 +30,7 @@ use syntax_pos::symbol::Symbol;
 extern crate flate2;
 #[macro_use] extern crate bitflags;
 extern crate libc;
+extern crate num_cpus;
 #[macro_use] extern crate rustc;
 extern crate rustc_mir;
 extern crate rustc_allocator;
@@ -58,13 +59,14 @@ use syntax_pos::symbol::InternedString;
 use rustc::mir::mono::Stats;
 pub use llvm_util::target_features;
 use std::any::Any;
+use std::path::Path;
 use std::sync::{mpsc, Arc};
 
 use rustc::dep_graph::DepGraph;
 use rustc::middle::allocator::AllocatorKind;
 use rustc::middle::cstore::{EncodedMetadata, MetadataLoader};
 use rustc::session::{Session, CompileIncomplete};
-use rustc::session::config::{OutputFilenames, OutputType, PrintRequest, OptLevel};
+use rustc::session::config::{Lto, OutputFilenames, OutputType, PrintRequest, OptLevel};
 use rustc::ty::{self, TyCtxt};
 use rustc::util::time_graph;
 use rustc::util::profiling::ProfileCategory;
@@ -204,9 +206,10 @@ impl WriteBackendMethods for LlvmCodegenBackend {
         back::write::codegen(cgcx, diag_handler, module, config, timeline)
     }
     fn prepare_thin(
+        cgcx: &CodegenContext<Self>,
         module: ModuleCodegen<Self::Module>
     ) -> (String, Self::ThinBuffer) {
-        back::lto::prepare_thin(module)
+        back::lto::prepare_thin(cgcx, module)
     }
     fn serialize_module(
         module: ModuleCodegen<Self::Module>
@@ -221,6 +224,9 @@ impl WriteBackendMethods for LlvmCodegenBackend {
     ) {
         back::lto::run_pass_manager(cgcx, module, config, thin)
     }
+    fn stack_sizes(object: &Path) -> Result<String, String> {
+        back::write::stack_sizes(object)
+    }
 }
 
 unsafe impl Send for LlvmCodegenBackend {} // Llvm is on a per-thread basis
@@ -318,6 +324,7 @@ impl CodegenBackend for LlvmCodegenBackend {
                 <rustc_codegen_ssa::back::write::OngoingCodegen<LlvmCodegenBackend>>()
                 .expect("Expected LlvmCodegenBackend's OngoingCodegen, found Box<Any>")
                 .join(sess);
+        llvm_util::save_profile_events(sess, outputs);
         if sess.opts.debugging_opts.incremental_info {
             rustc_codegen_ssa::back::write::dump_incremental_data(&codegen_results);
         }
@@ -366,9 +373,15 @@ unsafe impl Send for ModuleLlvm { }
 unsafe impl Sync for ModuleLlvm { }
 
 impl ModuleLlvm {
+    // With `-Z share-debuginfo-types` any module may end up as the base module
+    // of fat LTO, so its types have to be uniqued from the very start for the
+    // ones linked in later to be merged with them.
     fn new(tcx: TyCtxt<'_, '_, '_>, mod_name: &str) -> Self {
         unsafe {
-            let llcx = llvm::LLVMRustContextCreate(tcx.sess.fewer_names());
+            let llcx = llvm::LLVMRustContextAcquire(tcx.sess.fewer_names());
+            if tcx.sess.opts.debugging_opts.share_debuginfo_types && tcx.sess.lto() == Lto::Fat {
+                llvm::LLVMRustContextEnableDebugTypeODRUniquing(llcx);
+            }
             let llmod_raw = context::create_module(tcx, llcx, mod_name) as *const _;
 
             ModuleLlvm {
@@ -386,7 +399,10 @@ impl ModuleLlvm {
         handler: &Handler,
     ) -> Result<Self, FatalError> {
         unsafe {
-            let llcx = llvm::LLVMRustContextCreate(cgcx.fewer_names);
+            let llcx = llvm::LLVMRustContextAcquire(cgcx.fewer_names);
+            if cgcx.opts.debugging_opts.share_debuginfo_types && cgcx.lto == Lto::Fat {
+                llvm::LLVMRustContextEnableDebugTypeODRUniquing(llcx);
+            }
             let llmod_raw = buffer.parse(name, llcx, handler)?;
             let tm = match (cgcx.tm_factory.0)() {
                 Ok(m) => m,
@@ -414,7 +430,8 @@ impl ModuleLlvm {
 impl Drop for ModuleLlvm {
     fn drop(&mut self) {
         unsafe {
-            llvm::LLVMContextDispose(&mut *(self.llcx as *mut _));
+            llvm::LLVMRustContextRelease(&mut *(self.llcx as *mut _),
+                                         &mut *(self.llmod_raw as *mut _));
             llvm::LLVMRustDisposeTargetMachine(&mut *(self.tm as *mut _));
         }
     }
@@ -19,6 +19,18 @@ pub struct Child<'a> {
     pub raw: &'a mut super::ArchiveChild<'a>,
 }
 
+/// Iterates over the names and data of an archive's members, fetching them
+/// from LLVM many at a time instead of allocating a `Child` for each one.
+pub struct Members<'a> {
+    raw: &'a mut super::ArchiveIterator<'a>,
+    batch: Vec<super::ArchiveChildInfo>,
+    pos: usize,
+    done: bool,
+    error: Option<String>,
+}
+
+const MEMBERS_BATCH_SIZE: usize = 64;
+
 impl ArchiveRO {
     /// Opens a static archive for read-only purposes. This is more optimized
     /// than the `open` method because it uses LLVM's internal `Archive` class
@@ -36,6 +48,30 @@ impl ArchiveRO {
         };
     }
 
+    /// Returns the data of the first member called `name`, if any. The first
+    /// lookup indexes the whole archive, after which lookups don't need to
+    /// walk it anymore.
+    pub fn find(&self, name: &str) -> Result<Option<&[u8]>, String> {
+        unsafe {
+            // A null result is only an error if this call set one, so one left
+            // over from an earlier call mustn't be taken for it.
+            drop(super::last_error());
+            let mut data_len = 0;
+            let data_ptr = super::LLVMRustArchiveFindMember(self.raw,
+                                                            name.as_ptr() as *const _,
+                                                            name.len(),
+                                                            &mut data_len);
+            if data_ptr.is_null() {
+                match super::last_error() {
+                    Some(err) => Err(err),
+                    None => Ok(None),
+                }
+            } else {
+                Ok(Some(slice::from_raw_parts(data_ptr as *const u8, data_len as usize)))
+            }
+        }
+    }
+
     pub fn iter(&self) -> Iter<'_> {
         unsafe {
             Iter {
@@ -43,6 +79,18 @@ impl ArchiveRO {
             }
         }
     }
+
+    pub fn members(&self) -> Members<'_> {
+        unsafe {
+            Members {
+                raw: super::LLVMRustArchiveIteratorNew(self.raw),
+                batch: Vec::with_capacity(MEMBERS_BATCH_SIZE),
+                pos: 0,
+                done: false,
+                error: None,
+            }
+        }
+    }
 }
 
 impl Drop for ArchiveRO {
@@ -74,6 +122,57 @@ impl<'a> Drop for Iter<'a> {
     }
 }
 
+impl<'a> Iterator for Members<'a> {
+    type Item = Result<(Option<&'a str>, &'a [u8]), String>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.pos == self.batch.len() {
+            if self.done {
+                return self.error.take().map(Err);
+            }
+            unsafe {
+                self.batch.clear();
+                self.pos = 0;
+                // A short batch is only an error if this call set one, rather
+                // than the end of the archive.
+                drop(super::last_error());
+                let n = super::LLVMRustArchiveIteratorNextBatch(self.raw,
+                                                                self.batch.as_mut_ptr(),
+                                                                self.batch.capacity());
+                self.batch.set_len(n);
+                if n < self.batch.capacity() {
+                    self.done = true;
+                    self.error = super::last_error();
+                }
+            }
+            if self.batch.is_empty() {
+                return self.error.take().map(Err);
+            }
+        }
+
+        let info = &self.batch[self.pos];
+        self.pos += 1;
+        unsafe {
+            let name = if info.name.is_null() {
+                None
+            } else {
+                let name = slice::from_raw_parts(info.name as *const u8, info.name_len);
+                str::from_utf8(name).ok().map(|s| s.trim())
+            };
+            let data = slice::from_raw_parts(info.data as *const u8, info.data_len);
+            Some(Ok((name, data)))
+        }
+    }
+}
+
+impl<'a> Drop for Members<'a> {
+    fn drop(&mut self) {
+        unsafe {
+            super::LLVMRustArchiveIteratorFree(&mut *(self.raw as *mut _));
+        }
+    }
+}
+
 impl<'a> Child<'a> {
     pub fn name(&self) -> Option<&'a str> {
         unsafe {
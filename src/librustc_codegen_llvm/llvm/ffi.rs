@@ -117,6 +117,26 @@ pub enum Attribute {
     ReturnsTwice    = 25,
 }
 
+/// LLVMRustAttributeKind
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub enum AttributeKind {
+    Enum,
+    Alignment,
+    Dereferenceable,
+    DereferenceableOrNull,
+}
+
+/// LLVMRustAttributeDesc
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub struct AttributeDesc {
+    pub index: c_uint,
+    pub kind: AttributeKind,
+    pub attr: Attribute,
+    pub value: u64,
+}
+
 /// LLVMIntPredicate
 #[derive(Copy, Clone)]
 #[repr(C)]
@@ -334,6 +354,37 @@ impl SynchronizationScope {
     }
 }
 
+// These values **must** match with LLVMRustFastMathFlags!!
+bitflags! {
+    #[repr(C)]
+    #[derive(Default)]
+    pub struct FastMathFlags: ::libc::uint32_t {
+        const AllowReassoc    = (1 << 0);
+        const NoNaNs          = (1 << 1);
+        const NoInfs          = (1 << 2);
+        const NoSignedZeros   = (1 << 3);
+        const AllowReciprocal = (1 << 4);
+        const AllowContract   = (1 << 5);
+        const ApproxFunc      = (1 << 6);
+    }
+}
+
+impl FastMathFlags {
+    pub fn from_generic(flags: rustc_codegen_ssa::FastMathFlags) -> Self {
+        use rustc_codegen_ssa::FastMathFlags as Generic;
+
+        let mut result = FastMathFlags::empty();
+        result.set(FastMathFlags::AllowReassoc, flags.contains(Generic::REASSOC));
+        result.set(FastMathFlags::NoNaNs, flags.contains(Generic::NNAN));
+        result.set(FastMathFlags::NoInfs, flags.contains(Generic::NINF));
+        result.set(FastMathFlags::NoSignedZeros, flags.contains(Generic::NSZ));
+        result.set(FastMathFlags::AllowReciprocal, flags.contains(Generic::ARCP));
+        result.set(FastMathFlags::AllowContract, flags.contains(Generic::CONTRACT));
+        result.set(FastMathFlags::ApproxFunc, flags.contains(Generic::AFN));
+        result
+    }
+}
+
 /// LLVMRustFileType
 #[derive(Copy, Clone)]
 #[repr(C)]
@@ -383,6 +434,29 @@ impl AsmDialect {
     }
 }
 
+/// LLVMRustPassBuilderOptLevel
+#[derive(Copy, Clone, PartialEq)]
+#[repr(C)]
+pub enum PassBuilderOptLevel {
+    O0,
+    O1,
+    O2,
+    O3,
+    Os,
+    Oz,
+}
+
+/// LLVMRustOptStage
+#[derive(Copy, Clone, PartialEq)]
+#[repr(C)]
+pub enum OptStage {
+    PreLinkNoLTO,
+    PreLinkThinLTO,
+    PreLinkFatLTO,
+    ThinLTO,
+    FatLTO,
+}
+
 /// LLVMRustCodeGenOptLevel
 #[derive(Copy, Clone, PartialEq)]
 #[repr(C)]
@@ -423,6 +497,15 @@ pub enum CodeModel {
     None,
 }
 
+/// LLVMRustDebugCompression
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub enum DebugCompression {
+    None,
+    Zlib,
+    ZlibGnu,
+}
+
 /// LLVMRustDiagnosticKind
 #[derive(Copy, Clone)]
 #[repr(C)]
@@ -466,15 +549,85 @@ pub enum PassKind {
     Module,
 }
 
+/// LLVMRustSanitizer
+#[derive(Copy, Clone, PartialEq, Debug)]
+#[repr(C)]
+pub enum Sanitizer {
+    None,
+    Address,
+    Memory,
+    Thread,
+}
+
+/// LLVMRustSanitizerOptions
+#[derive(Copy, Clone, Debug)]
+#[repr(C)]
+pub struct SanitizerOptions {
+    pub sanitizer: Sanitizer,
+    pub recover: bool,
+    pub coverage_level: c_int,
+    pub trace_pc_guard: bool,
+    pub inline_8bit_counters: bool,
+    pub pc_table: bool,
+    pub trace_cmp: bool,
+    pub trace_div: bool,
+    pub trace_gep: bool,
+    pub indirect_calls: bool,
+    pub stack_depth: bool,
+}
+
 /// LLVMRustThinLTOData
 extern { pub type ThinLTOData; }
 
 /// LLVMRustThinLTOBuffer
 extern { pub type ThinLTOBuffer; }
 
-// LLVMRustModuleNameCallback
-pub type ThinLTOModuleNameCallback =
-    unsafe extern "C" fn(*mut c_void, *const c_char, *const c_char);
+/// LLVMRustTargetMachineFactory
+extern { pub type TargetMachineFactory; }
+
+/// LLVMRustPassTimings
+extern { pub type PassTimings; }
+
+/// LLVMRustPassTimingInfo
+#[repr(C)]
+pub struct PassTimingInfo {
+    pub pass: *const c_char,
+    pub pass_len: size_t,
+    pub wall_nanos: u64,
+    pub instr_count_delta: i64,
+    pub malloc_delta: i64,
+}
+
+/// LLVMRustSymbolSet
+extern { pub type SymbolSet; }
+
+/// LLVMRustOutputBuffer
+extern { pub type OutputBuffer; }
+
+/// RustRemarkStreamer
+extern { pub type RustRemarkStreamer; }
+
+// LLVMRustThinLTOStepCallback
+pub type ThinLTOStepCallback = unsafe extern "C" fn(*mut c_void, *const c_char);
+
+// LLVMRustProfileEventCallback
+pub type ProfileEventCallback = unsafe extern "C" fn(*mut c_void, *const c_char, u64, u64, u64);
+
+/// LLVMRustArchiveChildInfo
+#[repr(C)]
+pub struct ArchiveChildInfo {
+    pub name: *const c_char,
+    pub name_len: size_t,
+    pub data: *const c_char,
+    pub data_len: size_t,
+}
+
+/// LLVMRustLinkerInput
+#[repr(C)]
+pub struct LinkerInput {
+    pub data: *const c_char,
+    pub len: usize,
+}
 
 /// LLVMRustThinLTOModule
 #[repr(C)]
@@ -484,6 +637,15 @@ pub struct ThinLTOModule {
     pub len: usize,
 }
 
+/// LLVMRustThinLTOImportBudget
+#[repr(C)]
+pub struct ThinLTOImportBudget {
+    pub instr_limit: c_int,
+    pub hot_multiplier: f32,
+    pub cold_multiplier: f32,
+    pub max_imports_per_module: c_int,
+}
+
 /// LLVMThreadLocalMode
 #[derive(Copy, Clone)]
 #[repr(C)]
@@ -518,6 +680,7 @@ extern { pub type PassManagerBuilder; }
 extern { pub type ObjectFile; }
 #[repr(C)]
 pub struct SectionIterator<'a>(InvariantOpaque<'a>);
+extern { pub type SectionIndex; }
 extern { pub type Pass; }
 extern { pub type TargetMachine; }
 extern { pub type Archive; }
@@ -534,6 +697,12 @@ pub struct RustArchiveMember<'a>(InvariantOpaque<'a>);
 pub struct OperandBundleDef<'a>(InvariantOpaque<'a>);
 #[repr(C)]
 pub struct Linker<'a>(InvariantOpaque<'a>);
+#[repr(C)]
+pub struct AttributeListCache<'a>(InvariantOpaque<'a>);
+#[repr(C)]
+pub struct OperandBundlePool<'a>(InvariantOpaque<'a>);
+#[repr(C)]
+pub struct InlineAsmCache<'a>(InvariantOpaque<'a>);
 
 pub type DiagnosticHandler = unsafe extern "C" fn(&DiagnosticInfo, *mut c_void);
 pub type InlineAsmDiagHandler = unsafe extern "C" fn(&SMDiagnostic, *const c_void, c_uint);
@@ -633,8 +802,10 @@ extern "C" {
     pub fn LLVMRustInstallFatalErrorHandler();
 
     // Create and destroy contexts.
-    pub fn LLVMRustContextCreate(shouldDiscardNames: bool) -> &'static mut Context;
-    pub fn LLVMContextDispose(C: &'static mut Context);
+    pub fn LLVMRustSetContextPoolingEnabled(Enabled: bool);
+    pub fn LLVMRustContextAcquire(shouldDiscardNames: bool) -> &'static mut Context;
+    pub fn LLVMRustContextRelease(C: &'static mut Context, M: &'static mut Module);
+    pub fn LLVMRustContextEnableDebugTypeODRUniquing(C: &Context);
     pub fn LLVMGetMDKindIDInContext(C: &Context, Name: *const c_char, SLen: c_uint) -> c_uint;
 
     // Create modules.
@@ -759,6 +930,10 @@ extern "C" {
     pub fn LLVMIsDeclaration(Global: &Value) -> Bool;
     pub fn LLVMRustGetLinkage(Global: &Value) -> Linkage;
     pub fn LLVMRustSetLinkage(Global: &Value, RustLinkage: Linkage);
+    pub fn LLVMRustGlobalAddTypeMetadata(Global: &Value,
+                                         Offset: u64,
+                                         TypeId: *const c_char,
+                                         TypeIdLen: size_t);
     pub fn LLVMSetSection(Global: &Value, Section: *const c_char);
     pub fn LLVMRustGetVisibility(Global: &Value) -> Visibility;
     pub fn LLVMRustSetVisibility(Global: &Value, Viz: Visibility);
@@ -795,6 +970,9 @@ extern "C" {
     pub fn LLVMRustAddDereferenceableAttr(Fn: &Value, index: c_uint, bytes: u64);
     pub fn LLVMRustAddDereferenceableOrNullAttr(Fn: &Value, index: c_uint, bytes: u64);
     pub fn LLVMRustAddFunctionAttribute(Fn: &Value, index: c_uint, attr: Attribute);
+    pub fn LLVMRustAddFunctionAttributes(Fn: &Value,
+                                         Attrs: *const AttributeDesc,
+                                         NumAttrs: size_t);
     pub fn LLVMRustAddFunctionAttrStringValue(Fn: &Value,
                                               index: c_uint,
                                               Name: *const c_char,
@@ -819,6 +997,20 @@ extern "C" {
     // Operations on call sites
     pub fn LLVMSetInstructionCallConv(Instr: &Value, CC: c_uint);
     pub fn LLVMRustAddCallSiteAttribute(Instr: &Value, index: c_uint, attr: Attribute);
+    pub fn LLVMRustAddCallSiteAttributes(Instr: &Value,
+                                         Attrs: *const AttributeDesc,
+                                         NumAttrs: size_t);
+
+    pub fn LLVMRustCreateAttributeListCache(C: &'a Context) -> &'a mut AttributeListCache<'a>;
+    pub fn LLVMRustFreeAttributeListCache(Cache: &'a mut AttributeListCache<'a>);
+    pub fn LLVMRustAddFunctionAttributesCached(Cache: &AttributeListCache<'a>,
+                                               Fn: &'a Value,
+                                               Attrs: *const AttributeDesc,
+                                               NumAttrs: size_t);
+    pub fn LLVMRustAddCallSiteAttributesCached(Cache: &AttributeListCache<'a>,
+                                               Instr: &'a Value,
+                                               Attrs: *const AttributeDesc,
+                                               NumAttrs: size_t);
     pub fn LLVMRustAddAlignmentCallSiteAttr(Instr: &Value, index: c_uint, bytes: u32);
     pub fn LLVMRustAddDereferenceableCallSiteAttr(Instr: &Value, index: c_uint, bytes: u64);
     pub fn LLVMRustAddDereferenceableOrNullCallSiteAttr(Instr: &Value,
@@ -1021,6 +1213,7 @@ extern "C" {
     pub fn LLVMBuildFNeg(B: &Builder<'a>, V: &'a Value, Name: *const c_char) -> &'a Value;
     pub fn LLVMBuildNot(B: &Builder<'a>, V: &'a Value, Name: *const c_char) -> &'a Value;
     pub fn LLVMRustSetHasUnsafeAlgebra(Instr: &Value);
+    pub fn LLVMRustSetFastMathFlags(Instr: &Value, Flags: FastMathFlags);
 
     // Memory
     pub fn LLVMBuildAlloca(B: &Builder<'a>, Ty: &'a Type, Name: *const c_char) -> &'a Value;
@@ -1210,6 +1403,20 @@ extern "C" {
                                          Acc: &'a Value,
                                          Src: &'a Value)
                                          -> &'a Value;
+    pub fn LLVMRustBuildVectorReduceFAddOrdered(B: &Builder<'a>,
+                                                Acc: &'a Value,
+                                                Src: &'a Value)
+                                                -> &'a Value;
+    pub fn LLVMRustBuildVectorReduceFMulOrdered(B: &Builder<'a>,
+                                                Acc: &'a Value,
+                                                Src: &'a Value)
+                                                -> &'a Value;
+    pub fn LLVMRustBuildVectorReduceFAddUnordered(B: &Builder<'a>,
+                                                  Src: &'a Value)
+                                                  -> &'a Value;
+    pub fn LLVMRustBuildVectorReduceFMulUnordered(B: &Builder<'a>,
+                                                  Src: &'a Value)
+                                                  -> &'a Value;
     pub fn LLVMRustBuildVectorReduceAdd(B: &Builder<'a>,
                                         Src: &'a Value)
                                         -> &'a Value;
@@ -1289,6 +1496,11 @@ extern "C" {
 
     /// Writes a module to the specified path. Returns 0 on success.
     pub fn LLVMWriteBitcodeToFile(M: &Module, Path: *const c_char) -> c_int;
+    pub fn LLVMWriteBitcodeToFD(M: &Module,
+                                FD: c_int,
+                                ShouldClose: Bool,
+                                Unbuffered: Bool)
+                                -> c_int;
 
     /// Creates a pass manager.
     pub fn LLVMCreatePassManager() -> &'a mut PassManager<'a>;
@@ -1355,10 +1567,13 @@ extern "C" {
     pub fn LLVMStartMultithreaded() -> Bool;
 
     /// Returns a string describing the last error caused by an LLVMRust* call.
-    pub fn LLVMRustGetLastError() -> *const c_char;
+    pub fn LLVMRustTakeLastError(Message: *mut *const c_char, Len: *mut size_t) -> bool;
 
     /// Print the pass timings since static dtors aren't picking them up.
     pub fn LLVMRustPrintPassTimings();
+    pub fn LLVMRustSetProfileEventsEnabled(Enabled: bool);
+    pub fn LLVMRustProfileEventTimestamp() -> u64;
+    pub fn LLVMRustDrainProfileEvents(Callback: ProfileEventCallback, Payload: *mut c_void) -> u64;
 
     pub fn LLVMStructCreateNamed(C: &Context, Name: *const c_char) -> &Type;
 
@@ -1378,6 +1593,18 @@ extern "C" {
     pub fn LLVMRustInlineAsmVerify(Ty: &Type,
                                    Constraints: *const c_char)
                                    -> bool;
+    pub fn LLVMRustCreateInlineAsmCache() -> &'a mut InlineAsmCache<'a>;
+    pub fn LLVMRustFreeInlineAsmCache(Cache: &'a mut InlineAsmCache<'a>);
+    /// Like `LLVMRustInlineAsm`, but returns null if the constraints don't
+    /// verify, and only builds each distinct value once.
+    pub fn LLVMRustInlineAsmCached(Cache: &InlineAsmCache<'a>,
+                                   Ty: &'a Type,
+                                   AsmString: *const c_char,
+                                   Constraints: *const c_char,
+                                   SideEffects: Bool,
+                                   AlignStack: Bool,
+                                   Dialect: AsmDialect)
+                                   -> Option<&'a Value>;
 
     pub fn LLVMRustDebugMetadataVersion() -> u32;
     pub fn LLVMRustVersionMajor() -> u32;
@@ -1636,13 +1863,21 @@ extern "C" {
     pub fn LLVMRustPassKind(Pass: &Pass) -> PassKind;
     pub fn LLVMRustFindAndCreatePass(Pass: *const c_char) -> Option<&'static mut Pass>;
     pub fn LLVMRustAddPass(PM: &PassManager<'_>, Pass: &'static mut Pass);
+    pub fn LLVMRustAddSanitizerPasses(PM: &PassManager<'_>, Opts: &SanitizerOptions);
 
     pub fn LLVMRustHasFeature(T: &TargetMachine, s: *const c_char) -> bool;
+    pub fn LLVMRustHasFeatures(T: &TargetMachine,
+                               Features: *const *const c_char,
+                               NumFeatures: size_t,
+                               Enabled: *mut bool);
 
     pub fn LLVMRustPrintTargetCPUs(T: &TargetMachine);
     pub fn LLVMRustPrintTargetFeatures(T: &TargetMachine);
 
     pub fn LLVMRustGetHostCPUName(len: *mut usize) -> *const c_char;
+    pub fn LLVMRustGetHostCPUInfo(NameLen: *mut usize,
+                                  Features: *mut *const c_char,
+                                  FeaturesLen: *mut usize) -> *const c_char;
     pub fn LLVMRustCreateTargetMachine(Triple: *const c_char,
                                        CPU: *const c_char,
                                        Features: *const c_char,
@@ -1656,9 +1891,31 @@ extern "C" {
                                        TrapUnreachable: bool,
                                        Singlethread: bool,
                                        AsmComments: bool,
-                                       EmitStackSizeSection: bool)
+                                       EmitStackSizeSection: bool,
+                                       CompressDebugSections: DebugCompression,
+                                       EnableMachineOutliner: bool)
                                        -> Option<&'static mut TargetMachine>;
     pub fn LLVMRustDisposeTargetMachine(T: &'static mut TargetMachine);
+    pub fn LLVMRustCreateTargetMachineFactory(Triple: *const c_char,
+                                              CPU: *const c_char,
+                                              Features: *const c_char,
+                                              Model: CodeModel,
+                                              Reloc: RelocMode,
+                                              Level: CodeGenOptLevel,
+                                              UseSoftFP: bool,
+                                              PositionIndependentExecutable: bool,
+                                              FunctionSections: bool,
+                                              DataSections: bool,
+                                              TrapUnreachable: bool,
+                                              Singlethread: bool,
+                                              AsmComments: bool,
+                                              EmitStackSizeSection: bool,
+                                              CompressDebugSections: DebugCompression,
+                                              EnableMachineOutliner: bool)
+                                              -> Option<&'static mut TargetMachineFactory>;
+    pub fn LLVMRustFreeTargetMachineFactory(F: &'static mut TargetMachineFactory);
+    pub fn LLVMRustTargetMachineFactoryCreate(F: &TargetMachineFactory)
+                                              -> Option<&'static mut TargetMachine>;
     pub fn LLVMRustAddAnalysisPasses(T: &'a TargetMachine, PM: &PassManager<'a>, M: &'a Module);
     pub fn LLVMRustAddBuilderLibraryInfo(PMB: &'a PassManagerBuilder,
                                          M: &'a Module,
@@ -1670,17 +1927,70 @@ extern "C" {
                                                LoopVectorize: bool,
                                                PrepareForThinLTO: bool,
                                                PGOGenPath: *const c_char,
-                                               PGOUsePath: *const c_char);
+                                               PGOUsePath: *const c_char,
+                                               PGOSampleUsePath: *const c_char);
     pub fn LLVMRustAddLibraryInfo(PM: &PassManager<'a>,
                                   M: &'a Module,
                                   DisableSimplifyLibCalls: bool);
     pub fn LLVMRustRunFunctionPassManager(PM: &PassManager<'a>, M: &'a Module);
+    pub fn LLVMRustOptimizeWithNewPassManager(M: &'a Module,
+                                              TM: &'a TargetMachine,
+                                              OptLevel: PassBuilderOptLevel,
+                                              OptStage: OptStage,
+                                              NoPrepopulatePasses: bool,
+                                              VerifyIR: bool,
+                                              UseThinLTOBuffers: bool,
+                                              DisableSimplifyLibCalls: bool,
+                                              PGOGenPath: *const c_char,
+                                              PGOUsePath: *const c_char,
+                                              PGOSampleUsePath: *const c_char,
+                                              Timings: Option<&PassTimings>)
+                                              -> LLVMRustResult;
+    pub fn LLVMRustCreatePassTimings() -> &'static mut PassTimings;
+    pub fn LLVMRustFreePassTimings(T: &'static mut PassTimings);
+    pub fn LLVMRustPassTimingsCount(T: &PassTimings) -> size_t;
+    pub fn LLVMRustPassTimingsGet(T: &PassTimings, Index: size_t, Out: &mut PassTimingInfo);
     pub fn LLVMRustWriteOutputFile(T: &'a TargetMachine,
                                    PM: &PassManager<'a>,
                                    M: &'a Module,
                                    Output: *const c_char,
+                                   DwoOutput: *const c_char,
                                    FileType: FileType)
                                    -> LLVMRustResult;
+    pub fn LLVMRustGetStackSizes(Data: *const c_char,
+                                 Len: size_t,
+                                 Out: &RustString)
+                                 -> LLVMRustResult;
+    pub fn LLVMRustWriteObjectFileWithBitcode(T: &'a TargetMachine,
+                                              PM: &PassManager<'a>,
+                                              M: &'a Module,
+                                              Output: *const c_char,
+                                              DwoOutput: *const c_char,
+                                              Bitcode: *const c_char,
+                                              BitcodeLen: size_t)
+                                              -> LLVMRustResult;
+    pub fn LLVMRustWriteOutputBuffer(T: &'a TargetMachine,
+                                     PM: &PassManager<'a>,
+                                     M: &'a Module,
+                                     FileType: FileType)
+                                     -> &'static mut OutputBuffer;
+    pub fn LLVMRustOutputBufferFree(p: &'static mut OutputBuffer);
+    pub fn LLVMRustOutputBufferPtr(p: &OutputBuffer) -> *const u8;
+    pub fn LLVMRustOutputBufferLen(p: &OutputBuffer) -> usize;
+    pub fn LLVMRustWriteAsmAndObjectFiles(T: &'a TargetMachine,
+                                          PM: &PassManager<'a>,
+                                          M: &'a Module,
+                                          AsmPath: *const c_char,
+                                          ObjPath: *const c_char,
+                                          DwoPath: *const c_char)
+                                          -> LLVMRustResult;
+    pub fn LLVMRustModuleHasFunctionSubtargets(T: &TargetMachine, M: &Module) -> bool;
+    pub fn LLVMRustWriteOutputFilesSplit(T: &'a TargetMachine,
+                                         M: &'a Module,
+                                         Outputs: *const *const c_char,
+                                         NumParts: size_t,
+                                         FileType: FileType)
+                                         -> LLVMRustResult;
     pub fn LLVMRustPrintModule(PM: &PassManager<'a>,
                                M: &'a Module,
                                Output: *const c_char,
@@ -1693,7 +2003,19 @@ extern "C" {
     pub fn LLVMRustSetNormalizedTarget(M: &Module, triple: *const c_char);
     pub fn LLVMRustAddAlwaysInlinePass(P: &PassManagerBuilder, AddLifetimes: bool);
     pub fn LLVMRustRunRestrictionPass(M: &Module, syms: *const *const c_char, len: size_t);
+    pub fn LLVMRustCreateSymbolSet(syms: *const *const c_char,
+                                   len: size_t)
+                                   -> &'static mut SymbolSet;
+    pub fn LLVMRustFreeSymbolSet(set: &'static mut SymbolSet);
+    pub fn LLVMRustRunRestrictionPassWithSet(M: &Module, set: &SymbolSet);
     pub fn LLVMRustMarkAllFunctionsNounwind(M: &Module);
+    pub fn LLVMRustMergeConstants(M: &Module) -> c_uint;
+    pub fn LLVMRustStripTypeTests(M: &Module);
+    pub fn LLVMRustAddTargetClones(M: &Module,
+                                   Name: *const c_char,
+                                   Features: *const *const c_char,
+                                   NumClones: size_t)
+                                   -> LLVMRustResult;
 
     pub fn LLVMRustOpenArchive(path: *const c_char) -> Option<&'static mut Archive>;
     pub fn LLVMRustArchiveIteratorNew(AR: &'a Archive) -> &'a mut ArchiveIterator<'a>;
@@ -1703,10 +2025,26 @@ extern "C" {
     pub fn LLVMRustArchiveChildName(ACR: &ArchiveChild<'_>, size: &mut size_t) -> *const c_char;
     pub fn LLVMRustArchiveChildData(ACR: &ArchiveChild<'_>, size: &mut size_t) -> *const c_char;
     pub fn LLVMRustArchiveChildFree(ACR: &'a mut ArchiveChild<'a>);
+    pub fn LLVMRustArchiveIteratorNextBatch(AIR: &ArchiveIterator<'a>,
+                                            Out: *mut ArchiveChildInfo,
+                                            Capacity: size_t)
+                                            -> size_t;
     pub fn LLVMRustArchiveIteratorFree(AIR: &'a mut ArchiveIterator<'a>);
+    pub fn LLVMRustArchiveFindMember(AR: &Archive,
+                                     Name: *const c_char,
+                                     NameLen: size_t,
+                                     size: &mut size_t)
+                                     -> *const c_char;
     pub fn LLVMRustDestroyArchive(AR: &'static mut Archive);
 
     pub fn LLVMRustGetSectionName(SI: &SectionIterator<'_>, data: &mut *const c_char) -> size_t;
+    pub fn LLVMRustSectionIndexNew(OF: &ObjectFile) -> Option<&'static mut SectionIndex>;
+    pub fn LLVMRustSectionIndexFree(SI: &'static mut SectionIndex);
+    pub fn LLVMRustSectionIndexFind(SI: &SectionIndex,
+                                    Name: *const c_char,
+                                    NameLen: size_t,
+                                    size: &mut size_t)
+                                    -> *const c_char;
 
     #[allow(improper_ctypes)]
     pub fn LLVMRustWriteTwineToString(T: &Twine, s: &RustString);
@@ -1733,6 +2071,15 @@ extern "C" {
     pub fn LLVMRustWriteDiagnosticInfoToString(DI: &DiagnosticInfo, s: &RustString);
     pub fn LLVMRustGetDiagInfoKind(DI: &DiagnosticInfo) -> DiagnosticKind;
 
+    pub fn LLVMRustContextStartRemarkStreaming(C: &'a Context,
+                                               Path: *const c_char,
+                                               PassNames: *const *const c_char,
+                                               NumPassNames: size_t,
+                                               HotnessThreshold: u64)
+                                               -> Option<&'a RustRemarkStreamer>;
+    pub fn LLVMRustContextStopRemarkStreaming(C: &'a Context,
+                                              Streamer: &'a RustRemarkStreamer);
+
     pub fn LLVMRustSetInlineAsmDiagnosticHandler(C: &Context,
                                                  H: InlineAsmDiagHandler,
                                                  CX: *mut c_void);
@@ -1744,7 +2091,9 @@ extern "C" {
                                 NumMembers: size_t,
                                 Members: *const &RustArchiveMember<'_>,
                                 WriteSymbtab: bool,
-                                Kind: ArchiveKind)
+                                Kind: ArchiveKind,
+                                NumThreads: c_uint,
+                                Thin: bool)
                                 -> LLVMRustResult;
     pub fn LLVMRustArchiveMemberNew(Filename: *const c_char,
                                     Name: *const c_char,
@@ -1753,25 +2102,66 @@ extern "C" {
     pub fn LLVMRustArchiveMemberFree(Member: &'a mut RustArchiveMember<'a>);
 
     pub fn LLVMRustSetDataLayoutFromTargetMachine(M: &'a Module, TM: &'a TargetMachine);
+    pub fn LLVMRustSetDataLayoutFromTargetMachineFactory(M: &'a Module,
+                                                         F: &'a TargetMachineFactory);
 
     pub fn LLVMRustBuildOperandBundleDef(Name: *const c_char,
                                          Inputs: *const &'a Value,
                                          NumInputs: c_uint)
                                          -> &'a mut OperandBundleDef<'a>;
     pub fn LLVMRustFreeOperandBundleDef(Bundle: &'a mut OperandBundleDef<'a>);
+    pub fn LLVMRustCreateOperandBundlePool() -> &'a mut OperandBundlePool<'a>;
+    pub fn LLVMRustFreeOperandBundlePool(Pool: &'a mut OperandBundlePool<'a>);
+    pub fn LLVMRustOperandBundlePoolGetFunclet(Pool: &OperandBundlePool<'a>,
+                                               Pad: &'a Value)
+                                               -> &'a OperandBundleDef<'a>;
+    pub fn LLVMRustBuildCallWithAttributes(B: &Builder<'a>,
+                                           Fn: &'a Value,
+                                           Args: *const &'a Value,
+                                           NumArgs: c_uint,
+                                           Pool: &OperandBundlePool<'a>,
+                                           FuncletPad: Option<&'a Value>,
+                                           Cache: &AttributeListCache<'a>,
+                                           Attrs: *const AttributeDesc,
+                                           NumAttrs: size_t,
+                                           CC: c_uint,
+                                           Name: *const c_char)
+                                           -> &'a Value;
+    pub fn LLVMRustBuildInvokeWithAttributes(B: &Builder<'a>,
+                                             Fn: &'a Value,
+                                             Args: *const &'a Value,
+                                             NumArgs: c_uint,
+                                             Then: &'a BasicBlock,
+                                             Catch: &'a BasicBlock,
+                                             Pool: &OperandBundlePool<'a>,
+                                             FuncletPad: Option<&'a Value>,
+                                             Cache: &AttributeListCache<'a>,
+                                             Attrs: *const AttributeDesc,
+                                             NumAttrs: size_t,
+                                             CC: c_uint,
+                                             Name: *const c_char)
+                                             -> &'a Value;
 
     pub fn LLVMRustPositionBuilderAtStart(B: &Builder<'a>, BB: &'a BasicBlock);
 
     pub fn LLVMRustSetComdat(M: &'a Module, V: &'a Value, Name: *const c_char);
     pub fn LLVMRustUnsetComdat(V: &Value);
     pub fn LLVMRustSetModulePIELevel(M: &Module);
+    pub fn LLVMRustModuleGetSymbolOrdering(M: &Module, s: &RustString);
     pub fn LLVMRustModuleBufferCreate(M: &Module) -> &'static mut ModuleBuffer;
+    pub fn LLVMRustModuleBufferCreateWithSizeHint(M: &Module,
+                                                  SizeHint: usize)
+                                                  -> &'static mut ModuleBuffer;
     pub fn LLVMRustModuleBufferPtr(p: &ModuleBuffer) -> *const u8;
     pub fn LLVMRustModuleBufferLen(p: &ModuleBuffer) -> usize;
     pub fn LLVMRustModuleBufferFree(p: &'static mut ModuleBuffer);
     pub fn LLVMRustModuleCost(M: &Module) -> u64;
 
     pub fn LLVMRustThinLTOBufferCreate(M: &Module) -> &'static mut ThinLTOBuffer;
+    pub fn LLVMRustThinLTOBufferCreateWithSizeHint(M: &Module,
+                                                   SizeHint: size_t)
+                                                   -> &'static mut ThinLTOBuffer;
+    pub fn LLVMRustThinLTOBufferWriteToFD(M: &Module, FD: c_int) -> LLVMRustResult;
     pub fn LLVMRustThinLTOBufferFree(M: &'static mut ThinLTOBuffer);
     pub fn LLVMRustThinLTOBufferPtr(M: &ThinLTOBuffer) -> *const c_char;
     pub fn LLVMRustThinLTOBufferLen(M: &ThinLTOBuffer) -> size_t;
@@ -1780,6 +2170,15 @@ extern "C" {
         NumModules: c_uint,
         PreservedSymbols: *const *const c_char,
         PreservedSymbolsLen: c_uint,
+        ImportBudget: Option<&ThinLTOImportBudget>,
+    ) -> Option<&'static mut ThinLTOData>;
+    pub fn LLVMRustCreateThinLTODataFromFiles(
+        Identifiers: *const *const c_char,
+        Paths: *const *const c_char,
+        NumModules: c_uint,
+        PreservedSymbols: *const *const c_char,
+        PreservedSymbolsLen: c_uint,
+        ImportBudget: Option<&ThinLTOImportBudget>,
     ) -> Option<&'static mut ThinLTOData>;
     pub fn LLVMRustPrepareThinLTORename(
         Data: &ThinLTOData,
@@ -1797,26 +2196,73 @@ extern "C" {
         Data: &ThinLTOData,
         Module: &Module,
     ) -> bool;
-    pub fn LLVMRustGetThinLTOModuleImports(
-        Data: *const ThinLTOData,
-        ModuleNameCallback: ThinLTOModuleNameCallback,
+    pub fn LLVMRustPrepareThinLTOModule(
+        Data: &ThinLTOData,
+        Module: &Module,
+        StepCallback: Option<ThinLTOStepCallback>,
         CallbackPayload: *mut c_void,
-    );
+    ) -> bool;
+    pub fn LLVMRustThinLTOModuleCost(Data: &ThinLTOData, ModuleId: *const c_char) -> u64;
+    pub fn LLVMRustThinLTOSerializeImports(Data: &ThinLTOData, Out: &RustString);
+    pub fn LLVMRustThinLTODiffImports(
+        Data: &ThinLTOData,
+        Prev: *const u8,
+        PrevLen: size_t,
+        Changed: &RustString,
+    ) -> bool;
+    pub fn LLVMRustThinLTOSerializeDeadDefinitions(Data: &ThinLTOData, Out: &RustString);
     pub fn LLVMRustFreeThinLTOData(Data: &'static mut ThinLTOData);
+    pub fn LLVMRustComputeThinLTOCacheKey(
+        KeyOut: &RustString,
+        ModuleId: *const c_char,
+        Data: &ThinLTOData,
+    ) -> bool;
+    pub fn LLVMRustThinLTOCacheLookup(
+        CacheDir: *const c_char,
+        Key: *const c_char,
+    ) -> Option<&'static mut MemoryBuffer>;
+    pub fn LLVMRustThinLTOCacheStore(
+        CacheDir: *const c_char,
+        Key: *const c_char,
+        Data: *const c_char,
+        Len: size_t,
+    ) -> LLVMRustResult;
+    pub fn LLVMRustCheckBitcodeForLTO(
+        Data: *const c_char,
+        Len: size_t,
+        Identifier: *const c_char,
+        DataLayoutOut: &RustString,
+    ) -> LLVMRustResult;
     pub fn LLVMRustParseBitcodeForLTO(
         Context: &Context,
         Data: *const u8,
         len: usize,
         Identifier: *const c_char,
     ) -> Option<&Module>;
+    pub fn LLVMRustParseThinLTOModule(
+        ThinData: &ThinLTOData,
+        Context: &'a Context,
+        Data: *const u8,
+        len: usize,
+        Identifier: *const c_char,
+    ) -> Option<&'a Module>;
     pub fn LLVMRustThinLTOGetDICompileUnit(M: &Module,
                                            CU1: &mut *mut c_void,
                                            CU2: &mut *mut c_void);
     pub fn LLVMRustThinLTOPatchDICompileUnit(M: &Module, CU: *mut c_void);
 
     pub fn LLVMRustLinkerNew(M: &'a Module) -> &'a mut Linker<'a>;
+    pub fn LLVMRustLinkerNewOnlyNeeded(M: &'a Module,
+                                       Symbols: *const *const c_char,
+                                       NumSymbols: size_t)
+                                       -> &'a mut Linker<'a>;
     pub fn LLVMRustLinkerAdd(linker: &Linker<'_>,
                              bytecode: *const c_char,
                              bytecode_len: usize) -> bool;
+    pub fn LLVMRustLinkerAddBatch(linker: &Linker<'_>,
+                                  inputs: *const LinkerInput,
+                                  num_inputs: usize,
+                                  failed_index: &mut usize) -> bool;
+    pub fn LLVMRustLinkerFinish(linker: &Linker<'_>) -> bool;
     pub fn LLVMRustLinkerFree(linker: &'a mut Linker<'a>);
 }
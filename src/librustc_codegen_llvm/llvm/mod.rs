@@ -13,9 +13,11 @@ pub use self::Linkage::*;
 
 use std::str::FromStr;
 use std::string::FromUtf8Error;
+use std::ptr;
 use std::slice;
 use std::ffi::CStr;
 use std::cell::RefCell;
+use std::marker::PhantomData;
 use libc::{c_uint, c_char, size_t};
 use rustc_data_structures::small_c_str::SmallCStr;
 
@@ -63,6 +65,18 @@ impl AttributePlace {
     }
 }
 
+impl AttributeDesc {
+    pub fn new(idx: AttributePlace, attr: Attribute) -> Self {
+        AttributeDesc { index: idx.as_uint(), kind: AttributeKind::Enum, attr, value: 0 }
+    }
+
+    /// An integer attribute, `kind` mustn't be `AttributeKind::Enum`.
+    pub fn with_value(idx: AttributePlace, kind: AttributeKind, value: u64) -> Self {
+        // `attr` is ignored for everything but `AttributeKind::Enum`.
+        AttributeDesc { index: idx.as_uint(), kind, attr: Attribute::AlwaysInline, value }
+    }
+}
+
 #[derive(Copy, Clone, PartialEq)]
 #[repr(C)]
 pub enum CodeGenOptSize {
@@ -211,6 +225,56 @@ pub fn mk_section_iter(llof: &'a ffi::ObjectFile) -> SectionIter<'a> {
     unsafe { SectionIter { llsi: LLVMGetSections(llof) } }
 }
 
+// Memory-managed interface to an object file's sections by name.
+
+pub struct SectionIndex<'a> {
+    raw: &'static mut ffi::SectionIndex,
+    _marker: PhantomData<&'a ffi::ObjectFile>,
+}
+
+impl SectionIndex<'a> {
+    /// Indexes the sections of `llof` by name, reading its section table once.
+    pub fn new(llof: &'a ffi::ObjectFile) -> Result<SectionIndex<'a>, String> {
+        unsafe {
+            match LLVMRustSectionIndexNew(llof) {
+                Some(raw) => Ok(SectionIndex { raw, _marker: PhantomData }),
+                None => Err(last_error().unwrap_or_else(||
+                    "failed to read section table".to_string())),
+            }
+        }
+    }
+
+    /// Returns the contents of the first section called `name`, if any.
+    pub fn find(&self, name: &str) -> Result<Option<&'a [u8]>, String> {
+        unsafe {
+            // A null result is only an error if this call set one, so one left
+            // over from an earlier call mustn't be taken for it.
+            drop(last_error());
+            let mut size = 0;
+            let data = LLVMRustSectionIndexFind(self.raw,
+                                                name.as_ptr() as *const c_char,
+                                                name.len(),
+                                                &mut size);
+            if data.is_null() {
+                match last_error() {
+                    Some(err) => Err(err),
+                    None => Ok(None),
+                }
+            } else {
+                Ok(Some(slice::from_raw_parts(data as *const u8, size as usize)))
+            }
+        }
+    }
+}
+
+impl Drop for SectionIndex<'a> {
+    fn drop(&mut self) {
+        unsafe {
+            LLVMRustSectionIndexFree(&mut *(self.raw as *mut _));
+        }
+    }
+}
+
 /// Safe wrapper around `LLVMGetParam`, because segfaults are no fun.
 pub fn get_param(llfn: &'a Value, index: c_uint) -> &'a Value {
     unsafe {
@@ -228,6 +292,14 @@ pub fn build_string(f: impl FnOnce(&RustString)) -> Result<String, FromUtf8Error
     String::from_utf8(sr.bytes.into_inner())
 }
 
+pub fn build_byte_buffer(f: impl FnOnce(&RustString)) -> Vec<u8> {
+    let sr = RustString {
+        bytes: RefCell::new(Vec::new()),
+    };
+    f(&sr);
+    sr.bytes.into_inner()
+}
+
 pub fn twine_to_string(tr: &Twine) -> String {
     unsafe {
         build_string(|s| LLVMRustWriteTwineToString(tr, s))
@@ -237,14 +309,115 @@ pub fn twine_to_string(tr: &Twine) -> String {
 
 pub fn last_error() -> Option<String> {
     unsafe {
-        let cstr = LLVMRustGetLastError();
-        if cstr.is_null() {
-            None
-        } else {
-            let err = CStr::from_ptr(cstr).to_bytes();
-            let err = String::from_utf8_lossy(err).to_string();
-            libc::free(cstr as *mut _);
-            Some(err)
+        let mut msg = ptr::null();
+        let mut len = 0;
+        if !LLVMRustTakeLastError(&mut msg, &mut len) {
+            return None;
+        }
+        let err = slice::from_raw_parts(msg as *const u8, len);
+        Some(String::from_utf8_lossy(err).into_owned())
+    }
+}
+
+/// The attribute lists built for a context so far, keyed by the attributes
+/// they were built from, see `LLVMRustAttributeListCache`.
+pub struct AttributeListCache<'a> {
+    raw: &'a mut ffi::AttributeListCache<'a>,
+}
+
+impl AttributeListCache<'a> {
+    pub fn new(llcx: &'a Context) -> Self {
+        AttributeListCache { raw: unsafe { LLVMRustCreateAttributeListCache(llcx) } }
+    }
+
+    /// Adds all of `attrs` to `llfn` with a single call, reusing the list
+    /// built the last time the same attributes were added to anything.
+    pub fn add_function_attributes(&self, llfn: &'a Value, attrs: &[AttributeDesc]) {
+        unsafe {
+            LLVMRustAddFunctionAttributesCached(&*self.raw, llfn, attrs.as_ptr(), attrs.len());
+        }
+    }
+
+    /// Like `add_function_attributes`, but for a call or invoke instruction.
+    pub fn add_callsite_attributes(&self, callsite: &'a Value, attrs: &[AttributeDesc]) {
+        unsafe {
+            LLVMRustAddCallSiteAttributesCached(&*self.raw, callsite, attrs.as_ptr(), attrs.len());
+        }
+    }
+
+    crate fn raw(&self) -> &ffi::AttributeListCache<'a> {
+        &*self.raw
+    }
+}
+
+impl Drop for AttributeListCache<'a> {
+    fn drop(&mut self) {
+        unsafe {
+            LLVMRustFreeAttributeListCache(&mut *(self.raw as *mut _));
+        }
+    }
+}
+
+/// The "funclet" operand bundles of the calls in each MSVC landing pad, see
+/// `LLVMRustOperandBundlePool`.
+pub struct OperandBundlePool<'a> {
+    raw: &'a mut ffi::OperandBundlePool<'a>,
+}
+
+impl OperandBundlePool<'a> {
+    pub fn new() -> Self {
+        OperandBundlePool { raw: unsafe { LLVMRustCreateOperandBundlePool() } }
+    }
+
+    /// The bundle the calls within the `cleanuppad` or `catchpad` `pad` need.
+    pub fn funclet(&self, pad: &'a Value) -> &ffi::OperandBundleDef<'a> {
+        unsafe { LLVMRustOperandBundlePoolGetFunclet(&*self.raw, pad) }
+    }
+
+    crate fn raw(&self) -> &ffi::OperandBundlePool<'a> {
+        &*self.raw
+    }
+}
+
+impl Drop for OperandBundlePool<'a> {
+    fn drop(&mut self) {
+        unsafe {
+            LLVMRustFreeOperandBundlePool(&mut *(self.raw as *mut _));
+        }
+    }
+}
+
+/// The inline assembly values built so far, along with whether their
+/// constraints verified, see `LLVMRustInlineAsmCache`.
+pub struct InlineAsmCache<'a> {
+    raw: &'a mut ffi::InlineAsmCache<'a>,
+}
+
+impl InlineAsmCache<'a> {
+    pub fn new() -> Self {
+        InlineAsmCache { raw: unsafe { LLVMRustCreateInlineAsmCache() } }
+    }
+
+    /// The inline assembly value for `asm` with `constraints` and function
+    /// type `fty`, or `None` if LLVM rejects the constraints.
+    pub fn get(&self,
+               fty: &'a Type,
+               asm: &CStr,
+               constraints: &CStr,
+               volatile: Bool,
+               alignstack: Bool,
+               dialect: AsmDialect) -> Option<&'a Value> {
+        unsafe {
+            LLVMRustInlineAsmCached(&*self.raw, fty, asm.as_ptr(), constraints.as_ptr(),
+                                    volatile, alignstack, dialect)
+        }
+    }
+}
+
+impl Drop for InlineAsmCache<'a> {
+    fn drop(&mut self) {
+        unsafe {
+            LLVMRustFreeInlineAsmCache(&mut *(self.raw as *mut _));
         }
     }
 }
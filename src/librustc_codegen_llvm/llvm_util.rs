@@ -2,13 +2,15 @@ use crate::back::write::create_informational_target_machine;
 use crate::llvm;
 use syntax_pos::symbol::Symbol;
 use rustc::session::Session;
-use rustc::session::config::PrintRequest;
+use rustc::session::config::{DebugInfo, OutputFilenames, PrintRequest};
 use rustc_target::spec::MergeFunctions;
-use libc::c_int;
-use std::ffi::CString;
+use libc::{c_char, c_int, c_void};
+use std::ffi::{CStr, CString};
 use syntax::feature_gate::UnstableFeatures;
 
+use std::fs;
 use std::str;
+use std::ptr;
 use std::slice;
 use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::Once;
@@ -32,6 +34,60 @@ pub(crate) fn init(sess: &Session) {
         if POISONED.load(Ordering::SeqCst) {
             bug!("couldn't enable multi-threaded LLVM");
         }
+
+        llvm::LLVMRustSetProfileEventsEnabled(sess.opts.debugging_opts.self_profile);
+        llvm::LLVMRustSetContextPoolingEnabled(sess.opts.debugging_opts.reuse_llvm_contexts);
+    }
+}
+
+/// Writes out the events recorded by rustllvm's profile scopes (mostly the
+/// serial steps of ThinLTO) with `-Z self-profile`, to a
+/// `.llvm-profile-events.tsv` file next to the crate's other outputs. Each
+/// line is the id of the thread which recorded the event, its name, and its
+/// start (relative to the first event) and duration in nanoseconds.
+pub(crate) fn save_profile_events(sess: &Session, outputs: &OutputFilenames) {
+    if !sess.opts.debugging_opts.self_profile {
+        return
+    }
+
+    struct Event {
+        name: String,
+        thread: u64,
+        start: u64,
+        end: u64,
+    }
+
+    unsafe extern "C" fn push_event(payload: *mut c_void,
+                                    name: *const c_char,
+                                    thread: u64,
+                                    start: u64,
+                                    end: u64) {
+        let events = &mut *(payload as *mut Vec<Event>);
+        let name = CStr::from_ptr(name).to_string_lossy().into_owned();
+        events.push(Event { name, thread, start, end });
+    }
+
+    let mut events = Vec::new();
+    let dropped = unsafe {
+        llvm::LLVMRustDrainProfileEvents(push_event, &mut events as *mut _ as *mut c_void)
+    };
+    if dropped > 0 {
+        sess.warn(&format!("{} LLVM profile events were dropped", dropped));
+    }
+
+    let first = events.iter().map(|e| e.start).min().unwrap_or(0);
+    let mut out = String::from("thread\tevent\tstart_ns\tduration_ns\n");
+    for event in &events {
+        out.push_str(&format!("{}\t{}\t{}\t{}\n",
+                              event.thread,
+                              event.name,
+                              event.start - first,
+                              event.end - event.start));
+    }
+    let path = outputs.with_extension("llvm-profile-events.tsv");
+    if let Err(e) = fs::write(&path, out) {
+        sess.err(&format!("failed to write LLVM profile events to {}: {}",
+                          path.display(), e));
     }
 }
 
@@ -72,6 +128,21 @@ unsafe fn configure_llvm(sess: &Session) {
             }
         }
 
+        // Type units are only supported for ELF, and go unused without debuginfo.
+        if sess.opts.debugging_opts.share_debuginfo_types &&
+           sess.opts.debuginfo != DebugInfo::None &&
+           sess.target_uses_elf() {
+            add("-generate-type-units");
+        }
+
+        if sess.opts.debugging_opts.hot_cold_split {
+            if get_major_version() >= 8 {
+                add("-hot-cold-split");
+            } else {
+                sess.warn("-Z hot-cold-split requires LLVM 8 or later, ignoring it");
+            }
+        }
+
         // HACK(eddyb) LLVM inserts `llvm.assume` calls to preserve align attributes
         // during inlining. Unfortunately these may block other optimizations.
         add("-preserve-alignment-assumptions-during-inlining=false");
@@ -227,21 +298,32 @@ pub fn to_llvm_feature<'a>(sess: &Session, s: &'a str) -> &'a str {
 
 pub fn target_features(sess: &Session) -> Vec<Symbol> {
     let target_machine = create_informational_target_machine(sess, true);
-    target_feature_whitelist(sess)
+    let is_nightly_build = UnstableFeatures::from_environment().is_nightly_build();
+    let features: Vec<&str> = target_feature_whitelist(sess)
         .iter()
-        .filter_map(|&(feature, gate)| {
-            if UnstableFeatures::from_environment().is_nightly_build() || gate.is_none() {
-                Some(feature)
-            } else {
-                None
-            }
-        })
-        .filter(|feature| {
-            let llvm_feature = to_llvm_feature(sess, feature);
-            let cstr = CString::new(llvm_feature).unwrap();
-            unsafe { llvm::LLVMRustHasFeature(target_machine, cstr.as_ptr()) }
-        })
-        .map(|feature| Symbol::intern(feature)).collect()
+        .filter(|&&(_, gate)| is_nightly_build || gate.is_none())
+        .map(|&(feature, _)| feature)
+        .collect();
+
+    // This runs on every startup, so ask LLVM about all of them in one go
+    // rather than one feature at a time.
+    let llvm_features: Vec<CString> = features.iter()
+        .map(|feature| CString::new(to_llvm_feature(sess, feature)).unwrap())
+        .collect();
+    let ptrs: Vec<*const c_char> = llvm_features.iter().map(|s| s.as_ptr()).collect();
+    let mut enabled = vec![false; features.len()];
+    unsafe {
+        llvm::LLVMRustHasFeatures(target_machine,
+                                  ptrs.as_ptr(),
+                                  ptrs.len(),
+                                  enabled.as_mut_ptr());
+    }
+
+    features.iter()
+        .zip(enabled)
+        .filter(|&(_, enabled)| enabled)
+        .map(|(feature, _)| Symbol::intern(feature))
+        .collect()
 }
 
 pub fn target_feature_whitelist(sess: &Session)
@@ -298,9 +380,30 @@ pub fn target_cpu(sess: &Session) -> &str {
         return name
     }
 
+    host_cpu().0
+}
+
+/// The host CPU's name and the features LLVM detected on it, formatted as
+/// `+feature,-feature,...`. LLVM only probes the host once per process.
+fn host_cpu() -> (&'static str, &'static str) {
     unsafe {
-        let mut len = 0;
-        let ptr = llvm::LLVMRustGetHostCPUName(&mut len);
-        str::from_utf8(slice::from_raw_parts(ptr as *const u8, len)).unwrap()
+        let mut name_len = 0;
+        let mut features = ptr::null();
+        let mut features_len = 0;
+        let name = llvm::LLVMRustGetHostCPUInfo(&mut name_len, &mut features, &mut features_len);
+        let name = slice::from_raw_parts(name as *const u8, name_len);
+        let features = slice::from_raw_parts(features as *const u8, features_len);
+        (str::from_utf8(name).unwrap(), str::from_utf8(features).unwrap())
+    }
+}
+
+/// The features of the host CPU if compiling for it with
+/// `-C target-cpu=native`, and nothing otherwise, so that the
+/// features LLVM would otherwise assume for the host's CPU model (which a
+/// hypervisor may well have switched off) aren't used.
+pub fn native_target_features(sess: &Session) -> &'static str {
+    match sess.opts.cg.target_cpu {
+        Some(ref s) if s == "native" => host_cpu().1,
+        _ => "",
     }
 }
@@ -1,13 +1,11 @@
 use crate::llvm;
-use crate::llvm::{False, ObjectFile, mk_section_iter};
+use crate::llvm::{ObjectFile, SectionIndex};
 use crate::llvm::archive_ro::ArchiveRO;
 use rustc::middle::cstore::MetadataLoader;
 use rustc_target::spec::Target;
 
 use rustc_data_structures::owning_ref::OwningRef;
 use std::path::Path;
-use std::ptr;
-use std::slice;
 use rustc_fs_util::path_to_c_string;
 
 pub use rustc_data_structures::sync::MetadataRef;
@@ -29,15 +27,19 @@ impl MetadataLoader for LlvmMetadataLoader {
             })?;
         let buf: OwningRef<_, [u8]> = archive
             .try_map(|ar| {
-                ar.iter()
-                    .filter_map(|s| s.ok())
-                    .find(|sect| sect.name() == Some(METADATA_FILENAME))
-                    .map(|s| s.data())
-                    .ok_or_else(|| {
+                match ar.find(METADATA_FILENAME) {
+                    Ok(Some(data)) => Ok(data),
+                    Ok(None) => {
                         debug!("didn't find '{}' in the archive", METADATA_FILENAME);
-                        format!("failed to read rlib metadata: '{}'",
-                                filename.display())
-                    })
+                        Err(format!("failed to read rlib metadata: '{}'",
+                                    filename.display()))
+                    }
+                    Err(e) => {
+                        debug!("llvm didn't like `{}`: {}", filename.display(), e);
+                        Err(format!("failed to read rlib metadata in '{}': {}",
+                                    filename.display(), e))
+                    }
+                }
             })?;
         Ok(rustc_erase_owner!(buf))
     }
@@ -64,25 +66,14 @@ fn search_meta_section<'a>(of: &'a ObjectFile,
                            target: &Target,
                            filename: &Path)
                            -> Result<&'a [u8], String> {
-    unsafe {
-        let si = mk_section_iter(of.llof);
-        while llvm::LLVMIsSectionIteratorAtEnd(of.llof, si.llsi) == False {
-            let mut name_buf = ptr::null();
-            let name_len = llvm::LLVMRustGetSectionName(si.llsi, &mut name_buf);
-            let name = slice::from_raw_parts(name_buf as *const u8, name_len as usize).to_vec();
-            let name = String::from_utf8(name).unwrap();
-            debug!("get_metadata_section: name {}", name);
-            if read_metadata_section_name(target) == name {
-                let cbuf = llvm::LLVMGetSectionContents(si.llsi);
-                let csz = llvm::LLVMGetSectionSize(si.llsi) as usize;
-                // The buffer is valid while the object file is around
-                let buf: &'a [u8] = slice::from_raw_parts(cbuf as *const u8, csz);
-                return Ok(buf);
-            }
-            llvm::LLVMMoveToNextSection(si.llsi);
-        }
+    let index = SectionIndex::new(of.llof)
+        .map_err(|e| format!("failed to read sections of '{}': {}", filename.display(), e))?;
+    match index.find(read_metadata_section_name(target)) {
+        // The buffer is valid while the object file is around
+        Ok(Some(buf)) => Ok(buf),
+        Ok(None) => Err(format!("metadata not found: '{}'", filename.display())),
+        Err(e) => Err(format!("failed to read metadata in '{}': {}", filename.display(), e)),
     }
-    Err(format!("metadata not found: '{}'", filename.display()))
 }
 
 pub fn metadata_section_name(target: &Target) -> &'static str {
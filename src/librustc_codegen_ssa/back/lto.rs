@@ -19,9 +19,10 @@ impl<B: WriteBackendMethods> ThinModule<B> {
     }
 
     pub fn cost(&self) -> u64 {
-        // Yes, that's correct, we're using the size of the bytecode as an
-        // indicator for how costly this codegen unit is.
-        self.data().len() as u64
+        // This is whatever the backend estimated when it created the shared
+        // data, for LLVM the size of the module according to the ThinLTO
+        // summary index.
+        self.shared.module_costs[self.idx]
     }
 
     pub fn data(&self) -> &[u8] {
@@ -38,6 +39,8 @@ pub struct ThinShared<B: WriteBackendMethods> {
     pub thin_buffers: Vec<B::ThinBuffer>,
     pub serialized_modules: Vec<SerializedModule<B::ModuleBuffer>>,
     pub module_names: Vec<CString>,
+    /// How costly each module is to optimize, indexed like `module_names`.
+    pub module_costs: Vec<u64>,
 }
 
 
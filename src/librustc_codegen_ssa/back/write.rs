@@ -12,9 +12,10 @@ use rustc_incremental::{copy_cgu_workproducts_to_incr_comp_cache_dir,
 use rustc::dep_graph::{WorkProduct, WorkProductId, WorkProductFileKind};
 use rustc::dep_graph::cgu_reuse_tracker::CguReuseTracker;
 use rustc::middle::cstore::EncodedMetadata;
-use rustc::session::config::{self, OutputFilenames, OutputType, Passes, Sanitizer, Lto};
+use rustc::session::config::{self, OutputFilenames, OutputType, Passes, Sanitizer,
+                             SanitizerCoverage, Lto};
 use rustc::session::Session;
-use rustc::util::nodemap::FxHashMap;
+use rustc::util::nodemap::{FxHashMap, FxHashSet};
 use rustc::util::time_graph::{self, TimeGraph, Timeline};
 use rustc::hir::def_id::{CrateNum, LOCAL_CRATE};
 use rustc::ty::TyCtxt;
@@ -23,7 +24,7 @@ use rustc_fs_util::link_or_copy;
 use rustc_data_structures::svh::Svh;
 use rustc_errors::{Handler, Level, DiagnosticBuilder, FatalError, DiagnosticId};
 use rustc_errors::emitter::{Emitter};
-use rustc_target::spec::MergeFunctions;
+use rustc_target::spec::{LinkerFlavor, MergeFunctions};
 use syntax::attr;
 use syntax::ext::hygiene::Mark;
 use syntax_pos::MultiSpan;
@@ -56,6 +57,7 @@ pub struct ModuleConfig {
 
     pub pgo_gen: Option<String>,
     pub pgo_use: String,
+    pub pgo_sample_use: String,
 
     // Flags indicating which outputs to produce.
     pub emit_pre_lto_bc: bool,
@@ -83,6 +85,18 @@ pub struct ModuleConfig {
     pub no_integrated_as: bool,
     pub embed_bitcode: bool,
     pub embed_bitcode_marker: bool,
+    // Whether the stack sizes of the module's object file go into the report
+    // for `-Z stack-sizes-report`, which is only made for ELF targets.
+    pub stack_sizes_report: bool,
+    // How many partitions the module is split into for codegen with
+    // `-Z split-codegen-parts`, 1 if it's codegened in one go.
+    pub split_codegen_parts: usize,
+
+    // Instrumentation for the sanitizer in use and for coverage guided
+    // fuzzing, added at the end of the module's optimization pipeline.
+    pub sanitizer: Option<Sanitizer>,
+    pub sanitizer_recover: bool,
+    pub sanitizer_coverage: Option<SanitizerCoverage>,
 }
 
 impl ModuleConfig {
@@ -94,6 +108,7 @@ impl ModuleConfig {
 
             pgo_gen: None,
             pgo_use: String::new(),
+            pgo_sample_use: String::new(),
 
             emit_no_opt_bc: false,
             emit_pre_lto_bc: false,
@@ -107,6 +122,8 @@ impl ModuleConfig {
             embed_bitcode: false,
             embed_bitcode_marker: false,
             no_integrated_as: false,
+            stack_sizes_report: false,
+            split_codegen_parts: 1,
 
             verify_llvm_ir: false,
             no_prepopulate_passes: false,
@@ -115,7 +132,11 @@ impl ModuleConfig {
             vectorize_loop: false,
             vectorize_slp: false,
             merge_functions: false,
-            inline_threshold: None
+            inline_threshold: None,
+
+            sanitizer: None,
+            sanitizer_recover: false,
+            sanitizer_coverage: None,
         }
     }
 
@@ -125,6 +146,8 @@ impl ModuleConfig {
         self.no_builtins = no_builtins || sess.target.target.options.no_builtins;
         self.time_passes = sess.time_passes();
         self.inline_threshold = sess.opts.cg.inline_threshold;
+        self.stack_sizes_report = sess.opts.debugging_opts.stack_sizes_report.is_some() &&
+            sess.target_uses_elf();
         self.obj_is_bitcode = sess.target.target.options.obj_is_bitcode ||
                               sess.opts.cg.linker_plugin_lto.enabled();
         let embed_bitcode = sess.target.target.options.embed_bitcode ||
@@ -160,14 +183,23 @@ impl ModuleConfig {
         // but aliases are not supported by some backends (again, NVPTX).
         // Therefore, allow targets to opt out of the MergeFunctions pass,
         // but otherwise keep the pass enabled (at O2 and O3) since it can be
-        // useful for reducing code size.
+        // useful for reducing code size. At Os and Oz, where that's the whole
+        // point, it's opt-in with `-Z merge-functions-for-size`.
         self.merge_functions = match sess.opts.debugging_opts.merge_functions
                                      .unwrap_or(sess.target.target.options.merge_functions) {
             MergeFunctions::Disabled => false,
             MergeFunctions::Trampolines |
             MergeFunctions::Aliases => {
-                sess.opts.optimize == config::OptLevel::Default ||
-                sess.opts.optimize == config::OptLevel::Aggressive
+                match sess.opts.optimize {
+                    config::OptLevel::Default |
+                    config::OptLevel::Aggressive => true,
+                    config::OptLevel::Size |
+                    config::OptLevel::SizeMin => {
+                        sess.opts.debugging_opts.merge_functions_for_size
+                    }
+                    config::OptLevel::No |
+                    config::OptLevel::Less => false,
+                }
             }
         };
     }
@@ -239,7 +271,10 @@ pub struct CodegenContext<B: WriteBackendMethods> {
     // measuring is disabled.
     pub time_graph: Option<TimeGraph>,
     // The assembler command if no_integrated_as option is enabled, None otherwise
-    pub assembler_cmd: Option<Arc<AssemblerCommand>>
+    pub assembler_cmd: Option<Arc<AssemblerCommand>>,
+    // The linker command putting the partitions of `-Z split-codegen-parts`
+    // back together, None if modules aren't split
+    pub partial_linker_cmd: Option<Arc<AssemblerCommand>>,
 }
 
 impl<B: WriteBackendMethods> CodegenContext<B> {
@@ -350,21 +385,9 @@ pub fn start_async_codegen<B: ExtraBackendMethods>(
     let mut metadata_config = ModuleConfig::new(vec![]);
     let mut allocator_config = ModuleConfig::new(vec![]);
 
-    if let Some(ref sanitizer) = sess.opts.debugging_opts.sanitizer {
-        match *sanitizer {
-            Sanitizer::Address => {
-                modules_config.passes.push("asan".to_owned());
-                modules_config.passes.push("asan-module".to_owned());
-            }
-            Sanitizer::Memory => {
-                modules_config.passes.push("msan".to_owned())
-            }
-            Sanitizer::Thread => {
-                modules_config.passes.push("tsan".to_owned())
-            }
-            _ => {}
-        }
-    }
+    modules_config.sanitizer = sess.opts.debugging_opts.sanitizer.clone();
+    modules_config.sanitizer_recover = sess.opts.debugging_opts.sanitizer_recover;
+    modules_config.sanitizer_coverage = sess.opts.debugging_opts.sanitizer_coverage;
 
     if sess.opts.debugging_opts.profile {
         modules_config.passes.push("insert-gcov-profiling".to_owned())
@@ -372,6 +395,7 @@ pub fn start_async_codegen<B: ExtraBackendMethods>(
 
     modules_config.pgo_gen = sess.opts.debugging_opts.pgo_gen.clone();
     modules_config.pgo_use = sess.opts.debugging_opts.pgo_use.clone();
+    modules_config.pgo_sample_use = sess.opts.debugging_opts.pgo_sample_use.clone();
 
     modules_config.opt_level = Some(sess.opts.optimize);
     modules_config.opt_size = Some(sess.opts.optimize);
@@ -427,6 +451,11 @@ pub fn start_async_codegen<B: ExtraBackendMethods>(
     }
 
     modules_config.set_flags(sess, no_builtins);
+    if sess.target_uses_elf() {
+        if let Some(parts) = sess.opts.debugging_opts.split_codegen_parts {
+            modules_config.split_codegen_parts = parts.max(1);
+        }
+    }
     metadata_config.set_flags(sess, no_builtins);
     allocator_config.set_flags(sess, no_builtins);
 
@@ -491,6 +520,9 @@ fn copy_all_cgu_workproducts_to_incr_comp_cache_dir(
         if let Some(ref path) = module.bytecode_compressed {
             files.push((WorkProductFileKind::BytecodeCompressed, path.clone()));
         }
+        if let Some(ref path) = module.dwarf_object {
+            files.push((WorkProductFileKind::SplitDwarf, path.clone()));
+        }
 
         if let Some((id, product)) =
                 copy_cgu_workproducts_to_incr_comp_cache_dir(sess, &module.name, &files) {
@@ -582,6 +614,16 @@ fn produce_final_output_artifacts(sess: &Session,
         }
     }
 
+    if let Some(ref path) = sess.opts.debugging_opts.symbol_ordering_file {
+        write_symbol_ordering(sess, compiled_modules, crate_output, path);
+    }
+
+    if let Some(ref path) = sess.opts.debugging_opts.stack_sizes_report {
+        if sess.target_uses_elf() {
+            write_stack_sizes_report(sess, compiled_modules, crate_output, path);
+        }
+    }
+
     // Clean up unwanted temporary files.
 
     // We create the following files by default:
@@ -651,6 +693,95 @@ fn produce_final_output_artifacts(sess: &Session,
     // These are used in linking steps and will be cleaned up afterward.
 }
 
+/// Merges the symbol orderings the backend wrote for each module into the
+/// single file requested with `-Z symbol-ordering-file`, hottest first.
+///
+/// Modules reused from the incremental cache don't come with an ordering, so
+/// their functions are just left wherever the linker would put them anyway.
+fn write_symbol_ordering(sess: &Session,
+                         compiled_modules: &CompiledModules,
+                         crate_output: &OutputFilenames,
+                         dst: &Path) {
+    let modules = compiled_modules.modules.iter()
+        .chain(compiled_modules.allocator_module.iter());
+
+    let mut entries = Vec::new();
+    for module in modules {
+        let path = crate_output.temp_path_ext("order", Some(&module.name));
+        let ordering = match fs::read_to_string(&path) {
+            Ok(ordering) => ordering,
+            Err(_) => continue,
+        };
+        for line in ordering.lines() {
+            let mut parts = line.splitn(2, ' ');
+            let count = parts.next().and_then(|c| c.parse::<u64>().ok()).unwrap_or(0);
+            if let Some(symbol) = parts.next() {
+                entries.push((count, symbol.to_owned()));
+            }
+        }
+        if !sess.opts.cg.save_temps {
+            remove(sess, &path);
+        }
+    }
+
+    // The sort is stable, so the functions which follow a hot one within its
+    // module keep following it.
+    entries.sort_by(|a, b| b.0.cmp(&a.0));
+
+    let mut seen = FxHashSet::default();
+    let mut out = String::new();
+    for (_, symbol) in &entries {
+        if seen.insert(&symbol[..]) {
+            out.push_str(symbol);
+            out.push('\n');
+        }
+    }
+    if let Err(e) = fs::write(dst, out) {
+        sess.err(&format!("failed to write symbol ordering file {}: {}", dst.display(), e));
+    }
+}
+
+/// Merges the stack sizes the backend read out of each module's object file
+/// into the report requested with `-Z stack-sizes-report`, largest first.
+/// Those of modules reused from the incremental cache are read out of the
+/// reused object files when they're copied out of the cache.
+fn write_stack_sizes_report(sess: &Session,
+                            compiled_modules: &CompiledModules,
+                            crate_output: &OutputFilenames,
+                            dst: &Path) {
+    let modules = compiled_modules.modules.iter()
+        .chain(compiled_modules.allocator_module.iter());
+
+    let mut entries = Vec::new();
+    for module in modules {
+        let path = crate_output.temp_path_ext("stack-sizes", Some(&module.name));
+        let sizes = match fs::read_to_string(&path) {
+            Ok(sizes) => sizes,
+            Err(_) => continue,
+        };
+        for line in sizes.lines() {
+            let mut parts = line.splitn(2, '\t');
+            let size = parts.next().and_then(|s| s.parse::<u64>().ok());
+            if let (Some(size), Some(function)) = (size, parts.next()) {
+                entries.push((size, function.to_owned(), &module.name));
+            }
+        }
+        if !sess.opts.cg.save_temps {
+            remove(sess, &path);
+        }
+    }
+
+    entries.sort_by(|a, b| b.0.cmp(&a.0).then_with(|| a.1.cmp(&b.1)));
+
+    let mut out = String::from("stack_size\tfunction\tcodegen_unit\n");
+    for (size, function, module) in &entries {
+        out.push_str(&format!("{}\t{}\t{}\n", size, function, module));
+    }
+    if let Err(e) = fs::write(dst, out) {
+        sess.err(&format!("failed to write stack sizes report {}: {}", dst.display(), e));
+    }
+}
+
 pub fn dump_incremental_data(_codegen_results: &CodegenResults) {
     // FIXME(mw): This does not work at the moment because the situation has
     //            become more complicated due to incremental LTO. Now a CGU
@@ -800,7 +931,7 @@ fn execute_optimize_work_item<B: ExtraBackendMethods>(
             WorkItemResult::Compiled(module)
         }
         ComputedLtoType::Thin => {
-            let (name, thin_buffer) = B::prepare_thin(module);
+            let (name, thin_buffer) = B::prepare_thin(cgcx, module);
             if let Some(path) = bitcode {
                 fs::write(&path, thin_buffer.data()).unwrap_or_else(|e| {
                     panic!("Error writing pre-lto-bitcode file `{}`: {}",
@@ -839,6 +970,7 @@ fn execute_copy_from_cache_work_item<B: ExtraBackendMethods>(
     let mut object = None;
     let mut bytecode = None;
     let mut bytecode_compressed = None;
+    let mut dwarf_object = None;
     for (kind, saved_file) in &module.source.saved_files {
         let obj_out = match kind {
             WorkProductFileKind::Object => {
@@ -860,6 +992,13 @@ fn execute_copy_from_cache_work_item<B: ExtraBackendMethods>(
                 bytecode_compressed = Some(path.clone());
                 path
             }
+            WorkProductFileKind::SplitDwarf => {
+                let path = cgcx.output_filenames.temp_path(OutputType::Object,
+                                                           Some(&module.name))
+                    .with_extension("dwo");
+                dwarf_object = Some(path.clone());
+                path
+            }
         };
         let source_file = in_incr_comp_dir(&incr_comp_session_dir,
                                            &saved_file);
@@ -880,12 +1019,34 @@ fn execute_copy_from_cache_work_item<B: ExtraBackendMethods>(
     assert_eq!(bytecode.is_some(), module_config.emit_bc);
     assert_eq!(bytecode_compressed.is_some(), module_config.emit_bc_compressed);
 
+    // `-Z stack-sizes-report` is tracked, so the object was compiled with its
+    // `.stack_sizes` sections.
+    match object {
+        Some(ref object) if module_config.stack_sizes_report => {
+            let out = cgcx.output_filenames.temp_path_ext("stack-sizes", Some(&module.name));
+            let diag_handler = cgcx.create_diag_handler();
+            match B::stack_sizes(object) {
+                Ok(sizes) => {
+                    if let Err(e) = fs::write(&out, sizes) {
+                        diag_handler.err(&format!("failed to write stack sizes: {}", e));
+                    }
+                }
+                Err(e) => {
+                    diag_handler.warn(&format!("couldn't read the stack sizes of {}: {}",
+                                               object.display(), e));
+                }
+            }
+        }
+        _ => {}
+    }
+
     Ok(WorkItemResult::Compiled(CompiledModule {
         name: module.name,
         kind: ModuleKind::Regular,
         object,
         bytecode,
         bytecode_compressed,
+        dwarf_object,
     }))
 }
 
@@ -1022,6 +1183,23 @@ fn start_executing_work<B: ExtraBackendMethods>(
         None
     };
 
+    let partial_linker_cmd = if modules_config.split_codegen_parts > 1 {
+        let (linker, flavor) = link::linker_and_flavor(sess);
+        match flavor {
+            LinkerFlavor::Gcc | LinkerFlavor::Ld => {}
+            _ => sess.fatal("`-Z split-codegen-parts` needs a `cc` or `ld` linker to put \
+                             the partitions back together"),
+        }
+
+        let (name, cmd) = get_linker(sess, &linker, flavor);
+        Some(Arc::new(AssemblerCommand {
+            name,
+            cmd,
+        }))
+    } else {
+        None
+    };
+
     let ol = tcx.backend_optimization_level(LOCAL_CRATE);
     let cgcx = CodegenContext::<B> {
         backend: backend.clone(),
@@ -1052,6 +1230,7 @@ fn start_executing_work<B: ExtraBackendMethods>(
         target_pointer_width: tcx.sess.target.target.target_pointer_width.clone(),
         debuginfo: tcx.sess.opts.debuginfo,
         assembler_cmd,
+        partial_linker_cmd,
     };
 
     // This is the "main loop" of parallel work happening for parallel codegen.
@@ -1649,6 +1828,44 @@ pub fn run_assembler<B: ExtraBackendMethods>(
     }
 }
 
+/// Links the object files `parts` into the one relocatable `object`, with the
+/// linker `-Z split-codegen-parts` uses.
+pub fn run_partial_link<B: ExtraBackendMethods>(
+    cgcx: &CodegenContext<B>,
+    handler: &Handler,
+    parts: &[PathBuf],
+    object: &Path
+) {
+    let linker = cgcx.partial_linker_cmd
+        .as_ref()
+        .expect("cgcx.partial_linker_cmd is missing?");
+
+    let pname = &linker.name;
+    let mut cmd = linker.cmd.clone();
+    cmd.arg("-nostdlib").arg("-r").arg("-o").arg(object).args(parts);
+    debug!("{:?}", cmd);
+
+    match cmd.output() {
+        Ok(prog) => {
+            if !prog.status.success() {
+                let mut note = prog.stderr.clone();
+                note.extend_from_slice(&prog.stdout);
+
+                handler.struct_err(&format!("linking with `{}` failed: {}",
+                                            pname.display(),
+                                            prog.status))
+                    .note(&format!("{:?}", &cmd))
+                    .note(str::from_utf8(&note[..]).unwrap())
+                    .emit();
+                handler.abort_if_errors();
+            }
+        },
+        Err(e) => {
+            handler.err(&format!("could not exec the linker `{}`: {}", pname.display(), e));
+            handler.abort_if_errors();
+        }
+    }
+}
 
 enum SharedEmitterMessage {
     Diagnostic(Diagnostic),
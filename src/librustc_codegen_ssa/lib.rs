@@ -67,6 +67,7 @@ impl<M> ModuleCodegen<M> {
                             emit_obj: bool,
                             emit_bc: bool,
                             emit_bc_compressed: bool,
+                            emit_dwo: bool,
                             outputs: &OutputFilenames) -> CompiledModule {
         let object = if emit_obj {
             Some(outputs.temp_path(OutputType::Object, Some(&self.name)))
@@ -84,6 +85,11 @@ impl<M> ModuleCodegen<M> {
         } else {
             None
         };
+        let dwarf_object = if emit_dwo {
+            Some(outputs.temp_path(OutputType::Object, Some(&self.name)).with_extension("dwo"))
+        } else {
+            None
+        };
 
         CompiledModule {
             name: self.name.clone(),
@@ -91,6 +97,7 @@ impl<M> ModuleCodegen<M> {
             object,
             bytecode,
             bytecode_compressed,
+            dwarf_object,
         }
     }
 }
@@ -102,6 +109,8 @@ pub struct CompiledModule {
     pub object: Option<PathBuf>,
     pub bytecode: Option<PathBuf>,
     pub bytecode_compressed: Option<PathBuf>,
+    /// The split DWARF of `object`, with `-Z split-dwarf`.
+    pub dwarf_object: Option<PathBuf>,
 }
 
 pub struct CachedModuleCodegen {
@@ -124,6 +133,28 @@ bitflags::bitflags! {
     }
 }
 
+bitflags::bitflags! {
+    /// The optimizations a floating point operation allows which may change its
+    /// result; see the "Fast-Math Flags" section of the LLVM LangRef.
+    pub struct FastMathFlags: u8 {
+        /// Allow reassociating it with other operations which allow it.
+        const REASSOC = 1 << 0;
+        /// Allow assuming neither the inputs nor the result are NaN.
+        const NNAN = 1 << 1;
+        /// Allow assuming neither the inputs nor the result are infinite.
+        const NINF = 1 << 2;
+        /// Allow ignoring the sign of zero.
+        const NSZ = 1 << 3;
+        /// Allow using the reciprocal of a divisor instead of dividing.
+        const ARCP = 1 << 4;
+        /// Allow fusing it with another operation, e.g. a multiply and an add
+        /// into a fused multiply-add, without rounding in between.
+        const CONTRACT = 1 << 5;
+        /// Allow substituting approximations for math library functions.
+        const AFN = 1 << 6;
+    }
+}
+
 /// Misc info we load from metadata to persist beyond the tcx.
 pub struct CrateInfo {
     pub panic_runtime: Option<CrateNum>,
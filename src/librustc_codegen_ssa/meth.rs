@@ -4,7 +4,9 @@ use rustc_mir::monomorphize;
 use crate::callee;
 use crate::traits::*;
 
-use rustc::ty::{self, Ty};
+use rustc::ich::NodeIdHashingMode;
+use rustc::ty::{self, Ty, TyCtxt};
+use rustc_data_structures::stable_hasher::{HashStable, StableHasher};
 
 #[derive(Copy, Clone, Debug)]
 pub struct VirtualIndex(u64);
@@ -22,11 +24,25 @@ impl<'a, 'tcx: 'a> VirtualIndex {
         self,
         bx: &mut Bx,
         llvtable: Bx::Value,
+        object_ty: Ty<'tcx>,
         fn_ty: &FnType<'tcx, Ty<'tcx>>
     ) -> Bx::Value {
         // Load the data pointer from the object.
         debug!("get_fn({:?}, {:?})", llvtable, self);
 
+        // Tell LLVM the vtable is one of those `get_vtable` built for this
+        // trait, so it can devirtualize the call if they all agree on the
+        // function.
+        if bx.tcx().sess.opts.debugging_opts.whole_program_devirt {
+            if let ty::Dynamic(ref predicates, _) = object_ty.sty {
+                if let Some(trait_ref) = predicates.principal() {
+                    let type_id = vtable_type_id(bx.tcx(), trait_ref);
+                    let is_vtable = bx.type_test(llvtable, &type_id);
+                    bx.assume(is_vtable);
+                }
+            }
+        }
+
         let llvtable = bx.pointercast(
             llvtable,
             bx.type_ptr_to(bx.fn_ptr_backend_type(fn_ty))
@@ -114,6 +130,34 @@ pub fn get_vtable<'tcx, Cx: CodegenMethods<'tcx>>(
 
     cx.create_vtable_metadata(ty, vtable);
 
+    if tcx.sess.opts.debugging_opts.whole_program_devirt {
+        if let Some(trait_ref) = trait_ref {
+            cx.add_type_metadata(vtable, &vtable_type_id(tcx, trait_ref));
+        }
+    }
+
     cx.vtables().borrow_mut().insert((ty, trait_ref), vtable);
     vtable
 }
+
+/// The type id `-Z whole-program-devirt` ties the vtables built for
+/// `trait_ref` and the virtual calls made through them together with.
+///
+/// Vtables are only ever built for the principal trait of an object type, so
+/// that's all this depends on: the auto traits and associated types of `dyn
+/// Trait` don't change which vtables the object could be using. It's a stable
+/// hash so that every crate comes up with the same one.
+fn vtable_type_id<'a, 'tcx>(tcx: TyCtxt<'a, 'tcx, 'tcx>,
+                            trait_ref: ty::PolyExistentialTraitRef<'tcx>) -> String {
+    let trait_ref = tcx.erase_late_bound_regions(&trait_ref);
+    let trait_ref = tcx.erase_regions(&trait_ref);
+
+    let mut hasher = StableHasher::<u64>::new();
+    let mut hcx = tcx.create_stable_hashing_context();
+    hcx.while_hashing_spans(false, |hcx| {
+        hcx.with_node_id_hashing_mode(NodeIdHashingMode::HashDefPath, |hcx| {
+            trait_ref.hash_stable(hcx, &mut hasher);
+        });
+    });
+    format!("rust.vtable.{:016x}", hasher.finish())
+}
@@ -127,12 +127,12 @@ impl<'a, 'tcx: 'a, Bx: BuilderMethods<'a, 'tcx>> FunctionCx<'a, 'tcx, Bx> {
                 } else {
                     this.unreachable_block()
                 };
-                let invokeret = bx.invoke(fn_ptr,
-                                          &llargs,
-                                          ret_bx,
-                                          llblock(this, cleanup),
-                                          funclet(this));
-                bx.apply_attrs_callsite(&fn_ty, invokeret);
+                let invokeret = bx.invoke_with_attrs(&fn_ty,
+                                                     fn_ptr,
+                                                     &llargs,
+                                                     ret_bx,
+                                                     llblock(this, cleanup),
+                                                     funclet(this));
 
                 if let Some((ret_dest, target)) = destination {
                     let mut ret_bx = this.build_block(target);
@@ -140,8 +140,7 @@ impl<'a, 'tcx: 'a, Bx: BuilderMethods<'a, 'tcx>> FunctionCx<'a, 'tcx, Bx> {
                     this.store_return(&mut ret_bx, ret_dest, &fn_ty.ret, invokeret);
                 }
             } else {
-                let llret = bx.call(fn_ptr, &llargs, funclet(this));
-                bx.apply_attrs_callsite(&fn_ty, llret);
+                let llret = bx.call_with_attrs(&fn_ty, fn_ptr, &llargs, funclet(this));
                 if this.mir[bb].is_cleanup {
                     // Cleanup is always the cold path. Don't inline
                     // drop glue. Also, when there is a deeply-nested
@@ -316,7 +315,7 @@ impl<'a, 'tcx: 'a, Bx: BuilderMethods<'a, 'tcx>> FunctionCx<'a, 'tcx, Bx> {
                         let fn_ty = bx.new_vtable(sig, &[]);
                         let vtable = args[1];
                         args = &args[..1];
-                        (meth::DESTRUCTOR.get_fn(&mut bx, vtable, &fn_ty), fn_ty)
+                        (meth::DESTRUCTOR.get_fn(&mut bx, vtable, ty, &fn_ty), fn_ty)
                     }
                     _ => {
                         (bx.get_fn(drop_fn),
@@ -662,6 +661,8 @@ impl<'a, 'tcx: 'a, Bx: BuilderMethods<'a, 'tcx>> FunctionCx<'a, 'tcx, Bx> {
                     let mut op = self.codegen_operand(&mut bx, arg);
 
                     if let (0, Some(ty::InstanceDef::Virtual(_, idx))) = (i, def) {
+                        // The `Self` of a virtual call is the object type.
+                        let object_ty = instance.unwrap().substs.type_at(0);
                         if let Pair(..) = op.val {
                             // In the case of Rc<Self>, we need to explicitly pass a
                             // *mut RcBox<Self> with a Scalar (not ScalarPair) ABI. This is a hack
@@ -692,7 +693,7 @@ impl<'a, 'tcx: 'a, Bx: BuilderMethods<'a, 'tcx>> FunctionCx<'a, 'tcx, Bx> {
                             match op.val {
                                 Pair(data_ptr, meta) => {
                                     llfn = Some(meth::VirtualIndex::from_index(idx)
-                                        .get_fn(&mut bx, meta, &fn_ty));
+                                        .get_fn(&mut bx, meta, object_ty, &fn_ty));
                                     llargs.push(data_ptr);
                                     continue 'make_args
                                 }
@@ -701,7 +702,7 @@ impl<'a, 'tcx: 'a, Bx: BuilderMethods<'a, 'tcx>> FunctionCx<'a, 'tcx, Bx> {
                         } else if let Ref(data_ptr, Some(meta), _) = op.val {
                             // by-value dynamic dispatch
                             llfn = Some(meth::VirtualIndex::from_index(idx)
-                                .get_fn(&mut bx, meta, &fn_ty));
+                                .get_fn(&mut bx, meta, object_ty, &fn_ty));
                             llargs.push(data_ptr);
                             continue;
                         } else {
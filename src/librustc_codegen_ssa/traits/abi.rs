@@ -10,4 +10,26 @@ pub trait AbiMethods<'tcx> {
 
 pub trait AbiBuilderMethods<'tcx>: BackendTypes {
     fn apply_attrs_callsite(&mut self, ty: &FnType<'tcx, Ty<'tcx>>, callsite: Self::Value);
+
+    /// Builds the same call as `call` followed by `apply_attrs_callsite`
+    /// would, but without the extra round trip into the backend for the
+    /// attributes.
+    fn call_with_attrs(
+        &mut self,
+        ty: &FnType<'tcx, Ty<'tcx>>,
+        llfn: Self::Value,
+        args: &[Self::Value],
+        funclet: Option<&Self::Funclet>,
+    ) -> Self::Value;
+
+    /// Like `call_with_attrs`, but for an `invoke`.
+    fn invoke_with_attrs(
+        &mut self,
+        ty: &FnType<'tcx, Ty<'tcx>>,
+        llfn: Self::Value,
+        args: &[Self::Value],
+        then: Self::BasicBlock,
+        catch: Self::BasicBlock,
+        funclet: Option<&Self::Funclet>,
+    ) -> Self::Value;
 }
@@ -8,7 +8,7 @@ use crate::common::{AtomicOrdering, AtomicRmwBinOp, IntPredicate, RealPredicate,
     SynchronizationScope};
 use crate::mir::operand::OperandRef;
 use crate::mir::place::PlaceRef;
-use crate::MemFlags;
+use crate::{FastMathFlags, MemFlags};
 use rustc::ty::Ty;
 use rustc::ty::layout::{Align, Size};
 use std::ffi::CStr;
@@ -87,6 +87,8 @@ pub trait BuilderMethods<'a, 'tcx: 'a>:
     fn srem(&mut self, lhs: Self::Value, rhs: Self::Value) -> Self::Value;
     fn frem(&mut self, lhs: Self::Value, rhs: Self::Value) -> Self::Value;
     fn frem_fast(&mut self, lhs: Self::Value, rhs: Self::Value) -> Self::Value;
+    /// Replaces the fast-math flags of the floating point operation `instr`.
+    fn set_fast_math_flags(&mut self, instr: Self::Value, flags: FastMathFlags);
     fn shl(&mut self, lhs: Self::Value, rhs: Self::Value) -> Self::Value;
     fn lshr(&mut self, lhs: Self::Value, rhs: Self::Value) -> Self::Value;
     fn ashr(&mut self, lhs: Self::Value, rhs: Self::Value) -> Self::Value;
@@ -232,6 +234,10 @@ pub trait BuilderMethods<'a, 'tcx: 'a>:
     fn vector_splat(&mut self, num_elts: usize, elt: Self::Value) -> Self::Value;
     fn vector_reduce_fadd_fast(&mut self, acc: Self::Value, src: Self::Value) -> Self::Value;
     fn vector_reduce_fmul_fast(&mut self, acc: Self::Value, src: Self::Value) -> Self::Value;
+    fn vector_reduce_fadd(&mut self, acc: Self::Value, src: Self::Value) -> Self::Value;
+    fn vector_reduce_fmul(&mut self, acc: Self::Value, src: Self::Value) -> Self::Value;
+    fn vector_reduce_fadd_unordered(&mut self, src: Self::Value) -> Self::Value;
+    fn vector_reduce_fmul_unordered(&mut self, src: Self::Value) -> Self::Value;
     fn vector_reduce_add(&mut self, src: Self::Value) -> Self::Value;
     fn vector_reduce_mul(&mut self, src: Self::Value) -> Self::Value;
     fn vector_reduce_and(&mut self, src: Self::Value) -> Self::Value;
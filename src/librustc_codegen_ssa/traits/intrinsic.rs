@@ -20,4 +20,6 @@ pub trait IntrinsicCallMethods<'tcx>: BackendTypes {
     fn abort(&mut self);
     fn assume(&mut self, val: Self::Value);
     fn expect(&mut self, cond: Self::Value, expected: bool) -> Self::Value;
+    /// Tests whether `pointer` is an address of the type `type_id`.
+    fn type_test(&mut self, pointer: Self::Value, type_id: &str) -> Self::Value;
 }
@@ -5,6 +5,9 @@ use rustc::ty::layout::Align;
 pub trait StaticMethods: BackendTypes {
     fn static_addr_of(&self, cv: Self::Value, align: Align, kind: Option<&str>) -> Self::Value;
     fn codegen_static(&self, def_id: DefId, is_mutable: bool);
+    /// Marks the start of `global` as an address of the type `type_id`, which
+    /// is what `IntrinsicCallMethods::type_test` checks for.
+    fn add_type_metadata(&self, global: Self::Value, type_id: &str);
 }
 
 pub trait StaticBuilderMethods<'tcx>: BackendTypes {
@@ -6,6 +6,8 @@ use rustc::dep_graph::WorkProduct;
 use rustc::util::time_graph::Timeline;
 use rustc_errors::{FatalError, Handler};
 
+use std::path::Path;
+
 pub trait WriteBackendMethods: 'static + Sized + Clone {
     type Module: Send + Sync;
     type TargetMachine;
@@ -52,6 +54,7 @@ pub trait WriteBackendMethods: 'static + Sized + Clone {
         timeline: &mut Timeline,
     ) -> Result<CompiledModule, FatalError>;
     fn prepare_thin(
+        cgcx: &CodegenContext<Self>,
         module: ModuleCodegen<Self::Module>
     ) -> (String, Self::ThinBuffer);
     fn serialize_module(
@@ -63,6 +66,9 @@ pub trait WriteBackendMethods: 'static + Sized + Clone {
         config: &ModuleConfig,
         thin: bool,
     );
+    /// The `<size>\t<function>` lines of `-Z stack-sizes-report` for the
+    /// object file at `object`, read out of its `.stack_sizes` sections.
+    fn stack_sizes(object: &Path) -> Result<String, String>;
 }
 
 pub trait ThinBufferMethods: Send + Sync {
@@ -155,6 +155,7 @@ fn main() {
     }
 
     build_helper::rerun_if_changed_anything_in_dir(Path::new("../rustllvm"));
+    let bench_cfg = cfg.clone();
     cfg.file("../rustllvm/PassWrapper.cpp")
        .file("../rustllvm/RustWrapper.cpp")
        .file("../rustllvm/ArchiveWrapper.cpp")
@@ -165,6 +166,9 @@ fn main() {
 
     let (llvm_kind, llvm_link_arg) = detect_llvm_link();
 
+    // Everything the LLVM libraries need to be linked, for the benchmark.
+    let mut bench_link_args = Vec::new();
+
     // Link in all LLVM libraries, if we're uwring the "wrong" llvm-config then
     // we don't pick up system libs because unfortunately they're for the host
     // of llvm-config, not the target that we're attempting to link.
@@ -209,6 +213,7 @@ fn main() {
             "dylib"
         };
         println!("cargo:rustc-link-lib={}={}", kind, name);
+        bench_link_args.push(format!("-l{}", name));
     }
 
     // LLVM ldflags
@@ -229,8 +234,10 @@ fn main() {
             }
         } else if lib.starts_with("-l") {
             println!("cargo:rustc-link-lib={}", &lib[2..]);
+            bench_link_args.push(lib.to_string());
         } else if lib.starts_with("-L") {
             println!("cargo:rustc-link-search=native={}", &lib[2..]);
+            bench_link_args.push(lib.to_string());
         }
     }
 
@@ -275,4 +282,34 @@ fn main() {
         println!("cargo:rustc-link-lib=static-nobundle=pthread");
         println!("cargo:rustc-link-lib=dylib=uuid");
     }
+
+    println!("cargo:rerun-if-env-changed=RUSTLLVM_BENCH");
+    if env::var_os("RUSTLLVM_BENCH").is_some() {
+        if is_crossed || target.contains("windows") {
+            println!("cargo:warning=RUSTLLVM_BENCH is only supported for native \
+                      builds on unix-like hosts, skipping it");
+        } else {
+            build_bench(bench_cfg, &bench_link_args);
+        }
+    }
+}
+
+// Builds the micro-benchmarks in ../rustllvm/bench into a standalone binary,
+// linked against librustllvm.a and the same LLVM libraries as rustc is.
+fn build_bench(mut cfg: cc::Build, link_args: &[String]) {
+    let out_dir = PathBuf::from(env::var_os("OUT_DIR").expect("OUT_DIR was not set"));
+    let dst = out_dir.join("rustllvm-bench");
+    let mut cmd = cfg.cpp(true).get_compiler().to_command();
+    cmd.arg("../rustllvm/bench/RustLLVMBench.cpp")
+       .arg("-o").arg(&dst)
+       .arg("-L").arg(&out_dir)
+       .arg("-lrustllvm")
+       .args(link_args);
+    let status = cmd.status().unwrap_or_else(|e| {
+        panic!("failed to execute {:?}: {}", cmd, e)
+    });
+    if !status.success() {
+        panic!("failed to build the rustllvm benchmarks: {:?}", cmd);
+    }
+    println!("cargo:warning=rustllvm benchmarks built at {}", dst.display());
 }
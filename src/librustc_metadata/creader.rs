@@ -704,6 +704,53 @@ impl<'a> CrateLoader<'a> {
                                   &|data| data.root.needs_panic_runtime);
     }
 
+    // `-Z whole-program-devirt` lets LLVM assume it knows every vtable a
+    // virtual call could be using, which only holds if every crate that could
+    // create or call through one is built with it. So either all the crates
+    // linked together have it, or none do.
+    fn verify_whole_program_devirt(&self) {
+        let local = self.sess.opts.debugging_opts.whole_program_devirt;
+        let mut any = local;
+        self.cstore.iter_crate_data(|_, data| {
+            any = any || (data.root.whole_program_devirt &&
+                          !data.dep_kind.lock().macros_only());
+        });
+        if !any {
+            return
+        }
+
+        if !local {
+            self.sess.err("this crate depends on crates compiled with \
+                           `-Z whole-program-devirt`, so it has to be compiled \
+                           with it too");
+            return
+        }
+        self.cstore.iter_crate_data(|_, data| {
+            // Like for the panic strategy, compiler-builtins is exempt: it
+            // doesn't have any trait objects.
+            if data.dep_kind.lock().macros_only() || data.root.compiler_builtins ||
+               data.root.whole_program_devirt {
+                return
+            }
+            self.sess.err(&format!("the crate `{}` is not compiled with \
+                                    `-Z whole-program-devirt`, which every crate \
+                                    linked together with it has to be",
+                                   data.root.name));
+        });
+
+        // Anything the dynamic library is linked against, or loaded together
+        // with, could bring vtables that devirtualization never saw along.
+        for ct in self.sess.crate_types.borrow().iter() {
+            match *ct {
+                config::CrateType::Dylib | config::CrateType::Cdylib => {
+                    self.sess.err(&format!("`-Z whole-program-devirt` can't be used \
+                                            for a {} crate", ct));
+                }
+                _ => {}
+            }
+        }
+    }
+
     fn inject_sanitizer_runtime(&mut self) {
         if let Some(ref sanitizer) = self.sess.opts.debugging_opts.sanitizer {
             // Sanitizers can only be used on some tested platforms with
@@ -982,6 +1029,7 @@ impl<'a> CrateLoader<'a> {
         self.inject_profiler_runtime();
         self.inject_allocator_crate(krate);
         self.inject_panic_runtime(krate);
+        self.verify_whole_program_devirt();
 
         if log_enabled!(log::Level::Info) {
             dump_crates(&self.cstore);
@@ -479,6 +479,7 @@ impl<'a, 'tcx> EncodeContext<'a, 'tcx> {
             hash: tcx.crate_hash(LOCAL_CRATE),
             disambiguator: tcx.sess.local_crate_disambiguator(),
             panic_strategy: tcx.sess.panic_strategy(),
+            whole_program_devirt: tcx.sess.opts.debugging_opts.whole_program_devirt,
             edition: hygiene::default_edition(),
             has_global_allocator: has_global_allocator,
             has_panic_handler: has_panic_handler,
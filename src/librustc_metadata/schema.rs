@@ -181,6 +181,7 @@ pub struct CrateRoot {
     pub hash: Svh,
     pub disambiguator: CrateDisambiguator,
     pub panic_strategy: PanicStrategy,
+    pub whole_program_devirt: bool,
     pub edition: Edition,
     pub has_global_allocator: bool,
     pub has_panic_handler: bool,
@@ -753,7 +753,13 @@ pub struct TargetOptions {
     /// to opt out. The default is "aliases".
     ///
     /// Workaround for: https://github.com/rust-lang/rust/issues/57356
-    pub merge_functions: MergeFunctions
+    pub merge_functions: MergeFunctions,
+
+    /// Whether LLVM's MachineOutliner should fold repeated instruction
+    /// sequences into calls to shared functions. This trades speed for size,
+    /// so it's off by default, but it's worth turning on for targets with
+    /// little room for code. LLVM only outlines for AArch64.
+    pub machine_outliner: bool,
 }
 
 impl Default for TargetOptions {
@@ -837,6 +843,7 @@ impl Default for TargetOptions {
             simd_types_indirect: true,
             override_export_symbols: None,
             merge_functions: MergeFunctions::Aliases,
+            machine_outliner: false,
         }
     }
 }
@@ -1142,6 +1149,7 @@ impl Target {
         key!(simd_types_indirect, bool);
         key!(override_export_symbols, opt_list);
         key!(merge_functions, MergeFunctions)?;
+        key!(machine_outliner, bool);
 
         if let Some(array) = obj.find("abi-blacklist").and_then(Json::as_array) {
             for name in array.iter().filter_map(|abi| abi.as_string()) {
@@ -1356,6 +1364,7 @@ impl ToJson for Target {
         target_option_val!(simd_types_indirect);
         target_option_val!(override_export_symbols);
         target_option_val!(merge_functions);
+        target_option_val!(machine_outliner);
 
         if default.abi_blacklist != self.options.abi_blacklist {
             d.insert("abi-blacklist".to_string(), self.options.abi_blacklist.iter()
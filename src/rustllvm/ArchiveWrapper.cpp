@@ -1,8 +1,14 @@
+#include <mutex>
+
 #include "rustllvm.h"
 
 #include "llvm/Object/Archive.h"
 #include "llvm/Object/ArchiveWriter.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/ThreadPool.h"
 
 using namespace llvm;
 using namespace llvm::object;
@@ -29,13 +35,6 @@ struct RustArchiveIterator {
   RustArchiveIterator() : First(true), Err(Error::success()) {}
 };
 
-enum class LLVMRustArchiveKind {
-  Other,
-  GNU,
-  BSD,
-  COFF,
-};
-
 static Archive::Kind fromRust(LLVMRustArchiveKind Kind) {
   switch (Kind) {
   case LLVMRustArchiveKind::GNU:
@@ -49,17 +48,83 @@ static Archive::Kind fromRust(LLVMRustArchiveKind Kind) {
   }
 }
 
-typedef OwningBinary<Archive> *LLVMRustArchiveRef;
+// An archive opened by `LLVMRustOpenArchive`, along with an index of its
+// members by name. The index is only built the first time a member is looked
+// up with `LLVMRustArchiveFindMember`, so archives which are just iterated
+// over don't pay for it. The underlying buffer may be shared with other
+// handles to the same file, see `getArchiveBuffer`.
+struct RustArchive {
+  std::shared_ptr<MemoryBuffer> Buf;
+  std::unique_ptr<Archive> Ar;
+  bool Indexed;
+  StringMap<StringRef> Index;
+
+  RustArchive(std::shared_ptr<MemoryBuffer> Buf, std::unique_ptr<Archive> Ar)
+      : Buf(std::move(Buf)), Ar(std::move(Ar)), Indexed(false) {}
+};
+
+typedef RustArchive *LLVMRustArchiveRef;
 typedef RustArchiveMember *LLVMRustArchiveMemberRef;
 typedef Archive::Child *LLVMRustArchiveChildRef;
 typedef Archive::Child const *LLVMRustArchiveChildConstRef;
 typedef RustArchiveIterator *LLVMRustArchiveIteratorRef;
 
-extern "C" LLVMRustArchiveRef LLVMRustOpenArchive(char *Path) {
+// The name of `Child` as rustc sees it. Members of thin archives are named by
+// their path relative to the archive, which is just the file name when they
+// live next to it; rustc always looks members up by file name, so that's
+// what they're named here too.
+static StringRef memberName(const Archive::Child &Child, StringRef Name) {
+  if (Child.getParent()->isThin())
+    return sys::path::filename(Name);
+  return Name;
+}
+
+// The same rlib tends to get opened over and over, for example to load its
+// metadata and then again to link it, so the mapped files are shared between
+// all open handles to them. Entries are keyed by path and checked against the
+// file's modification time and size, so a file which is rewritten in the
+// meantime is mapped afresh. Only weak references are kept here: once the
+// last handle to an archive is closed, its buffer goes away as it otherwise
+// would.
+namespace {
+struct CachedArchiveBuffer {
+  std::weak_ptr<MemoryBuffer> Buf;
+  sys::TimePoint<> ModTime;
+  uint64_t Size = 0;
+};
+}
+
+static std::mutex ArchiveBufferCacheLock;
+static ManagedStatic<StringMap<CachedArchiveBuffer>> ArchiveBufferCache;
+
+static ErrorOr<std::shared_ptr<MemoryBuffer>> getArchiveBuffer(StringRef Path) {
+  sys::fs::file_status Status;
+  if (std::error_code EC = sys::fs::status(Path, Status))
+    return EC;
+
+  std::lock_guard<std::mutex> Lock(ArchiveBufferCacheLock);
+  CachedArchiveBuffer &Entry = (*ArchiveBufferCache)[Path];
+  if (Entry.ModTime == Status.getLastModificationTime() &&
+      Entry.Size == Status.getSize()) {
+    if (std::shared_ptr<MemoryBuffer> Buf = Entry.Buf.lock())
+      return Buf;
+  }
+
   ErrorOr<std::unique_ptr<MemoryBuffer>> BufOr =
       MemoryBuffer::getFile(Path, -1, false);
+  if (!BufOr)
+    return BufOr.getError();
+  std::shared_ptr<MemoryBuffer> Buf = std::move(BufOr.get());
+  Entry.Buf = Buf;
+  Entry.ModTime = Status.getLastModificationTime();
+  Entry.Size = Status.getSize();
+  return Buf;
+}
+
+extern "C" LLVMRustArchiveRef LLVMRustOpenArchive(char *Path) {
+  ErrorOr<std::shared_ptr<MemoryBuffer>> BufOr = getArchiveBuffer(Path);
   if (!BufOr) {
-    LLVMRustSetLastError(BufOr.getError().message().c_str());
+    LLVMRustSetLastErrorCode(BufOr.getError());
     return nullptr;
   }
 
@@ -71,8 +136,8 @@ extern "C" LLVMRustArchiveRef LLVMRustOpenArchive(char *Path) {
     return nullptr;
   }
 
-  OwningBinary<Archive> *Ret = new OwningBinary<Archive>(
-      std::move(ArchiveOr.get()), std::move(BufOr.get()));
+  RustArchive *Ret = new RustArchive(std::move(BufOr.get()),
+                                     std::move(ArchiveOr.get()));
 
   return Ret;
 }
@@ -83,7 +148,7 @@ extern "C" void LLVMRustDestroyArchive(LLVMRustArchiveRef RustArchive) {
 
 extern "C" LLVMRustArchiveIteratorRef
 LLVMRustArchiveIteratorNew(LLVMRustArchiveRef RustArchive) {
-  Archive *Archive = RustArchive->getBinary();
+  Archive *Archive = RustArchive->Ar.get();
   RustArchiveIterator *RAI = new RustArchiveIterator();
   RAI->Cur = Archive->child_begin(RAI->Err);
   if (RAI->Err) {
@@ -125,6 +190,65 @@ LLVMRustArchiveIteratorNext(LLVMRustArchiveIteratorRef RAI) {
   return Ret;
 }
 
+// The name and data of one archive member, as filled in by
+// `LLVMRustArchiveIteratorNextBatch`.
+struct LLVMRustArchiveChildInfo {
+  const char *Name;
+  size_t NameLen;
+  const char *Data;
+  size_t DataLen;
+};
+
+// Like calling `LLVMRustArchiveIteratorNext` (plus `LLVMRustArchiveChildName`
+// and `LLVMRustArchiveChildData`) up to `Capacity` times, except each child is
+// written straight into `Out` rather than allocated. Returns how many children
+// were written, where anything less than `Capacity` means the end of the
+// archive was reached or an error happened, in which case the last error is
+// set. A child whose name can't be read gets a null `Name`, same as
+// `LLVMRustArchiveChildName` would return.
+extern "C" size_t
+LLVMRustArchiveIteratorNextBatch(LLVMRustArchiveIteratorRef RAI,
+                                 LLVMRustArchiveChildInfo *Out,
+                                 size_t Capacity) {
+  size_t N = 0;
+  while (N < Capacity && RAI->Cur != RAI->End) {
+    // See `LLVMRustArchiveIteratorNext` for why the iterator is advanced
+    // before fetching a child instead of after.
+    if (!RAI->First) {
+      ++RAI->Cur;
+      if (RAI->Err) {
+        LLVMRustSetLastError(toString(std::move(RAI->Err)).c_str());
+        return N;
+      }
+      if (RAI->Cur == RAI->End)
+        break;
+    } else {
+      RAI->First = false;
+    }
+
+    const Archive::Child &Child = *RAI->Cur.operator->();
+    Expected<StringRef> BufOrErr = Child.getBuffer();
+    if (!BufOrErr) {
+      LLVMRustSetLastError(toString(BufOrErr.takeError()).c_str());
+      return N;
+    }
+    LLVMRustArchiveChildInfo &Info = Out[N++];
+    Info.Data = BufOrErr->data();
+    Info.DataLen = BufOrErr->size();
+    Expected<StringRef> NameOrErr = Child.getName();
+    if (NameOrErr) {
+      StringRef Name = memberName(Child, *NameOrErr);
+      Info.Name = Name.data();
+      Info.NameLen = Name.size();
+    } else {
+      consumeError(NameOrErr.takeError());
+      Info.Name = nullptr;
+      Info.NameLen = 0;
+    }
+  }
+  return N;
+}
+
 extern "C" void LLVMRustArchiveChildFree(LLVMRustArchiveChildRef Child) {
   delete Child;
 }
@@ -143,7 +267,7 @@ LLVMRustArchiveChildName(LLVMRustArchiveChildConstRef Child, size_t *Size) {
     LLVMRustSetLastError(toString(NameOrErr.takeError()).c_str());
     return nullptr;
   }
-  StringRef Name = NameOrErr.get();
+  StringRef Name = memberName(*Child, NameOrErr.get());
   *Size = Name.size();
   return Name.data();
 }
@@ -161,6 +285,56 @@ extern "C" const char *LLVMRustArchiveChildData(LLVMRustArchiveChildRef Child,
   return Buf.data();
 }
 
+// Members whose name or data can't be read are left out of the index rather
+// than failing the whole lookup, as they can't be what anybody is looking for
+// anyway. Only an archive which can't be walked at all is an error.
+static bool buildArchiveIndex(RustArchive *RustArchive) {
+  Error Err = Error::success();
+  Archive *Archive = RustArchive->Ar.get();
+  for (const Archive::Child &Child : Archive->children(Err)) {
+    Expected<StringRef> NameOrErr = Child.getName();
+    if (!NameOrErr) {
+      consumeError(NameOrErr.takeError());
+      continue;
+    }
+    Expected<StringRef> BufOrErr = Child.getBuffer();
+    if (!BufOrErr) {
+      consumeError(BufOrErr.takeError());
+      continue;
+    }
+    // Names are trimmed the same way rustc trims them when iterating, and if
+    // there's more than one member by the same name the first one wins, same
+    // as a linear search would.
+    RustArchive->Index.insert(
+        std::make_pair(memberName(Child, *NameOrErr).trim(), *BufOrErr));
+  }
+  if (Err) {
+    LLVMRustSetLastError(toString(std::move(Err)).c_str());
+    return false;
+  }
+  return true;
+}
+
+// Returns the data of the first member called `Name`, or null if there's no
+// such member. If the archive turns out to be malformed that's also null, but
+// with the last error set.
+extern "C" const char *
+LLVMRustArchiveFindMember(LLVMRustArchiveRef RustArchive, const char *Name,
+                          size_t NameLen, size_t *Size) {
+  if (!RustArchive->Indexed) {
+    if (!buildArchiveIndex(RustArchive)) {
+      RustArchive->Index.clear();
+      return nullptr;
+    }
+    RustArchive->Indexed = true;
+  }
+  auto It = RustArchive->Index.find(StringRef(Name, NameLen));
+  if (It == RustArchive->Index.end())
+    return nullptr;
+  *Size = It->second.size();
+  return It->second.data();
+}
+
 extern "C" LLVMRustArchiveMemberRef
 LLVMRustArchiveMemberNew(char *Filename, char *Name,
                          LLVMRustArchiveChildRef Child) {
@@ -176,38 +350,92 @@ extern "C" void LLVMRustArchiveMemberFree(LLVMRustArchiveMemberRef Member) {
   delete Member;
 }
 
+// Touches every page of `Buf`, so that if it's a mapped file it's read in now
+// rather than whenever `writeArchive` gets around to parsing it.
+static void prefaultBuffer(const MemoryBuffer &Buf) {
+  const volatile char *Data = Buf.getBufferStart();
+  size_t PageSize = sys::Process::getPageSize();
+  for (size_t I = 0; I < Buf.getBufferSize(); I += PageSize)
+    (void)Data[I];
+}
+
+// Writes an archive of `NumMembers` members to `Dst`. Members in files are
+// memory mapped rather than copied, and with more than one of `NumThreads`
+// they're opened and read in on a thread pool. Building the symbol table and
+// writing the output is still done by LLVM's `writeArchive` in one pass, but
+// by then all the members are already in memory and it isn't waiting on the
+// disk for each one in turn.
+//
+// With `Thin` a GNU thin archive is written instead, which only refers to its
+// members by their paths (relative to `Dst`), so those files have to stay put
+// for as long as the archive is used. Members of other archives can't be
+// referred to like that, so every member has to be a file.
 extern "C" LLVMRustResult
 LLVMRustWriteArchive(char *Dst, size_t NumMembers,
                      const LLVMRustArchiveMemberRef *NewMembers,
-                     bool WriteSymbtab, LLVMRustArchiveKind RustKind) {
+                     bool WriteSymbtab, LLVMRustArchiveKind RustKind,
+                     unsigned NumThreads, bool Thin) {
 
-  std::vector<NewArchiveMember> Members;
+  std::vector<NewArchiveMember> Members(NumMembers);
+  std::vector<std::string> Errors(NumMembers);
   auto Kind = fromRust(RustKind);
+  if (Thin) {
+    if (Kind != Archive::K_GNU) {
+      LLVMRustSetLastError("thin archives have to be GNU archives");
+      return LLVMRustResult::Failure;
+    }
+    for (size_t I = 0; I < NumMembers; I++) {
+      if (!NewMembers[I]->Filename) {
+        LLVMRustSetLastError("thin archives can only refer to files");
+        return LLVMRustResult::Failure;
+      }
+    }
+  }
 
-  for (size_t I = 0; I < NumMembers; I++) {
+  auto LoadMember = [&](size_t I) {
     auto Member = NewMembers[I];
     assert(Member->Name);
     if (Member->Filename) {
       Expected<NewArchiveMember> MOrErr =
           NewArchiveMember::getFile(Member->Filename, true);
       if (!MOrErr) {
-        LLVMRustSetLastError(toString(MOrErr.takeError()).c_str());
-        return LLVMRustResult::Failure;
+        Errors[I] = toString(MOrErr.takeError());
+        return;
       }
-      MOrErr->MemberName = sys::path::filename(MOrErr->MemberName);
-      Members.push_back(std::move(*MOrErr));
+      // `writeArchive` works out where the files of thin archives' members
+      // are relative to the archive from their full paths.
+      if (!Thin)
+        MOrErr->MemberName = sys::path::filename(MOrErr->MemberName);
+      if (NumThreads > 1)
+        prefaultBuffer(*MOrErr->Buf);
+      Members[I] = std::move(*MOrErr);
     } else {
       Expected<NewArchiveMember> MOrErr =
           NewArchiveMember::getOldMember(Member->Child, true);
       if (!MOrErr) {
-        LLVMRustSetLastError(toString(MOrErr.takeError()).c_str());
-        return LLVMRustResult::Failure;
+        Errors[I] = toString(MOrErr.takeError());
+        return;
       }
-      Members.push_back(std::move(*MOrErr));
+      Members[I] = std::move(*MOrErr);
+    }
+  };
+  if (NumThreads > 1 && NumMembers > 1) {
+    ThreadPool Pool(std::min<size_t>(NumThreads, NumMembers));
+    for (size_t I = 0; I < NumMembers; I++)
+      Pool.async(LoadMember, I);
+    Pool.wait();
+  } else {
+    for (size_t I = 0; I < NumMembers; I++)
+      LoadMember(I);
+  }
+  for (size_t I = 0; I < NumMembers; I++) {
+    if (!Members[I].Buf) {
+      LLVMRustSetLastError(Errors[I].c_str());
+      return LLVMRustResult::Failure;
     }
   }
 
-  auto Result = writeArchive(Dst, Members, WriteSymbtab, Kind, true, false);
+  auto Result = writeArchive(Dst, Members, WriteSymbtab, Kind, true, Thin);
   if (!Result)
     return LLVMRustResult::Success;
   LLVMRustSetLastError(toString(std::move(Result)).c_str());
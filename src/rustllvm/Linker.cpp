@@ -1,3 +1,4 @@
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Linker/Linker.h"
 
 #include "rustllvm.h"
@@ -7,10 +8,31 @@ using namespace llvm;
 struct RustLinker {
   Linker L;
   LLVMContext &Ctx;
+  Module &Dst;
+
+  // Everything below is only used by linkers created with
+  // `LLVMRustLinkerNewOnlyNeeded`, which only link in what's actually
+  // referenced (or preserved) instead of every module in its entirety.
+  bool OnlyNeeded;
+  StringSet<> Preserved;
+  // Every module added so far, parsed lazily and not linked in until
+  // `LLVMRustLinkerFinish`, along with the names of the symbols each one
+  // declares...
+  std::vector<std::unique_ptr<Module>> Pending;
+  std::vector<std::vector<std::string>> Refs;
+  // ... and which of them (the first, if there's more than one) defines each
+  // external symbol.
+  StringMap<size_t> DefinedIn;
+  // The modules which define appending globals (`llvm.used`,
+  // `llvm.global_ctors`, ...), which have to be linked in whether or not
+  // anything references them.
+  std::vector<size_t> Roots;
 
   RustLinker(Module &M) :
     L(M),
-    Ctx(M.getContext())
+    Ctx(M.getContext()),
+    Dst(M),
+    OnlyNeeded(false)
   {}
 };
 
@@ -22,18 +44,52 @@ LLVMRustLinkerNew(LLVMModuleRef DstRef) {
   return Ret.release();
 }
 
+// Creates a linker which links modules with `Linker::LinkOnlyNeeded`, so a
+// definition is only ever materialized and linked in if it's referenced from
+// what's already linked or is one of the `NumSymbols` symbols in `Symbols`.
+// Everything else would just be internalized and deleted by
+// `LLVMRustRunRestrictionPass` afterwards anyway.
+//
+// Modules added to it are only parsed, and `LLVMRustLinkerFinish` has to be
+// called once they've all been added to actually link them in.
+extern "C" RustLinker*
+LLVMRustLinkerNewOnlyNeeded(LLVMModuleRef DstRef, char **Symbols,
+                            size_t NumSymbols) {
+  Module *Dst = unwrap(DstRef);
+
+  auto Ret = llvm::make_unique<RustLinker>(*Dst);
+  Ret->OnlyNeeded = true;
+  for (size_t I = 0; I < NumSymbols; I++)
+    Ret->Preserved.insert(Symbols[I]);
+  return Ret.release();
+}
+
 extern "C" void
 LLVMRustLinkerFree(RustLinker *L) {
   delete L;
 }
 
-extern "C" bool
-LLVMRustLinkerAdd(RustLinker *L, char *BC, size_t Len) {
-  std::unique_ptr<MemoryBuffer> Buf =
-      MemoryBuffer::getMemBufferCopy(StringRef(BC, Len));
+// Adds a declaration of `GV` to `M`, which gives `LinkOnlyNeeded` a reason to
+// link in its definition.
+static void declareInModule(Module &M, const GlobalValue &GV) {
+  if (auto *FTy = dyn_cast<FunctionType>(GV.getValueType())) {
+    Function::Create(FTy, GlobalValue::ExternalLinkage, GV.getName(), &M);
+    return;
+  }
+  new GlobalVariable(M, GV.getValueType(), /* isConstant = */ false,
+                     GlobalValue::ExternalLinkage, nullptr, GV.getName());
+}
 
+// Links the bitcode module in `Buf` into the destination module. The buffer
+// isn't copied: the module is only parsed lazily out of it and then destroyed
+// once it's been linked in, so all the buffer needs to do is outlive this
+// call (or, for `OnlyNeeded` linkers, the linker).
+//
+// `OnlyNeeded` linkers only parse the module here and keep it around for
+// `LLVMRustLinkerFinish` to link in.
+static bool linkBitcode(RustLinker *L, MemoryBufferRef Buf) {
   Expected<std::unique_ptr<Module>> SrcOrError =
-      llvm::getLazyBitcodeModule(Buf->getMemBufferRef(), L->Ctx);
+      llvm::getLazyBitcodeModule(Buf, L->Ctx);
   if (!SrcOrError) {
     LLVMRustSetLastError(toString(SrcOrError.takeError()).c_str());
     return false;
@@ -41,9 +97,133 @@ LLVMRustLinkerAdd(RustLinker *L, char *BC, size_t Len) {
 
   auto Src = std::move(*SrcOrError);
 
+  if (L->OnlyNeeded) {
+    size_t Index = L->Pending.size();
+    std::vector<std::string> Refs;
+    bool IsRoot = false;
+    for (const GlobalValue &GV : Src->global_values()) {
+      if (GV.hasLocalLinkage() || !GV.hasName())
+        continue;
+      if (GV.hasAppendingLinkage())
+        IsRoot = true;
+      else if (GV.isDeclaration())
+        Refs.push_back(GV.getName().str());
+      else
+        L->DefinedIn.insert(std::make_pair(GV.getName(), Index));
+    }
+    if (IsRoot)
+      L->Roots.push_back(Index);
+    L->Pending.push_back(std::move(Src));
+    L->Refs.push_back(std::move(Refs));
+    return true;
+  }
+
   if (L->L.linkInModule(std::move(Src))) {
     LLVMRustSetLastError("");
     return false;
   }
   return true;
 }
+
+extern "C" bool
+LLVMRustLinkerAdd(RustLinker *L, char *BC, size_t Len) {
+  return linkBitcode(L, MemoryBufferRef(StringRef(BC, Len), ""));
+}
+
+// Just an argument to `LLVMRustLinkerAddBatch` below.
+struct LLVMRustLinkerInput {
+  const char *data;
+  size_t len;
+};
+
+// Links all of `Inputs` in order, as if by calling `LLVMRustLinkerAdd` on
+// each of them. If one fails to link, `*FailedIndex` is set to its index and
+// nothing after it is linked.
+//
+// Note that the modules are parsed one at a time into the destination's
+// context: they can't be parsed concurrently as an `LLVMContext` isn't thread
+// safe, and modules parsed in other contexts can't be linked in.
+extern "C" bool
+LLVMRustLinkerAddBatch(RustLinker *L, const LLVMRustLinkerInput *Inputs,
+                       size_t NumInputs, size_t *FailedIndex) {
+  for (size_t I = 0; I < NumInputs; I++) {
+    StringRef BC(Inputs[I].data, Inputs[I].len);
+    if (!linkBitcode(L, MemoryBufferRef(BC, ""))) {
+      *FailedIndex = I;
+      return false;
+    }
+  }
+  return true;
+}
+
+// For `OnlyNeeded` linkers, links in every module which was added and defines
+// something that's needed. Doesn't do anything for other linkers.
+//
+// What's needed is worked out up front, a module at a time: the modules that
+// define a preserved symbol, something the destination declares or an
+// appending global (which keeps `#[used]` statics and constructors), and then
+// the modules defining anything one of those declares, and so on. Every
+// symbol declared along the way is then declared in the destination too, so
+// that whichever needed module is linked in first, and only once, brings along
+// every definition that's needed from it. Linking a module in more than once
+// would duplicate its local symbols.
+extern "C" bool
+LLVMRustLinkerFinish(RustLinker *L) {
+  if (!L->OnlyNeeded)
+    return true;
+
+  std::vector<bool> Needed(L->Pending.size(), false);
+  std::vector<size_t> Worklist;
+  std::vector<StringRef> Wanted;
+  auto Want = [&](StringRef Name) {
+    auto It = L->DefinedIn.find(Name);
+    if (It == L->DefinedIn.end())
+      return;
+    Wanted.push_back(It->getKey());
+    if (!Needed[It->second]) {
+      Needed[It->second] = true;
+      Worklist.push_back(It->second);
+    }
+  };
+
+  for (const GlobalValue &GV : L->Dst.global_values())
+    if (GV.isDeclaration() && GV.hasName())
+      Want(GV.getName());
+  for (const auto &Sym : L->Preserved)
+    Want(Sym.getKey());
+  for (size_t I : L->Roots) {
+    if (!Needed[I]) {
+      Needed[I] = true;
+      Worklist.push_back(I);
+    }
+  }
+  while (!Worklist.empty()) {
+    size_t I = Worklist.back();
+    Worklist.pop_back();
+    for (const std::string &Ref : L->Refs[I])
+      Want(Ref);
+  }
+
+  for (StringRef Name : Wanted) {
+    if (L->Dst.getNamedValue(Name))
+      continue;
+    const Module &Src = *L->Pending[L->DefinedIn[Name]];
+    declareInModule(L->Dst, *Src.getNamedValue(Name));
+  }
+
+  // In the order they were added, like any other linker.
+  for (size_t I = 0; I < L->Pending.size(); I++) {
+    std::unique_ptr<Module> Src = std::move(L->Pending[I]);
+    if (!Needed[I])
+      continue;
+    if (L->L.linkInModule(std::move(Src), Linker::Flags::LinkOnlyNeeded)) {
+      LLVMRustSetLastError("");
+      return false;
+    }
+  }
+  L->Pending.clear();
+  L->Refs.clear();
+  L->DefinedIn.clear();
+  L->Roots.clear();
+  return true;
+}
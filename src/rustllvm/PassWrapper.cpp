@@ -1,24 +1,63 @@
 #include <stdio.h>
 
+#include <chrono>
+#include <map>
+#include <mutex>
 #include <vector>
 #include <set>
 
 #include "rustllvm.h"
 
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/BitstreamReader.h"
+#include "llvm/Bitcode/LLVMBitCodes.h"
+#include "llvm/CodeGen/ParallelCG.h"
 #include "llvm/CodeGen/TargetSubtargetInfo.h"
 #include "llvm/IR/AutoUpgrade.h"
 #include "llvm/IR/AssemblyAnnotationWriter.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Mangler.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/MC/MCAsmBackend.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCCodeEmitter.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCObjectWriter.h"
+#include "llvm/MC/MCParser/MCAsmParser.h"
+#include "llvm/MC/MCParser/MCTargetAsmParser.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCStreamer.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/CBindingWrapping.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/DataExtractor.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/IPO/AlwaysInliner.h"
 #include "llvm/Transforms/IPO/FunctionImport.h"
+#if LLVM_VERSION_GE(8, 0)
+#include "llvm/Transforms/Instrumentation/MemorySanitizer.h"
+#include "llvm/Transforms/Instrumentation/ThreadSanitizer.h"
+#endif
+#include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/FunctionImportUtils.h"
+#include "llvm/Transforms/Utils/NameAnonGlobals.h"
 #include "llvm/LTO/LTO.h"
 
 #include "llvm-c/Transforms/PassManagerBuilder.h"
@@ -91,6 +130,93 @@ extern "C" void LLVMRustAddPass(LLVMPassManagerRef PMR, LLVMPassRef RustPass) {
   PMB->add(Pass);
 }
 
+enum class LLVMRustSanitizer {
+  None,
+  Address,
+  Memory,
+  Thread,
+};
+
+// Mirrors `SanitizerCoverageOptions`; `CoverageLevel` is 0 when no coverage
+// instrumentation was asked for and otherwise 1 (functions), 2 (basic blocks)
+// or 3 (edges).
+struct LLVMRustSanitizerOptions {
+  LLVMRustSanitizer Sanitizer;
+  bool Recover;
+  int CoverageLevel;
+  bool TracePCGuard;
+  bool Inline8bitCounters;
+  bool PCTable;
+  bool TraceCmp;
+  bool TraceDiv;
+  bool TraceGep;
+  bool IndirectCalls;
+  bool StackDepth;
+};
+
+// Adds the instrumentation passes for `Opts` to a module pass manager. This
+// is meant to run after the optimization pipeline so that only the code which
+// survived optimization is instrumented.
+extern "C" void
+LLVMRustAddSanitizerPasses(LLVMPassManagerRef PMR,
+                           const LLVMRustSanitizerOptions *Opts) {
+  PassManagerBase *PMB = unwrap(PMR);
+
+  if (Opts->CoverageLevel != 0) {
+    SanitizerCoverageOptions Coverage;
+    switch (Opts->CoverageLevel) {
+    case 1:
+      Coverage.CoverageType = SanitizerCoverageOptions::SCK_Function;
+      break;
+    case 2:
+      Coverage.CoverageType = SanitizerCoverageOptions::SCK_BB;
+      break;
+    case 3:
+      Coverage.CoverageType = SanitizerCoverageOptions::SCK_Edge;
+      break;
+    default:
+      report_fatal_error("Bad SanitizerCoverage level.");
+    }
+    Coverage.TracePCGuard = Opts->TracePCGuard;
+    Coverage.Inline8bitCounters = Opts->Inline8bitCounters;
+    Coverage.PCTable = Opts->PCTable;
+    Coverage.TraceCmp = Opts->TraceCmp;
+    Coverage.TraceDiv = Opts->TraceDiv;
+    Coverage.TraceGep = Opts->TraceGep;
+    Coverage.IndirectCalls = Opts->IndirectCalls;
+    Coverage.StackDepth = Opts->StackDepth;
+    PMB->add(createSanitizerCoverageModulePass(Coverage));
+  }
+
+  switch (Opts->Sanitizer) {
+  case LLVMRustSanitizer::None:
+    break;
+  case LLVMRustSanitizer::Address:
+    PMB->add(createAddressSanitizerFunctionPass(/*CompileKernel=*/false,
+                                                Opts->Recover));
+    PMB->add(createAddressSanitizerModulePass(/*CompileKernel=*/false,
+                                              Opts->Recover));
+    break;
+  case LLVMRustSanitizer::Memory:
+#if LLVM_VERSION_GE(8, 0)
+    PMB->add(createMemorySanitizerLegacyPassPass(/*TrackOrigins=*/0,
+                                                 Opts->Recover));
+#else
+    PMB->add(createMemorySanitizerPass(/*TrackOrigins=*/0, Opts->Recover));
+#endif
+    break;
+  case LLVMRustSanitizer::Thread:
+#if LLVM_VERSION_GE(8, 0)
+    PMB->add(createThreadSanitizerLegacyPassPass());
+#else
+    PMB->add(createThreadSanitizerPass());
+#endif
+    break;
+  default:
+    report_fatal_error("Bad LLVMRustSanitizer.");
+  }
+}
+
 extern "C"
 void LLVMRustPassManagerBuilderPopulateThinLTOPassManager(
   LLVMPassManagerBuilderRef PMBR,
@@ -187,6 +313,54 @@ extern "C" bool LLVMRustHasFeature(LLVMTargetMachineRef TM,
   return MCInfo->checkFeatures(std::string("+") + Feature);
 }
 
+#ifdef LLVM_RUSTLLVM
+// Adds everything implied by `Implies`, transitively, to `Bits`, the same way
+// `MCSubtargetInfo` does when it applies a `+feature` flag.
+static void setImpliedBits(FeatureBitset &Bits, const FeatureBitset &Implies,
+                           ArrayRef<SubtargetFeatureKV> FeatTable) {
+  for (auto &FE : FeatTable) {
+    if ((FE.Value & Implies).any()) {
+      Bits |= FE.Value;
+      setImpliedBits(Bits, FE.Implies, FeatTable);
+    }
+  }
+}
+#endif
+
+// Sets `Enabled[I]` to whether `Features[I]` is enabled for `TM`, for each of
+// the `NumFeatures` features, which is the same as calling
+// `LLVMRustHasFeature` on each of them in turn. With our LLVM the feature
+// table and bits are only looked up once and each feature is found with a
+// binary search of the (sorted) table rather than by parsing a feature string
+// and applying it to a fresh bitset.
+extern "C" void LLVMRustHasFeatures(LLVMTargetMachineRef TM,
+                                    const char *const *Features,
+                                    size_t NumFeatures, bool *Enabled) {
+  TargetMachine *Target = unwrap(TM);
+  const MCSubtargetInfo *MCInfo = Target->getMCSubtargetInfo();
+#ifdef LLVM_RUSTLLVM
+  const FeatureBitset &Bits = MCInfo->getFeatureBits();
+  const ArrayRef<SubtargetFeatureKV> FeatTable = MCInfo->getFeatureTable();
+  for (size_t I = 0; I < NumFeatures; I++) {
+    StringRef Feature(Features[I]);
+    auto FE = std::lower_bound(
+        FeatTable.begin(), FeatTable.end(), Feature,
+        [](const SubtargetFeatureKV &KV, StringRef Key) { return KV.Key < Key; });
+    if (FE == FeatTable.end() || Feature != FE->Key) {
+      // `checkFeatures` ignores unknown features, so they always "match".
+      Enabled[I] = true;
+      continue;
+    }
+    FeatureBitset Needed = FE->Value;
+    setImpliedBits(Needed, FE->Implies, FeatTable);
+    Enabled[I] = (Bits & Needed) == Needed;
+  }
+#else
+  for (size_t I = 0; I < NumFeatures; I++)
+    Enabled[I] = MCInfo->checkFeatures(std::string("+") + Features[I]);
+#endif
+}
+
 enum class LLVMRustCodeModel {
   Other,
   Small,
@@ -320,13 +494,107 @@ extern "C" void LLVMRustPrintTargetFeatures(LLVMTargetMachineRef) {
 }
 #endif
 
+// What LLVM detects about the host, which is probed only once per process:
+// it's asked for on every `-C target-cpu=native` compile, and probing can be
+// slow (e.g. when `cpuid` traps to a hypervisor).
+struct HostCPUInfo {
+  std::string Name;
+  // Comma separated `+feature` and `-feature` flags for every feature LLVM
+  // detected as present or absent, sorted by name. Empty if LLVM can't
+  // detect the host's features.
+  std::string Features;
+
+  HostCPUInfo() : Name(sys::getHostCPUName()) {
+    StringMap<bool> HostFeatures;
+    if (!sys::getHostCPUFeatures(HostFeatures))
+      return;
+    std::vector<StringRef> Keys;
+    for (auto &F : HostFeatures)
+      Keys.push_back(F.getKey());
+    std::sort(Keys.begin(), Keys.end());
+    for (StringRef Key : Keys) {
+      if (!Features.empty())
+        Features += ',';
+      Features += HostFeatures[Key] ? '+' : '-';
+      Features += Key;
+    }
+  }
+};
+
+static const HostCPUInfo &getHostCPUInfo() {
+  static const HostCPUInfo Info;
+  return Info;
+}
+
 extern "C" const char* LLVMRustGetHostCPUName(size_t *len) {
-  StringRef Name = sys::getHostCPUName();
+  const std::string &Name = getHostCPUInfo().Name;
   *len = Name.size();
   return Name.data();
 }
 
-extern "C" LLVMTargetMachineRef LLVMRustCreateTargetMachine(
+// Returns the host CPU's name, as `LLVMRustGetHostCPUName` does, and stores
+// its features (in the same format as a `target-features` attribute) in
+// `*Features` and `*FeaturesLen`. Both strings live until the process exits.
+extern "C" const char* LLVMRustGetHostCPUInfo(size_t *NameLen,
+                                              const char **Features,
+                                              size_t *FeaturesLen) {
+  const HostCPUInfo &Info = getHostCPUInfo();
+  *NameLen = Info.Name.size();
+  *Features = Info.Features.data();
+  *FeaturesLen = Info.Features.size();
+  return Info.Name.data();
+}
+
+// Everything needed to create a `TargetMachine`, resolved once up front so
+// that creating each one is just a matter of calling `createTargetMachine`.
+// rustc creates at least one target machine per codegen unit and LTO worker,
+// all with the same settings, so there's no point going through the target
+// registry and building the `TargetOptions` again for each of them.
+//
+// A factory is immutable once created, apart from the data layout below, so
+// target machines can be created from it on any number of threads at once.
+struct LLVMRustTargetMachineFactory {
+  const llvm::Target *TheTarget;
+  std::string Triple;
+  std::string CPU;
+  std::string Features;
+  TargetOptions Options;
+  Optional<Reloc::Model> RM;
+  Optional<CodeModel::Model> CM;
+  CodeGenOpt::Level OptLevel;
+
+  // The data layout of the target machines this creates, which is only worked
+  // out (by creating one of them) the first time it's asked for.
+  std::once_flag DataLayoutOnce;
+  std::string DataLayout;
+};
+
+static TargetMachine *
+createTargetMachineFromFactory(const LLVMRustTargetMachineFactory *Factory) {
+  return Factory->TheTarget->createTargetMachine(
+      Factory->Triple, Factory->CPU, Factory->Features, Factory->Options,
+      Factory->RM, Factory->CM, Factory->OptLevel);
+}
+
+enum class LLVMRustDebugCompression {
+  None,
+  Zlib,
+  ZlibGnu,
+};
+
+static DebugCompressionType fromRust(LLVMRustDebugCompression Compression) {
+  switch (Compression) {
+  case LLVMRustDebugCompression::None:
+    return DebugCompressionType::None;
+  case LLVMRustDebugCompression::Zlib:
+    return DebugCompressionType::Z;
+  case LLVMRustDebugCompression::ZlibGnu:
+    return DebugCompressionType::GNU;
+  }
+  report_fatal_error("Bad DebugCompression.");
+}
+
+extern "C" LLVMRustTargetMachineFactory *LLVMRustCreateTargetMachineFactory(
     const char *TripleStr, const char *CPU, const char *Feature,
     LLVMRustCodeModel RustCM, LLVMRustRelocMode RustReloc,
     LLVMRustCodeGenOptLevel RustOptLevel, bool UseSoftFloat,
@@ -335,21 +603,32 @@ extern "C" LLVMTargetMachineRef LLVMRustCreateTargetMachine(
     bool TrapUnreachable,
     bool Singlethread,
     bool AsmComments,
-    bool EmitStackSizeSection) {
+    bool EmitStackSizeSection,
+    LLVMRustDebugCompression CompressDebugSections,
+    bool EnableMachineOutliner) {
+
+  if (CompressDebugSections != LLVMRustDebugCompression::None &&
+      !zlib::isAvailable()) {
+    LLVMRustSetLastError("debug sections can't be compressed, "
+                         "LLVM was built without zlib");
+    return nullptr;
+  }
 
-  auto OptLevel = fromRust(RustOptLevel);
-  auto RM = fromRust(RustReloc);
+  auto Ret = llvm::make_unique<LLVMRustTargetMachineFactory>();
+  Ret->OptLevel = fromRust(RustOptLevel);
+  Ret->RM = fromRust(RustReloc);
 
   std::string Error;
-  Triple Trip(Triple::normalize(TripleStr));
-  const llvm::Target *TheTarget =
-      TargetRegistry::lookupTarget(Trip.getTriple(), Error);
-  if (TheTarget == nullptr) {
+  Ret->Triple = Triple::normalize(TripleStr);
+  Ret->TheTarget = TargetRegistry::lookupTarget(Ret->Triple, Error);
+  if (Ret->TheTarget == nullptr) {
     LLVMRustSetLastError(Error.c_str());
     return nullptr;
   }
+  Ret->CPU = CPU;
+  Ret->Features = Feature;
 
-  TargetOptions Options;
+  TargetOptions &Options = Ret->Options;
 
   Options.FloatABIType = FloatABI::Default;
   if (UseSoftFloat) {
@@ -373,13 +652,67 @@ extern "C" LLVMTargetMachineRef LLVMRustCreateTargetMachine(
   }
 
   Options.EmitStackSizeSection = EmitStackSizeSection;
+  Options.CompressDebugSections = fromRust(CompressDebugSections);
+#if LLVM_VERSION_GE(7, 0)
+  // The outliner folds repeated instruction sequences into calls to shared
+  // functions after register allocation, which only pays off when code size
+  // matters more than the calls it adds. LLVM only adds the pass for targets
+  // which support outlining by default, which is just AArch64 here; the rest
+  // ignore this.
+  Options.EnableMachineOutliner = EnableMachineOutliner;
+#endif
 
-  Optional<CodeModel::Model> CM;
   if (RustCM != LLVMRustCodeModel::None)
-    CM = fromRust(RustCM);
-  TargetMachine *TM = TheTarget->createTargetMachine(
-      Trip.getTriple(), CPU, Feature, Options, RM, CM, OptLevel);
-  return wrap(TM);
+    Ret->CM = fromRust(RustCM);
+  return Ret.release();
+}
+
+extern "C" void
+LLVMRustFreeTargetMachineFactory(LLVMRustTargetMachineFactory *Factory) {
+  delete Factory;
+}
+
+extern "C" LLVMTargetMachineRef
+LLVMRustTargetMachineFactoryCreate(const LLVMRustTargetMachineFactory *Factory) {
+  return wrap(createTargetMachineFromFactory(Factory));
+}
+
+// Same as `LLVMRustSetDataLayoutFromTargetMachine` for a target machine
+// created by `Factory`, without needing one: only the first call creates a
+// target machine to get the data layout from, later calls (from any thread)
+// reuse it.
+extern "C" void
+LLVMRustSetDataLayoutFromTargetMachineFactory(
+    LLVMModuleRef M, LLVMRustTargetMachineFactory *Factory) {
+  std::call_once(Factory->DataLayoutOnce, [Factory]() {
+    std::unique_ptr<TargetMachine> TM(createTargetMachineFromFactory(Factory));
+    Factory->DataLayout = TM->createDataLayout().getStringRepresentation();
+  });
+  unwrap(M)->setDataLayout(Factory->DataLayout);
+}
+
+extern "C" LLVMTargetMachineRef LLVMRustCreateTargetMachine(
+    const char *TripleStr, const char *CPU, const char *Feature,
+    LLVMRustCodeModel RustCM, LLVMRustRelocMode RustReloc,
+    LLVMRustCodeGenOptLevel RustOptLevel, bool UseSoftFloat,
+    bool PositionIndependentExecutable, bool FunctionSections,
+    bool DataSections,
+    bool TrapUnreachable,
+    bool Singlethread,
+    bool AsmComments,
+    bool EmitStackSizeSection,
+    LLVMRustDebugCompression CompressDebugSections,
+    bool EnableMachineOutliner) {
+  std::unique_ptr<LLVMRustTargetMachineFactory> Factory(
+      LLVMRustCreateTargetMachineFactory(
+          TripleStr, CPU, Feature, RustCM, RustReloc, RustOptLevel,
+          UseSoftFloat, PositionIndependentExecutable, FunctionSections,
+          DataSections, TrapUnreachable, Singlethread, AsmComments,
+          EmitStackSizeSection, CompressDebugSections,
+          EnableMachineOutliner));
+  if (!Factory)
+    return nullptr;
+  return LLVMRustTargetMachineFactoryCreate(Factory.get());
 }
 
 extern "C" void LLVMRustDisposeTargetMachine(LLVMTargetMachineRef TM) {
@@ -400,7 +733,8 @@ extern "C" void LLVMRustAddAnalysisPasses(LLVMTargetMachineRef TM,
 extern "C" void LLVMRustConfigurePassManagerBuilder(
     LLVMPassManagerBuilderRef PMBR, LLVMRustCodeGenOptLevel OptLevel,
     bool MergeFunctions, bool SLPVectorize, bool LoopVectorize, bool PrepareForThinLTO,
-    const char* PGOGenPath, const char* PGOUsePath) {
+    const char* PGOGenPath, const char* PGOUsePath,
+    const char* PGOSampleUsePath) {
 #if LLVM_VERSION_GE(7, 0)
   unwrap(PMBR)->MergeFunctions = MergeFunctions;
 #endif
@@ -418,29 +752,58 @@ extern "C" void LLVMRustConfigurePassManagerBuilder(
     assert(!PGOGenPath);
     unwrap(PMBR)->PGOInstrUse = PGOUsePath;
   }
+  if (PGOSampleUsePath) {
+    assert(!PGOGenPath && !PGOUsePath);
+    unwrap(PMBR)->PGOSampleUse = PGOSampleUsePath;
+  }
+}
+
+// A `TargetLibraryInfoImpl` is the same for every module with the same target
+// triple, but working out which library functions are available on a target
+// isn't free, and it was redone for each of the two pass managers (and the
+// builder) of every codegen unit. So one is only built per triple (and
+// `DisableSimplifyLibCalls`), the first time it's needed, and then shared by
+// everything after that. They're never modified once they're here, so any
+// thread can use them without holding the lock.
+static std::mutex TargetLibraryInfoCacheLock;
+static ManagedStatic<StringMap<std::unique_ptr<TargetLibraryInfoImpl>>>
+    TargetLibraryInfoCache;
+
+static const TargetLibraryInfoImpl &
+getTargetLibraryInfo(const Module &M, bool DisableSimplifyLibCalls) {
+  std::string Key = M.getTargetTriple();
+  if (DisableSimplifyLibCalls)
+    Key += "+no-builtins";
+
+  std::lock_guard<std::mutex> Lock(TargetLibraryInfoCacheLock);
+  std::unique_ptr<TargetLibraryInfoImpl> &TLII = (*TargetLibraryInfoCache)[Key];
+  if (!TLII) {
+    TLII = llvm::make_unique<TargetLibraryInfoImpl>(
+        Triple(M.getTargetTriple()));
+    if (DisableSimplifyLibCalls)
+      TLII->disableAllFunctions();
+  }
+  return *TLII;
 }
 
 // Unfortunately, the LLVM C API doesn't provide a way to set the `LibraryInfo`
 // field of a PassManagerBuilder, we expose our own method of doing so.
+//
+// The builder owns (and deletes) its `LibraryInfo`, so it gets its own copy of
+// the shared one, which is still much cheaper than building it from scratch.
 extern "C" void LLVMRustAddBuilderLibraryInfo(LLVMPassManagerBuilderRef PMBR,
                                               LLVMModuleRef M,
                                               bool DisableSimplifyLibCalls) {
-  Triple TargetTriple(unwrap(M)->getTargetTriple());
-  TargetLibraryInfoImpl *TLI = new TargetLibraryInfoImpl(TargetTriple);
-  if (DisableSimplifyLibCalls)
-    TLI->disableAllFunctions();
-  unwrap(PMBR)->LibraryInfo = TLI;
+  unwrap(PMBR)->LibraryInfo = new TargetLibraryInfoImpl(
+      getTargetLibraryInfo(*unwrap(M), DisableSimplifyLibCalls));
 }
 
 // Unfortunately, the LLVM C API doesn't provide a way to create the
 // TargetLibraryInfo pass, so we use this method to do so.
 extern "C" void LLVMRustAddLibraryInfo(LLVMPassManagerRef PMR, LLVMModuleRef M,
                                        bool DisableSimplifyLibCalls) {
-  Triple TargetTriple(unwrap(M)->getTargetTriple());
-  TargetLibraryInfoImpl TLII(TargetTriple);
-  if (DisableSimplifyLibCalls)
-    TLII.disableAllFunctions();
-  unwrap(PMR)->add(new TargetLibraryInfoWrapperPass(TLII));
+  unwrap(PMR)->add(new TargetLibraryInfoWrapperPass(
+      getTargetLibraryInfo(*unwrap(M), DisableSimplifyLibCalls)));
 }
 
 // Unfortunately, the LLVM C API doesn't provide an easy way of iterating over
@@ -452,18 +815,308 @@ extern "C" void LLVMRustRunFunctionPassManager(LLVMPassManagerRef PMR,
       unwrap<llvm::legacy::FunctionPassManager>(PMR);
   P->doInitialization();
 
-  // Upgrade all calls to old intrinsics first.
-  for (Module::iterator I = unwrap(M)->begin(), E = unwrap(M)->end(); I != E;)
-    UpgradeCallsToIntrinsic(&*I++); // must be post-increment, as we remove
+  // Upgrade all calls to old intrinsics first. Only intrinsic declarations
+  // can need upgrading, so the functions to run the passes on are collected
+  // along the way rather than walking the whole module a second time.
+  //
+  // The passes can't be run on several functions in parallel: they create
+  // constants and types in the module's `LLVMContext`, which isn't
+  // thread-safe.
+  std::vector<Function *> Definitions;
+  for (Module::iterator I = unwrap(M)->begin(), E = unwrap(M)->end(); I != E;) {
+    Function *F = &*I++; // must be post-increment, as we remove
+    if (!F->isDeclaration())
+      Definitions.push_back(F);
+    else if (F->isIntrinsic())
+      UpgradeCallsToIntrinsic(F);
+  }
 
-  for (Module::iterator I = unwrap(M)->begin(), E = unwrap(M)->end(); I != E;
-       ++I)
-    if (!I->isDeclaration())
-      P->run(*I);
+  for (Function *F : Definitions)
+    P->run(*F);
 
   P->doFinalization();
 }
 
+// Per-pass timings for one module, collected while it's optimized with
+// `LLVMRustOptimizeWithNewPassManager`. Unlike `-Z time-llvm-passes`, which
+// can only print LLVM's global timers once at the end, these are kept per
+// module so they can be attributed to a codegen unit and read back through
+// `LLVMRustPassTimingsGet`.
+//
+// Heap usage is only available as the current total from the system's
+// allocator, so the best that can be reported is how much it changed over
+// the course of each pass, not its peak.
+struct LLVMRustPassTiming {
+  std::string Pass;
+  uint64_t WallNanos;
+  int64_t InstrCountDelta;
+  int64_t MallocDelta;
+};
+
+struct LLVMRustPassTimings {
+  struct Running {
+    std::chrono::steady_clock::time_point Start;
+    int64_t InstrCount;
+    int64_t MallocUsage;
+  };
+
+  std::vector<LLVMRustPassTiming> Timings;
+  // Passes can be nested (pass managers and adaptors are passes too), so this
+  // is a stack of the ones which have started but not finished yet.
+  std::vector<Running> Stack;
+};
+
+// What `LLVMRustPassTimingsGet` fills in, pointing into the timings.
+struct LLVMRustPassTimingInfo {
+  const char *Pass;
+  size_t PassLen;
+  uint64_t WallNanos;
+  int64_t InstrCountDelta;
+  int64_t MallocDelta;
+};
+
+extern "C" LLVMRustPassTimings *LLVMRustCreatePassTimings() {
+  return new LLVMRustPassTimings();
+}
+
+extern "C" void LLVMRustFreePassTimings(LLVMRustPassTimings *Timings) {
+  delete Timings;
+}
+
+extern "C" size_t LLVMRustPassTimingsCount(const LLVMRustPassTimings *Timings) {
+  return Timings->Timings.size();
+}
+
+extern "C" void LLVMRustPassTimingsGet(const LLVMRustPassTimings *Timings,
+                                       size_t Index,
+                                       LLVMRustPassTimingInfo *Out) {
+  const LLVMRustPassTiming &Timing = Timings->Timings[Index];
+  Out->Pass = Timing.Pass.data();
+  Out->PassLen = Timing.Pass.size();
+  Out->WallNanos = Timing.WallNanos;
+  Out->InstrCountDelta = Timing.InstrCountDelta;
+  Out->MallocDelta = Timing.MallocDelta;
+}
+
+#if LLVM_VERSION_GE(8, 0)
+// The number of instructions in whatever IR unit a pass is being run on.
+static int64_t instructionCount(Any IR) {
+  if (any_isa<const Module *>(IR))
+    return any_cast<const Module *>(IR)->getInstructionCount();
+  if (any_isa<const Function *>(IR))
+    return any_cast<const Function *>(IR)->getInstructionCount();
+  if (any_isa<const LazyCallGraph::SCC *>(IR)) {
+    int64_t Count = 0;
+    for (const LazyCallGraph::Node &N : *any_cast<const LazyCallGraph::SCC *>(IR))
+      Count += N.getFunction().getInstructionCount();
+    return Count;
+  }
+  if (any_isa<const Loop *>(IR)) {
+    int64_t Count = 0;
+    for (const BasicBlock *BB : any_cast<const Loop *>(IR)->blocks())
+      Count += BB->size();
+    return Count;
+  }
+  return 0;
+}
+
+static void registerPassTimingCallbacks(PassInstrumentationCallbacks &PIC,
+                                        LLVMRustPassTimings *Timings) {
+  PIC.registerBeforePassCallback([Timings](StringRef, Any IR) {
+    Timings->Stack.push_back({std::chrono::steady_clock::now(),
+                              instructionCount(IR),
+                              (int64_t)sys::Process::GetMallocUsage()});
+    return true;
+  });
+
+  auto Finish = [Timings](StringRef Pass, int64_t InstrCount) {
+    LLVMRustPassTimings::Running Started = Timings->Stack.back();
+    Timings->Stack.pop_back();
+    auto Elapsed = std::chrono::steady_clock::now() - Started.Start;
+    Timings->Timings.push_back({
+        Pass.str(),
+        (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Elapsed).count(),
+        InstrCount - Started.InstrCount,
+        (int64_t)sys::Process::GetMallocUsage() - Started.MallocUsage});
+  };
+  PIC.registerAfterPassCallback([Finish](StringRef Pass, Any IR) {
+    Finish(Pass, instructionCount(IR));
+  });
+  // The IR unit is gone by now (e.g. a loop that was deleted), so there's
+  // nothing left to count.
+  PIC.registerAfterPassInvalidatedCallback([Timings, Finish](StringRef Pass) {
+    Finish(Pass, Timings->Stack.back().InstrCount);
+  });
+}
+#endif
+
+enum class LLVMRustPassBuilderOptLevel {
+  O0,
+  O1,
+  O2,
+  O3,
+  Os,
+  Oz,
+};
+
+enum class LLVMRustOptStage {
+  PreLinkNoLTO,
+  PreLinkThinLTO,
+  PreLinkFatLTO,
+  ThinLTO,
+  FatLTO,
+};
+
+#if LLVM_VERSION_GE(7, 0)
+static PassBuilder::OptimizationLevel fromRust(LLVMRustPassBuilderOptLevel Level) {
+  switch (Level) {
+  case LLVMRustPassBuilderOptLevel::O0:
+    return PassBuilder::O0;
+  case LLVMRustPassBuilderOptLevel::O1:
+    return PassBuilder::O1;
+  case LLVMRustPassBuilderOptLevel::O2:
+    return PassBuilder::O2;
+  case LLVMRustPassBuilderOptLevel::O3:
+    return PassBuilder::O3;
+  case LLVMRustPassBuilderOptLevel::Os:
+    return PassBuilder::Os;
+  case LLVMRustPassBuilderOptLevel::Oz:
+    return PassBuilder::Oz;
+  default:
+    report_fatal_error("Bad PassBuilderOptLevel.");
+  }
+}
+#endif
+
+// An alternative to populating the legacy function and module pass managers
+// through a `PassManagerBuilder` and running them: this builds LLVM's default
+// pipeline for `OptStage` with the new pass manager's `PassBuilder` and runs
+// it on the whole module in one go. The analysis managers are shared by the
+// whole pipeline, so analyses are only recomputed when a pass actually
+// invalidates them.
+//
+// With `NoPrepopulatePasses` no default pipeline is added at all, which leaves
+// just the verifier (with `VerifyIR`) and, for modules that are going to be
+// serialized to ThinLTO buffers (`UseThinLTOBuffers`), NameAnonGlobals.
+//
+// If `Timings` isn't null, every pass which is run is recorded in it. That
+// needs pass instrumentation, which is only there as of LLVM 8, so with older
+// versions it's left empty.
+extern "C" LLVMRustResult
+LLVMRustOptimizeWithNewPassManager(
+    LLVMModuleRef ModuleRef, LLVMTargetMachineRef TMRef,
+    LLVMRustPassBuilderOptLevel OptLevelRust, LLVMRustOptStage OptStage,
+    bool NoPrepopulatePasses, bool VerifyIR, bool UseThinLTOBuffers,
+    bool DisableSimplifyLibCalls,
+    const char *PGOGenPath, const char *PGOUsePath,
+    const char *PGOSampleUsePath, LLVMRustPassTimings *Timings) {
+#if LLVM_VERSION_GE(7, 0)
+  Module *TheModule = unwrap(ModuleRef);
+  TargetMachine *TM = unwrap(TMRef);
+  PassBuilder::OptimizationLevel OptLevel = fromRust(OptLevelRust);
+
+  Optional<PGOOptions> PGOOpt;
+  if (PGOGenPath) {
+    assert(!PGOUsePath);
+#if LLVM_VERSION_GE(8, 0)
+    PGOOpt = PGOOptions(PGOGenPath, "", "", "", true);
+#else
+    PGOOpt = PGOOptions(PGOGenPath, "", "", true);
+#endif
+  } else if (PGOUsePath) {
+#if LLVM_VERSION_GE(8, 0)
+    PGOOpt = PGOOptions("", PGOUsePath, "", "", false);
+#else
+    PGOOpt = PGOOptions("", PGOUsePath, "", false);
+#endif
+  } else if (PGOSampleUsePath) {
+#if LLVM_VERSION_GE(8, 0)
+    PGOOpt = PGOOptions("", "", PGOSampleUsePath, "", false, true);
+#else
+    PGOOpt = PGOOptions("", "", PGOSampleUsePath, false, true);
+#endif
+  }
+
+#if LLVM_VERSION_GE(8, 0)
+  PassInstrumentationCallbacks PIC;
+  if (Timings)
+    registerPassTimingCallbacks(PIC, Timings);
+  PassBuilder PB(TM, PGOOpt, &PIC);
+#else
+  PassBuilder PB(TM, PGOOpt);
+#endif
+
+  // The analysis managers have to be destroyed in the reverse order of their
+  // dependencies (proxies from outer to inner managers), so they're declared
+  // in this order.
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  // Register our own target library info and alias analysis pipeline before
+  // the defaults, as the first registration of an analysis is the one used.
+  const TargetLibraryInfoImpl &TLII =
+      getTargetLibraryInfo(*TheModule, DisableSimplifyLibCalls);
+  FAM.registerPass([&] { return TargetLibraryAnalysis(TLII); });
+  FAM.registerPass([&] { return PB.buildDefaultAAPipeline(); });
+
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (VerifyIR)
+    MPM.addPass(VerifierPass());
+
+  bool NeedsNameAnonGlobals = UseThinLTOBuffers;
+  if (!NoPrepopulatePasses) {
+    // None of the default pipelines can be built for O0, as all they'd do is
+    // run the always-inliner, so that's done by hand.
+    if (OptLevel == PassBuilder::O0) {
+      MPM.addPass(AlwaysInlinerPass());
+    } else {
+      switch (OptStage) {
+      case LLVMRustOptStage::PreLinkNoLTO:
+        MPM.addPass(PB.buildPerModuleDefaultPipeline(OptLevel));
+        break;
+      case LLVMRustOptStage::PreLinkThinLTO:
+        MPM.addPass(PB.buildThinLTOPreLinkDefaultPipeline(OptLevel));
+        // The ThinLTO pre-link pipeline already names anonymous globals.
+        NeedsNameAnonGlobals = false;
+        break;
+      case LLVMRustOptStage::PreLinkFatLTO:
+        MPM.addPass(PB.buildLTOPreLinkDefaultPipeline(OptLevel));
+        break;
+      case LLVMRustOptStage::ThinLTO:
+        // The import summary is only needed for importing, which was done
+        // when the module was prepared for ThinLTO.
+        MPM.addPass(PB.buildThinLTODefaultPipeline(OptLevel, false, nullptr));
+        break;
+      case LLVMRustOptStage::FatLTO:
+        MPM.addPass(PB.buildLTODefaultPipeline(OptLevel, false, nullptr));
+        break;
+      }
+    }
+  }
+
+  if (NeedsNameAnonGlobals)
+    MPM.addPass(NameAnonGlobalPass());
+  if (VerifyIR)
+    MPM.addPass(VerifierPass());
+
+  MPM.run(*TheModule, MAM);
+  return LLVMRustResult::Success;
+#else
+  LLVMRustSetLastError("the new pass manager is not supported "
+                       "by this LLVM version");
+  return LLVMRustResult::Failure;
+#endif
+}
+
 extern "C" void LLVMRustSetLLVMOptions(int Argc, char **Argv) {
   // Initializing the command-line options more than once is not allowed. So,
   // check if they've already been initialized.  (This could happen if we're
@@ -493,10 +1146,13 @@ static TargetMachine::CodeGenFileType fromRust(LLVMRustFileType Type) {
   }
 }
 
+// If `DwoPath` isn't null, the DWARF which doesn't need to be linked (most of
+// it) is split out of the object file into a `.dwo` file at `DwoPath`.
 extern "C" LLVMRustResult
 LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
-                        LLVMModuleRef M, const char *Path,
+                        LLVMModuleRef M, const char *Path, const char *DwoPath,
                         LLVMRustFileType RustFileType) {
+  RustProfileScope Scope("write-output-file");
   llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
   auto FileType = fromRust(RustFileType);
 
@@ -512,8 +1168,29 @@ LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
 
 #if LLVM_VERSION_GE(7, 0)
   buffer_ostream BOS(OS);
+  if (DwoPath) {
+    raw_fd_ostream DOS(DwoPath, EC, sys::fs::F_None);
+    if (EC) {
+      delete PM;
+      LLVMRustSetLastErrorCode(EC);
+      return LLVMRustResult::Failure;
+    }
+    buffer_ostream DBOS(DOS);
+    TargetMachine *TM = unwrap(Target);
+    TM->Options.MCOptions.SplitDwarfFile = DwoPath;
+    TM->addPassesToEmitFile(*PM, BOS, &DBOS, FileType, false);
+    PM->run(*unwrap(M));
+    TM->Options.MCOptions.SplitDwarfFile.clear();
+    delete PM;
+    return LLVMRustResult::Success;
+  }
   unwrap(Target)->addPassesToEmitFile(*PM, BOS, nullptr, FileType, false);
 #else
+  if (DwoPath) {
+    delete PM;
+    LLVMRustSetLastError("split DWARF requires LLVM 7 or later");
+    return LLVMRustResult::Failure;
+  }
   unwrap(Target)->addPassesToEmitFile(*PM, OS, FileType, false);
 #endif
   PM->run(*unwrap(M));
@@ -525,59 +1202,546 @@ LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
   return LLVMRustResult::Success;
 }
 
+// The output of `LLVMRustWriteOutputBuffer`, an object file or assembly held
+// in memory instead of written to disk.
+struct LLVMRustOutputBuffer {
+  SmallVector<char, 0> data;
+};
 
-// Callback to demangle function name
-// Parameters:
-// * name to be demangled
-// * name len
-// * output buffer
-// * output buffer len
-// Returns len of demangled string, or 0 if demangle failed.
-typedef size_t (*DemangleFn)(const char*, size_t, char*, size_t);
+// Same as `LLVMRustWriteOutputFile` for an object file, except that the
+// module's embedded bitcode global is only a zeroed placeholder of the size of
+// `Bitcode`, which is copied straight into its section once the object's made.
+// That way the bitcode is never turned into a constant, which would copy (and
+// hash) it into the context, only for the backend to copy it again into the
+// object. The object is put together in memory, patched and then written out.
+extern "C" LLVMRustResult
+LLVMRustWriteObjectFileWithBitcode(LLVMTargetMachineRef Target,
+                                   LLVMPassManagerRef PMR, LLVMModuleRef M,
+                                   const char *Path, const char *DwoPath,
+                                   const char *Bitcode, size_t BitcodeLen) {
+  RustProfileScope Scope("write-output-file");
+  llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
+  TargetMachine *TM = unwrap(Target);
 
+  SmallVector<char, 0> Object;
+  {
+    raw_svector_ostream OS(Object);
+#if LLVM_VERSION_GE(7, 0)
+    std::unique_ptr<raw_fd_ostream> DOS;
+    std::unique_ptr<buffer_ostream> DBOS;
+    if (DwoPath) {
+      std::error_code EC;
+      DOS = llvm::make_unique<raw_fd_ostream>(DwoPath, EC, sys::fs::F_None);
+      if (EC) {
+        delete PM;
+        LLVMRustSetLastErrorCode(EC);
+        return LLVMRustResult::Failure;
+      }
+      DBOS = llvm::make_unique<buffer_ostream>(*DOS);
+      TM->Options.MCOptions.SplitDwarfFile = DwoPath;
+    }
+    TM->addPassesToEmitFile(*PM, OS, DBOS.get(), TargetMachine::CGFT_ObjectFile,
+                            false);
+    PM->run(*unwrap(M));
+    TM->Options.MCOptions.SplitDwarfFile.clear();
+#else
+    if (DwoPath) {
+      delete PM;
+      LLVMRustSetLastError("split DWARF requires LLVM 7 or later");
+      return LLVMRustResult::Failure;
+    }
+    TM->addPassesToEmitFile(*PM, OS, TargetMachine::CGFT_ObjectFile, false);
+    PM->run(*unwrap(M));
+#endif
+    // The pass manager holds on to pointers to the streams.
+    delete PM;
+  }
 
-namespace {
+  MemoryBufferRef Buffer(StringRef(Object.data(), Object.size()), Path);
+  Expected<std::unique_ptr<object::ObjectFile>> ObjOrErr =
+      object::ObjectFile::createObjectFile(Buffer);
+  if (!ObjOrErr) {
+    LLVMRustSetLastError(toString(ObjOrErr.takeError()).c_str());
+    return LLVMRustResult::Failure;
+  }
+  bool Patched = false;
+  for (const object::SectionRef &Section : (*ObjOrErr)->sections()) {
+    StringRef Name;
+    if (Section.getName(Name) || (Name != ".llvmbc" && Name != "__bitcode"))
+      continue;
+    StringRef Contents;
+    if (std::error_code EC = Section.getContents(Contents)) {
+      LLVMRustSetLastErrorCode(EC);
+      return LLVMRustResult::Failure;
+    }
+    // The section's only the placeholder, so it's the bitcode's size (maybe
+    // with some padding) and its contents are right there in `Object`.
+    if (Contents.size() < BitcodeLen || Contents.data() < Object.data() ||
+        Contents.end() > Object.data() + Object.size()) {
+      LLVMRustSetLastError("embedded bitcode section has the wrong size");
+      return LLVMRustResult::Failure;
+    }
+    memcpy(Object.data() + (Contents.data() - Object.data()), Bitcode,
+           BitcodeLen);
+    Patched = true;
+    break;
+  }
+  if (!Patched) {
+    LLVMRustSetLastError("object file has no embedded bitcode section");
+    return LLVMRustResult::Failure;
+  }
 
-class RustAssemblyAnnotationWriter : public AssemblyAnnotationWriter {
-  DemangleFn Demangle;
-  std::vector<char> Buf;
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::F_None);
+  if (EC) {
+    LLVMRustSetLastErrorCode(EC);
+    return LLVMRustResult::Failure;
+  }
+  OS.write(Object.data(), Object.size());
+  return LLVMRustResult::Success;
+}
 
-public:
-  RustAssemblyAnnotationWriter(DemangleFn Demangle) : Demangle(Demangle) {}
+// Writes a `<size> <symbol>` line to `Out` for every function in the
+// `.stack_sizes` sections of the ELF object file `Data`, which LLVM emits
+// with `EmitStackSizeSection`. Each entry in those is the function's address
+// followed by its frame size as a ULEB128. In a relocatable object the
+// address is a relocation, against the function's symbol or, for a local
+// function, against its section with the function's offset as the addend.
+extern "C" LLVMRustResult
+LLVMRustGetStackSizes(const char *Data, size_t Len, RustStringRef Out) {
+  MemoryBufferRef Buffer(StringRef(Data, Len), "object");
+  Expected<std::unique_ptr<object::ObjectFile>> ObjOrErr =
+      object::ObjectFile::createObjectFile(Buffer);
+  if (!ObjOrErr) {
+    LLVMRustSetLastError(toString(ObjOrErr.takeError()).c_str());
+    return LLVMRustResult::Failure;
+  }
+  object::ObjectFile &Obj = **ObjOrErr;
+  if (!isa<object::ELFObjectFileBase>(&Obj)) {
+    LLVMRustSetLastError("stack sizes are only recorded in ELF object files");
+    return LLVMRustResult::Failure;
+  }
 
-  // Return empty string if demangle failed
-  // or if name does not need to be demangled
-  StringRef CallDemangle(StringRef name) {
-    if (!Demangle) {
-      return StringRef();
+  // The function symbols by section index and offset into it, for the
+  // relocations against section symbols.
+  std::map<std::pair<uint64_t, uint64_t>, StringRef> Functions;
+  for (const object::SymbolRef &Sym : Obj.symbols()) {
+    Expected<object::SymbolRef::Type> Type = Sym.getType();
+    if (!Type) {
+      consumeError(Type.takeError());
+      continue;
     }
-
-    if (Buf.size() < name.size() * 2) {
-      // Semangled name usually shorter than mangled,
-      // but allocate twice as much memory just in case
-      Buf.resize(name.size() * 2);
+    if (*Type != object::SymbolRef::ST_Function)
+      continue;
+    Expected<StringRef> Name = Sym.getName();
+    Expected<object::section_iterator> Sec = Sym.getSection();
+    if (!Name || !Sec || *Sec == Obj.section_end()) {
+      if (!Name)
+        consumeError(Name.takeError());
+      if (!Sec)
+        consumeError(Sec.takeError());
+      continue;
     }
+    Functions[std::make_pair((*Sec)->getIndex(), Sym.getValue())] = *Name;
+  }
 
-    auto R = Demangle(name.data(), name.size(), Buf.data(), Buf.size());
-    if (!R) {
-      // Demangle failed.
-      return StringRef();
+  RawRustStringOstream OS(Out);
+  for (const object::SectionRef &RelocSec : Obj.sections()) {
+    object::section_iterator Sec = RelocSec.getRelocatedSection();
+    StringRef Name;
+    if (Sec == Obj.section_end() || Sec->getName(Name) ||
+        Name != ".stack_sizes")
+      continue;
+    StringRef Contents;
+    if (std::error_code EC = Sec->getContents(Contents)) {
+      LLVMRustSetLastErrorCode(EC);
+      return LLVMRustResult::Failure;
     }
+    DataExtractor Entries(Contents, Obj.isLittleEndian(),
+                          Obj.getBytesInAddress());
 
-    auto Demangled = StringRef(Buf.data(), R);
-    if (Demangled == name) {
-      // Do not print anything if demangled name is equal to mangled.
-      return StringRef();
+    for (const object::RelocationRef &Reloc : RelocSec.relocations()) {
+      object::symbol_iterator Sym = Reloc.getSymbol();
+      if (Sym == Obj.symbol_end())
+        continue;
+      uint32_t Offset = Reloc.getOffset();
+      if (!Entries.isValidOffset(Offset))
+        continue;
+      // SHT_REL relocations keep their addend in the relocated field itself.
+      uint64_t Addend = Entries.getAddress(&Offset);
+      Expected<int64_t> RelaAddend =
+          object::ELFRelocationRef(Reloc).getAddend();
+      if (RelaAddend)
+        Addend = *RelaAddend;
+      else
+        consumeError(RelaAddend.takeError());
+      uint64_t Size = Entries.getULEB128(&Offset);
+
+      StringRef Function;
+      Expected<object::SymbolRef::Type> Type = Sym->getType();
+      Expected<object::section_iterator> SymSec = Sym->getSection();
+      if (Type && *Type == object::SymbolRef::ST_Function) {
+        Expected<StringRef> SymName = Sym->getName();
+        if (SymName)
+          Function = *SymName;
+        else
+          consumeError(SymName.takeError());
+      } else if (SymSec && *SymSec != Obj.section_end()) {
+        auto It =
+            Functions.find(std::make_pair((*SymSec)->getIndex(), Addend));
+        if (It != Functions.end())
+          Function = It->second;
+      }
+      if (!Type)
+        consumeError(Type.takeError());
+      if (!SymSec)
+        consumeError(SymSec.takeError());
+      if (!Function.empty())
+        OS << Size << ' ' << Function << '\n';
     }
-
-    return Demangled;
   }
+  return LLVMRustResult::Success;
+}
 
-  void emitFunctionAnnot(const Function *F,
-                         formatted_raw_ostream &OS) override {
-    StringRef Demangled = CallDemangle(F->getName());
-    if (Demangled.empty()) {
-        return;
+// Same as `LLVMRustWriteOutputFile`, except the output is returned in a
+// buffer rather than written to a path, for when it's going to be read right
+// back in anyway.
+extern "C" LLVMRustOutputBuffer*
+LLVMRustWriteOutputBuffer(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
+                          LLVMModuleRef M, LLVMRustFileType RustFileType) {
+  llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
+  auto FileType = fromRust(RustFileType);
+
+  auto Ret = llvm::make_unique<LLVMRustOutputBuffer>();
+  {
+    raw_svector_ostream OS(Ret->data);
+#if LLVM_VERSION_GE(7, 0)
+    unwrap(Target)->addPassesToEmitFile(*PM, OS, nullptr, FileType, false);
+#else
+    unwrap(Target)->addPassesToEmitFile(*PM, OS, FileType, false);
+#endif
+    PM->run(*unwrap(M));
+
+    // Same as above, the pass manager holds on to a pointer to `OS`.
+    delete PM;
+  }
+  return Ret.release();
+}
+
+extern "C" void
+LLVMRustOutputBufferFree(LLVMRustOutputBuffer *Buffer) {
+  delete Buffer;
+}
+
+extern "C" const void*
+LLVMRustOutputBufferPtr(const LLVMRustOutputBuffer *Buffer) {
+  return Buffer->data.data();
+}
+
+extern "C" size_t
+LLVMRustOutputBufferLen(const LLVMRustOutputBuffer *Buffer) {
+  return Buffer->data.size();
+}
+
+// Writes both the assembly for `M` to `AsmPath` and the object file to
+// `ObjPath`, while only running the (expensive) codegen pipeline once:
+// codegen emits assembly into memory, which is written out as-is and then
+// assembled into the object file with the target's integrated assembler.
+// Assembling is cheap compared to instruction selection, scheduling and
+// register allocation, so this saves the second backend run (and the module
+// copy it needs, as codegen modifies the module) that emitting each of them
+// with `LLVMRustWriteOutputFile` would take.
+//
+// This depends on the target's assembly being something its own assembler
+// accepts, which is the same assumption `-C no-integrated-as` makes, and on
+// the target having an asm parser and object file support at all.
+//
+// As with `LLVMRustWriteOutputFile`, if `DwoPath` isn't null the split DWARF
+// is written there. The assembly has all of it in `.dwo` sections, which the
+// object writer moves into the `.dwo` file when assembling.
+extern "C" LLVMRustResult
+LLVMRustWriteAsmAndObjectFiles(LLVMTargetMachineRef Target,
+                               LLVMPassManagerRef PMR, LLVMModuleRef M,
+                               const char *AsmPath, const char *ObjPath,
+                               const char *DwoPath) {
+  llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
+  TargetMachine *TM = unwrap(Target);
+  const llvm::Target &T = TM->getTarget();
+  const Triple &TT = TM->getTargetTriple();
+
+#if !LLVM_VERSION_GE(7, 0)
+  if (DwoPath) {
+    delete PM;
+    LLVMRustSetLastError("split DWARF requires LLVM 7 or later");
+    return LLVMRustResult::Failure;
+  }
+#endif
+
+  SmallString<0> Asm;
+  {
+    raw_svector_ostream OS(Asm);
+#if LLVM_VERSION_GE(7, 0)
+    if (DwoPath)
+      TM->Options.MCOptions.SplitDwarfFile = DwoPath;
+    TM->addPassesToEmitFile(*PM, OS, nullptr,
+                            TargetMachine::CGFT_AssemblyFile, false);
+#else
+    TM->addPassesToEmitFile(*PM, OS, TargetMachine::CGFT_AssemblyFile, false);
+#endif
+    PM->run(*unwrap(M));
+#if LLVM_VERSION_GE(7, 0)
+    TM->Options.MCOptions.SplitDwarfFile.clear();
+#endif
+
+    // Same as in `LLVMRustWriteOutputFile`, the pass manager holds on to a
+    // pointer to `OS`.
+    delete PM;
+  }
+
+  std::error_code EC;
+  {
+    raw_fd_ostream AsmOS(AsmPath, EC, sys::fs::F_None);
+    if (EC) {
+      LLVMRustSetLastErrorCode(EC);
+      return LLVMRustResult::Failure;
+    }
+    AsmOS << Asm;
+  }
+
+  raw_fd_ostream ObjOS(ObjPath, EC, sys::fs::F_None);
+  if (EC) {
+    LLVMRustSetLastErrorCode(EC);
+    return LLVMRustResult::Failure;
+  }
+  std::unique_ptr<raw_fd_ostream> DwoOS;
+  if (DwoPath) {
+    DwoOS = llvm::make_unique<raw_fd_ostream>(DwoPath, EC, sys::fs::F_None);
+    if (EC) {
+      LLVMRustSetLastErrorCode(EC);
+      return LLVMRustResult::Failure;
+    }
+  }
+
+  const MCRegisterInfo *MRI = TM->getMCRegisterInfo();
+  const MCAsmInfo *MAI = TM->getMCAsmInfo();
+  const MCInstrInfo *MII = TM->getMCInstrInfo();
+  const MCSubtargetInfo *STI = TM->getMCSubtargetInfo();
+  const MCTargetOptions &MCOptions = TM->Options.MCOptions;
+
+  SourceMgr SrcMgr;
+  SrcMgr.AddNewSourceBuffer(MemoryBuffer::getMemBuffer(Asm, AsmPath, false),
+                            SMLoc());
+  MCObjectFileInfo MOFI;
+  MCContext Ctx(MAI, MRI, &MOFI, &SrcMgr);
+  MOFI.InitMCObjectFileInfo(TT, TM->isPositionIndependent(), Ctx,
+                            TM->getCodeModel() == CodeModel::Large);
+
+  MCCodeEmitter *CE = T.createMCCodeEmitter(*MII, *MRI, Ctx);
+  MCAsmBackend *MAB = T.createMCAsmBackend(*STI, *MRI, MCOptions);
+  if (!CE || !MAB) {
+    delete CE;
+    delete MAB;
+    LLVMRustSetLastError("target does not support emitting object files");
+    return LLVMRustResult::Failure;
+  }
+
+  // `MCStreamer`s own their backend, writer and code emitter.
+#if LLVM_VERSION_GE(7, 0)
+  std::unique_ptr<MCAsmBackend> OwnedMAB(MAB);
+  std::unique_ptr<MCObjectWriter> OW =
+      DwoOS ? OwnedMAB->createDwoObjectWriter(ObjOS, *DwoOS)
+            : OwnedMAB->createObjectWriter(ObjOS);
+  std::unique_ptr<MCStreamer> Streamer(T.createMCObjectStreamer(
+      TT, Ctx, std::move(OwnedMAB), std::move(OW),
+      std::unique_ptr<MCCodeEmitter>(CE), *STI, MCOptions.MCRelaxAll,
+      MCOptions.MCIncrementalLinkerCompatible,
+      /* DWARFMustBeAtTheEnd = */ false));
+#else
+  std::unique_ptr<MCStreamer> Streamer(T.createMCObjectStreamer(
+      TT, Ctx, std::unique_ptr<MCAsmBackend>(MAB), ObjOS,
+      std::unique_ptr<MCCodeEmitter>(CE), *STI, MCOptions.MCRelaxAll,
+      MCOptions.MCIncrementalLinkerCompatible,
+      /* DWARFMustBeAtTheEnd = */ false));
+#endif
+
+  std::unique_ptr<MCAsmParser> Parser(
+      createMCAsmParser(SrcMgr, Ctx, *Streamer, *MAI));
+  std::unique_ptr<MCTargetAsmParser> TAP(
+      T.createMCAsmParser(*STI, *Parser, *MII, MCOptions));
+  if (!TAP) {
+    LLVMRustSetLastError("target does not support assembly parsing");
+    return LLVMRustResult::Failure;
+  }
+  Parser->setTargetParser(*TAP);
+
+  // Any errors have already been reported through the source manager's
+  // diagnostic handler, which prints them to stderr by default.
+  if (Parser->Run(/* NoInitialTextSection = */ false)) {
+    LLVMRustSetLastError("failed to assemble the generated assembly");
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+}
+
+// Whether any function in `M` is codegened for another CPU or other features
+// than the target machine's, with `#[target_feature]` for instance. The
+// assembler `LLVMRustWriteAsmAndObjectFiles` uses only knows of the target
+// machine's, so it can't assemble the instructions that need those.
+extern "C" bool
+LLVMRustModuleHasFunctionSubtargets(LLVMTargetMachineRef Target,
+                                    LLVMModuleRef M) {
+  TargetMachine *TM = unwrap(Target);
+  StringRef CPU = TM->getTargetCPU();
+  StringRef Features = TM->getTargetFeatureString();
+  for (const Function &F : *unwrap(M)) {
+    if (F.isDeclaration())
+      continue;
+    Attribute A = F.getFnAttribute("target-cpu");
+    if (A.isStringAttribute() && A.getValueAsString() != CPU)
+      return true;
+    A = F.getFnAttribute("target-features");
+    if (A.isStringAttribute() && A.getValueAsString() != Features)
+      return true;
+  }
+  return false;
+}
+
+// Like `LLVMRustWriteOutputFile` without the pass manager, except that the
+// module is split into `NumParts` partitions with LLVM's `SplitModule` and
+// each partition is codegen'd on its own thread and written to `Paths[i]`.
+// This keeps the optimizations of having one big module (which is expected to
+// be optimized already) while still using more than one core for the backend.
+//
+// The partitions reference each other's symbols (locals are externalized as
+// needed), so all of the outputs have to be linked together. `M` itself is
+// left untouched, the split is done on a copy of it.
+extern "C" LLVMRustResult
+LLVMRustWriteOutputFilesSplit(LLVMTargetMachineRef Target, LLVMModuleRef M,
+                              const char **Paths, size_t NumParts,
+                              LLVMRustFileType RustFileType) {
+  TargetMachine *TM = unwrap(Target);
+  auto FileType = fromRust(RustFileType);
+
+  std::vector<std::unique_ptr<raw_fd_ostream>> Files;
+  std::vector<raw_pwrite_stream *> OSs;
+  for (size_t I = 0; I < NumParts; I++) {
+    std::error_code EC;
+    Files.push_back(
+      llvm::make_unique<raw_fd_ostream>(Paths[I], EC, sys::fs::F_None));
+    if (EC) {
+      LLVMRustSetLastErrorCode(EC);
+      return LLVMRustResult::Failure;
+    }
+    OSs.push_back(Files.back().get());
+  }
+
+  // Each thread needs a target machine of its own, configured the same way as
+  // the one we were given.
+  auto TMFactory = [TM]() {
+    return std::unique_ptr<TargetMachine>(TM->getTarget().createTargetMachine(
+      TM->getTargetTriple().str(), TM->getTargetCPU(),
+      TM->getTargetFeatureString(), TM->Options, TM->getRelocationModel(),
+      TM->getCodeModel(), TM->getOptLevel()));
+  };
+
+#if LLVM_VERSION_GE(7, 0)
+  std::unique_ptr<Module> Copy = CloneModule(*unwrap(M));
+#else
+  std::unique_ptr<Module> Copy = CloneModule(unwrap(M));
+#endif
+
+  // `SplitModule` turns the locals used across partitions into hidden globals
+  // of the same name, but codegen units name their locals independently
+  // (`str.0`, `vtable.0`, the local copies of `#[inline]` functions, ...), so
+  // they'd clash once the objects of different units are linked together.
+  // Suffixing them with the module's name, which is unique per codegen unit,
+  // keeps them apart.
+  const std::string Suffix = "." + Copy->getModuleIdentifier();
+  for (GlobalValue &GV : Copy->global_values()) {
+    if (!GV.hasLocalLinkage() || !GV.hasName() || GV.hasComdat() ||
+        GV.getName().startswith("llvm."))
+      continue;
+    GV.setName(GV.getName() + Suffix);
+  }
+
+  splitCodeGen(std::move(Copy), OSs, {}, TMFactory, FileType);
+
+  for (auto &File : Files) {
+    File->close();
+    if (File->has_error()) {
+      LLVMRustSetLastErrorCode(File->error());
+      File->clear_error();
+      return LLVMRustResult::Failure;
+    }
+  }
+  return LLVMRustResult::Success;
+}
+
+
+// Callback to demangle function name
+// Parameters:
+// * name to be demangled
+// * name len
+// * output buffer
+// * output buffer len
+// Returns len of demangled string, or 0 if demangle failed.
+typedef size_t (*DemangleFn)(const char*, size_t, char*, size_t);
+
+
+namespace {
+
+class RustAssemblyAnnotationWriter : public AssemblyAnnotationWriter {
+  DemangleFn Demangle;
+  std::vector<char> Buf;
+  // What `CallDemangle` returned for each value already annotated, as the
+  // same functions tend to be called over and over again. The cache only
+  // lives as long as the writer, i.e. for printing a single module.
+  DenseMap<const Value *, std::string> Demangled;
+
+public:
+  RustAssemblyAnnotationWriter(DemangleFn Demangle) : Demangle(Demangle) {}
+
+  // Like `CallDemangle`, but only calls it once per value.
+  StringRef CachedDemangle(const Value *V) {
+    auto Inserted = Demangled.insert(std::make_pair(V, std::string()));
+    if (Inserted.second)
+      Inserted.first->second = CallDemangle(V->getName()).str();
+    return Inserted.first->second;
+  }
+
+  // Return empty string if demangle failed
+  // or if name does not need to be demangled
+  StringRef CallDemangle(StringRef name) {
+    if (!Demangle) {
+      return StringRef();
+    }
+
+    if (Buf.size() < name.size() * 2) {
+      // Semangled name usually shorter than mangled,
+      // but allocate twice as much memory just in case
+      Buf.resize(name.size() * 2);
+    }
+
+    auto R = Demangle(name.data(), name.size(), Buf.data(), Buf.size());
+    if (!R) {
+      // Demangle failed.
+      return StringRef();
+    }
+
+    auto Demangled = StringRef(Buf.data(), R);
+    if (Demangled == name) {
+      // Do not print anything if demangled name is equal to mangled.
+      return StringRef();
+    }
+
+    return Demangled;
+  }
+
+  void emitFunctionAnnot(const Function *F,
+                         formatted_raw_ostream &OS) override {
+    StringRef Demangled = CachedDemangle(F);
+    if (Demangled.empty()) {
+        return;
     }
 
     OS << "; " << Demangled << "\n";
@@ -603,7 +1767,7 @@ public:
       return;
     }
 
-    StringRef Demangled = CallDemangle(Value->getName());
+    StringRef Demangled = CachedDemangle(Value);
     if (Demangled.empty()) {
       return;
     }
@@ -655,6 +1819,10 @@ extern "C" void LLVMRustPrintModule(LLVMPassManagerRef PMR, LLVMModuleRef M,
   raw_fd_ostream OS(Path, EC, sys::fs::F_None);
   if (EC)
     ErrorInfo = EC.message();
+  // The IR of a big module easily runs into the hundreds of megabytes, so
+  // write it out in bigger chunks than the default. `FOS` takes over the
+  // buffer size (and the buffering) of `OS`.
+  OS.SetBufferSize(1 << 20);
 
   formatted_raw_ostream FOS(OS);
 
@@ -688,17 +1856,32 @@ extern "C" void LLVMRustAddAlwaysInlinePass(LLVMPassManagerBuilderRef PMBR,
   unwrap(PMBR)->Inliner = llvm::createAlwaysInlinerLegacyPass(AddLifetimes);
 }
 
-extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M, char **Symbols,
-                                           size_t Len) {
+// A set of symbol names to preserve when running the restriction pass below.
+// Building one up front means it can be reused across any number of modules.
+struct LLVMRustSymbolSet {
+  StringSet<> Symbols;
+};
+
+extern "C" LLVMRustSymbolSet*
+LLVMRustCreateSymbolSet(char **Symbols, size_t Len) {
+  auto Ret = llvm::make_unique<LLVMRustSymbolSet>();
+  for (size_t I = 0; I < Len; I++)
+    Ret->Symbols.insert(Symbols[I]);
+  return Ret.release();
+}
+
+extern "C" void
+LLVMRustFreeSymbolSet(LLVMRustSymbolSet *Set) {
+  delete Set;
+}
+
+// Internalizes everything in `M` which isn't in `Set`.
+extern "C" void LLVMRustRunRestrictionPassWithSet(LLVMModuleRef M,
+                                                  const LLVMRustSymbolSet *Set) {
   llvm::legacy::PassManager passes;
 
   auto PreserveFunctions = [=](const GlobalValue &GV) {
-    for (size_t I = 0; I < Len; I++) {
-      if (GV.getName() == Symbols[I]) {
-        return true;
-      }
-    }
-    return false;
+    return Set->Symbols.count(GV.getName()) != 0;
   };
 
   passes.add(llvm::createInternalizePass(PreserveFunctions));
@@ -706,6 +1889,14 @@ extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M, char **Symbols,
   passes.run(*unwrap(M));
 }
 
+extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M, char **Symbols,
+                                           size_t Len) {
+  LLVMRustSymbolSet Set;
+  for (size_t I = 0; I < Len; I++)
+    Set.Symbols.insert(Symbols[I]);
+  LLVMRustRunRestrictionPassWithSet(M, &Set);
+}
+
 extern "C" void LLVMRustMarkAllFunctionsNounwind(LLVMModuleRef M) {
   for (Module::iterator GV = unwrap(M)->begin(), E = unwrap(M)->end(); GV != E;
        ++GV) {
@@ -725,6 +1916,232 @@ extern "C" void LLVMRustMarkAllFunctionsNounwind(LLVMModuleRef M) {
   }
 }
 
+// Folds identical private and internal `unnamed_addr` constants in `M` into
+// one, returning how many were removed. rustc emits a fresh private global
+// for every constant allocation in every codegen unit, so the same panic
+// locations, strings and vtables turn up over and over. Constants are uniqued
+// by their context, so equal initializers are the same `Constant` and one
+// pass with a hash index keyed on it finds every duplicate. The first global
+// in module order is kept, and it takes on the largest alignment of any of
+// the globals folded into it.
+//
+// This is what LLVM's ConstantMerge does, but the pipeline used when
+// preparing for ThinLTO stops before running it, and with fat LTO it's worth
+// doing right after the modules have been linked together as well.
+extern "C" unsigned LLVMRustMergeConstants(LLVMModuleRef M) {
+  Module *Mod = unwrap(M);
+  const DataLayout &DL = Mod->getDataLayout();
+
+  // Anything in `llvm.used` or `llvm.compiler.used` has to stay where it is.
+  SmallPtrSet<GlobalValue *, 8> Used;
+  collectUsedGlobalVariables(*Mod, Used, false);
+  collectUsedGlobalVariables(*Mod, Used, true);
+
+  auto Alignment = [&](GlobalVariable *GV) {
+    unsigned Align = GV->getAlignment();
+    return Align ? Align : DL.getPreferredAlignment(GV);
+  };
+
+  typedef std::pair<Constant *, unsigned> Key;
+  DenseMap<Key, GlobalVariable *> Canonical;
+  SmallVector<std::pair<GlobalVariable *, GlobalVariable *>, 16> Replace;
+  for (GlobalVariable &GV : Mod->globals()) {
+    if (!GV.hasLocalLinkage() || !GV.isConstant() ||
+        !GV.hasGlobalUnnamedAddr() || !GV.hasDefinitiveInitializer() ||
+        GV.isThreadLocal() || GV.hasSection() || GV.hasComdat() ||
+        GV.hasMetadata() || Used.count(&GV))
+      continue;
+    Key K(GV.getInitializer(), GV.getAddressSpace());
+    auto Inserted = Canonical.insert(std::make_pair(K, &GV));
+    if (!Inserted.second)
+      Replace.push_back(std::make_pair(&GV, Inserted.first->second));
+  }
+
+  for (auto &R : Replace) {
+    GlobalVariable *Dup = R.first, *Keep = R.second;
+    unsigned Align = std::max(Alignment(Dup), Alignment(Keep));
+    Keep->setAlignment(Align);
+    Dup->replaceAllUsesWith(ConstantExpr::getBitCast(Keep, Dup->getType()));
+    Dup->eraseFromParent();
+  }
+  return Replace.size();
+}
+
+// Replaces every `llvm.type.test` in `M` with `true`, along with the
+// `llvm.assume`s they feed. Whatever whole program devirtualization could've
+// done with them has been done by the time a module is codegened, and the
+// backends don't know what to do with the rest.
+extern "C" void LLVMRustStripTypeTests(LLVMModuleRef M) {
+  Function *TypeTest =
+      unwrap(M)->getFunction(Intrinsic::getName(Intrinsic::type_test));
+  if (!TypeTest)
+    return;
+
+  while (!TypeTest->use_empty()) {
+    CallInst *Test = cast<CallInst>(TypeTest->user_back());
+    while (!Test->use_empty()) {
+      auto *Assume = dyn_cast<IntrinsicInst>(Test->user_back());
+      if (!Assume || Assume->getIntrinsicID() != Intrinsic::assume)
+        break;
+      Assume->eraseFromParent();
+    }
+    Test->replaceAllUsesWith(ConstantInt::getTrue(Test->getContext()));
+    Test->eraseFromParent();
+  }
+  TypeTest->eraseFromParent();
+}
+
+// The bits of `__cpu_model.__cpu_features[0]`, which `__cpu_indicator_init`
+// (from libgcc or compiler-rt) sets for the features the host has: this is
+// the start of the `ProcessorFeatures` enum they share, and is what clang's
+// `__builtin_cpu_supports` checks.
+struct X86CPUModelFeature {
+  const char *Name;
+  unsigned Bit;
+};
+
+static const X86CPUModelFeature X86CPUModelFeatures[] = {
+  {"cmov", 0},      {"mmx", 1},          {"popcnt", 2},
+  {"sse", 3},       {"sse2", 4},         {"sse3", 5},
+  {"ssse3", 6},     {"sse4.1", 7},       {"sse4.2", 8},
+  {"avx", 9},       {"avx2", 10},        {"sse4a", 11},
+  {"fma4", 12},     {"xop", 13},         {"fma", 14},
+  {"avx512f", 15},  {"bmi", 16},         {"bmi2", 17},
+  {"aes", 18},      {"pclmul", 19},      {"avx512vl", 20},
+  {"avx512bw", 21}, {"avx512dq", 22},    {"avx512cd", 23},
+  {"avx512er", 24}, {"avx512pf", 25},    {"avx512vbmi", 26},
+  {"avx512ifma", 27}, {"avx5124vnniw", 28}, {"avx5124fmaps", 29},
+  {"avx512vpopcntdq", 30},
+};
+
+// Parses the comma separated features in `Features` (with or without a
+// leading `+`) into the `target-features` they add to a clone and the mask of
+// `__cpu_features[0]` bits the host needs for that clone to be picked.
+static bool parseCloneFeatures(StringRef Features, std::string &Attr,
+                               uint32_t &Mask) {
+  SmallVector<StringRef, 8> Split;
+  Features.split(Split, ',', -1, /* KeepEmpty = */ false);
+  Mask = 0;
+  for (StringRef Feature : Split) {
+    Feature.consume_front("+");
+    auto *Known = std::find_if(
+        std::begin(X86CPUModelFeatures), std::end(X86CPUModelFeatures),
+        [&](const X86CPUModelFeature &F) { return Feature == F.Name; });
+    if (Known == std::end(X86CPUModelFeatures)) {
+      LLVMRustSetLastError(("target feature `" + Feature +
+                            "` can't be detected when the program is loaded")
+                               .str()
+                               .c_str());
+      return false;
+    }
+    Mask |= 1u << Known->Bit;
+    if (!Attr.empty())
+      Attr += ',';
+    Attr += '+';
+    Attr += Feature;
+  }
+  if (!Mask) {
+    LLVMRustSetLastError("target clones need at least one feature");
+    return false;
+  }
+  return true;
+}
+
+// Replaces the definition of `Name` in `M` with an ifunc, which picks one of
+// `NumClones` clones of it (each with the extra target features in the
+// respective `Features` string) or the original when the program is loaded:
+// the first clone whose features the host has all of is used, so the most
+// demanding ones should come first. Doesn't do anything if `M` doesn't define
+// `Name`.
+//
+// This is what clang does for `__attribute__((target_clones(...)))`, and the
+// same as there it's only supported for ELF targets on x86, where the
+// resolver can ask `__cpu_model` about the host.
+extern "C" LLVMRustResult
+LLVMRustAddTargetClones(LLVMModuleRef M, const char *Name,
+                        const char *const *Features, size_t NumClones) {
+  Module &Mod = *unwrap(M);
+  Function *F = Mod.getFunction(Name);
+  if (!F || F->isDeclaration())
+    return LLVMRustResult::Success;
+
+  Triple TT(Mod.getTargetTriple());
+  if (!TT.isOSBinFormatELF() ||
+      (TT.getArch() != Triple::x86 && TT.getArch() != Triple::x86_64)) {
+    LLVMRustSetLastError("target clones are only supported for x86 ELF targets");
+    return LLVMRustResult::Failure;
+  }
+  if (F->hasComdat()) {
+    LLVMRustSetLastError(
+        ("`" + F->getName() + "` is in a comdat, so it can't be cloned").str().c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  StringRef BaseFeatures =
+      F->getFnAttribute("target-features").getValueAsString();
+  std::vector<std::pair<Function *, uint32_t>> Clones;
+  for (size_t I = 0; I < NumClones; I++) {
+    std::string Attr;
+    uint32_t Mask;
+    if (!parseCloneFeatures(Features[I], Attr, Mask))
+      return LLVMRustResult::Failure;
+    if (!BaseFeatures.empty())
+      Attr = BaseFeatures.str() + "," + Attr;
+
+    ValueToValueMapTy VMap;
+    Function *Clone = CloneFunction(F, VMap);
+    Clone->setName(F->getName() + ".target_clone." + Twine(I));
+    Clone->setLinkage(GlobalValue::InternalLinkage);
+    Clone->addFnAttr("target-features", Attr);
+    Clones.push_back(std::make_pair(Clone, Mask));
+  }
+
+  // The original stays around (under a new name) as the fallback.
+  std::string FnName = F->getName().str();
+  GlobalValue::LinkageTypes Linkage = F->getLinkage();
+  GlobalValue::VisibilityTypes Visibility = F->getVisibility();
+  F->setName(FnName + ".default");
+  F->setLinkage(GlobalValue::InternalLinkage);
+  F->setVisibility(GlobalValue::DefaultVisibility);
+
+  LLVMContext &Ctx = Mod.getContext();
+  FunctionType *ResolverTy = FunctionType::get(F->getType(), false);
+  Function *Resolver = Function::Create(
+      ResolverTy, GlobalValue::InternalLinkage, FnName + ".resolver", &Mod);
+  IRBuilder<> IRB(BasicBlock::Create(Ctx, "", Resolver));
+
+  // `__cpu_indicator_init` is normally a constructor, but ifunc resolvers run
+  // before those do.
+  IRB.CreateCall(Mod.getOrInsertFunction("__cpu_indicator_init",
+                                         Type::getVoidTy(Ctx)));
+  Type *Int32Ty = IRB.getInt32Ty();
+  StructType *CPUModelTy = StructType::get(
+      Int32Ty, Int32Ty, Int32Ty, ArrayType::get(Int32Ty, 1));
+  Constant *CPUModel = Mod.getOrInsertGlobal("__cpu_model", CPUModelTy);
+  Value *FeaturesPtr = IRB.CreateGEP(
+      CPUModelTy, CPUModel,
+      {IRB.getInt32(0), IRB.getInt32(3), IRB.getInt32(0)});
+  Value *HostFeatures = IRB.CreateLoad(Int32Ty, FeaturesPtr);
+
+  Value *Picked = F;
+  for (auto It = Clones.rbegin(); It != Clones.rend(); ++It) {
+    Value *Mask = IRB.getInt32(It->second);
+    Value *HasAll = IRB.CreateICmpEQ(IRB.CreateAnd(HostFeatures, Mask), Mask);
+    Picked = IRB.CreateSelect(HasAll, It->first, Picked);
+  }
+  IRB.CreateRet(Picked);
+
+  GlobalIFunc *IFunc = GlobalIFunc::create(F->getValueType(),
+                                           F->getAddressSpace(), Linkage,
+                                           FnName, Resolver, &Mod);
+  IFunc->setVisibility(Visibility);
+  F->replaceAllUsesWith(IFunc);
+  // Except for the resolver itself, which has to return the original.
+  for (Instruction &I : Resolver->getEntryBlock())
+    I.replaceUsesOfWith(IFunc, F);
+  return LLVMRustResult::Success;
+}
+
 extern "C" void
 LLVMRustSetDataLayoutFromTargetMachine(LLVMModuleRef Module,
                                        LLVMTargetMachineRef TMR) {
@@ -736,6 +2153,78 @@ extern "C" void LLVMRustSetModulePIELevel(LLVMModuleRef M) {
   unwrap(M)->setPIELevel(PIELevel::Level::Large);
 }
 
+// The profiled entry count of `F`, or 0 if there isn't one.
+static uint64_t getEntryCount(const Function &F) {
+#if LLVM_VERSION_GE(7, 0)
+  auto Count = F.getEntryCount();
+  return Count.hasValue() ? Count.getCount() : 0;
+#else
+  auto Count = F.getEntryCount();
+  return Count ? *Count : 0;
+#endif
+}
+
+// Writes out the functions defined in `M` in the order the linker should lay
+// them out in to keep hot code together, one `<count> <symbol>` per line.
+//
+// Functions are taken hottest first (by profiled entry count, or in module
+// order without a profile), each one followed by whatever it directly calls
+// that hasn't been placed yet, depth first. Calls into cold functions are
+// never followed from a hot one, so those are left to the end. `<count>` is
+// the entry count of the function which started the chain, so the lines of
+// several modules can be merged with a stable sort without pulling a caller
+// apart from its callees.
+extern "C" void
+LLVMRustModuleGetSymbolOrdering(LLVMModuleRef M, RustStringRef Str) {
+  Module &Mod = *unwrap(M);
+
+  std::vector<std::pair<uint64_t, Function *>> Roots;
+  for (Function &F : Mod)
+    if (!F.isDeclaration())
+      Roots.push_back(std::make_pair(getEntryCount(F), &F));
+  std::stable_sort(Roots.begin(), Roots.end(),
+                   [](const std::pair<uint64_t, Function *> &A,
+                      const std::pair<uint64_t, Function *> &B) {
+                     return A.first > B.first;
+                   });
+
+  RawRustStringOstream OS(Str);
+  Mangler Mang;
+  SmallPtrSet<const Function *, 32> Placed;
+  SmallVector<Function *, 16> Worklist;
+  SmallVector<Function *, 8> Callees;
+  for (auto &Root : Roots) {
+    if (!Placed.insert(Root.second).second)
+      continue;
+    bool Hot = Root.first > 0;
+    Worklist.push_back(Root.second);
+    while (!Worklist.empty()) {
+      Function *F = Worklist.pop_back_val();
+      OS << Root.first << ' ';
+      Mang.getNameWithPrefix(OS, F, false);
+      OS << '\n';
+
+      Callees.clear();
+      for (BasicBlock &BB : *F) {
+        for (Instruction &I : BB) {
+          CallSite CS(&I);
+          if (!CS)
+            continue;
+          Function *Callee = CS.getCalledFunction();
+          if (!Callee || Callee->isDeclaration() ||
+              Callee->hasFnAttribute(Attribute::Cold) ||
+              (Hot && getEntryCount(*Callee) == 0))
+            continue;
+          if (Placed.insert(Callee).second)
+            Callees.push_back(Callee);
+        }
+      }
+      // Reversed, so callees are placed in the order they're first called in.
+      Worklist.append(Callees.rbegin(), Callees.rend());
+    }
+  }
+}
+
 // Here you'll find an implementation of ThinLTO as used by the Rust compiler
 // right now. This ThinLTO support is only enabled on "recent ish" versions of
 // LLVM, and otherwise it's just blanket rejected from other compilers.
@@ -777,6 +2266,10 @@ struct LLVMRustThinLTOData {
   // from.
   StringMap<MemoryBufferRef> ModuleMap;
 
+  // Backing storage for `ModuleMap` when the bitcode was read from files by
+  // `LLVMRustCreateThinLTODataFromFiles`, empty otherwise.
+  std::vector<std::unique_ptr<MemoryBuffer>> OwnedBuffers;
+
   // A set that we manage of everything we *don't* want internalized. Note that
   // this includes all transitive references right now as well, but it may not
   // always!
@@ -788,18 +2281,16 @@ struct LLVMRustThinLTOData {
   StringMap<FunctionImporter::ExportSetTy> ExportLists;
   StringMap<GVSummaryMapTy> ModuleToDefinedGVSummaries;
 
+  // The linkage that each module's ODR/weak symbols were resolved to in the
+  // combined index. This is kept around after `LLVMRustCreateThinLTOData`
+  // because it's one of the inputs to a module's cache key.
+  StringMap<std::map<GlobalValue::GUID, GlobalValue::LinkageTypes>> ResolvedODR;
+
 #if LLVM_VERSION_GE(7, 0)
   LLVMRustThinLTOData() : Index(/* HaveGVs = */ false) {}
 #endif
 };
 
-// Just an argument to the `LLVMRustCreateThinLTOData` function below.
-struct LLVMRustThinLTOModule {
-  const char *identifier;
-  const char *data;
-  size_t len;
-};
-
 // This is copied from `lib/LTO/ThinLTOCodeGenerator.cpp`, not sure what it
 // does.
 static const GlobalValueSummary *
@@ -823,27 +2314,155 @@ getFirstDefinitionForLinker(const GlobalValueSummaryList &GVSummaryList) {
   return FirstDefForLinker->get();
 }
 
-// The main entry point for creating the global ThinLTO analysis. The structure
-// here is basically the same as before threads are spawned in the `run`
-// function of `lib/LTO/ThinLTOCodeGenerator.cpp`.
-extern "C" LLVMRustThinLTOData*
-LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
-                          int num_modules,
-                          const char **preserved_symbols,
-                          int num_symbols) {
-  auto Ret = llvm::make_unique<LLVMRustThinLTOData>();
+// `ComputeCrossModuleImport` only takes its thresholds from LLVM's global
+// command line options, so this sets one of them by name for as long as it's
+// alive and then puts the old value back, unless it was already passed
+// explicitly through `-C llvm-args`. Callers hold `ImportOptionsLock` for
+// as long as any of these are alive, so that no other thread computes its
+// imports with them. `T` must be the type the option was declared with.
+static std::mutex ImportOptionsLock;
 
-  // Load each module's summary and merge it into one combined index
-  for (int i = 0; i < num_modules; i++) {
-    auto module = &modules[i];
-    StringRef buffer(module->data, module->len);
-    MemoryBufferRef mem_buffer(buffer, module->identifier);
+template <typename T>
+class ScopedLLVMOption {
+  cl::opt<T> *Opt = nullptr;
+  T Saved = T();
 
-    Ret->ModuleMap[module->identifier] = mem_buffer;
+public:
+  ScopedLLVMOption(const char *Name, T Value, bool Override) {
+    if (!Override)
+      return;
+    auto &Opts = cl::getRegisteredOptions();
+    auto It = Opts.find(Name);
+    if (It == Opts.end() || It->second->getNumOccurrences() > 0)
+      return;
+#if defined(__GXX_RTTI) || defined(_CPPRTTI)
+    Opt = dynamic_cast<cl::opt<T> *>(It->second);
+    if (!Opt)
+      report_fatal_error(Twine("LLVM option `") + Name + "` has another type");
+#else
+    // LLVM is usually built without RTTI, in which case there's no checking
+    // this: `T` has to match the declaration in `FunctionImport.cpp`.
+    Opt = static_cast<cl::opt<T> *>(It->second);
+#endif
+    Saved = Opt->getValue();
+    Opt->setValue(Value);
+  }
 
-    if (Error Err = readModuleSummaryIndex(mem_buffer, Ret->Index, i)) {
-      LLVMRustSetLastError(toString(std::move(Err)).c_str());
-      return nullptr;
+  ~ScopedLLVMOption() {
+    if (Opt)
+      Opt->setValue(Saved);
+  }
+
+  ScopedLLVMOption(const ScopedLLVMOption &) = delete;
+  ScopedLLVMOption &operator=(const ScopedLLVMOption &) = delete;
+};
+
+// LLVM has no limit on how many functions a module imports, only on how big
+// each imported function may be, so this trims each module's import list down
+// to `MaxImports` functions after the fact. The functions called from the
+// hottest call sites in the module are kept first (only meaningful with
+// profile data, otherwise all call sites are "unknown"), then the smallest.
+//
+// The exporting modules have already had their export lists computed, so
+// some symbols may end up promoted without anybody importing them. That's
+// harmless, it just means they aren't internalized.
+static void
+pruneThinLTOImports(LLVMRustThinLTOData *Data, unsigned MaxImports) {
+  struct Candidate {
+    StringRef FromModule;
+    GlobalValue::GUID GUID;
+    CalleeInfo::HotnessType Hotness;
+    unsigned InstCount;
+  };
+
+  for (auto &ModuleImports : Data->ImportLists) {
+    auto &ImportList = ModuleImports.getValue();
+
+    // The hottest edge from any of this module's own functions to each callee.
+    DenseMap<GlobalValue::GUID, CalleeInfo::HotnessType> Hotness;
+    const auto &Defined =
+      Data->ModuleToDefinedGVSummaries.find(ModuleImports.getKey());
+    if (Defined != Data->ModuleToDefinedGVSummaries.end()) {
+      for (const auto &Def : Defined->second) {
+        auto *FS = dyn_cast<FunctionSummary>(Def.second);
+        if (!FS)
+          continue;
+        for (const auto &Edge : FS->calls()) {
+          auto EdgeHotness =
+            static_cast<CalleeInfo::HotnessType>(Edge.second.Hotness);
+          auto &H = Hotness[Edge.first.getGUID()];
+          H = std::max(H, EdgeHotness);
+        }
+      }
+    }
+
+    std::vector<Candidate> Candidates;
+    for (auto &FromModule : ImportList) {
+      for (auto &Entry : FromModule.getValue()) {
+#if LLVM_VERSION_GE(7, 0)
+        GlobalValue::GUID GUID = Entry;
+#else
+        GlobalValue::GUID GUID = Entry.first;
+#endif
+        auto *S = Data->Index.findSummaryInModule(GUID, FromModule.getKey());
+        auto *FS = S ? dyn_cast<FunctionSummary>(S) : nullptr;
+        if (!FS)
+          continue;
+        Candidates.push_back({FromModule.getKey(), GUID,
+                              Hotness.lookup(GUID), FS->instCount()});
+      }
+    }
+    if (Candidates.size() <= MaxImports)
+      continue;
+
+    std::sort(Candidates.begin(), Candidates.end(),
+              [](const Candidate &A, const Candidate &B) {
+      if (A.Hotness != B.Hotness)
+        return A.Hotness > B.Hotness;
+      if (A.InstCount != B.InstCount)
+        return A.InstCount < B.InstCount;
+      return A.GUID < B.GUID;
+    });
+    for (size_t i = MaxImports; i < Candidates.size(); i++)
+      ImportList[Candidates[i].FromModule].erase(Candidates[i].GUID);
+
+    // Don't leave behind modules we no longer import anything from, those
+    // would still show up as dependencies in `LLVMRustThinLTOSerializeImports`.
+    std::vector<std::string> Empty;
+    for (auto &FromModule : ImportList)
+      if (FromModule.getValue().empty())
+        Empty.push_back(FromModule.getKey().str());
+    for (const auto &Name : Empty)
+      ImportList.erase(Name);
+  }
+}
+
+// The main part of creating the global ThinLTO analysis, shared between the
+// entry points below which differ only in where the bitcode comes from. The
+// structure here is basically the same as before threads are spawned in the
+// `run` function of `lib/LTO/ThinLTOCodeGenerator.cpp`.
+//
+// `import_budget` may be null, in which case LLVM decides what to import on
+// its own.
+static LLVMRustThinLTOData*
+computeThinLTOData(std::unique_ptr<LLVMRustThinLTOData> Ret,
+                   ArrayRef<MemoryBufferRef> Buffers,
+                   const char **preserved_symbols,
+                   int num_symbols,
+                   const LLVMRustThinLTOImportBudget *import_budget) {
+  RustProfileScope Scope("thinlto-create-data");
+  int num_modules = Buffers.size();
+  for (const auto &Buffer : Buffers)
+    Ret->ModuleMap[Buffer.getBufferIdentifier()] = Buffer;
+
+  // Load each module's summary and merge it into one combined index
+  {
+    RustProfileScope Scope("thinlto-load-summaries");
+    for (int i = 0; i < num_modules; i++) {
+      if (Error Err = readModuleSummaryIndex(Buffers[i], Ret->Index, i)) {
+        LLVMRustSetLastError(toString(std::move(Err)).c_str());
+        return nullptr;
+      }
     }
   }
 
@@ -861,80 +2480,161 @@ LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
   // combined index
   //
   // This is copied from `lib/LTO/ThinLTOCodeGenerator.cpp`
+  {
+    RustProfileScope Scope("thinlto-dead-symbols");
 #if LLVM_VERSION_GE(7, 0)
-  auto deadIsPrevailing = [&](GlobalValue::GUID G) {
-    return PrevailingType::Unknown;
-  };
+    auto deadIsPrevailing = [&](GlobalValue::GUID G) {
+      return PrevailingType::Unknown;
+    };
 #if LLVM_VERSION_GE(8, 0)
-  computeDeadSymbolsWithConstProp(Ret->Index, Ret->GUIDPreservedSymbols,
-                                  deadIsPrevailing, /* ImportEnabled = */ true);
+    computeDeadSymbolsWithConstProp(Ret->Index, Ret->GUIDPreservedSymbols,
+                                    deadIsPrevailing, /* ImportEnabled = */ true);
 #else
-  computeDeadSymbols(Ret->Index, Ret->GUIDPreservedSymbols, deadIsPrevailing);
+    computeDeadSymbols(Ret->Index, Ret->GUIDPreservedSymbols, deadIsPrevailing);
 #endif
 #else
-  computeDeadSymbols(Ret->Index, Ret->GUIDPreservedSymbols);
+    computeDeadSymbols(Ret->Index, Ret->GUIDPreservedSymbols);
 #endif
-  ComputeCrossModuleImport(
-    Ret->Index,
-    Ret->ModuleToDefinedGVSummaries,
-    Ret->ImportLists,
-    Ret->ExportLists
-  );
+  }
+  {
+    RustProfileScope Scope("thinlto-compute-imports");
+    {
+      std::lock_guard<std::mutex> Lock(ImportOptionsLock);
+      ScopedLLVMOption<unsigned> InstrLimit(
+          "import-instr-limit",
+          import_budget ? import_budget->instr_limit : 0,
+          import_budget && import_budget->instr_limit >= 0);
+      ScopedLLVMOption<float> HotMultiplier(
+          "import-hot-multiplier",
+          import_budget ? import_budget->hot_multiplier : 0,
+          import_budget && import_budget->hot_multiplier >= 0);
+      ScopedLLVMOption<float> ColdMultiplier(
+          "import-cold-multiplier",
+          import_budget ? import_budget->cold_multiplier : 0,
+          import_budget && import_budget->cold_multiplier >= 0);
+      ComputeCrossModuleImport(
+        Ret->Index,
+        Ret->ModuleToDefinedGVSummaries,
+        Ret->ImportLists,
+        Ret->ExportLists
+      );
+    }
+    if (import_budget && import_budget->max_imports_per_module >= 0)
+      pruneThinLTOImports(Ret.get(), import_budget->max_imports_per_module);
+  }
 
   // Resolve LinkOnce/Weak symbols, this has to be computed early be cause it
   // impacts the caching.
   //
   // This is copied from `lib/LTO/ThinLTOCodeGenerator.cpp` with some of this
   // being lifted from `lib/LTO/LTO.cpp` as well
-  StringMap<std::map<GlobalValue::GUID, GlobalValue::LinkageTypes>> ResolvedODR;
-  DenseMap<GlobalValue::GUID, const GlobalValueSummary *> PrevailingCopy;
-  for (auto &I : Ret->Index) {
-    if (I.second.SummaryList.size() > 1)
-      PrevailingCopy[I.first] = getFirstDefinitionForLinker(I.second.SummaryList);
-  }
-  auto isPrevailing = [&](GlobalValue::GUID GUID, const GlobalValueSummary *S) {
-    const auto &Prevailing = PrevailingCopy.find(GUID);
-    if (Prevailing == PrevailingCopy.end())
-      return true;
-    return Prevailing->second == S;
-  };
-  auto recordNewLinkage = [&](StringRef ModuleIdentifier,
-                              GlobalValue::GUID GUID,
-                              GlobalValue::LinkageTypes NewLinkage) {
-    ResolvedODR[ModuleIdentifier][GUID] = NewLinkage;
-  };
+  {
+    RustProfileScope Scope("thinlto-resolve-weak");
+    DenseMap<GlobalValue::GUID, const GlobalValueSummary *> PrevailingCopy;
+    for (auto &I : Ret->Index) {
+      if (I.second.SummaryList.size() > 1)
+        PrevailingCopy[I.first] = getFirstDefinitionForLinker(I.second.SummaryList);
+    }
+    auto isPrevailing = [&](GlobalValue::GUID GUID, const GlobalValueSummary *S) {
+      const auto &Prevailing = PrevailingCopy.find(GUID);
+      if (Prevailing == PrevailingCopy.end())
+        return true;
+      return Prevailing->second == S;
+    };
+    auto recordNewLinkage = [&](StringRef ModuleIdentifier,
+                                GlobalValue::GUID GUID,
+                                GlobalValue::LinkageTypes NewLinkage) {
+      Ret->ResolvedODR[ModuleIdentifier][GUID] = NewLinkage;
+    };
 #if LLVM_VERSION_GE(8, 0)
-  thinLTOResolvePrevailingInIndex(Ret->Index, isPrevailing, recordNewLinkage);
+    thinLTOResolvePrevailingInIndex(Ret->Index, isPrevailing, recordNewLinkage);
 #else
-  thinLTOResolveWeakForLinkerInIndex(Ret->Index, isPrevailing, recordNewLinkage);
+    thinLTOResolveWeakForLinkerInIndex(Ret->Index, isPrevailing, recordNewLinkage);
 #endif
+  }
 
   // Here we calculate an `ExportedGUIDs` set for use in the `isExported`
   // callback below. This callback below will dictate the linkage for all
   // summaries in the index, and we basically just only want to ensure that dead
   // symbols are internalized. Otherwise everything that's already external
   // linkage will stay as external, and internal will stay as internal.
-  std::set<GlobalValue::GUID> ExportedGUIDs;
-  for (auto &List : Ret->Index) {
-    for (auto &GVS: List.second.SummaryList) {
-      if (GlobalValue::isLocalLinkage(GVS->linkage()))
-        continue;
-      auto GUID = GVS->getOriginalName();
-      if (GVS->flags().Live)
-        ExportedGUIDs.insert(GUID);
+  {
+    RustProfileScope Scope("thinlto-internalize-index");
+    std::set<GlobalValue::GUID> ExportedGUIDs;
+    for (auto &List : Ret->Index) {
+      for (auto &GVS: List.second.SummaryList) {
+        if (GlobalValue::isLocalLinkage(GVS->linkage()))
+          continue;
+        auto GUID = GVS->getOriginalName();
+        if (GVS->flags().Live)
+          ExportedGUIDs.insert(GUID);
+      }
     }
+    auto isExported = [&](StringRef ModuleIdentifier, GlobalValue::GUID GUID) {
+      const auto &ExportList = Ret->ExportLists.find(ModuleIdentifier);
+      return (ExportList != Ret->ExportLists.end() &&
+        ExportList->second.count(GUID)) ||
+        ExportedGUIDs.count(GUID);
+    };
+    thinLTOInternalizeAndPromoteInIndex(Ret->Index, isExported);
   }
-  auto isExported = [&](StringRef ModuleIdentifier, GlobalValue::GUID GUID) {
-    const auto &ExportList = Ret->ExportLists.find(ModuleIdentifier);
-    return (ExportList != Ret->ExportLists.end() &&
-      ExportList->second.count(GUID)) ||
-      ExportedGUIDs.count(GUID);
-  };
-  thinLTOInternalizeAndPromoteInIndex(Ret->Index, isExported);
 
   return Ret.release();
 }
 
+// The main entry point for creating the global ThinLTO analysis, from modules
+// which rustc already has serialized in memory. The buffers need to outlive
+// the returned data.
+extern "C" LLVMRustThinLTOData*
+LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
+                          int num_modules,
+                          const char **preserved_symbols,
+                          int num_symbols,
+                          const LLVMRustThinLTOImportBudget *import_budget) {
+  std::vector<MemoryBufferRef> Buffers;
+  Buffers.reserve(num_modules);
+  for (int i = 0; i < num_modules; i++) {
+    auto module = &modules[i];
+    StringRef buffer(module->data, module->len);
+    Buffers.push_back(MemoryBufferRef(buffer, module->identifier));
+  }
+  return computeThinLTOData(llvm::make_unique<LLVMRustThinLTOData>(), Buffers,
+                            preserved_symbols, num_symbols, import_budget);
+}
+
+// Same as `LLVMRustCreateThinLTOData`, except that the module named
+// `identifiers[i]` is read from the bitcode file at `paths[i]`. The files are
+// memory mapped (for anything but tiny files) and owned by the returned data,
+// so only the pages the summaries and function imports actually touch are
+// ever read in, rather than every module sitting resident in memory for the
+// whole LTO session.
+extern "C" LLVMRustThinLTOData*
+LLVMRustCreateThinLTODataFromFiles(const char **identifiers,
+                                   const char **paths,
+                                   int num_modules,
+                                   const char **preserved_symbols,
+                                   int num_symbols,
+                                   const LLVMRustThinLTOImportBudget *import_budget) {
+  auto Ret = llvm::make_unique<LLVMRustThinLTOData>();
+
+  std::vector<MemoryBufferRef> Buffers;
+  Buffers.reserve(num_modules);
+  for (int i = 0; i < num_modules; i++) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+      MemoryBuffer::getFile(paths[i], -1, /* RequiresNullTerminator = */ false);
+    if (!BufOrErr) {
+      std::string Msg = std::string("failed to open ") + paths[i] + ": " +
+                        BufOrErr.getError().message();
+      LLVMRustSetLastError(Msg.c_str());
+      return nullptr;
+    }
+    Buffers.push_back(MemoryBufferRef((*BufOrErr)->getBuffer(), identifiers[i]));
+    Ret->OwnedBuffers.push_back(std::move(*BufOrErr));
+  }
+  return computeThinLTOData(std::move(Ret), Buffers,
+                            preserved_symbols, num_symbols, import_budget);
+}
+
 extern "C" void
 LLVMRustFreeThinLTOData(LLVMRustThinLTOData *Data) {
   delete Data;
@@ -946,11 +2646,28 @@ LLVMRustFreeThinLTOData(LLVMRustThinLTOData *Data) {
 // with one another, one per module. The passes here correspond to the analysis
 // passes in `lib/LTO/ThinLTOCodeGenerator.cpp`, currently found in the
 // `ProcessThinLTOModule` function. Here they're split up into separate steps
-// so rustc can save off the intermediate bytecode between each step.
+// so rustc can save off the intermediate bytecode between each step, and
+// there's also `LLVMRustPrepareThinLTOModule` which runs them all at once.
+
+// Note that `StringMap::lookup` returns a copy, which for these maps isn't
+// exactly cheap, so these look up by reference instead.
+static const GVSummaryMapTy &
+definedGlobalsFor(const LLVMRustThinLTOData *Data, StringRef ModuleId) {
+  static const GVSummaryMapTy Empty;
+  const auto &It = Data->ModuleToDefinedGVSummaries.find(ModuleId);
+  return It == Data->ModuleToDefinedGVSummaries.end() ? Empty : It->second;
+}
 
-extern "C" bool
-LLVMRustPrepareThinLTORename(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
-  Module &Mod = *unwrap(M);
+static const FunctionImporter::ImportMapTy &
+importListFor(const LLVMRustThinLTOData *Data, StringRef ModuleId) {
+  static const FunctionImporter::ImportMapTy Empty;
+  const auto &It = Data->ImportLists.find(ModuleId);
+  return It == Data->ImportLists.end() ? Empty : It->second;
+}
+
+static bool
+prepareThinLTORename(const LLVMRustThinLTOData *Data, Module &Mod) {
+  RustProfileScope Scope("thinlto-rename");
   if (renameModuleForThinLTO(Mod, Data->Index)) {
     LLVMRustSetLastError("renameModuleForThinLTO failed");
     return false;
@@ -958,10 +2675,9 @@ LLVMRustPrepareThinLTORename(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
   return true;
 }
 
-extern "C" bool
-LLVMRustPrepareThinLTOResolveWeak(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
-  Module &Mod = *unwrap(M);
-  const auto &DefinedGlobals = Data->ModuleToDefinedGVSummaries.lookup(Mod.getModuleIdentifier());
+static bool
+prepareThinLTOResolveWeak(Module &Mod, const GVSummaryMapTy &DefinedGlobals) {
+  RustProfileScope Scope("thinlto-resolve-weak-module");
 #if LLVM_VERSION_GE(8, 0)
   thinLTOResolvePrevailingInModule(Mod, DefinedGlobals);
 #else
@@ -970,19 +2686,17 @@ LLVMRustPrepareThinLTOResolveWeak(const LLVMRustThinLTOData *Data, LLVMModuleRef
   return true;
 }
 
-extern "C" bool
-LLVMRustPrepareThinLTOInternalize(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
-  Module &Mod = *unwrap(M);
-  const auto &DefinedGlobals = Data->ModuleToDefinedGVSummaries.lookup(Mod.getModuleIdentifier());
+static bool
+prepareThinLTOInternalize(Module &Mod, const GVSummaryMapTy &DefinedGlobals) {
+  RustProfileScope Scope("thinlto-internalize-module");
   thinLTOInternalizeModule(Mod, DefinedGlobals);
   return true;
 }
 
-extern "C" bool
-LLVMRustPrepareThinLTOImport(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
-  Module &Mod = *unwrap(M);
-
-  const auto &ImportList = Data->ImportLists.lookup(Mod.getModuleIdentifier());
+static bool
+prepareThinLTOImport(const LLVMRustThinLTOData *Data, Module &Mod,
+                     const FunctionImporter::ImportMapTy &ImportList) {
+  RustProfileScope Scope("thinlto-import");
   auto Loader = [&](StringRef Identifier) {
     const auto &Memory = Data->ModuleMap.lookup(Identifier);
     auto &Context = Mod.getContext();
@@ -1025,25 +2739,311 @@ LLVMRustPrepareThinLTOImport(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
   return true;
 }
 
-extern "C" typedef void (*LLVMRustModuleNameCallback)(void*, // payload
-                                                      const char*, // importing module name
-                                                      const char*); // imported module name
+extern "C" bool
+LLVMRustPrepareThinLTORename(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
+  return prepareThinLTORename(Data, *unwrap(M));
+}
+
+extern "C" bool
+LLVMRustPrepareThinLTOResolveWeak(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
+  Module &Mod = *unwrap(M);
+  return prepareThinLTOResolveWeak(
+    Mod, definedGlobalsFor(Data, Mod.getModuleIdentifier()));
+}
+
+extern "C" bool
+LLVMRustPrepareThinLTOInternalize(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
+  Module &Mod = *unwrap(M);
+  return prepareThinLTOInternalize(
+    Mod, definedGlobalsFor(Data, Mod.getModuleIdentifier()));
+}
+
+extern "C" bool
+LLVMRustPrepareThinLTOImport(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
+  Module &Mod = *unwrap(M);
+  return prepareThinLTOImport(
+    Data, Mod, importListFor(Data, Mod.getModuleIdentifier()));
+}
+
+extern "C" typedef void (*LLVMRustThinLTOStepCallback)(void*, // payload
+                                                       const char*); // step just finished
+
+// Runs all of the above per-module steps, in order, looking up the module's
+// entries in the global analysis only once. If `step_callback` isn't null
+// it's called after each step with the step's name, which rustc uses to save
+// off the intermediate bytecode when asked to.
+extern "C" bool
+LLVMRustPrepareThinLTOModule(const LLVMRustThinLTOData *Data, LLVMModuleRef M,
+                             LLVMRustThinLTOStepCallback step_callback,
+                             void *callback_payload) {
+  Module &Mod = *unwrap(M);
+  const std::string ModuleId = Mod.getModuleIdentifier();
+  const auto &DefinedGlobals = definedGlobalsFor(Data, ModuleId);
+  const auto &ImportList = importListFor(Data, ModuleId);
+
+  auto Step = [&](const char *Name, bool Ok) {
+    if (Ok && step_callback)
+      step_callback(callback_payload, Name);
+    return Ok;
+  };
+  return Step("rename", prepareThinLTORename(Data, Mod)) &&
+         Step("resolve", prepareThinLTOResolveWeak(Mod, DefinedGlobals)) &&
+         Step("internalize", prepareThinLTOInternalize(Mod, DefinedGlobals)) &&
+         Step("import", prepareThinLTOImport(Data, Mod, ImportList));
+}
+
+// Computes the key under which the result of optimizing and codegen'ing the
+// module `ModuleId` can be cached. This mirrors the caching done in
+// `lib/LTO/ThinLTOCodeGenerator.cpp`: the key covers the module's own hash in
+// the combined index along with everything from the global analysis that
+// affects it, namely what it imports and exports and how its weak symbols were
+// resolved. Note that none of rustc's own settings (opt level, target, etc) are
+// part of the key, so callers are expected to mix those in themselves.
+//
+// Returns `false` if no key could be computed, in which case the module simply
+// shouldn't be cached.
+extern "C" bool
+LLVMRustComputeThinLTOCacheKey(RustStringRef KeyOut,
+                               const char *ModuleId,
+                               const LLVMRustThinLTOData *Data) {
+#if LLVM_VERSION_GE(7, 0)
+  // Without a module hash there's nothing stable to key on, same as upstream.
+  // A module which isn't in the index at all has none either (and
+  // `getModuleHash` would assert on it).
+  auto ModulePath = Data->Index.modulePaths().find(ModuleId);
+  if (ModulePath == Data->Index.modulePaths().end() ||
+      ModulePath->second.second == ModuleHash{{0}})
+    return false;
+
+  SmallString<40> Key;
+  llvm::lto::Config Conf;
+  std::map<GlobalValue::GUID, GlobalValue::LinkageTypes> NoResolvedODR;
+  GVSummaryMapTy NoDefinedGlobals;
+  const auto &ResolvedODR = Data->ResolvedODR.find(ModuleId);
+  const auto &DefinedGlobals = Data->ModuleToDefinedGVSummaries.find(ModuleId);
+  llvm::computeLTOCacheKey(
+    Key, Conf, Data->Index, ModuleId,
+    Data->ImportLists.lookup(ModuleId),
+    Data->ExportLists.lookup(ModuleId),
+    ResolvedODR != Data->ResolvedODR.end() ? ResolvedODR->second : NoResolvedODR,
+    DefinedGlobals != Data->ModuleToDefinedGVSummaries.end()
+      ? DefinedGlobals->second : NoDefinedGlobals
+  );
+
+  RawRustStringOstream OS(KeyOut);
+  OS << Key;
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Looks up a previously stored object file for `Key` in `CacheDir`, returning
+// `nullptr` if there's no entry (or it couldn't be read). Entries are named
+// the same way as `ThinLTOCodeGenerator` names them.
+extern "C" LLVMMemoryBufferRef
+LLVMRustThinLTOCacheLookup(const char *CacheDir, const char *Key) {
+  SmallString<128> EntryPath;
+  sys::path::append(EntryPath, CacheDir, Twine("llvmcache-") + Key);
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+    MemoryBuffer::getFile(EntryPath, -1, false);
+  if (!BufOrErr)
+    return nullptr;
+  return wrap(BufOrErr.get().release());
+}
 
-// Calls `module_name_callback` for each module import done by ThinLTO.
-// The callback is provided with regular null-terminated C strings.
+// Stores the object file `Data` under `Key` in `CacheDir`. The entry is first
+// written to a temporary file and then renamed into place so concurrent
+// compilations sharing a cache never observe a partially written entry.
+extern "C" LLVMRustResult
+LLVMRustThinLTOCacheStore(const char *CacheDir, const char *Key,
+                          const char *Data, size_t Len) {
+  SmallString<128> EntryPath;
+  sys::path::append(EntryPath, CacheDir, Twine("llvmcache-") + Key);
+
+  int TempFD;
+  SmallString<128> TempPath;
+  SmallString<128> TempModel(EntryPath);
+  TempModel += ".tmp%%%%%%%";
+  if (std::error_code EC =
+        sys::fs::createUniqueFile(TempModel, TempFD, TempPath)) {
+    LLVMRustSetLastErrorCode(EC);
+    return LLVMRustResult::Failure;
+  }
+  {
+    raw_fd_ostream OS(TempFD, /* shouldClose = */ true);
+    OS.write(Data, Len);
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(TempPath);
+      LLVMRustSetLastError("failed to write ThinLTO cache entry");
+      return LLVMRustResult::Failure;
+    }
+  }
+  if (std::error_code EC = sys::fs::rename(TempPath, EntryPath)) {
+    sys::fs::remove(TempPath);
+    LLVMRustSetLastErrorCode(EC);
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+}
+
+// The summary index's view of how costly the module `ModuleId` is to optimize
+// and codegen: the instructions in all the functions it defines, plus its call
+// graph edges. This doesn't include anything the module will import, but it
+// doesn't need the module itself to be loaded either.
+extern "C" uint64_t
+LLVMRustThinLTOModuleCost(const LLVMRustThinLTOData *Data,
+                          const char *ModuleId) {
+  uint64_t Cost = 0;
+  for (const auto &Def : definedGlobalsFor(Data, ModuleId)) {
+    auto *FS = dyn_cast<FunctionSummary>(Def.second);
+    if (!FS)
+      continue;
+    Cost += 1 + FS->instCount() + FS->calls().size();
+  }
+  return Cost;
+}
+
+// The import map, i.e. which modules each module imports from, is handed to
+// rustc serialized as one buffer. With every number a little endian
+// `uint32_t`, that's:
+//
+//  * the number of modules, followed by each module's ID as its length and
+//    bytes, sorted;
+//  * then for each module in that order, the number of modules it imports
+//    from followed by their (sorted) indices in the table above.
+//
+// Both the current map and a previous one are turned into this one module ID
+// to sorted imported module IDs form to compare them.
+typedef std::map<std::string, std::vector<std::string>> ThinLTOImportSets;
+
+static ThinLTOImportSets importSetsFor(const LLVMRustThinLTOData *Data) {
+  ThinLTOImportSets Sets;
+  for (const auto &Module : Data->ModuleMap) {
+    std::vector<std::string> &Imports = Sets[Module.getKey().str()];
+    const auto &ImportList = importListFor(Data, Module.getKey());
+    for (const auto &Imported : ImportList)
+      Imports.push_back(Imported.getKey().str());
+    std::sort(Imports.begin(), Imports.end());
+  }
+  return Sets;
+}
+
+static void writeU32(raw_ostream &OS, uint32_t V) {
+  char Buf[4];
+  support::endian::write32le(Buf, V);
+  OS.write(Buf, sizeof(Buf));
+}
+
+static bool readU32(StringRef &Buf, uint32_t &V) {
+  if (Buf.size() < 4)
+    return false;
+  V = support::endian::read32le(Buf.data());
+  Buf = Buf.drop_front(4);
+  return true;
+}
+
+static bool parseImportSets(StringRef Buf, ThinLTOImportSets &Sets) {
+  uint32_t NumModules;
+  if (!readU32(Buf, NumModules))
+    return false;
+  std::vector<std::string> Ids;
+  for (uint32_t I = 0; I < NumModules; I++) {
+    uint32_t Len;
+    if (!readU32(Buf, Len) || Buf.size() < Len)
+      return false;
+    Ids.push_back(Buf.take_front(Len).str());
+    Buf = Buf.drop_front(Len);
+  }
+  for (const std::string &Id : Ids) {
+    std::vector<std::string> &Imports = Sets[Id];
+    uint32_t NumImports;
+    if (!readU32(Buf, NumImports))
+      return false;
+    for (uint32_t I = 0; I < NumImports; I++) {
+      uint32_t Index;
+      if (!readU32(Buf, Index) || Index >= Ids.size())
+        return false;
+      Imports.push_back(Ids[Index]);
+    }
+    std::sort(Imports.begin(), Imports.end());
+  }
+  return Buf.empty();
+}
+
+// Writes the import map in the format above. rustc both reads it back itself
+// and keeps it around for the next incremental session to compare against.
+extern "C" void
+LLVMRustThinLTOSerializeImports(const LLVMRustThinLTOData *Data,
+                                RustStringRef Out) {
+  ThinLTOImportSets Sets = importSetsFor(Data);
+  std::map<StringRef, uint32_t> Indices;
+  for (const auto &Set : Sets)
+    Indices.insert(std::make_pair(Set.first, Indices.size()));
+
+  RawRustStringOstream OS(Out);
+  writeU32(OS, Sets.size());
+  for (const auto &Set : Sets) {
+    writeU32(OS, Set.first.size());
+    OS << Set.first;
+  }
+  for (const auto &Set : Sets) {
+    writeU32(OS, Set.second.size());
+    for (const std::string &Imported : Set.second)
+      writeU32(OS, Indices[Imported]);
+  }
+}
+
+// Writes the IDs of the modules which import from a different set of modules
+// than they did in `Prev` (a map serialized with the function above), or
+// which weren't in it at all, to `Changed`, each followed by a nul. Returns
+// `false`, having written nothing, if `Prev` isn't a valid serialized map.
+extern "C" bool
+LLVMRustThinLTODiffImports(const LLVMRustThinLTOData *Data,
+                           const char *Prev, size_t PrevLen,
+                           RustStringRef Changed) {
+  ThinLTOImportSets PrevSets;
+  if (!parseImportSets(StringRef(Prev, PrevLen), PrevSets))
+    return false;
+
+  RawRustStringOstream OS(Changed);
+  for (const auto &Set : importSetsFor(Data)) {
+    auto It = PrevSets.find(Set.first);
+    if (It == PrevSets.end() || It->second != Set.second)
+      OS << Set.first << '\0';
+  }
+  return true;
+}
+
+// Writes a line for every module in `Data`: a hash of the GUIDs of the
+// definitions in it the global analysis found to be dead, which
+// `LLVMRustParseThinLTOModule` drops from the module, followed by the module's
+// ID. Whether a definition is dead depends on every other module, so what's
+// been codegened for a module can only be reused while this stays the same.
 extern "C" void
-LLVMRustGetThinLTOModuleImports(const LLVMRustThinLTOData *data,
-                                LLVMRustModuleNameCallback module_name_callback,
-                                void* callback_payload) {
-  for (const auto& importing_module : data->ImportLists) {
-    const std::string importing_module_id = importing_module.getKey().str();
-    const auto& imports = importing_module.getValue();
-    for (const auto& imported_module : imports) {
-      const std::string imported_module_id = imported_module.getKey().str();
-      module_name_callback(callback_payload,
-                           importing_module_id.c_str(),
-                           imported_module_id.c_str());
+LLVMRustThinLTOSerializeDeadDefinitions(const LLVMRustThinLTOData *Data,
+                                        RustStringRef Out) {
+  RawRustStringOstream OS(Out);
+  for (const auto &Module : Data->ModuleMap) {
+    std::vector<GlobalValue::GUID> Dead;
+    for (const auto &Def : definedGlobalsFor(Data, Module.getKey()))
+      if (!Data->Index.isGlobalValueLive(Def.second))
+        Dead.push_back(Def.first);
+    std::sort(Dead.begin(), Dead.end());
+
+    MD5 Hasher;
+    for (GlobalValue::GUID GUID : Dead) {
+      uint8_t Bytes[8];
+      support::endian::write64le(Bytes, GUID);
+      Hasher.update(ArrayRef<uint8_t>(Bytes));
     }
+    MD5::MD5Result Hash;
+    Hasher.final(Hash);
+    SmallString<32> Hex;
+    MD5::stringifyResult(Hash, Hex);
+    OS << Hex << ' ' << Module.getKey() << '\n';
   }
 }
 
@@ -1059,20 +3059,54 @@ struct LLVMRustThinLTOBuffer {
   std::string data;
 };
 
+static void
+writeThinLTOBitcode(Module &M, raw_ostream &OS) {
+  legacy::PassManager PM;
+  PM.add(createWriteThinLTOBitcodePass(OS));
+  PM.run(M);
+}
+
 extern "C" LLVMRustThinLTOBuffer*
 LLVMRustThinLTOBufferCreate(LLVMModuleRef M) {
   auto Ret = llvm::make_unique<LLVMRustThinLTOBuffer>();
   {
     raw_string_ostream OS(Ret->data);
-    {
-      legacy::PassManager PM;
-      PM.add(createWriteThinLTOBitcodePass(OS));
-      PM.run(*unwrap(M));
-    }
+    writeThinLTOBitcode(*unwrap(M), OS);
   }
   return Ret.release();
 }
 
+// Same as `LLVMRustThinLTOBufferCreate`, but reserves `SizeHint` bytes up
+// front. If the hint is about right (say, the size of this module the last
+// time it was serialized) this avoids regrowing, and copying, the buffer over
+// and over while the bitcode is written out.
+extern "C" LLVMRustThinLTOBuffer*
+LLVMRustThinLTOBufferCreateWithSizeHint(LLVMModuleRef M, size_t SizeHint) {
+  auto Ret = llvm::make_unique<LLVMRustThinLTOBuffer>();
+  Ret->data.reserve(SizeHint);
+  {
+    raw_string_ostream OS(Ret->data);
+    writeThinLTOBitcode(*unwrap(M), OS);
+  }
+  return Ret.release();
+}
+
+// Writes the same bitcode as `LLVMRustThinLTOBufferCreate` straight to the
+// already open file descriptor `FD` instead of into memory. The descriptor is
+// left open.
+extern "C" LLVMRustResult
+LLVMRustThinLTOBufferWriteToFD(LLVMModuleRef M, int FD) {
+  raw_fd_ostream OS(FD, /* shouldClose = */ false);
+  writeThinLTOBitcode(*unwrap(M), OS);
+  OS.flush();
+  if (OS.has_error()) {
+    LLVMRustSetLastErrorCode(OS.error());
+    OS.clear_error();
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+}
+
 extern "C" void
 LLVMRustThinLTOBufferFree(LLVMRustThinLTOBuffer *Buffer) {
   delete Buffer;
@@ -1088,6 +3122,119 @@ LLVMRustThinLTOBufferLen(const LLVMRustThinLTOBuffer *Buffer) {
   return Buffer->data.length();
 }
 
+// Reads the data layout of the first module in the bitcode in `Buffer` into
+// `DataLayout`, straight from the record near the start of its module block.
+// Every other block is skipped over without being looked at, so this doesn't
+// need a context and takes no longer for a large module than for a small one.
+// Bitcode without a data layout leaves `DataLayout` empty.
+static bool readBitcodeDataLayout(MemoryBufferRef Buffer,
+                                  std::string &DataLayout) {
+  const unsigned char *BufPtr =
+      reinterpret_cast<const unsigned char *>(Buffer.getBufferStart());
+  const unsigned char *BufEnd = BufPtr + Buffer.getBufferSize();
+  if (isBitcodeWrapper(BufPtr, BufEnd) &&
+      SkipBitcodeWrapperHeader(BufPtr, BufEnd, true)) {
+    LLVMRustSetLastError("invalid bitcode wrapper header");
+    return false;
+  }
+
+  BitstreamCursor Stream(ArrayRef<uint8_t>(BufPtr, BufEnd));
+  if (Stream.Read(8) != 'B' || Stream.Read(8) != 'C' ||
+      Stream.Read(4) != 0x0 || Stream.Read(4) != 0xC ||
+      Stream.Read(4) != 0xE || Stream.Read(4) != 0xD) {
+    LLVMRustSetLastError("file doesn't start with bitcode header");
+    return false;
+  }
+
+  // Find the module block among the identification, string table and symbol
+  // table blocks at the top level.
+  while (true) {
+    if (Stream.AtEndOfStream()) {
+      LLVMRustSetLastError("bitcode doesn't contain a module");
+      return false;
+    }
+    BitstreamEntry Entry = Stream.advance();
+    if (Entry.Kind != BitstreamEntry::SubBlock) {
+      LLVMRustSetLastError("malformed bitcode");
+      return false;
+    }
+    if (Entry.ID == bitc::MODULE_BLOCK_ID)
+      break;
+    if (Stream.SkipBlock()) {
+      LLVMRustSetLastError("malformed bitcode");
+      return false;
+    }
+  }
+
+  if (Stream.EnterSubBlock(bitc::MODULE_BLOCK_ID)) {
+    LLVMRustSetLastError("malformed bitcode");
+    return false;
+  }
+  SmallVector<uint64_t, 64> Record;
+  while (true) {
+    BitstreamEntry Entry = Stream.advance();
+    switch (Entry.Kind) {
+    case BitstreamEntry::Error:
+      LLVMRustSetLastError("malformed bitcode");
+      return false;
+    case BitstreamEntry::EndBlock:
+      return true;
+    case BitstreamEntry::SubBlock:
+      if (Stream.SkipBlock()) {
+        LLVMRustSetLastError("malformed bitcode");
+        return false;
+      }
+      continue;
+    case BitstreamEntry::Record:
+      break;
+    }
+    Record.clear();
+    if (Stream.readRecord(Entry.ID, Record) == bitc::MODULE_CODE_DATALAYOUT) {
+      DataLayout.assign(Record.begin(), Record.end());
+      return true;
+    }
+  }
+}
+
+// Checks that the bitcode in `data` can be used for LTO before any work is
+// done on it: that the LLVM which produced it isn't newer than ours (which
+// wouldn't be able to read it, or worse, would misread it) and that it can
+// be read at all. Only the identification block and the module block's own
+// records are read, so this is cheap enough to do for every input up front.
+// The module's data layout is written to `DataLayoutOut` for the caller to
+// check against the rest of the inputs.
+extern "C" LLVMRustResult
+LLVMRustCheckBitcodeForLTO(const char *data, size_t len,
+                           const char *identifier,
+                           RustStringRef DataLayoutOut) {
+  MemoryBufferRef Buffer(StringRef(data, len), identifier);
+  Expected<std::string> ProducerOrErr = getBitcodeProducerString(Buffer);
+  if (!ProducerOrErr) {
+    LLVMRustSetLastError(toString(ProducerOrErr.takeError()).c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  // Producers are named like `LLVM7.0.1` (with a suffix for forks like ours),
+  // anything else is from a toolchain we can't tell the version of.
+  StringRef Producer = *ProducerOrErr;
+  unsigned Major;
+  if (Producer.consume_front("LLVM") && !Producer.consumeInteger(10, Major) &&
+      Major > LLVM_VERSION_MAJOR) {
+    std::string Error = "bitcode was produced by " + *ProducerOrErr +
+                        ", which is newer than the LLVM " +
+                        std::to_string(LLVM_VERSION_MAJOR) + " in use";
+    LLVMRustSetLastError(Error.c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  std::string DataLayout;
+  if (!readBitcodeDataLayout(Buffer, DataLayout))
+    return LLVMRustResult::Failure;
+  RawRustStringOstream OS(DataLayoutOut);
+  OS << DataLayout;
+  return LLVMRustResult::Success;
+}
+
 // This is what we used to parse upstream bitcode for actual ThinLTO
 // processing.  We'll call this once per module optimized through ThinLTO, and
 // it'll be called concurrently on many threads.
@@ -1108,6 +3255,83 @@ LLVMRustParseBitcodeForLTO(LLVMContextRef Context,
   return wrap(std::move(*SrcOrError).release());
 }
 
+// Drops the definitions in `Mod` which the global analysis found to be dead,
+// the same as `dropDeadSymbols` in `lib/LTO/LTOBackend.cpp`. This doesn't need
+// the definitions to have been materialized, so for lazily loaded modules the
+// dead ones are never even parsed.
+//
+// Aliases (and whatever they alias) are left alone, both as an alias can't
+// point at a declaration and as replacing one would leave whatever is yet
+// to be materialized referring to the old one.
+static void dropDeadDefinitions(const LLVMRustThinLTOData *Data, Module &Mod) {
+  const auto &DefinedGlobals = definedGlobalsFor(Data, Mod.getModuleIdentifier());
+  SmallPtrSet<const GlobalObject *, 4> Aliased;
+  for (GlobalAlias &GA : Mod.aliases())
+    if (const GlobalObject *GO = GA.getBaseObject())
+      Aliased.insert(GO);
+
+  auto IsDead = [&](const GlobalObject &GO) {
+    if (GO.isDeclaration() || Aliased.count(&GO))
+      return false;
+    GlobalValueSummary *GVS = DefinedGlobals.lookup(GO.getGUID());
+    return GVS && !Data->Index.isGlobalValueLive(GVS);
+  };
+  for (Function &F : Mod) {
+    if (IsDead(F)) {
+      F.deleteBody();
+      F.clearMetadata();
+      F.setComdat(nullptr);
+    }
+  }
+  for (GlobalVariable &GV : Mod.globals()) {
+    if (IsDead(GV)) {
+      GV.setInitializer(nullptr);
+      GV.setLinkage(GlobalValue::ExternalLinkage);
+      GV.clearMetadata();
+      GV.setComdat(nullptr);
+    }
+  }
+}
+
+// Parses a module for ThinLTO to optimize, like `LLVMRustParseBitcodeForLTO`
+// does, except that the module's loaded lazily: first only its globals and
+// metadata, which is all that's needed to see which of its definitions the
+// global analysis in `Data` found to be dead, and then, once those have been
+// dropped, the rest of it. Metadata which is only used by functions is only
+// loaded along with them.
+//
+// As the module is fully materialized by the time this returns, `data`
+// doesn't have to outlive this call.
+extern "C" LLVMModuleRef
+LLVMRustParseThinLTOModule(const LLVMRustThinLTOData *Data,
+                           LLVMContextRef Context,
+                           const char *data,
+                           size_t len,
+                           const char *identifier) {
+  RustProfileScope Scope("thinlto-parse-module");
+  MemoryBufferRef Buffer(StringRef(data, len), identifier);
+  unwrap(Context)->enableDebugTypeODRUniquing();
+  Expected<std::unique_ptr<Module>> SrcOrError =
+      getLazyBitcodeModule(Buffer, *unwrap(Context),
+                           /* ShouldLazyLoadMetadata = */ true);
+  if (!SrcOrError) {
+    LLVMRustSetLastError(toString(SrcOrError.takeError()).c_str());
+    return nullptr;
+  }
+
+  std::unique_ptr<Module> Src = std::move(*SrcOrError);
+  if (Error Err = Src->materializeMetadata()) {
+    LLVMRustSetLastError(toString(std::move(Err)).c_str());
+    return nullptr;
+  }
+  dropDeadDefinitions(Data, *Src);
+  if (Error Err = Src->materializeAll()) {
+    LLVMRustSetLastError(toString(std::move(Err)).c_str());
+    return nullptr;
+  }
+  return wrap(Src.release());
+}
+
 // Rewrite all `DICompileUnit` pointers to the `DICompileUnit` specified. See
 // the comment in `back/lto.rs` for why this exists.
 extern "C" void
@@ -1144,28 +3368,51 @@ LLVMRustThinLTOPatchDICompileUnit(LLVMModuleRef Mod, DICompileUnit *Unit) {
       return;
   }
 
-  // Use LLVM's built-in `DebugInfoFinder` to find a bunch of debuginfo and
-  // process it recursively. Note that we specifically iterate over instructions
-  // to ensure we feed everything into it.
-  DebugInfoFinder Finder;
-  Finder.processModule(*M);
+  // Only subprograms which are definitions point to a unit, and the only ones
+  // which can point to a unit other than `Unit` are those of functions which
+  // were imported, along with whatever was inlined into those before they
+  // were. Everything which was already in this module was codegened for the
+  // one unit it had, so only the bodies of functions whose own subprogram
+  // belongs to another unit (or which don't have a subprogram at all) are
+  // walked here, rather than handing every instruction and, recursively,
+  // every type in the module to a `DebugInfoFinder`.
+  SmallPtrSet<DISubprogram *, 32> Subprograms;
+  SmallPtrSet<const DILocation *, 32> SeenLocations;
+  auto AddScope = [&](DIScope *Scope) {
+    if (auto *LS = dyn_cast_or_null<DILocalScope>(Scope))
+      if (DISubprogram *SP = LS->getSubprogram())
+        Subprograms.insert(SP);
+  };
   for (Function &F : M->functions()) {
+    DISubprogram *SP = F.getSubprogram();
+    if (SP) {
+      Subprograms.insert(SP);
+      if (SP->getUnit() == Unit)
+        continue;
+    }
     for (auto &FI : F) {
       for (Instruction &BI : FI) {
-        if (auto Loc = BI.getDebugLoc())
-          Finder.processLocation(*M, Loc);
-        if (auto DVI = dyn_cast<DbgValueInst>(&BI))
-          Finder.processValue(*M, DVI);
-        if (auto DDI = dyn_cast<DbgDeclareInst>(&BI))
-          Finder.processDeclare(*M, DDI);
+        for (const DILocation *Loc = BI.getDebugLoc().get(); Loc;
+             Loc = Loc->getInlinedAt()) {
+          if (!SeenLocations.insert(Loc).second)
+            break;
+          AddScope(Loc->getScope());
+        }
+#if LLVM_VERSION_GE(8, 0)
+        if (auto DVI = dyn_cast<DbgVariableIntrinsic>(&BI))
+#else
+        if (auto DVI = dyn_cast<DbgInfoIntrinsic>(&BI))
+#endif
+          AddScope(DVI->getVariable()->getScope());
       }
     }
   }
 
   // After we've found all our debuginfo, rewrite all subprograms to point to
   // the same `DICompileUnit`.
-  for (auto &F : Finder.subprograms()) {
-    F->replaceUnit(Unit);
+  for (DISubprogram *SP : Subprograms) {
+    if (SP->getUnit() && SP->getUnit() != Unit)
+      SP->replaceUnit(Unit);
   }
 
   // Erase any other references to other `DICompileUnit` instances, the verifier
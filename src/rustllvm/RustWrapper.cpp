@@ -8,10 +8,17 @@
 #include "llvm/Object/Archive.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Bitcode/BitcodeWriterPass.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Regex.h"
 #include "llvm/Support/Signals.h"
+#include "llvm/Support/YAMLTraits.h"
 #include "llvm/ADT/Optional.h"
 
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
 //===----------------------------------------------------------------------===
 //
@@ -47,7 +54,21 @@ static AtomicOrdering fromRust(LLVMAtomicOrdering Ordering) {
   report_fatal_error("Invalid LLVMAtomicOrdering value!");
 }
 
-static LLVM_THREAD_LOCAL char *LastError;
+// The last error set on this thread.
+//
+// Setting one never allocates: messages are copied into a fixed-size buffer,
+// truncated if they don't fit, and an `std::error_code` is only kept as is
+// until its message is asked for. Everything starts out zeroed, which is
+// `None`, as it's all plain data for the sake of `LLVM_THREAD_LOCAL`.
+struct LLVMRustLastError {
+  enum { None, Message, ErrorCode } Kind;
+  int CodeValue;
+  const std::error_category *CodeCategory;
+  size_t Len;
+  char Buf[4096];
+};
+
+static LLVM_THREAD_LOCAL LLVMRustLastError LastError;
 
 // Custom error handler for fatal LLVM errors.
 //
@@ -75,27 +96,138 @@ LLVMRustCreateMemoryBufferWithContentsOfFile(const char *Path) {
   ErrorOr<std::unique_ptr<MemoryBuffer>> BufOr =
       MemoryBuffer::getFile(Path, -1, false);
   if (!BufOr) {
-    LLVMRustSetLastError(BufOr.getError().message().c_str());
+    LLVMRustSetLastErrorCode(BufOr.getError());
     return nullptr;
   }
   return wrap(BufOr.get().release());
 }
 
-extern "C" char *LLVMRustGetLastError(void) {
-  char *Ret = LastError;
-  LastError = nullptr;
-  return Ret;
+// Takes the last error set on this thread, returning false if there isn't
+// one. The message `*Message` points to stays valid until the next error is
+// set on this thread, and isn't nul-terminated if it was truncated.
+extern "C" bool LLVMRustTakeLastError(const char **Message, size_t *Len) {
+  if (LastError.Kind == LLVMRustLastError::None)
+    return false;
+  if (LastError.Kind == LLVMRustLastError::ErrorCode) {
+    std::error_code EC(LastError.CodeValue, *LastError.CodeCategory);
+    LLVMRustSetLastError(EC.message().c_str());
+  }
+  LastError.Kind = LLVMRustLastError::None;
+  *Message = LastError.Buf;
+  *Len = LastError.Len;
+  return true;
 }
 
 extern "C" void LLVMRustSetLastError(const char *Err) {
-  free((void *)LastError);
-  LastError = strdup(Err);
+  size_t Len = std::min(strlen(Err), sizeof(LastError.Buf));
+  memcpy(LastError.Buf, Err, Len);
+  if (Len < sizeof(LastError.Buf))
+    LastError.Buf[Len] = '\0';
+  LastError.Len = Len;
+  LastError.Kind = LLVMRustLastError::Message;
+}
+
+void LLVMRustSetLastErrorCode(std::error_code EC) {
+  LastError.CodeValue = EC.value();
+  LastError.CodeCategory = &EC.category();
+  LastError.Kind = LLVMRustLastError::ErrorCode;
+}
+
+// Contexts given back with `LLVMRustContextRelease` while pooling is enabled
+// are kept around to be handed out again by `LLVMRustContextAcquire`, rather
+// than having every module build its type, constant and metadata uniquing
+// tables up from nothing. A context never forgets the types and constants
+// created in it though, so each one is only reused a bounded number of times
+// before it's thrown away, and at most one is kept idle per hardware thread.
+namespace {
+struct LLVMRustContextPool {
+  std::mutex Lock;
+  bool Enabled = false;
+  std::vector<LLVMContext *> Idle;
+  // How many modules each context handed out while pooling has been used for.
+  DenseMap<LLVMContext *, unsigned> Uses;
+};
+}
+
+static const unsigned MaxContextUses = 8;
+
+static LLVMRustContextPool &getContextPool() {
+  static LLVMRustContextPool Pool;
+  return Pool;
+}
+
+extern "C" void LLVMRustSetContextPoolingEnabled(bool Enabled) {
+  LLVMRustContextPool &Pool = getContextPool();
+  std::vector<LLVMContext *> Idle;
+  {
+    std::lock_guard<std::mutex> Guard(Pool.Lock);
+    Pool.Enabled = Enabled;
+    if (!Enabled) {
+      for (LLVMContext *Ctx : Pool.Idle)
+        Pool.Uses.erase(Ctx);
+      Idle.swap(Pool.Idle);
+    }
+  }
+  for (LLVMContext *Ctx : Idle)
+    delete Ctx;
+}
+
+extern "C" LLVMContextRef LLVMRustContextAcquire(bool shouldDiscardNames) {
+  LLVMRustContextPool &Pool = getContextPool();
+  LLVMContext *Ctx = nullptr;
+  {
+    std::lock_guard<std::mutex> Guard(Pool.Lock);
+    if (Pool.Enabled) {
+      if (!Pool.Idle.empty()) {
+        Ctx = Pool.Idle.back();
+        Pool.Idle.pop_back();
+      } else {
+        Ctx = new LLVMContext();
+      }
+      Pool.Uses[Ctx]++;
+    }
+  }
+  if (!Ctx)
+    Ctx = new LLVMContext();
+  Ctx->setDiscardValueNames(shouldDiscardNames);
+  return wrap(Ctx);
+}
+
+// Deletes `M` (the context's module, if it still has one) and then either
+// puts `C` back into the pool, looking just like a new context does, or
+// disposes of it.
+extern "C" void LLVMRustContextRelease(LLVMContextRef C, LLVMModuleRef M) {
+  LLVMContext *Ctx = unwrap(C);
+  delete unwrap(M);
+  Ctx->setDiagnosticHandler(llvm::make_unique<DiagnosticHandler>());
+  Ctx->setInlineAsmDiagnosticHandler(nullptr);
+  Ctx->disableDebugTypeODRUniquing();
+
+  LLVMRustContextPool &Pool = getContextPool();
+  bool Reuse = false;
+  {
+    std::lock_guard<std::mutex> Guard(Pool.Lock);
+    auto It = Pool.Uses.find(Ctx);
+    if (It != Pool.Uses.end()) {
+      unsigned MaxIdle = std::max(1u, std::thread::hardware_concurrency());
+      Reuse = Pool.Enabled && It->second < MaxContextUses &&
+              Pool.Idle.size() < MaxIdle;
+      if (Reuse)
+        Pool.Idle.push_back(Ctx);
+      else
+        Pool.Uses.erase(It);
+    }
+  }
+  if (!Reuse)
+    delete Ctx;
 }
 
-extern "C" LLVMContextRef LLVMRustContextCreate(bool shouldDiscardNames) {
-  auto ctx = new LLVMContext();
-  ctx->setDiscardValueNames(shouldDiscardNames);
-  return wrap(ctx);
+// Makes debuginfo types with the same unique identifier be the same node in
+// `C`, so that they're only emitted once when modules are linked together (or
+// functions are imported) into it. Only types parsed into the context after
+// this was called are uniqued.
+extern "C" void LLVMRustContextEnableDebugTypeODRUniquing(LLVMContextRef C) {
+  unwrap(C)->enableDebugTypeODRUniquing();
 }
 
 extern "C" void LLVMRustSetNormalizedTarget(LLVMModuleRef M,
@@ -108,6 +240,119 @@ extern "C" void LLVMRustPrintPassTimings() {
   TimerGroup::printAll(OS);
 }
 
+// Profile events, recorded by `RustProfileScope`s around the interesting bits
+// of the glue (mostly ThinLTO's serial steps) so that they can show up in
+// rustc's own profiles.
+//
+// Each thread records into its own ring buffer, which only ever holds the
+// most recent `ProfileEventRing::Capacity` events. The buffer's lock is only
+// ever contended by `LLVMRustDrainProfileEvents`, so recording an event costs
+// two clock reads and an uncontended lock. The buffers themselves are never
+// freed (the threads recording into them can't be told apart from the ones
+// that are gone), but are emptied and shrunk whenever they're drained.
+std::atomic<bool> RustProfileEventsEnabled(false);
+
+namespace {
+struct ProfileEvent {
+  const char *Name;
+  uint64_t Start;
+  uint64_t End;
+};
+
+struct ProfileEventRing {
+  static const size_t Capacity = 1 << 16;
+
+  std::mutex Lock;
+  uint64_t ThreadId;
+  std::vector<ProfileEvent> Events;
+  // Where the next event goes once `Events` is full, overwriting the oldest.
+  size_t Next = 0;
+  uint64_t Dropped = 0;
+};
+}
+
+static std::mutex ProfileEventRingsLock;
+static ManagedStatic<std::vector<std::unique_ptr<ProfileEventRing>>>
+    ProfileEventRings;
+static LLVM_THREAD_LOCAL ProfileEventRing *ThreadProfileEventRing;
+
+static ProfileEventRing &getThreadProfileEventRing() {
+  if (!ThreadProfileEventRing) {
+    std::lock_guard<std::mutex> Lock(ProfileEventRingsLock);
+    ProfileEventRings->push_back(llvm::make_unique<ProfileEventRing>());
+    ThreadProfileEventRing = ProfileEventRings->back().get();
+    ThreadProfileEventRing->ThreadId = ProfileEventRings->size() - 1;
+  }
+  return *ThreadProfileEventRing;
+}
+
+// Nanoseconds on a monotonic clock, which is the same one (`CLOCK_MONOTONIC`
+// on Linux, for example) that Rust's `Instant` uses.
+static uint64_t profileTimestamp() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+RustProfileScope::RustProfileScope(const char *Name)
+    : Name(Name),
+      Start(RustProfileEventsEnabled.load(std::memory_order_relaxed)
+                ? profileTimestamp() : 0) {}
+
+RustProfileScope::~RustProfileScope() {
+  if (!Start)
+    return;
+  ProfileEvent Event = {Name, Start, profileTimestamp()};
+  ProfileEventRing &Ring = getThreadProfileEventRing();
+  std::lock_guard<std::mutex> Lock(Ring.Lock);
+  if (Ring.Events.size() < ProfileEventRing::Capacity) {
+    Ring.Events.push_back(Event);
+    return;
+  }
+  Ring.Events[Ring.Next] = Event;
+  Ring.Next = (Ring.Next + 1) % ProfileEventRing::Capacity;
+  Ring.Dropped++;
+}
+
+extern "C" void LLVMRustSetProfileEventsEnabled(bool Enabled) {
+  RustProfileEventsEnabled.store(Enabled, std::memory_order_relaxed);
+}
+
+// The current time on the clock profile events are timestamped with, so the
+// caller can line them up with its own clock.
+extern "C" uint64_t LLVMRustProfileEventTimestamp() {
+  return profileTimestamp();
+}
+
+typedef void (*LLVMRustProfileEventCallback)(void *, const char *Name,
+                                             uint64_t ThreadId,
+                                             uint64_t StartNanos,
+                                             uint64_t EndNanos);
+
+// Passes every event recorded so far to `Callback` and forgets about them.
+// Each thread's events are passed in the order they were recorded, one
+// thread after another. Returns how many events were lost because a thread
+// recorded more of them than its buffer holds.
+extern "C" uint64_t
+LLVMRustDrainProfileEvents(LLVMRustProfileEventCallback Callback,
+                           void *Payload) {
+  uint64_t Dropped = 0;
+  std::lock_guard<std::mutex> RingsLock(ProfileEventRingsLock);
+  for (auto &Ring : *ProfileEventRings) {
+    std::vector<ProfileEvent> Events;
+    {
+      std::lock_guard<std::mutex> Lock(Ring->Lock);
+      Events.swap(Ring->Events);
+      std::rotate(Events.begin(), Events.begin() + Ring->Next, Events.end());
+      Ring->Next = 0;
+      Dropped += Ring->Dropped;
+      Ring->Dropped = 0;
+    }
+    for (const ProfileEvent &Event : Events)
+      Callback(Payload, Event.Name, Ring->ThreadId, Event.Start, Event.End);
+  }
+  return Dropped;
+}
+
 extern "C" LLVMValueRef LLVMRustGetNamedValue(LLVMModuleRef M,
                                               const char *Name) {
   return wrap(unwrap(M)->getNamedValue(Name));
@@ -267,6 +512,150 @@ extern "C" void LLVMRustAddDereferenceableOrNullAttr(LLVMValueRef Fn,
   A->addAttributes(Index, B);
 }
 
+static void addToBuilder(AttrBuilder &B, const LLVMRustAttributeDesc &Desc) {
+  switch (Desc.Kind) {
+  case LLVMRustAttributeKind::Enum:
+    B.addAttribute(fromRust(Desc.Attr));
+    break;
+  case LLVMRustAttributeKind::Alignment:
+    B.addAlignmentAttr(Desc.Value);
+    break;
+  case LLVMRustAttributeKind::Dereferenceable:
+    B.addDereferenceableAttr(Desc.Value);
+    break;
+  case LLVMRustAttributeKind::DereferenceableOrNull:
+    B.addDereferenceableOrNullAttr(Desc.Value);
+    break;
+  }
+}
+
+// Builds the list of all attributes in `Attrs`, with one `AttrBuilder` per
+// index instead of one per attribute.
+static AttributeList buildAttributeList(LLVMContext &Ctx,
+                                        const LLVMRustAttributeDesc *Attrs,
+                                        size_t NumAttrs) {
+  SmallVector<std::pair<unsigned, AttrBuilder>, 8> Builders;
+  for (size_t I = 0; I < NumAttrs; I++) {
+    const LLVMRustAttributeDesc &Desc = Attrs[I];
+    auto It = std::find_if(Builders.begin(), Builders.end(),
+                           [&](const std::pair<unsigned, AttrBuilder> &P) {
+                             return P.first == Desc.Index;
+                           });
+    if (It == Builders.end()) {
+      Builders.emplace_back(Desc.Index, AttrBuilder());
+      It = Builders.end() - 1;
+    }
+    addToBuilder(It->second, Desc);
+  }
+
+  SmallVector<std::pair<unsigned, AttributeSet>, 8> Sets;
+  for (auto &P : Builders)
+    Sets.emplace_back(P.first, AttributeSet::get(Ctx, P.second));
+  // `AttributeList::get` wants them in order of their index, which callers
+  // don't have to give them in (the function's index sorts last).
+  std::sort(Sets.begin(), Sets.end(),
+            [](const std::pair<unsigned, AttributeSet> &A,
+               const std::pair<unsigned, AttributeSet> &B) {
+              return A.first < B.first;
+            });
+  return AttributeList::get(Ctx, Sets);
+}
+
+static void addToFunction(Function *F, AttributeList PAL) {
+  if (!F->getAttributes().isEmpty())
+    PAL = AttributeList::get(F->getContext(), {F->getAttributes(), PAL});
+  F->setAttributes(PAL);
+}
+
+static void addToCallSite(CallSite Call, AttributeList PAL) {
+  if (!Call.getAttributes().isEmpty())
+    PAL = AttributeList::get(Call->getContext(), {Call.getAttributes(), PAL});
+  Call.setAttributes(PAL);
+}
+
+// Adds all of `Attrs` to `Fn` at once, which only has to build and unique a
+// single new `AttributeList` rather than one for every attribute.
+extern "C" void LLVMRustAddFunctionAttributes(LLVMValueRef Fn,
+                                              const LLVMRustAttributeDesc *Attrs,
+                                              size_t NumAttrs) {
+  if (NumAttrs == 0)
+    return;
+  Function *F = unwrap<Function>(Fn);
+  addToFunction(F, buildAttributeList(F->getContext(), Attrs, NumAttrs));
+}
+
+// Like `LLVMRustAddFunctionAttributes`, but for a call or invoke.
+extern "C" void LLVMRustAddCallSiteAttributes(LLVMValueRef Instr,
+                                              const LLVMRustAttributeDesc *Attrs,
+                                              size_t NumAttrs) {
+  if (NumAttrs == 0)
+    return;
+  CallSite Call = CallSite(unwrap<Instruction>(Instr));
+  addToCallSite(Call, buildAttributeList(Call->getContext(), Attrs, NumAttrs));
+}
+
+// The `AttributeList`s built from the descriptions passed to
+// `LLVMRustAdd{Function,CallSite}AttributesCached`, keyed by those
+// descriptions. Nearly every function and call only ever has one of a handful
+// of attribute combinations, so most of them are found here rather than built
+// and then uniqued (again) by LLVM.
+//
+// The lists belong to `Ctx`, so the cache mustn't outlive it.
+struct LLVMRustAttributeListCache {
+  LLVMContext &Ctx;
+  StringMap<AttributeList> Lists;
+
+  LLVMRustAttributeListCache(LLVMContext &Ctx) : Ctx(Ctx) {}
+
+  AttributeList get(const LLVMRustAttributeDesc *Attrs, size_t NumAttrs) {
+    // Built field by field, so that padding doesn't end up in the key.
+    SmallVector<uint64_t, 32> Key;
+    for (size_t I = 0; I < NumAttrs; I++) {
+      Key.push_back(Attrs[I].Index);
+      Key.push_back((uint64_t(Attrs[I].Kind) << 32) | uint64_t(Attrs[I].Attr));
+      Key.push_back(Attrs[I].Value);
+    }
+    StringRef KeyRef(reinterpret_cast<const char *>(Key.data()),
+                     Key.size() * sizeof(uint64_t));
+    auto It = Lists.find(KeyRef);
+    if (It != Lists.end())
+      return It->second;
+    AttributeList PAL = buildAttributeList(Ctx, Attrs, NumAttrs);
+    Lists.insert(std::make_pair(KeyRef, PAL));
+    return PAL;
+  }
+};
+
+extern "C" LLVMRustAttributeListCache *
+LLVMRustCreateAttributeListCache(LLVMContextRef C) {
+  return new LLVMRustAttributeListCache(*unwrap(C));
+}
+
+extern "C" void
+LLVMRustFreeAttributeListCache(LLVMRustAttributeListCache *Cache) {
+  delete Cache;
+}
+
+extern "C" void
+LLVMRustAddFunctionAttributesCached(LLVMRustAttributeListCache *Cache,
+                                    LLVMValueRef Fn,
+                                    const LLVMRustAttributeDesc *Attrs,
+                                    size_t NumAttrs) {
+  if (NumAttrs == 0)
+    return;
+  addToFunction(unwrap<Function>(Fn), Cache->get(Attrs, NumAttrs));
+}
+
+extern "C" void
+LLVMRustAddCallSiteAttributesCached(LLVMRustAttributeListCache *Cache,
+                                    LLVMValueRef Instr,
+                                    const LLVMRustAttributeDesc *Attrs,
+                                    size_t NumAttrs) {
+  if (NumAttrs == 0)
+    return;
+  addToCallSite(CallSite(unwrap<Instruction>(Instr)), Cache->get(Attrs, NumAttrs));
+}
+
 extern "C" void LLVMRustAddFunctionAttrStringValue(LLVMValueRef Fn,
                                                    unsigned Index,
                                                    const char *Name,
@@ -295,6 +684,50 @@ extern "C" void LLVMRustSetHasUnsafeAlgebra(LLVMValueRef V) {
   }
 }
 
+// These values **must** match rustc_codegen_llvm::llvm::FastMathFlags!
+enum class LLVMRustFastMathFlags : uint32_t {
+  None = 0,
+  AllowReassoc = (1 << 0),
+  NoNaNs = (1 << 1),
+  NoInfs = (1 << 2),
+  NoSignedZeros = (1 << 3),
+  AllowReciprocal = (1 << 4),
+  AllowContract = (1 << 5),
+  ApproxFunc = (1 << 6),
+};
+
+static bool isSet(LLVMRustFastMathFlags Flags, LLVMRustFastMathFlags Flag) {
+  return (static_cast<uint32_t>(Flags) & static_cast<uint32_t>(Flag)) != 0;
+}
+
+static FastMathFlags fromRust(LLVMRustFastMathFlags Flags) {
+  FastMathFlags Result;
+  if (isSet(Flags, LLVMRustFastMathFlags::AllowReassoc))
+    Result.setAllowReassoc();
+  if (isSet(Flags, LLVMRustFastMathFlags::NoNaNs))
+    Result.setNoNaNs();
+  if (isSet(Flags, LLVMRustFastMathFlags::NoInfs))
+    Result.setNoInfs();
+  if (isSet(Flags, LLVMRustFastMathFlags::NoSignedZeros))
+    Result.setNoSignedZeros();
+  if (isSet(Flags, LLVMRustFastMathFlags::AllowReciprocal))
+    Result.setAllowReciprocal();
+  if (isSet(Flags, LLVMRustFastMathFlags::AllowContract))
+    Result.setAllowContract(true);
+  if (isSet(Flags, LLVMRustFastMathFlags::ApproxFunc))
+    Result.setApproxFunc();
+  return Result;
+}
+
+// Sets just the given fast-math flags, where `LLVMRustSetHasUnsafeAlgebra`
+// sets every one of them.
+extern "C" void LLVMRustSetFastMathFlags(LLVMValueRef V,
+                                         LLVMRustFastMathFlags Flags) {
+  if (auto I = dyn_cast<Instruction>(unwrap<Value>(V))) {
+    I->setFastMathFlags(fromRust(Flags));
+  }
+}
+
 extern "C" LLVMValueRef
 LLVMRustBuildAtomicLoad(LLVMBuilderRef B, LLVMValueRef Source, const char *Name,
                         LLVMAtomicOrdering Order) {
@@ -378,6 +811,53 @@ extern "C" bool LLVMRustInlineAsmVerify(LLVMTypeRef Ty,
   return InlineAsm::Verify(unwrap<FunctionType>(Ty), Constraints);
 }
 
+// The `InlineAsm` values built by `LLVMRustInlineAsmCached`, or null for the
+// ones with constraints that don't verify, keyed by everything they were
+// built from. The same `asm!` in a generic function or macro is codegened
+// over and over with identical operand types and constraints, and this saves
+// parsing the constraints each time.
+//
+// The values belong to the context of the types they're built with, so the
+// cache mustn't outlive it.
+struct LLVMRustInlineAsmCache {
+  StringMap<InlineAsm *> Asms;
+};
+
+extern "C" LLVMRustInlineAsmCache *LLVMRustCreateInlineAsmCache() {
+  return new LLVMRustInlineAsmCache();
+}
+
+extern "C" void LLVMRustFreeInlineAsmCache(LLVMRustInlineAsmCache *Cache) {
+  delete Cache;
+}
+
+extern "C" LLVMValueRef
+LLVMRustInlineAsmCached(LLVMRustInlineAsmCache *Cache, LLVMTypeRef Ty,
+                        const char *AsmString, const char *Constraints,
+                        LLVMBool HasSideEffects, LLVMBool IsAlignStack,
+                        LLVMRustAsmDialect Dialect) {
+  FunctionType *FTy = unwrap<FunctionType>(Ty);
+  StringRef Asm(AsmString), Cons(Constraints);
+
+  SmallString<128> Key;
+  const char *TyBytes = reinterpret_cast<const char *>(&FTy);
+  Key.append(TyBytes, TyBytes + sizeof(FTy));
+  Key.push_back(HasSideEffects ? 1 : 0);
+  Key.push_back(IsAlignStack ? 1 : 0);
+  Key.push_back(static_cast<char>(Dialect));
+  Key.append(Cons);
+  Key.push_back('\0');
+  Key.append(Asm);
+
+  auto Inserted = Cache->Asms.insert(
+      std::make_pair(StringRef(Key), static_cast<InlineAsm *>(nullptr)));
+  InlineAsm *&Entry = Inserted.first->second;
+  if (Inserted.second && InlineAsm::Verify(FTy, Cons))
+    Entry = InlineAsm::get(FTy, Asm, Cons, HasSideEffects, IsAlignStack,
+                           fromRust(Dialect));
+  return wrap(Entry);
+}
+
 extern "C" void LLVMRustAppendModuleInlineAsm(LLVMModuleRef M, const char *Asm) {
   unwrap(M)->appendModuleInlineAsm(StringRef(Asm));
 }
@@ -990,6 +1470,56 @@ extern "C" size_t LLVMRustGetSectionName(LLVMSectionIteratorRef SI,
   return Ret.size();
 }
 
+// Same as the conversion in LLVM's own C API, which isn't exported.
+inline OwningBinary<ObjectFile> *unwrap(LLVMObjectFileRef OF) {
+  return reinterpret_cast<OwningBinary<ObjectFile> *>(OF);
+}
+
+// The sections of an object file by name, built in one pass over its section
+// table so that looking up a section (in particular `.rustc` when loading a
+// dylib's metadata) doesn't take an FFI call per section. If a name appears
+// more than once the first section wins, same as a linear walk would.
+struct LLVMRustSectionIndex {
+  StringMap<SectionRef> Sections;
+};
+
+// Returns null with the last error set if the section table can't be read.
+extern "C" LLVMRustSectionIndex *
+LLVMRustSectionIndexNew(LLVMObjectFileRef OF) {
+  auto Index = llvm::make_unique<LLVMRustSectionIndex>();
+  for (const SectionRef &Section : unwrap(OF)->getBinary()->sections()) {
+    StringRef Name;
+    if (std::error_code EC = Section.getName(Name)) {
+      LLVMRustSetLastErrorCode(EC);
+      return nullptr;
+    }
+    Index->Sections.insert(std::make_pair(Name, Section));
+  }
+  return Index.release();
+}
+
+extern "C" void LLVMRustSectionIndexFree(LLVMRustSectionIndex *Index) {
+  delete Index;
+}
+
+// Returns the contents of the section called `Name`, or null if there's no
+// such section. If its contents can't be read that's also null, but with the
+// last error set. The contents live as long as the object file does.
+extern "C" const char *
+LLVMRustSectionIndexFind(LLVMRustSectionIndex *Index, const char *Name,
+                         size_t NameLen, size_t *Size) {
+  auto It = Index->Sections.find(StringRef(Name, NameLen));
+  if (It == Index->Sections.end())
+    return nullptr;
+  StringRef Contents;
+  if (std::error_code EC = It->second.getContents(Contents)) {
+    LLVMRustSetLastErrorCode(EC);
+    return nullptr;
+  }
+  *Size = Contents.size();
+  return Contents.data();
+}
+
 // LLVMArrayType function does not support 64-bit ElementCount
 extern "C" LLVMTypeRef LLVMRustArrayType(LLVMTypeRef ElementTy,
                                          uint64_t ElementCount) {
@@ -1051,6 +1581,144 @@ extern "C" void LLVMRustWriteDiagnosticInfoToString(LLVMDiagnosticInfoRef DI,
   unwrap(DI)->print(DP);
 }
 
+// A diagnostic handler which writes optimization remarks straight to a YAML
+// file, in the same format as `-pass-remarks-output` (and so readable by
+// `opt-viewer`), instead of passing each of them through FFI to be formatted
+// on the Rust side. Only remarks from passes matching `PassFilter` and at
+// least `HotnessThreshold` hot are written out, and the passes are only asked
+// to produce the ones which will be. Knowing the hotness takes PGO data, so
+// remarks without any are written out regardless of the threshold.
+// Everything else, including remarks the previous handler wants as well, is
+// passed on to that handler.
+class RustRemarkStreamer : public DiagnosticHandler {
+public:
+  std::unique_ptr<DiagnosticHandler> Prev;
+  bool PrevHotnessRequested;
+  uint64_t PrevHotnessThreshold;
+
+  RustRemarkStreamer(StringRef Path, std::error_code &EC, StringRef PassFilter,
+                     uint64_t HotnessThreshold)
+      : OS(Path, EC, sys::fs::F_None), Out(OS), PassFilter(PassFilter),
+        HotnessThreshold(HotnessThreshold) {}
+
+  bool handleDiagnostics(const DiagnosticInfo &DI) override {
+    auto *Remark = dyn_cast<DiagnosticInfoOptimizationBase>(&DI);
+    if (!Remark)
+      return Prev->handleDiagnostics(DI);
+
+    Optional<uint64_t> Hotness = Remark->getHotness();
+    if (isRemarkEnabled(*this, *Remark) &&
+        (!Hotness || *Hotness >= HotnessThreshold)) {
+      auto *P = const_cast<DiagnosticInfoOptimizationBase *>(Remark);
+      Out << P;
+    }
+    if (isRemarkEnabled(*Prev, *Remark))
+      return Prev->handleDiagnostics(DI);
+    return true;
+  }
+
+  bool isAnalysisRemarkEnabled(StringRef PassName) const override {
+    return PassFilter.match(PassName) || Prev->isAnalysisRemarkEnabled(PassName);
+  }
+  bool isMissedOptRemarkEnabled(StringRef PassName) const override {
+    return PassFilter.match(PassName) || Prev->isMissedOptRemarkEnabled(PassName);
+  }
+  bool isPassedOptRemarkEnabled(StringRef PassName) const override {
+    return PassFilter.match(PassName) || Prev->isPassedOptRemarkEnabled(PassName);
+  }
+
+private:
+  raw_fd_ostream OS;
+  yaml::Output Out;
+  Regex PassFilter;
+  uint64_t HotnessThreshold;
+
+  // Whether `Handler` asks for `Remark`, going by its kind and pass.
+  static bool isRemarkEnabled(const DiagnosticHandler &Handler,
+                              const DiagnosticInfoOptimizationBase &Remark) {
+    StringRef PassName = Remark.getPassName();
+    switch (Remark.getKind()) {
+    case DK_OptimizationRemark:
+    case DK_MachineOptimizationRemark:
+      return Handler.isPassedOptRemarkEnabled(PassName);
+    case DK_OptimizationRemarkMissed:
+    case DK_MachineOptimizationRemarkMissed:
+      return Handler.isMissedOptRemarkEnabled(PassName);
+    case DK_OptimizationRemarkAnalysis:
+    case DK_OptimizationRemarkAnalysisFPCommute:
+    case DK_OptimizationRemarkAnalysisAliasing:
+    case DK_MachineOptimizationRemarkAnalysis:
+      return Handler.isAnalysisRemarkEnabled(PassName);
+    default:
+      return Handler.isAnyRemarkEnabled(PassName);
+    }
+  }
+};
+
+// Starts writing the remarks produced in `C` to the file at `Path`, see
+// `RustRemarkStreamer` above, for the passes named in `PassNames`, or all of
+// them if there are none. Returns null on failure, otherwise the streamer,
+// which has to be passed to `LLVMRustContextStopRemarkStreaming` before
+// anything else changes the context's diagnostic handler.
+extern "C" RustRemarkStreamer *
+LLVMRustContextStartRemarkStreaming(LLVMContextRef C, const char *Path,
+                                    const char **PassNames,
+                                    size_t NumPassNames,
+                                    uint64_t HotnessThreshold) {
+  LLVMContext &Ctx = *unwrap(C);
+
+  std::string PassFilter = ".*";
+  if (NumPassNames) {
+    PassFilter = "^(";
+    for (size_t I = 0; I < NumPassNames; I++) {
+      if (I)
+        PassFilter += "|";
+      PassFilter += Regex::escape(PassNames[I]);
+    }
+    PassFilter += ")$";
+  }
+
+  std::error_code EC;
+  auto Streamer = llvm::make_unique<RustRemarkStreamer>(Path, EC, PassFilter,
+                                                        HotnessThreshold);
+  if (EC) {
+    LLVMRustSetLastErrorCode(EC);
+    return nullptr;
+  }
+
+  Streamer->PrevHotnessRequested = Ctx.getDiagnosticsHotnessRequested();
+  Streamer->PrevHotnessThreshold = Ctx.getDiagnosticsHotnessThreshold();
+  if (HotnessThreshold) {
+    Ctx.setDiagnosticsHotnessRequested(true);
+    Ctx.setDiagnosticsHotnessThreshold(HotnessThreshold);
+  }
+
+  // The context always has a handler, but one which does nothing keeps
+  // `Prev` from having to be checked everywhere if it ever doesn't.
+  Streamer->Prev = Ctx.getDiagnosticHandler();
+  if (!Streamer->Prev)
+    Streamer->Prev = llvm::make_unique<DiagnosticHandler>();
+  RustRemarkStreamer *Ret = Streamer.get();
+  Ctx.setDiagnosticHandler(std::move(Streamer));
+  return Ret;
+}
+
+// Puts back the diagnostic handler (and hotness settings) from before
+// `LLVMRustContextStartRemarkStreaming` returned `Streamer`, which finishes
+// the remarks file.
+extern "C" void
+LLVMRustContextStopRemarkStreaming(LLVMContextRef C,
+                                   RustRemarkStreamer *Streamer) {
+  LLVMContext &Ctx = *unwrap(C);
+  std::unique_ptr<DiagnosticHandler> Handler = Ctx.getDiagnosticHandler();
+  if (Handler.get() != Streamer)
+    report_fatal_error("remark streaming stopped with another diagnostic "
+                       "handler installed");
+  Ctx.setDiagnosticsHotnessRequested(Streamer->PrevHotnessRequested);
+  Ctx.setDiagnosticsHotnessThreshold(Streamer->PrevHotnessThreshold);
+  Ctx.setDiagnosticHandler(std::move(Streamer->Prev));
+}
+
 enum class LLVMRustDiagnosticKind {
   Other,
   InlineAsm,
@@ -1234,6 +1902,57 @@ extern "C" LLVMValueRef LLVMRustBuildCall(LLVMBuilderRef B, LLVMValueRef Fn,
       unwrap(Fn), makeArrayRef(unwrap(Args), NumArgs), Bundles, Name));
 }
 
+// The "funclet" operand bundles of the calls and invokes in MSVC cleanup and
+// catch pads, built once for each pad rather than once for each call, and all
+// freed at once along with the pool.
+struct LLVMRustOperandBundlePool {
+  DenseMap<Value *, std::unique_ptr<OperandBundleDef>> Funclets;
+
+  OperandBundleDef *funclet(Value *Pad) {
+    std::unique_ptr<OperandBundleDef> &Bundle = Funclets[Pad];
+    if (!Bundle)
+      Bundle = llvm::make_unique<OperandBundleDef>("funclet", makeArrayRef(Pad));
+    return Bundle.get();
+  }
+};
+
+extern "C" LLVMRustOperandBundlePool *LLVMRustCreateOperandBundlePool() {
+  return new LLVMRustOperandBundlePool();
+}
+
+extern "C" void LLVMRustFreeOperandBundlePool(LLVMRustOperandBundlePool *Pool) {
+  delete Pool;
+}
+
+extern "C" OperandBundleDef *
+LLVMRustOperandBundlePoolGetFunclet(LLVMRustOperandBundlePool *Pool,
+                                    LLVMValueRef Pad) {
+  return Pool->funclet(unwrap(Pad));
+}
+
+// Builds a call with the funclet bundle of `FuncletPad`, if it isn't null, and
+// then adds `Attrs` and sets the calling convention of the call, all of which
+// would otherwise take an FFI call each.
+extern "C" LLVMValueRef
+LLVMRustBuildCallWithAttributes(LLVMBuilderRef B, LLVMValueRef Fn,
+                                LLVMValueRef *Args, unsigned NumArgs,
+                                LLVMRustOperandBundlePool *Pool,
+                                LLVMValueRef FuncletPad,
+                                LLVMRustAttributeListCache *Cache,
+                                const LLVMRustAttributeDesc *Attrs,
+                                size_t NumAttrs, unsigned CC,
+                                const char *Name) {
+  ArrayRef<OperandBundleDef> Bundles;
+  if (FuncletPad)
+    Bundles = makeArrayRef(*Pool->funclet(unwrap(FuncletPad)));
+  CallInst *Call = unwrap(B)->CreateCall(
+      unwrap(Fn), makeArrayRef(unwrap(Args), NumArgs), Bundles, Name);
+  if (NumAttrs != 0)
+    addToCallSite(Call, Cache->get(Attrs, NumAttrs));
+  Call->setCallingConv(static_cast<CallingConv::ID>(CC));
+  return wrap(Call);
+}
+
 extern "C" LLVMValueRef LLVMRustBuildMemCpy(LLVMBuilderRef B,
                                             LLVMValueRef Dst, unsigned DstAlign,
                                             LLVMValueRef Src, unsigned SrcAlign,
@@ -1280,6 +1999,30 @@ LLVMRustBuildInvoke(LLVMBuilderRef B, LLVMValueRef Fn, LLVMValueRef *Args,
                                       Bundles, Name));
 }
 
+// Like `LLVMRustBuildCallWithAttributes`, but for an invoke.
+extern "C" LLVMValueRef
+LLVMRustBuildInvokeWithAttributes(LLVMBuilderRef B, LLVMValueRef Fn,
+                                  LLVMValueRef *Args, unsigned NumArgs,
+                                  LLVMBasicBlockRef Then,
+                                  LLVMBasicBlockRef Catch,
+                                  LLVMRustOperandBundlePool *Pool,
+                                  LLVMValueRef FuncletPad,
+                                  LLVMRustAttributeListCache *Cache,
+                                  const LLVMRustAttributeDesc *Attrs,
+                                  size_t NumAttrs, unsigned CC,
+                                  const char *Name) {
+  ArrayRef<OperandBundleDef> Bundles;
+  if (FuncletPad)
+    Bundles = makeArrayRef(*Pool->funclet(unwrap(FuncletPad)));
+  InvokeInst *Invoke = unwrap(B)->CreateInvoke(
+      unwrap(Fn), unwrap(Then), unwrap(Catch),
+      makeArrayRef(unwrap(Args), NumArgs), Bundles, Name);
+  if (NumAttrs != 0)
+    addToCallSite(Invoke, Cache->get(Attrs, NumAttrs));
+  Invoke->setCallingConv(static_cast<CallingConv::ID>(CC));
+  return wrap(Invoke);
+}
+
 extern "C" void LLVMRustPositionBuilderAtStart(LLVMBuilderRef B,
                                                LLVMBasicBlockRef BB) {
   auto Point = unwrap(BB)->getFirstInsertionPt();
@@ -1380,6 +2123,17 @@ extern "C" void LLVMRustSetLinkage(LLVMValueRef V,
   LLVMSetLinkage(V, fromRust(RustLinkage));
 }
 
+// Marks `Offset` bytes into `Global` as an address of type `TypeId`, which is
+// what `llvm.type.test` checks a pointer against.
+extern "C" void LLVMRustGlobalAddTypeMetadata(LLVMValueRef Global,
+                                              uint64_t Offset,
+                                              const char *TypeId,
+                                              size_t TypeIdLen) {
+  GlobalObject *GO = unwrap<GlobalObject>(Global);
+  GO->addTypeMetadata(Offset,
+                      MDString::get(GO->getContext(), StringRef(TypeId, TypeIdLen)));
+}
+
 // Returns true if both high and low were successfully set. Fails in case constant wasn’t any of
 // the common sizes (1, 8, 16, 32, 64, 128 bits)
 extern "C" bool LLVMRustConstInt128Get(LLVMValueRef CV, bool sext, uint64_t *high, uint64_t *low)
@@ -1446,16 +2200,34 @@ struct LLVMRustModuleBuffer {
   std::string data;
 };
 
+static void
+writeBitcode(Module &M, raw_ostream &OS) {
+  legacy::PassManager PM;
+  PM.add(createBitcodeWriterPass(OS));
+  PM.run(M);
+}
+
 extern "C" LLVMRustModuleBuffer*
 LLVMRustModuleBufferCreate(LLVMModuleRef M) {
   auto Ret = llvm::make_unique<LLVMRustModuleBuffer>();
   {
     raw_string_ostream OS(Ret->data);
-    {
-      legacy::PassManager PM;
-      PM.add(createBitcodeWriterPass(OS));
-      PM.run(*unwrap(M));
-    }
+    writeBitcode(*unwrap(M), OS);
+  }
+  return Ret.release();
+}
+
+// Same as `LLVMRustModuleBufferCreate`, but reserves `SizeHint` bytes up front
+// so a good guess at the final size avoids regrowing the buffer as the
+// bitcode is written out. (For writing a module straight to an open file
+// descriptor there's `LLVMWriteBitcodeToFD` upstream already.)
+extern "C" LLVMRustModuleBuffer*
+LLVMRustModuleBufferCreateWithSizeHint(LLVMModuleRef M, size_t SizeHint) {
+  auto Ret = llvm::make_unique<LLVMRustModuleBuffer>();
+  Ret->data.reserve(SizeHint);
+  {
+    raw_string_ostream OS(Ret->data);
+    writeBitcode(*unwrap(M), OS);
   }
   return Ret.release();
 }
@@ -1475,10 +2247,20 @@ LLVMRustModuleBufferLen(const LLVMRustModuleBuffer *Buffer) {
   return Buffer->data.length();
 }
 
+// A "gauge" of how costly it is to optimize and codegen this module, used to
+// order work biggest first. Just counting functions makes one giant generated
+// function look as cheap as one tiny one, so this weighs functions by how
+// many basic blocks and instructions they have, with declarations costing
+// next to nothing.
 extern "C" uint64_t
 LLVMRustModuleCost(LLVMModuleRef M) {
-  auto f = unwrap(M)->functions();
-  return std::distance(std::begin(f), std::end(f));
+  uint64_t Cost = 0;
+  for (const Function &F : unwrap(M)->functions()) {
+    Cost += 1;
+    for (const BasicBlock &BB : F)
+      Cost += 1 + BB.size();
+  }
+  return Cost;
 }
 
 // Vector reductions:
@@ -1490,6 +2272,81 @@ extern "C" LLVMValueRef
 LLVMRustBuildVectorReduceFMul(LLVMBuilderRef B, LLVMValueRef Acc, LLVMValueRef Src) {
     return wrap(unwrap(B)->CreateFMulReduce(unwrap(Acc),unwrap(Src)));
 }
+
+// Floating point reductions which the backends can always lower, unlike the
+// FAdd/FMul reduction intrinsics above: those can only be lowered with every
+// fast-math flag set, which throws out NaN and infinity semantics along with
+// the order of the operations.
+//
+// An ordered reduction folds the elements into `Acc` one at a time, so it
+// rounds just like the equivalent scalar loop.
+static Value *buildOrderedReduction(IRBuilder<> *B, Instruction::BinaryOps Op,
+                                    Value *Acc, Value *Src) {
+  unsigned N = Src->getType()->getVectorNumElements();
+  for (unsigned I = 0; I < N; I++)
+    Acc = B->CreateBinOp(Op, Acc, B->CreateExtractElement(Src, B->getInt32(I)),
+                         "bin.rdx");
+  return Acc;
+}
+
+// An unordered reduction may be associated any which way, so it's built as a
+// tree: the upper half of the vector is shuffled down onto the lower half and
+// combined with it until a single element is left, which is the pattern the
+// backends turn into horizontal operations. Each step only gets the `reassoc`
+// fast-math flag, so LLVM can keep reassociating it but NaNs, infinities and
+// signed zeros still behave.
+static Value *buildUnorderedReduction(IRBuilder<> *B, Instruction::BinaryOps Op,
+                                      Value *Src) {
+  IRBuilder<>::FastMathFlagGuard Guard(*B);
+  FastMathFlags FMF;
+  FMF.setAllowReassoc();
+  B->setFastMathFlags(FMF);
+
+  unsigned N = Src->getType()->getVectorNumElements();
+  if (!isPowerOf2_32(N)) {
+    Value *Acc = B->CreateExtractElement(Src, B->getInt32(0));
+    for (unsigned I = 1; I < N; I++)
+      Acc = B->CreateBinOp(Op, Acc, B->CreateExtractElement(Src, B->getInt32(I)),
+                           "bin.rdx");
+    return Acc;
+  }
+
+  Value *Undef = UndefValue::get(Src->getType());
+  Constant *UndefIndex = UndefValue::get(B->getInt32Ty());
+  SmallVector<Constant *, 32> Mask(N, UndefIndex);
+  for (unsigned Width = N / 2; Width >= 1; Width /= 2) {
+    for (unsigned I = 0; I < Width; I++)
+      Mask[I] = B->getInt32(Width + I);
+    for (unsigned I = Width; I < N; I++)
+      Mask[I] = UndefIndex;
+    Value *Shuf = B->CreateShuffleVector(Src, Undef, ConstantVector::get(Mask),
+                                         "rdx.shuf");
+    Src = B->CreateBinOp(Op, Src, Shuf, "bin.rdx");
+  }
+  return B->CreateExtractElement(Src, B->getInt32(0));
+}
+
+extern "C" LLVMValueRef
+LLVMRustBuildVectorReduceFAddOrdered(LLVMBuilderRef B, LLVMValueRef Acc,
+                                     LLVMValueRef Src) {
+  return wrap(buildOrderedReduction(unwrap(B), Instruction::FAdd,
+                                    unwrap(Acc), unwrap(Src)));
+}
+extern "C" LLVMValueRef
+LLVMRustBuildVectorReduceFMulOrdered(LLVMBuilderRef B, LLVMValueRef Acc,
+                                     LLVMValueRef Src) {
+  return wrap(buildOrderedReduction(unwrap(B), Instruction::FMul,
+                                    unwrap(Acc), unwrap(Src)));
+}
+extern "C" LLVMValueRef
+LLVMRustBuildVectorReduceFAddUnordered(LLVMBuilderRef B, LLVMValueRef Src) {
+  return wrap(buildUnorderedReduction(unwrap(B), Instruction::FAdd, unwrap(Src)));
+}
+extern "C" LLVMValueRef
+LLVMRustBuildVectorReduceFMulUnordered(LLVMBuilderRef B, LLVMValueRef Src) {
+  return wrap(buildUnorderedReduction(unwrap(B), Instruction::FMul, unwrap(Src)));
+}
+
 extern "C" LLVMValueRef
 LLVMRustBuildVectorReduceAdd(LLVMBuilderRef B, LLVMValueRef Src) {
     return wrap(unwrap(B)->CreateAddReduce(unwrap(Src)));
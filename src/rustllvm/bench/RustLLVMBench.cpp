@@ -0,0 +1,528 @@
+// Micro-benchmarks for the entry points in ../*.cpp that rustc leans on the
+// hardest: serializing modules, building the ThinLTO index, linking bitcode,
+// adding attributes and writing archives. Each is driven through the same
+// `extern "C"` functions rustc calls, on synthetic modules and on whatever
+// recorded bitcode files and archives are passed on the command line, and
+// reports its throughput and the peak RSS of the process once it's done.
+//
+// It's only built when `RUSTLLVM_BENCH` is set while building rustc_llvm, see
+// its build.rs, which links it against the same librustllvm.a and LLVM
+// libraries as rustc itself:
+//
+//     rustllvm-bench [-b NAME] [-n ITERS] [-m MODULES] [-f FUNCS] [FILE...]
+//
+// The peak RSS only ever grows, so pass `-b` to run a single benchmark if its
+// own high-water mark is what's of interest.
+
+#include "../rustllvm.h"
+
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::object;
+
+// Normally implemented by rustc_codegen_llvm, on top of a `RustString`.
+struct OpaqueRustString {
+  std::string Data;
+};
+
+extern "C" void LLVMRustStringWriteImpl(RustStringRef Str, const char *Ptr,
+                                        size_t Size) {
+  Str->Data.append(Ptr, Size);
+}
+
+namespace {
+
+struct BenchOptions {
+  const char *Only = nullptr;
+  unsigned Iters = 10;
+  unsigned NumModules = 16;
+  unsigned NumFunctions = 500;
+};
+
+// A module along with the context it lives in, as rustc keeps them for each
+// codegen unit.
+struct BenchModule {
+  LLVMContext *Ctx;
+  Module *M;
+  std::string Name;
+};
+
+// The members of one archive to write: either files on disk or the children
+// of a recorded archive.
+struct ArchiveInput {
+  std::string Name;
+  std::vector<std::string> Files;
+  RustArchive *Recorded = nullptr;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static std::string lastError() {
+  const char *Msg;
+  size_t Len;
+  if (!LLVMRustTakeLastError(&Msg, &Len))
+    return "unknown error";
+  return std::string(Msg, strnlen(Msg, Len));
+}
+
+// The high-water mark of the process' resident set, in bytes.
+static uint64_t peakRSS() {
+  struct rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage) != 0)
+    return 0;
+#if defined(__APPLE__)
+  return Usage.ru_maxrss;
+#else
+  return uint64_t(Usage.ru_maxrss) * 1024;
+#endif
+}
+
+// Prints one result: `Ops` operations processing `Bytes` bytes in total (zero
+// if counting bytes doesn't make sense for it) over `Iters` timed runs.
+static void report(const char *Bench, const std::string &Input,
+                   Clock::duration Elapsed, unsigned Iters, uint64_t Ops,
+                   uint64_t Bytes) {
+  double Secs = std::chrono::duration<double>(Elapsed).count();
+  if (Secs <= 0)
+    Secs = 1e-9;
+  char Throughput[32] = "-";
+  if (Bytes != 0)
+    snprintf(Throughput, sizeof(Throughput), "%.1f MB/s",
+             Bytes * double(Iters) / Secs / 1e6);
+  printf("%-18s %-24s %10.3f ms %14.0f ops/s %14s %8.1f MB peak\n", Bench,
+         Input.c_str(), Secs * 1e3 / Iters, Ops * double(Iters) / Secs,
+         Throughput, peakRSS() / 1e6);
+  fflush(stdout);
+}
+
+template <typename F> static Clock::duration timeIters(unsigned Iters, F Run) {
+  Clock::time_point Start = Clock::now();
+  for (unsigned I = 0; I < Iters; I++)
+    Run();
+  return Clock::now() - Start;
+}
+
+// Builds the `Index`th of a set of synthetic modules, whose functions each
+// call the one before them, the first one calling the last function of the
+// previous module. That gives ThinLTO something to import and the linker
+// something to resolve while keeping every symbol unique across the set.
+static BenchModule syntheticModule(unsigned Index, unsigned NumFunctions) {
+  BenchModule BM;
+  BM.Ctx = new LLVMContext();
+  BM.Name = "synth." + std::to_string(Index);
+  BM.M = new Module(BM.Name, *BM.Ctx);
+
+  Type *I64 = Type::getInt64Ty(*BM.Ctx);
+  FunctionType *FnTy = FunctionType::get(I64, {I64}, false);
+  auto FnName = [](unsigned Mod, unsigned Fn) {
+    return "synth_" + std::to_string(Mod) + "_" + std::to_string(Fn);
+  };
+
+  Function *Prev = nullptr;
+  if (Index > 0)
+    Prev = Function::Create(FnTy, GlobalValue::ExternalLinkage,
+                            FnName(Index - 1, NumFunctions - 1), BM.M);
+  for (unsigned I = 0; I < NumFunctions; I++) {
+    Function *F = Function::Create(FnTy, GlobalValue::ExternalLinkage,
+                                   FnName(Index, I), BM.M);
+    IRBuilder<> B(BasicBlock::Create(*BM.Ctx, "start", F));
+    Value *X = &*F->arg_begin();
+    X = B.CreateAdd(B.CreateMul(X, B.getInt64(3)), B.getInt64(I));
+    if (Prev)
+      X = B.CreateCall(Prev, {X});
+    B.CreateRet(X);
+    Prev = F;
+  }
+  return BM;
+}
+
+static bool loadBitcode(const char *Path, BenchModule &BM) {
+  BM.Ctx = new LLVMContext();
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(Path, Err, *BM.Ctx);
+  if (!M) {
+    fprintf(stderr, "rustllvm-bench: %s: %s\n", Path,
+            Err.getMessage().str().c_str());
+    delete BM.Ctx;
+    return false;
+  }
+  BM.M = M.release();
+  BM.Name = sys::path::filename(Path).str();
+  return true;
+}
+
+static void freeModules(std::vector<BenchModule> &Modules) {
+  for (BenchModule &BM : Modules) {
+    delete BM.M;
+    delete BM.Ctx;
+  }
+  Modules.clear();
+}
+
+static std::string setName(const std::vector<BenchModule> &Modules) {
+  if (Modules.size() == 1)
+    return Modules[0].Name;
+  return std::to_string(Modules.size()) + " modules";
+}
+
+static void benchModuleBuffer(const BenchOptions &Opts,
+                              const std::vector<BenchModule> &Modules) {
+  uint64_t Bytes = 0;
+  Clock::duration Elapsed = timeIters(Opts.Iters, [&] {
+    Bytes = 0;
+    for (const BenchModule &BM : Modules) {
+      LLVMRustModuleBuffer *Buf = LLVMRustModuleBufferCreate(wrap(BM.M));
+      Bytes += LLVMRustModuleBufferLen(Buf);
+      LLVMRustModuleBufferFree(Buf);
+    }
+  });
+  report("module-buffer", setName(Modules), Elapsed, Opts.Iters,
+         Modules.size(), Bytes);
+}
+
+static void benchThinLTOData(const BenchOptions &Opts,
+                             const std::vector<BenchModule> &Modules) {
+  std::vector<LLVMRustThinLTOBuffer *> Buffers;
+  std::vector<LLVMRustThinLTOModule> Inputs;
+  uint64_t Bytes = 0;
+  for (const BenchModule &BM : Modules) {
+    LLVMRustThinLTOBuffer *Buf = LLVMRustThinLTOBufferCreate(wrap(BM.M));
+    Buffers.push_back(Buf);
+    Inputs.push_back({BM.Name.c_str(),
+                      (const char *)LLVMRustThinLTOBufferPtr(Buf),
+                      LLVMRustThinLTOBufferLen(Buf)});
+    Bytes += LLVMRustThinLTOBufferLen(Buf);
+  }
+
+  LLVMRustThinLTOImportBudget Budget = {-1, -1, -1, -1};
+  bool Failed = false;
+  Clock::duration Elapsed = timeIters(Opts.Iters, [&] {
+    LLVMRustThinLTOData *Data =
+        LLVMRustCreateThinLTOData(Inputs.data(), Inputs.size(), nullptr, 0,
+                                  &Budget);
+    if (!Data)
+      Failed = true;
+    LLVMRustFreeThinLTOData(Data);
+  });
+  if (Failed)
+    fprintf(stderr, "rustllvm-bench: thinlto-data: %s\n", lastError().c_str());
+  else
+    report("thinlto-data", setName(Modules), Elapsed, Opts.Iters,
+           Modules.size(), Bytes);
+
+  for (LLVMRustThinLTOBuffer *Buf : Buffers)
+    LLVMRustThinLTOBufferFree(Buf);
+}
+
+static void benchLinkerAdd(const BenchOptions &Opts,
+                           const std::vector<BenchModule> &Modules) {
+  std::vector<LLVMRustModuleBuffer *> Buffers;
+  uint64_t Bytes = 0;
+  for (const BenchModule &BM : Modules) {
+    Buffers.push_back(LLVMRustModuleBufferCreate(wrap(BM.M)));
+    Bytes += LLVMRustModuleBufferLen(Buffers.back());
+  }
+
+  bool Failed = false;
+  Clock::duration Elapsed = timeIters(Opts.Iters, [&] {
+    LLVMContext Ctx;
+    Module Dst("linked", Ctx);
+    RustLinker *L = LLVMRustLinkerNew(wrap(&Dst));
+    for (LLVMRustModuleBuffer *Buf : Buffers) {
+      char *Ptr = (char *)LLVMRustModuleBufferPtr(Buf);
+      if (!Failed && !LLVMRustLinkerAdd(L, Ptr, LLVMRustModuleBufferLen(Buf)))
+        Failed = true;
+    }
+    LLVMRustLinkerFree(L);
+  });
+  if (Failed)
+    fprintf(stderr, "rustllvm-bench: linker-add: %s\n", lastError().c_str());
+  else
+    report("linker-add", setName(Modules), Elapsed, Opts.Iters,
+           Modules.size(), Bytes);
+
+  for (LLVMRustModuleBuffer *Buf : Buffers)
+    LLVMRustModuleBufferFree(Buf);
+}
+
+// Adds the same handful of attributes rustc puts on most functions, and on
+// their pointer arguments, to every definition in the modules, once through
+// `LLVMRustAddFunctionAttributes` and once through the cached variant.
+static void benchAttributes(const BenchOptions &Opts,
+                            const std::vector<BenchModule> &Modules) {
+  // `Attr` doesn't matter for the integer attributes.
+  const unsigned FnIndex = ~0U;
+  const LLVMRustAttributeDesc Attrs[] = {
+      {FnIndex, LLVMRustAttributeKind::Enum, NoUnwind, 0},
+      {FnIndex, LLVMRustAttributeKind::Enum, UWTable, 0},
+      {FnIndex, LLVMRustAttributeKind::Enum, NonLazyBind, 0},
+      {1, LLVMRustAttributeKind::Enum, NoAlias, 0},
+      {1, LLVMRustAttributeKind::Enum, NoCapture, 0},
+      {1, LLVMRustAttributeKind::Dereferenceable, NonNull, 16},
+      {1, LLVMRustAttributeKind::Alignment, NonNull, 8},
+  };
+  size_t NumAttrs = sizeof(Attrs) / sizeof(Attrs[0]);
+
+  std::vector<std::pair<LLVMContext *, std::vector<Function *>>> Fns;
+  uint64_t NumFns = 0;
+  for (const BenchModule &BM : Modules) {
+    Fns.emplace_back(BM.Ctx, std::vector<Function *>());
+    for (Function &F : *BM.M)
+      if (!F.isDeclaration() && F.arg_size() > 0 &&
+          F.arg_begin()->getType()->isPointerTy())
+        Fns.back().second.push_back(&F);
+    NumFns += Fns.back().second.size();
+  }
+  if (NumFns == 0) {
+    // The synthetic functions take an integer, which the argument
+    // attributes don't apply to, so only the function ones are used.
+    NumAttrs = 3;
+    for (size_t I = 0; I < Modules.size(); I++) {
+      for (Function &F : *Modules[I].M)
+        if (!F.isDeclaration())
+          Fns[I].second.push_back(&F);
+      NumFns += Fns[I].second.size();
+    }
+  }
+
+  Clock::duration Elapsed = timeIters(Opts.Iters, [&] {
+    for (auto &ModFns : Fns)
+      for (Function *F : ModFns.second)
+        LLVMRustAddFunctionAttributes(wrap(F), Attrs, NumAttrs);
+  });
+  report("attributes", setName(Modules), Elapsed, Opts.Iters, NumFns, 0);
+
+  Elapsed = timeIters(Opts.Iters, [&] {
+    for (auto &ModFns : Fns) {
+      LLVMRustAttributeListCache *Cache =
+          LLVMRustCreateAttributeListCache(wrap(ModFns.first));
+      for (Function *F : ModFns.second)
+        LLVMRustAddFunctionAttributesCached(Cache, wrap(F), Attrs, NumAttrs);
+      LLVMRustFreeAttributeListCache(Cache);
+    }
+  });
+  report("attributes-cached", setName(Modules), Elapsed, Opts.Iters, NumFns,
+         0);
+}
+
+static void benchWriteArchive(const BenchOptions &Opts,
+                              const ArchiveInput &Input, const char *Dst) {
+  std::vector<RustArchiveMember *> Members;
+  std::vector<Archive::Child *> Children;
+  std::vector<std::string> Names;
+  uint64_t Bytes = 0;
+  if (Input.Recorded) {
+    RustArchiveIterator *RAI = LLVMRustArchiveIteratorNew(Input.Recorded);
+    while (const Archive::Child *Child = LLVMRustArchiveIteratorNext(RAI)) {
+      Children.push_back(const_cast<Archive::Child *>(Child));
+      size_t NameLen;
+      const char *Name = LLVMRustArchiveChildName(Child, &NameLen);
+      if (!Name)
+        continue;
+      Names.emplace_back(Name, NameLen);
+      Expected<StringRef> Buf = Child->getBuffer();
+      if (Buf)
+        Bytes += Buf->size();
+      else
+        consumeError(Buf.takeError());
+    }
+    LLVMRustArchiveIteratorFree(RAI);
+    // Members only point to their names, so they're created once `Names` is
+    // done growing.
+    for (size_t I = 0, N = 0; I < Children.size(); I++) {
+      size_t NameLen;
+      if (!LLVMRustArchiveChildName(Children[I], &NameLen))
+        continue;
+      Members.push_back(LLVMRustArchiveMemberNew(
+          nullptr, const_cast<char *>(Names[N++].c_str()), Children[I]));
+    }
+  } else {
+    for (const std::string &File : Input.Files) {
+      Members.push_back(LLVMRustArchiveMemberNew(
+          const_cast<char *>(File.c_str()),
+          const_cast<char *>(sys::path::filename(File).data()), nullptr));
+      uint64_t Size;
+      if (!sys::fs::file_size(File, Size))
+        Bytes += Size;
+    }
+  }
+
+#if defined(__APPLE__)
+  LLVMRustArchiveKind Kind = LLVMRustArchiveKind::BSD;
+#else
+  LLVMRustArchiveKind Kind = LLVMRustArchiveKind::GNU;
+#endif
+  bool Failed = false;
+  Clock::duration Elapsed = timeIters(Opts.Iters, [&] {
+    if (!Failed &&
+        LLVMRustWriteArchive(const_cast<char *>(Dst), Members.size(),
+                             Members.data(), /* WriteSymbtab = */ true, Kind,
+                             /* NumThreads = */ 1, /* Thin = */ false) !=
+            LLVMRustResult::Success)
+      Failed = true;
+  });
+  if (Failed)
+    fprintf(stderr, "rustllvm-bench: write-archive: %s\n",
+            lastError().c_str());
+  else
+    report("write-archive", Input.Name, Elapsed, Opts.Iters, Members.size(),
+           Bytes);
+
+  for (RustArchiveMember *Member : Members)
+    LLVMRustArchiveMemberFree(Member);
+  for (Archive::Child *Child : Children)
+    LLVMRustArchiveChildFree(Child);
+  sys::fs::remove(Dst);
+}
+
+// Runs every benchmark that takes modules on `Modules`.
+static void benchModules(const BenchOptions &Opts,
+                         const std::vector<BenchModule> &Modules) {
+  auto Enabled = [&](const char *Name) {
+    return !Opts.Only || strncmp(Opts.Only, Name, strlen(Opts.Only)) == 0;
+  };
+  if (Enabled("module-buffer"))
+    benchModuleBuffer(Opts, Modules);
+  if (Enabled("thinlto-data"))
+    benchThinLTOData(Opts, Modules);
+  if (Enabled("linker-add"))
+    benchLinkerAdd(Opts, Modules);
+  if (Enabled("attributes"))
+    benchAttributes(Opts, Modules);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: rustllvm-bench [-b NAME] [-n ITERS] [-m MODULES] "
+          "[-f FUNCS] [FILE...]\n"
+          "\n"
+          "Benchmarks the rustllvm entry points on MODULES synthetic modules\n"
+          "of FUNCS functions each, and then on every bitcode file or archive\n"
+          "given. NAME picks the benchmarks whose names start with it.\n");
+  exit(1);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmParser();
+
+  BenchOptions Opts;
+  std::vector<const char *> Files;
+  for (int I = 1; I < argc; I++) {
+    auto Value = [&]() -> unsigned {
+      if (++I == argc)
+        usage();
+      return strtoul(argv[I], nullptr, 10);
+    };
+    if (!strcmp(argv[I], "-b")) {
+      if (++I == argc)
+        usage();
+      Opts.Only = argv[I];
+    } else if (!strcmp(argv[I], "-n")) {
+      Opts.Iters = Value();
+    } else if (!strcmp(argv[I], "-m")) {
+      Opts.NumModules = Value();
+    } else if (!strcmp(argv[I], "-f")) {
+      Opts.NumFunctions = Value();
+    } else if (argv[I][0] == '-') {
+      usage();
+    } else {
+      Files.push_back(argv[I]);
+    }
+  }
+  if (Opts.Iters == 0 || Opts.NumModules == 0 || Opts.NumFunctions == 0)
+    usage();
+
+  SmallString<128> TmpDir;
+  if (std::error_code EC =
+          sys::fs::createUniqueDirectory("rustllvm-bench", TmpDir)) {
+    fprintf(stderr, "rustllvm-bench: %s\n", EC.message().c_str());
+    return 1;
+  }
+  auto TmpPath = [&](const std::string &Name) {
+    SmallString<128> Path(TmpDir);
+    sys::path::append(Path, Name);
+    return Path.str().str();
+  };
+  bool WantArchives =
+      !Opts.Only || strncmp(Opts.Only, "write-archive", strlen(Opts.Only)) == 0;
+
+  // The synthetic modules, and an archive of their bitcode.
+  std::vector<BenchModule> Modules;
+  for (unsigned I = 0; I < Opts.NumModules; I++)
+    Modules.push_back(syntheticModule(I, Opts.NumFunctions));
+  benchModules(Opts, Modules);
+  if (WantArchives) {
+    ArchiveInput Synthetic;
+    Synthetic.Name = setName(Modules);
+    for (const BenchModule &BM : Modules) {
+      std::string Path = TmpPath(BM.Name + ".bc");
+      std::error_code EC;
+      raw_fd_ostream OS(Path, EC, sys::fs::F_None);
+      if (EC) {
+        fprintf(stderr, "rustllvm-bench: %s: %s\n", Path.c_str(),
+                EC.message().c_str());
+        continue;
+      }
+      LLVMRustModuleBuffer *Buf = LLVMRustModuleBufferCreate(wrap(BM.M));
+      OS.write((const char *)LLVMRustModuleBufferPtr(Buf),
+               LLVMRustModuleBufferLen(Buf));
+      LLVMRustModuleBufferFree(Buf);
+      Synthetic.Files.push_back(Path);
+    }
+    benchWriteArchive(Opts, Synthetic, TmpPath("synth.a").c_str());
+    for (const std::string &File : Synthetic.Files)
+      sys::fs::remove(File);
+  }
+  freeModules(Modules);
+
+  // The recorded modules, each on its own, and archives.
+  for (const char *File : Files) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufOr = MemoryBuffer::getFile(File);
+    if (!BufOr) {
+      fprintf(stderr, "rustllvm-bench: %s: %s\n", File,
+              BufOr.getError().message().c_str());
+      continue;
+    }
+    if ((*BufOr)->getBuffer().startswith("!<arch>\n")) {
+      if (!WantArchives)
+        continue;
+      ArchiveInput Recorded;
+      Recorded.Name = sys::path::filename(File).str();
+      Recorded.Recorded = LLVMRustOpenArchive(const_cast<char *>(File));
+      if (!Recorded.Recorded) {
+        fprintf(stderr, "rustllvm-bench: %s: %s\n", File, lastError().c_str());
+        continue;
+      }
+      benchWriteArchive(Opts, Recorded, TmpPath(Recorded.Name).c_str());
+      LLVMRustDestroyArchive(Recorded.Recorded);
+      continue;
+    }
+    BenchModule BM;
+    if (!loadBitcode(File, BM))
+      continue;
+    Modules.push_back(BM);
+    benchModules(Opts, Modules);
+    freeModules(Modules);
+  }
+
+  sys::fs::remove(TmpDir);
+  return 0;
+}
@@ -1,3 +1,5 @@
+#include <atomic>
+
 #include "llvm-c/BitReader.h"
 #include "llvm-c/Core.h"
 #include "llvm-c/ExecutionEngine.h"
@@ -54,11 +56,32 @@
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/IRPrintingPasses.h"
 #include "llvm/Linker/Linker.h"
+#include "llvm/Object/Archive.h"
 
 extern "C" void LLVMRustSetLastError(const char *);
+// Like `LLVMRustSetLastError`, but without formatting the message of `EC`
+// unless it's asked for.
+void LLVMRustSetLastErrorCode(std::error_code EC);
 
 enum class LLVMRustResult { Success, Failure };
 
+// Whether profile events are being recorded at the moment, which they only
+// are after `LLVMRustSetProfileEventsEnabled(true)`. See RustWrapper.cpp.
+extern std::atomic<bool> RustProfileEventsEnabled;
+
+// Records the time from its construction to its destruction as a profile
+// event called `Name`, which has to outlive the event (in practice it's
+// always a string literal). Doesn't do anything beyond checking
+// `RustProfileEventsEnabled` if events aren't being recorded.
+class RustProfileScope {
+  const char *Name;
+  uint64_t Start;
+
+public:
+  explicit RustProfileScope(const char *Name);
+  ~RustProfileScope();
+};
+
 enum LLVMRustAttribute {
   AlwaysInline = 0,
   ByVal = 1,
@@ -114,3 +137,114 @@ public:
     flush();
   }
 };
+
+// The types and entry points below are shared between the files defining them
+// and the benchmarks in bench/, which drive them the same way rustc does.
+
+struct LLVMRustModuleBuffer;
+struct LLVMRustThinLTOBuffer;
+struct LLVMRustThinLTOData;
+struct LLVMRustAttributeListCache;
+struct RustLinker;
+struct RustArchive;
+struct RustArchiveMember;
+struct RustArchiveIterator;
+
+enum class LLVMRustArchiveKind {
+  Other,
+  GNU,
+  BSD,
+  COFF,
+};
+
+enum class LLVMRustAttributeKind {
+  Enum,
+  Alignment,
+  Dereferenceable,
+  DereferenceableOrNull,
+};
+
+// One of the attributes added by `LLVMRustAddFunctionAttributes` and
+// `LLVMRustAddCallSiteAttributes`: `Attr` if `Kind` is `Enum`, otherwise the
+// integer attribute `Kind` with `Value` as its argument.
+struct LLVMRustAttributeDesc {
+  unsigned Index;
+  LLVMRustAttributeKind Kind;
+  LLVMRustAttribute Attr;
+  uint64_t Value;
+};
+
+// Just an argument to the `LLVMRustCreateThinLTOData` function.
+struct LLVMRustThinLTOModule {
+  const char *identifier;
+  const char *data;
+  size_t len;
+};
+
+// Knobs rustc has over how much gets imported across modules, passed to the
+// `LLVMRustCreateThinLTOData*` functions in PassWrapper.cpp.
+struct LLVMRustThinLTOImportBudget {
+  // Overrides for `-import-instr-limit`, `-import-hot-multiplier` and
+  // `-import-cold-multiplier`, where a negative value means LLVM's default is
+  // kept. Note that the multipliers only make a difference if the summaries
+  // have profile data in them to tell hot and cold call sites apart.
+  int instr_limit;
+  float hot_multiplier;
+  float cold_multiplier;
+  // The most functions any one module may import, negative meaning no limit.
+  // See `pruneThinLTOImports` for which ones are kept.
+  int max_imports_per_module;
+};
+
+extern "C" {
+bool LLVMRustTakeLastError(const char **Message, size_t *Len);
+
+LLVMRustModuleBuffer *LLVMRustModuleBufferCreate(LLVMModuleRef M);
+void LLVMRustModuleBufferFree(LLVMRustModuleBuffer *Buffer);
+const void *LLVMRustModuleBufferPtr(const LLVMRustModuleBuffer *Buffer);
+size_t LLVMRustModuleBufferLen(const LLVMRustModuleBuffer *Buffer);
+
+LLVMRustThinLTOBuffer *LLVMRustThinLTOBufferCreate(LLVMModuleRef M);
+void LLVMRustThinLTOBufferFree(LLVMRustThinLTOBuffer *Buffer);
+const void *LLVMRustThinLTOBufferPtr(const LLVMRustThinLTOBuffer *Buffer);
+size_t LLVMRustThinLTOBufferLen(const LLVMRustThinLTOBuffer *Buffer);
+LLVMRustThinLTOData *
+LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *Modules, int NumModules,
+                          const char **PreservedSymbols, int NumSymbols,
+                          const LLVMRustThinLTOImportBudget *ImportBudget);
+void LLVMRustFreeThinLTOData(LLVMRustThinLTOData *Data);
+
+RustLinker *LLVMRustLinkerNew(LLVMModuleRef Dst);
+bool LLVMRustLinkerAdd(RustLinker *L, char *BC, size_t Len);
+void LLVMRustLinkerFree(RustLinker *L);
+
+void LLVMRustAddFunctionAttributes(LLVMValueRef Fn,
+                                   const LLVMRustAttributeDesc *Attrs,
+                                   size_t NumAttrs);
+LLVMRustAttributeListCache *LLVMRustCreateAttributeListCache(LLVMContextRef C);
+void LLVMRustFreeAttributeListCache(LLVMRustAttributeListCache *Cache);
+void LLVMRustAddFunctionAttributesCached(LLVMRustAttributeListCache *Cache,
+                                         LLVMValueRef Fn,
+                                         const LLVMRustAttributeDesc *Attrs,
+                                         size_t NumAttrs);
+
+RustArchive *LLVMRustOpenArchive(char *Path);
+void LLVMRustDestroyArchive(RustArchive *Archive);
+RustArchiveIterator *LLVMRustArchiveIteratorNew(RustArchive *Archive);
+const llvm::object::Archive::Child *
+LLVMRustArchiveIteratorNext(RustArchiveIterator *RAI);
+void LLVMRustArchiveIteratorFree(RustArchiveIterator *RAI);
+void LLVMRustArchiveChildFree(llvm::object::Archive::Child *Child);
+const char *
+LLVMRustArchiveChildName(const llvm::object::Archive::Child *Child,
+                         size_t *Size);
+RustArchiveMember *
+LLVMRustArchiveMemberNew(char *Filename, char *Name,
+                         llvm::object::Archive::Child *Child);
+void LLVMRustArchiveMemberFree(RustArchiveMember *Member);
+LLVMRustResult LLVMRustWriteArchive(char *Dst, size_t NumMembers,
+                                    RustArchiveMember *const *Members,
+                                    bool WriteSymbtab,
+                                    LLVMRustArchiveKind Kind,
+                                    unsigned NumThreads, bool Thin);
+}
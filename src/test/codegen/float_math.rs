@@ -4,6 +4,7 @@
 #![feature(core_intrinsics)]
 
 use std::intrinsics::{fadd_fast, fsub_fast, fmul_fast, fdiv_fast, frem_fast};
+use std::intrinsics::{fadd_contract, fsub_contract, fmul_contract};
 
 // CHECK-LABEL: @add
 #[no_mangle]
@@ -48,3 +49,23 @@ pub fn division(x: f32, y: f32) -> f32 {
         fdiv_fast(x, y)
     }
 }
+
+// CHECK-LABEL: @multiply_add
+#[no_mangle]
+pub fn multiply_add(x: f32, y: f32, z: f32) -> f32 {
+// CHECK: fmul contract float
+// CHECK: fadd contract float
+    unsafe {
+        fadd_contract(fmul_contract(x, y), z)
+    }
+}
+
+// CHECK-LABEL: @multiply_sub
+#[no_mangle]
+pub fn multiply_sub(x: f32, y: f32, z: f32) -> f32 {
+// CHECK: fmul contract float
+// CHECK: fsub contract float
+    unsafe {
+        fsub_contract(fmul_contract(x, y), z)
+    }
+}
@@ -0,0 +1,15 @@
+// Test that `-Z sanitizer-coverage=trace-pc-guard` instruments functions with calls to the
+// SanitizerCoverage guard callback, without a sanitizer.
+
+// only-linux
+// only-x86_64
+// compile-flags: -Z sanitizer-coverage=trace-pc-guard
+
+#![crate_type = "lib"]
+
+// CHECK-LABEL: define {{.*}}@covered
+// CHECK: call void @__sanitizer_cov_trace_pc_guard
+#[no_mangle]
+pub fn covered(x: &i32) -> i32 {
+    *x
+}
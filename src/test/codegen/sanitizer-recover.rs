@@ -0,0 +1,18 @@
+// Test that `-Z sanitizer-recover` makes AddressSanitizer report errors with the callbacks
+// that return, instead of those that abort.
+
+// only-linux
+// only-x86_64
+// revisions: ABORT RECOVER
+//[ABORT] compile-flags: -Z sanitizer=address
+//[RECOVER] compile-flags: -Z sanitizer=address -Z sanitizer-recover
+
+#![crate_type = "lib"]
+
+// CHECK-LABEL: define {{.*}}@load
+// ABORT: call void @__asan_report_load4(
+// RECOVER: call void @__asan_report_load4_noabort(
+#[no_mangle]
+pub fn load(x: &i32) -> i32 {
+    *x
+}
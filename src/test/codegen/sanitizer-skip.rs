@@ -0,0 +1,36 @@
+// Test that `-Z sanitizer-skip` keeps the sanitizer attribute off the functions under a path,
+// including those nested further down, and off nothing else.
+
+// only-linux
+// only-x86_64
+// compile-flags: -Z sanitizer=address -Z sanitizer-skip=sanitizer_skip::skipped
+
+#![crate_type = "lib"]
+
+pub mod skipped {
+    // CHECK-DAG: define {{.*}}7skipped5outer{{.*}} #[[OUTER:[0-9]+]]
+    #[inline(never)]
+    pub fn outer(x: &i32) -> i32 {
+        *x
+    }
+
+    pub mod nested {
+        // CHECK-DAG: define {{.*}}6nested5inner{{.*}} #[[INNER:[0-9]+]]
+        #[inline(never)]
+        pub fn inner(x: &i32) -> i32 {
+            *x
+        }
+    }
+}
+
+pub mod kept {
+    // CHECK-DAG: define {{.*}}4kept7sibling{{.*}} #[[SIBLING:[0-9]+]]
+    #[inline(never)]
+    pub fn sibling(x: &i32) -> i32 {
+        *x
+    }
+}
+
+// CHECK-DAG: attributes #[[OUTER]] = { {{([^s]|s[^a])*}} }
+// CHECK-DAG: attributes #[[INNER]] = { {{([^s]|s[^a])*}} }
+// CHECK-DAG: attributes #[[SIBLING]] = { {{.*}}sanitize_address{{.*}} }
@@ -0,0 +1,54 @@
+// compile-flags: -C no-prepopulate-passes
+// ignore-tidy-linelength
+
+#![crate_type = "lib"]
+
+#![feature(repr_simd, platform_intrinsics)]
+#![allow(non_camel_case_types)]
+
+#[repr(simd)]
+#[derive(Copy, Clone)]
+pub struct f32x4(pub f32, pub f32, pub f32, pub f32);
+
+extern "platform-intrinsic" {
+    fn simd_reduce_add_ordered<T, U>(x: T, acc: U) -> U;
+    fn simd_reduce_mul_ordered<T, U>(x: T, acc: U) -> U;
+    fn simd_reduce_add_unordered<T, U>(x: T) -> U;
+    fn simd_reduce_mul_unordered<T, U>(x: T) -> U;
+}
+
+// CHECK-LABEL: @reduce_add_ordered
+#[no_mangle]
+pub unsafe fn reduce_add_ordered(x: f32x4) -> f32 {
+    // CHECK-NOT: llvm.experimental.vector.reduce
+    // CHECK: extractelement <4 x float> %{{.*}}, i32 0
+    // CHECK: %bin.rdx = fadd float 0.000000e+00
+    // CHECK: extractelement <4 x float> %{{.*}}, i32 1
+    // CHECK: fadd float %bin.rdx
+    simd_reduce_add_ordered(x, 0.0)
+}
+
+// CHECK-LABEL: @reduce_mul_ordered
+#[no_mangle]
+pub unsafe fn reduce_mul_ordered(x: f32x4) -> f32 {
+    // CHECK-NOT: llvm.experimental.vector.reduce
+    // CHECK: %bin.rdx = fmul float 1.000000e+00
+    simd_reduce_mul_ordered(x, 1.0)
+}
+
+// CHECK-LABEL: @reduce_add_unordered
+#[no_mangle]
+pub unsafe fn reduce_add_unordered(x: f32x4) -> f32 {
+    // CHECK: %rdx.shuf = shufflevector <4 x float> [[X:%.*]], <4 x float> undef, <4 x i32> <i32 2, i32 3, i32 undef, i32 undef>
+    // CHECK: %bin.rdx = fadd reassoc <4 x float> [[X]], %rdx.shuf
+    // CHECK: shufflevector <4 x float> %bin.rdx, <4 x float> undef, <4 x i32> <i32 1, i32 undef, i32 undef, i32 undef>
+    // CHECK: fadd reassoc <4 x float> %bin.rdx
+    simd_reduce_add_unordered(x)
+}
+
+// CHECK-LABEL: @reduce_mul_unordered
+#[no_mangle]
+pub unsafe fn reduce_mul_unordered(x: f32x4) -> f32 {
+    // CHECK: %bin.rdx = fmul reassoc <4 x float>
+    simd_reduce_mul_unordered(x)
+}
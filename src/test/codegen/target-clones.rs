@@ -0,0 +1,26 @@
+// only-x86_64
+// only-linux
+// compile-flags: -C no-prepopulate-passes -Z target-clones=kernel=avx512f,avx512bw|avx2,fma
+
+#![crate_type = "lib"]
+
+// CHECK: @kernel = ifunc {{.*}} @kernel.resolver
+
+// CHECK-LABEL: define internal i32 @kernel.default
+// CHECK-LABEL: define internal i32 @kernel.target_clone.0
+// CHECK-SAME: [[AVX512:#[0-9]+]]
+// CHECK-LABEL: define internal i32 @kernel.target_clone.1
+// CHECK-SAME: [[AVX2:#[0-9]+]]
+#[no_mangle]
+pub fn kernel(x: i32) -> i32 {
+    x.wrapping_mul(3)
+}
+
+// CHECK-LABEL: define internal {{.*}} @kernel.resolver
+// CHECK: call void @__cpu_indicator_init()
+// CHECK: load i32, i32* getelementptr {{.*}} @__cpu_model
+// CHECK: and i32 %{{.*}}, 17408
+// CHECK: and i32 %{{.*}}, 2129920
+
+// CHECK: attributes [[AVX512]] = {{.*}} "target-features"="{{.*}}+avx512f,+avx512bw"
+// CHECK: attributes [[AVX2]] = {{.*}} "target-features"="{{.*}}+avx2,+fma"
@@ -0,0 +1,35 @@
+// ignore-tidy-linelength
+// compile-flags: -C no-prepopulate-passes -C linker-plugin-lto -Z whole-program-devirt
+
+// The bitcode the linker gets keeps its type tests, and is split into a
+// regular LTO module for the linker to devirtualize calls in.
+
+#![crate_type = "lib"]
+
+pub trait Trait {
+    fn get(&self) -> u32;
+}
+
+impl Trait for u8 {
+    fn get(&self) -> u32 {
+        *self as u32
+    }
+}
+
+// CHECK: @vtable.{{[0-9]+}} = {{.*}} !type ![[TYPE:[0-9]+]]
+
+#[no_mangle]
+pub fn make(x: &u8) -> &dyn Trait {
+    x
+}
+
+// CHECK-LABEL: @call
+// CHECK: [[TEST:%.*]] = call i1 @llvm.type.test(i8* {{.*}}, metadata !"[[ID:rust.vtable.[0-9a-f]+]]")
+// CHECK-NEXT: call void @llvm.assume(i1 [[TEST]])
+#[no_mangle]
+pub fn call(x: &dyn Trait) -> u32 {
+    x.get()
+}
+
+// CHECK-DAG: !{i32 {{[0-9]+}}, !"EnableSplitLTOUnit", i32 1}
+// CHECK-DAG: ![[TYPE]] = !{i64 0, !"[[ID]]"}
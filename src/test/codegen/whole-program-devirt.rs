@@ -0,0 +1,34 @@
+// compile-flags: -C no-prepopulate-passes -Z whole-program-devirt
+
+// Bitcode that no LTO will devirtualize with doesn't get any type tests, but
+// the vtables are still marked with their type id.
+
+#![crate_type = "lib"]
+
+pub trait Trait {
+    fn get(&self) -> u32;
+}
+
+impl Trait for u8 {
+    fn get(&self) -> u32 {
+        *self as u32
+    }
+}
+
+// CHECK: @vtable.{{[0-9]+}} = {{.*}} !type ![[TYPE:[0-9]+]]
+
+#[no_mangle]
+pub fn make(x: &u8) -> &dyn Trait {
+    x
+}
+
+// CHECK-LABEL: @call
+// CHECK-NOT: @llvm.type.test
+// CHECK-NOT: @llvm.assume
+// CHECK: ret
+#[no_mangle]
+pub fn call(x: &dyn Trait) -> u32 {
+    x.get()
+}
+
+// CHECK: ![[TYPE]] = !{i64 0, !"rust.vtable.{{[0-9a-f]+}}"}
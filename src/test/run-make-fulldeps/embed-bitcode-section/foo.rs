@@ -0,0 +1,4 @@
+#[no_mangle]
+pub extern "C" fn embedded_bitcode_answer(x: u32) -> u32 {
+    x.wrapping_mul(42)
+}
@@ -0,0 +1,9 @@
+#![crate_type = "rlib"]
+
+extern "C" fn ctor() {
+    std::env::set_var("CTOR_RAN", "1");
+}
+
+#[used]
+#[link_section = ".init_array"]
+static CTOR: extern "C" fn() = ctor;
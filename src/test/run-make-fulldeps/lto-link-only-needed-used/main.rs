@@ -0,0 +1,6 @@
+// Nothing in `ctor` is referenced, it's only linked in for its constructor.
+extern crate ctor;
+
+fn main() {
+    assert_eq!(std::env::var("CTOR_RAN").as_ref().map(|s| &s[..]), Ok("1"));
+}
@@ -0,0 +1,39 @@
+#![feature(no_core, lang_items)]
+#![crate_type="rlib"]
+#![no_core]
+
+#[lang = "sized"]
+trait Sized {}
+#[lang = "copy"]
+trait Copy {}
+#[lang = "freeze"]
+trait Freeze {}
+
+extern "C" {
+    fn sink(a: u64, b: u64, c: u64, d: u64);
+}
+
+const A: u64 = 0x0123_4567_89ab_cdef;
+const B: u64 = 0x1122_3344_5566_7788;
+const C: u64 = 0x99aa_bbcc_ddee_ff00;
+const D: u64 = 0x0f1e_2d3c_4b5a_6978;
+
+// Each of the constants takes several instructions to materialize, and every
+// function materializes the same ones in the same order.
+#[no_mangle]
+pub unsafe fn first() {
+    sink(A, B, C, D);
+    sink(A, B, C, D);
+}
+
+#[no_mangle]
+pub unsafe fn second() {
+    sink(A, B, C, D);
+    sink(A, B, C, D);
+}
+
+#[no_mangle]
+pub unsafe fn third() {
+    sink(A, B, C, D);
+    sink(A, B, C, D);
+}
@@ -0,0 +1,24 @@
+use std::collections::HashMap;
+
+#[inline(never)]
+fn count_words(text: &str) -> HashMap<&str, usize> {
+    let mut counts = HashMap::new();
+    for word in text.split_whitespace() {
+        *counts.entry(word).or_insert(0) += 1;
+    }
+    counts
+}
+
+#[inline(never)]
+fn fib(n: u64) -> u64 {
+    if n < 2 { n } else { fib(n - 1) + fib(n - 2) }
+}
+
+static GREETING: &str = "hello world hello";
+
+fn main() {
+    let counts = count_words(GREETING);
+    assert_eq!(counts["hello"], 2);
+    assert_eq!(counts["world"], 1);
+    assert_eq!(fib(20), 6765);
+}
@@ -0,0 +1,45 @@
+// Each module is its own codegen unit, all of which have string literals and
+// local copies of the same `#[inline]` functions.
+
+#[inline]
+fn describe(n: usize) -> String {
+    format!("{} is {}", n, if n % 2 == 0 { "even" } else { "odd" })
+}
+
+#[inline]
+fn shout(s: &str) -> String {
+    s.to_uppercase() + "!"
+}
+
+mod a {
+    pub fn run() -> String {
+        super::shout(&super::describe(1)) + "a"
+    }
+}
+
+mod b {
+    pub fn run() -> String {
+        super::shout(&super::describe(2)) + "b"
+    }
+}
+
+mod c {
+    pub fn run() -> String {
+        let s: &dyn ToString = &3;
+        super::shout(&s.to_string()) + "c"
+    }
+}
+
+mod d {
+    pub fn run() -> String {
+        let s: &dyn ToString = &"four";
+        super::shout(&s.to_string()) + "d"
+    }
+}
+
+fn main() {
+    assert_eq!(a::run(), "1 IS ODD!a");
+    assert_eq!(b::run(), "2 IS EVEN!b");
+    assert_eq!(c::run(), "3!c");
+    assert_eq!(d::run(), "FOUR!d");
+}
@@ -0,0 +1,23 @@
+use std::ptr;
+
+#[inline(never)]
+fn big_frame(n: usize) -> u8 {
+    let mut buf = [0u8; 65536];
+    for i in 0..buf.len() {
+        unsafe { ptr::write_volatile(&mut buf[i], (i * n) as u8) }
+    }
+    unsafe { ptr::read_volatile(&buf[n % buf.len()]) }
+}
+
+mod other {
+    #[inline(never)]
+    pub fn small_frame(n: usize) -> usize {
+        n.wrapping_mul(31)
+    }
+}
+
+fn main() {
+    let n = std::env::args().count();
+    assert_eq!(big_frame(n), n as u8);
+    assert_eq!(other::small_frame(n), n * 31);
+}
@@ -0,0 +1,256 @@
+// run-pass
+#![allow(dead_code)]
+#![allow(improper_ctypes)]
+#![feature(test)]
+
+// compile-flags: --test -C opt-level=3
+// ignore-wasm32-bare no libc for ffi testing
+
+// Call overhead of passing and returning the C ABI shapes from
+// rust_test_helpers by value. Run as a test each benchmark makes a single
+// pass over its loop, which checks the results; `--bench` times them. A
+// regression that makes the argument lowering spill or memcpy a struct
+// shows up as a jump in ns/iter for that shape.
+
+extern crate test;
+
+use test::{black_box, Bencher};
+
+// Calls per benchmark iteration, so the loop doesn't dominate the timing.
+const CALLS: u64 = 1000;
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Debug)]
+pub struct TwoU8s {
+    one: u8, two: u8
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Debug)]
+pub struct TwoU16s {
+    one: u16, two: u16
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Debug)]
+pub struct TwoU32s {
+    one: u32, two: u32
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Debug)]
+pub struct TwoU64s {
+    one: u64, two: u64
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Debug)]
+pub struct TwoDoubles {
+    one: f64, two: f64
+}
+
+#[repr(C)]
+#[derive(Copy, Clone)]
+pub struct ManyInts {
+    arg1: i8,
+    arg2: i16,
+    arg3: i32,
+    arg4: i16,
+    arg5: i8,
+    arg6: TwoU8s,
+}
+
+#[repr(C)]
+pub struct Empty;
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Debug)]
+pub struct Quad {
+    a: u64, b: u64, c: u64, d: u64
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Debug)]
+pub struct Floats {
+    a: f64, b: u8, c: f64
+}
+
+#[link(name = "rust_test_helpers", kind = "static")]
+extern {
+    fn rust_dbg_extern_identity_u32(v: u32) -> u32;
+    fn rust_dbg_extern_identity_u64(v: u64) -> u64;
+    fn rust_dbg_extern_identity_double(v: f64) -> f64;
+    fn rust_dbg_extern_identity_TwoU8s(v: TwoU8s) -> TwoU8s;
+    fn rust_dbg_extern_identity_TwoU16s(v: TwoU16s) -> TwoU16s;
+    fn rust_dbg_extern_identity_TwoU32s(v: TwoU32s) -> TwoU32s;
+    fn rust_dbg_extern_identity_TwoU64s(v: TwoU64s) -> TwoU64s;
+    fn rust_dbg_extern_identity_TwoDoubles(v: TwoDoubles) -> TwoDoubles;
+    fn rust_dbg_extern_return_TwoU64s() -> TwoU64s;
+    #[cfg(not(any(target_env = "msvc", target_os = "emscripten")))]
+    fn rust_dbg_extern_empty_struct(v1: ManyInts, e: Empty, v2: ManyInts);
+    fn rust_dbg_abi_1(q: Quad) -> Quad;
+    fn rust_dbg_abi_2(f: Floats) -> Floats;
+    fn rust_interesting_average(_: u64, ...) -> f64;
+}
+
+// MSVC doesn't support 128 bit integers, see i128-ffi.rs.
+#[cfg(all(not(windows), target_pointer_width = "64"))]
+#[link(name = "rust_test_helpers", kind = "static")]
+extern "C" {
+    fn identity(f: u128) -> u128;
+    fn sub(f: i128, f: i128) -> i128;
+}
+
+// Calls `f` `CALLS` times, feeding each result back in as the next argument
+// so that no call can be hoisted out of the loop.
+fn bench_identity<T: Copy + PartialEq + std::fmt::Debug>(
+    b: &mut Bencher,
+    x: T,
+    f: unsafe extern fn(T) -> T,
+) {
+    let f = black_box(f);
+    b.iter(|| {
+        let mut y = black_box(x);
+        for _ in 0..CALLS {
+            y = unsafe { f(y) };
+        }
+        assert_eq!(x, y);
+        y
+    });
+}
+
+#[bench]
+fn bench_u32(b: &mut Bencher) {
+    bench_identity(b, 22u32, rust_dbg_extern_identity_u32);
+}
+
+#[bench]
+fn bench_u64(b: &mut Bencher) {
+    bench_identity(b, 22u64, rust_dbg_extern_identity_u64);
+}
+
+#[bench]
+fn bench_double(b: &mut Bencher) {
+    bench_identity(b, 22.0f64, rust_dbg_extern_identity_double);
+}
+
+#[bench]
+fn bench_two_u8s(b: &mut Bencher) {
+    bench_identity(b, TwoU8s { one: 22, two: 23 }, rust_dbg_extern_identity_TwoU8s);
+}
+
+#[bench]
+fn bench_two_u16s(b: &mut Bencher) {
+    bench_identity(b, TwoU16s { one: 22, two: 23 }, rust_dbg_extern_identity_TwoU16s);
+}
+
+#[bench]
+fn bench_two_u32s(b: &mut Bencher) {
+    bench_identity(b, TwoU32s { one: 22, two: 23 }, rust_dbg_extern_identity_TwoU32s);
+}
+
+#[bench]
+fn bench_two_u64s(b: &mut Bencher) {
+    bench_identity(b, TwoU64s { one: 22, two: 23 }, rust_dbg_extern_identity_TwoU64s);
+}
+
+#[bench]
+fn bench_two_doubles(b: &mut Bencher) {
+    bench_identity(b, TwoDoubles { one: 10.0, two: 20.0 },
+                   rust_dbg_extern_identity_TwoDoubles);
+}
+
+#[bench]
+fn bench_return_two_u64s(b: &mut Bencher) {
+    b.iter(|| {
+        let mut sum = 0;
+        for _ in 0..CALLS {
+            let y = unsafe { rust_dbg_extern_return_TwoU64s() };
+            sum += y.one + y.two;
+        }
+        assert_eq!(sum, 30 * CALLS);
+        sum
+    });
+}
+
+#[cfg(not(any(target_env = "msvc", target_os = "emscripten")))]
+#[bench]
+fn bench_many_ints(b: &mut Bencher) {
+    let v1 = ManyInts {
+        arg1: 2, arg2: 3, arg3: 4, arg4: 5, arg5: 6,
+        arg6: TwoU8s { one: 7, two: 8 },
+    };
+    let v2 = ManyInts {
+        arg1: 1, arg2: 2, arg3: 3, arg4: 4, arg5: 5,
+        arg6: TwoU8s { one: 6, two: 7 },
+    };
+    b.iter(|| {
+        for _ in 0..CALLS {
+            unsafe { rust_dbg_extern_empty_struct(black_box(v1), Empty, black_box(v2)) };
+        }
+    });
+}
+
+#[bench]
+fn bench_quad(b: &mut Bencher) {
+    let q = Quad { a: 0xaaaa_aaaa_aaaa_aaaa,
+                   b: 0xbbbb_bbbb_bbbb_bbbb,
+                   c: 0xcccc_cccc_cccc_cccc,
+                   d: 0xdddd_dddd_dddd_dddd };
+    b.iter(|| {
+        let mut y = black_box(q);
+        for _ in 0..CALLS {
+            y = unsafe { rust_dbg_abi_1(y) };
+        }
+        // Every second call puts the fields back in place, each one step
+        // further along.
+        assert_eq!(y.a, q.a + CALLS);
+        y
+    });
+}
+
+#[bench]
+fn bench_floats(b: &mut Bencher) {
+    let f = Floats { a: 1.0, b: 0, c: 2.0 };
+    b.iter(|| {
+        let mut y = black_box(f);
+        for _ in 0..CALLS {
+            y = unsafe { rust_dbg_abi_2(y) };
+        }
+        assert_eq!(y.b, 0xff);
+        y
+    });
+}
+
+#[bench]
+fn bench_variadic(b: &mut Bencher) {
+    b.iter(|| {
+        let mut sum = 0.0;
+        for i in 0..CALLS {
+            sum += unsafe {
+                rust_interesting_average(2, black_box(i as i64), 10.0f64, 20i64, 20.0f64)
+            };
+        }
+        sum
+    });
+}
+
+#[cfg(all(not(windows), target_pointer_width = "64"))]
+#[bench]
+fn bench_u128(b: &mut Bencher) {
+    bench_identity(b, 0x33EE_0E2A_54E2_59DA_A0E7_8E41u128, identity);
+}
+
+#[cfg(all(not(windows), target_pointer_width = "64"))]
+#[bench]
+fn bench_i128_pair(b: &mut Bencher) {
+    let k = 0x1234_5678_9ABC_DEFF_EDCBi128;
+    b.iter(|| {
+        let mut y = black_box(k) * CALLS as i128;
+        for _ in 0..CALLS {
+            y = unsafe { sub(y, k) };
+        }
+        assert_eq!(y, 0);
+        y
+    });
+}